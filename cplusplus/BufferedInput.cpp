@@ -11,70 +11,850 @@
  */
 
 #include "zdw/BufferedInput.h"
+#include "ring_buffer.h"
 #include <cassert>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <zlib.h>
+#ifdef ZDW_HAVE_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef ZDW_HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef ZDW_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using adobe::zdw::BufferedInput;
+using std::string;
+
+
+namespace {
+
+const size_t IN_BUFFER_SIZE = 256 * 1024; //compressed bytes read from the file at once
+const size_t MAGIC_SIZE = 6; //enough leading bytes to recognize each format
+const size_t READ_AHEAD_CHUNK_SIZE = 4 * 1024 * 1024; //uncompressed bytes read ahead at once
+const size_t READ_AHEAD_CHUNKS = 4;
+
+enum Format { PLAIN, GZIP, BZIP2, XZ, ZSTD };
+
+//Returns: the compression format indicated by the first len bytes of the input
+Format detect_format(const unsigned char* magic, const size_t len)
+{
+	if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+		return GZIP;
+	if (len >= 3 && !memcmp(magic, "BZh", 3))
+		return BZIP2;
+	if (len >= 6 && !memcmp(magic, "\xfd" "7zXZ\0", 6))
+		return XZ;
+	if (len >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+		return ZSTD;
+	return PLAIN;
+}
+
+//********************************************************
+//Uncompressed data read from a file or stream.
+class PlainInput : public BufferedInput
+{
+public:
+	PlainInput(FILE* fp, const bool bOwnsFile,
+		const char* prefix, const size_t prefixLen, //(in) bytes already read from fp
+		const size_t capacity)
+		: BufferedInput(capacity)
+		, fp(fp), bOwnsFile(bOwnsFile)
+		, prefixLen(prefixLen), prefixPos(0)
+	{
+		assert(prefixLen <= MAGIC_SIZE);
+		memcpy(this->prefix, prefix, prefixLen);
+	}
+	~PlainInput() { close(); }
+
+	void close()
+	{
+		if (this->fp && this->bOwnsFile)
+			fclose(this->fp);
+		this->fp = NULL;
+	}
+
+	bool is_open() const { return this->fp != NULL; }
+
+protected:
+	size_t readSource(char* data, const size_t size)
+	{
+		size_t bytesRead = 0;
+		if (this->prefixPos < this->prefixLen) {
+			bytesRead = this->prefixLen - this->prefixPos;
+			if (bytesRead > size)
+				bytesRead = size;
+			memcpy(data, this->prefix + this->prefixPos, bytesRead);
+			this->prefixPos += bytesRead;
+		}
+		if (bytesRead < size && this->fp)
+			bytesRead += fread(data + bytesRead, 1, size - bytesRead, this->fp);
+		return bytesRead;
+	}
+
+	//Seeks past the data in a regular file instead of reading it.
+	size_t skipSource(size_t size)
+	{
+		struct stat st;
+		if (!this->fp || this->prefixPos < this->prefixLen ||
+				fstat(fileno(this->fp), &st) != 0 || !S_ISREG(st.st_mode))
+			return BufferedInput::skipSource(size);
+
+		const off_t pos = ftello(this->fp);
+		if (pos < 0)
+			return BufferedInput::skipSource(size);
+		if (static_cast<off_t>(size) > st.st_size - pos)
+			size = st.st_size > pos ? st.st_size - pos : 0;
+		if (fseeko(this->fp, static_cast<off_t>(size), SEEK_CUR) != 0)
+			return 0;
+		return size;
+	}
+
+	bool rewindSource()
+	{
+		if (!this->fp || fseeko(this->fp, 0, SEEK_SET) != 0)
+			return false;
+		this->prefixPos = this->prefixLen = 0;
+		return true;
+	}
+
+private:
+	FILE *fp;
+	const bool bOwnsFile;
+	char prefix[MAGIC_SIZE];
+	size_t prefixLen, prefixPos;
+};
+
+//********************************************************
+//An uncompressed file, memory-mapped so its data can be used in place.
+class MappedInput : public BufferedInput
+{
+public:
+	//Returns: the mapped file read by fp, or NULL if it can't be mapped
+	static MappedInput* open(FILE* fp)
+	{
+		struct stat st;
+		const int fd = fileno(fp);
+		if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0)
+			return NULL;
+
+		void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED)
+			return NULL;
+		return new MappedInput(static_cast<char*>(addr), st.st_size);
+	}
+
+	~MappedInput() { close(); }
+
+	void close()
+	{
+		if (this->addr) {
+			munmap(this->addr, this->size);
+			this->addr = NULL;
+		}
+	}
+
+	bool is_open() const { return this->addr != NULL; }
+
+protected:
+	size_t readSource(char*, const size_t) { return 0; } //all data are already in memory
+
+private:
+	MappedInput(char* addr, const size_t size)
+		: BufferedInput(addr, size)
+		, addr(addr), size(size)
+	{ }
+
+	char *addr;
+	const size_t size;
+};
+
+//********************************************************
+//Data already held in memory, e.g., part of another input.
+class MemoryInput : public BufferedInput
+{
+public:
+	MemoryInput(const char* data, const size_t length)
+		: BufferedInput(data, length)
+	{ }
+
+	void close() { }
+	bool is_open() const { return true; }
+
+protected:
+	size_t readSource(char*, const size_t) { return 0; }
+};
+
+//********************************************************
+//Data read from another input by a separate thread, which keeps a few chunks ahead of the reader,
+//so that decompression or reading from a pipe overlaps with the reader's processing.
+class ReadAheadInput : public BufferedInput
+{
+public:
+	//Returns: a reader of source's data, which it takes ownership of, or NULL if the thread can't be started
+	static ReadAheadInput* open(BufferedInput* source, const size_t capacity)
+	{
+		ReadAheadInput *input = new ReadAheadInput(source, capacity);
+		if (!input->start()) {
+			input->source = NULL; //remains owned by the caller
+			delete input;
+			return NULL;
+		}
+		return input;
+	}
+
+	~ReadAheadInput()
+	{
+		stop();
+		delete this->source;
+	}
+
+	void close()
+	{
+		stop();
+		if (this->source)
+			this->source->close();
+	}
+
+	bool is_open() const { return this->source && this->source->is_open(); }
+
+protected:
+	size_t readSource(char* data, const size_t size)
+	{
+		size_t bytesRead = 0;
+		while (bytesRead < size)
+		{
+			Chunk *chunk = this->chunks.front();
+			if (!chunk)
+				break; //end of input
+			size_t len = chunk->length - this->chunkPos;
+			if (len > size - bytesRead)
+				len = size - bytesRead;
+			memcpy(data + bytesRead, chunk->data + this->chunkPos, len);
+			bytesRead += len;
+			this->chunkPos += len;
+			if (this->chunkPos == chunk->length) {
+				this->chunks.pop();
+				this->chunkPos = 0;
+			}
+		}
+		return bytesRead;
+	}
+
+	bool rewindSource()
+	{
+		stop();
+		if (!this->source->rewind())
+			return false;
+		this->chunks.reset();
+		this->chunkPos = 0;
+		return start();
+	}
+
+private:
+	struct Chunk
+	{
+		Chunk() : data(NULL), length(0) { }
+		~Chunk() { delete[] data; }
+
+		char *data;
+		size_t length;
+	};
+
+	ReadAheadInput(BufferedInput* source, const size_t capacity)
+		: BufferedInput(capacity)
+		, source(source)
+		, chunks(READ_AHEAD_CHUNKS)
+		, chunkPos(0)
+		, bRunning(false)
+	{
+		for (size_t i = 0; i < this->chunks.size(); ++i)
+			this->chunks.slot(i).data = new char[READ_AHEAD_CHUNK_SIZE];
+	}
+
+	bool start()
+	{
+		this->bRunning = pthread_create(&this->thread, NULL, readThread, this) == 0;
+		return this->bRunning;
+	}
+
+	void stop()
+	{
+		if (this->bRunning) {
+			this->chunks.close();
+			pthread_join(this->thread, NULL);
+			this->bRunning = false;
+		}
+	}
+
+	static void* readThread(void* arg)
+	{
+		ReadAheadInput *input = static_cast<ReadAheadInput*>(arg);
+		Chunk *chunk;
+		while ((chunk = input->chunks.beginPush()) != NULL)
+		{
+			chunk->length = input->source->read(chunk->data, READ_AHEAD_CHUNK_SIZE);
+			if (chunk->length)
+				input->chunks.push();
+			if (chunk->length < READ_AHEAD_CHUNK_SIZE)
+				break; //end of input
+		}
+		input->chunks.close();
+		return NULL;
+	}
+
+	BufferedInput *source;
+	adobe::zdw::RingBuffer<Chunk> chunks;
+	size_t chunkPos; //bytes of the front chunk already read
+	pthread_t thread;
+	bool bRunning;
+};
+
+//********************************************************
+//Data uncompressed in-process from a file or stream.
+//
+//Subclasses run a codec over the compressed input, writing straight into the requested buffer.
+class DecoderInput : public BufferedInput
+{
+protected:
+	enum Status { DECODE_OK, DECODE_END, DECODE_ERROR };
+
+	DecoderInput(FILE* fp, const bool bOwnsFile,
+		const char* prefix, const size_t prefixLen, //(in) bytes already read from fp
+		const size_t capacity)
+		: BufferedInput(capacity)
+		, fp(fp), bOwnsFile(bOwnsFile)
+		, inBuffer(new char[IN_BUFFER_SIZE])
+		, in(inBuffer), inAvail(prefixLen)
+		, bInputEOF(false), bDone(false)
+	{
+		assert(prefixLen <= IN_BUFFER_SIZE);
+		memcpy(this->inBuffer, prefix, prefixLen);
+	}
+
+	~DecoderInput()
+	{
+		closeFile();
+		delete[] this->inBuffer;
+	}
+
+	void closeFile()
+	{
+		if (this->fp && this->bOwnsFile)
+			fclose(this->fp);
+		this->fp = NULL;
+	}
+
+	//Uncompresses from in/inAvail into out/outAvail, advancing both.
+	virtual Status decode(char*& out, size_t& outAvail) = 0;
+
+	//Prepares the codec for the next stream, as when files are concatenated.
+	virtual bool restart() = 0;
+
+	size_t readSource(char* data, const size_t size)
+	{
+		char *out = data;
+		size_t outAvail = size;
+		while (outAvail && !this->bDone)
+		{
+			const size_t outBefore = outAvail, inBefore = this->inAvail;
+			switch (decode(out, outAvail))
+			{
+				case DECODE_OK:
+					//No progress means the codec needs more input.
+					if (outAvail == outBefore && this->inAvail == inBefore &&
+							(this->inAvail || !fillInput()))
+						this->bDone = true; //truncated input
+					break;
+				case DECODE_END:
+					//Another stream may follow, as when compressed files are concatenated.
+					if (!this->inAvail)
+						fillInput();
+					if (!this->inAvail || !restart())
+						this->bDone = true;
+					break;
+				default:
+				case DECODE_ERROR:
+					this->bDone = true;
+					break;
+			}
+		}
+		return size - outAvail;
+	}
+
+	bool rewindSource()
+	{
+		if (!this->fp || fseeko(this->fp, 0, SEEK_SET) != 0)
+			return false;
+		this->in = this->inBuffer;
+		this->inAvail = 0;
+		this->bInputEOF = this->bDone = false;
+		return restart();
+	}
+
+	//Returns: whether the input state changed -- more data was read, or its end was reached
+	bool fillInput()
+	{
+		if (this->bInputEOF || !this->fp)
+			return false;
+		this->in = this->inBuffer;
+		this->inAvail = fread(this->inBuffer, 1, IN_BUFFER_SIZE, this->fp);
+		if (this->inAvail < IN_BUFFER_SIZE)
+			this->bInputEOF = true;
+		return true;
+	}
+
+	FILE *fp;
+	const bool bOwnsFile;
+	char *inBuffer;
+	const char *in; //compressed data not yet consumed
+	size_t inAvail;
+	bool bInputEOF, bDone;
+};
+
+//********************************************************
+class GzipInput : public DecoderInput
+{
+public:
+	GzipInput(FILE* fp, const bool bOwnsFile, const char* prefix, const size_t prefixLen, const size_t capacity)
+		: DecoderInput(fp, bOwnsFile, prefix, prefixLen, capacity)
+	{
+		memset(&this->strm, 0, sizeof(this->strm));
+		this->bInit = inflateInit2(&this->strm, 15 + 32) == Z_OK; //+32: detect the gzip wrapper
+	}
+	~GzipInput() { close(); }
+
+	void close()
+	{
+		if (this->bInit) {
+			inflateEnd(&this->strm);
+			this->bInit = false;
+		}
+		closeFile();
+	}
+
+	bool is_open() const { return this->bInit && this->fp; }
+
+protected:
+	Status decode(char*& out, size_t& outAvail)
+	{
+		this->strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(this->in));
+		this->strm.avail_in = this->inAvail;
+		this->strm.next_out = reinterpret_cast<Bytef*>(out);
+		this->strm.avail_out = outAvail;
+		const int ret = inflate(&this->strm, Z_NO_FLUSH);
+		this->in = reinterpret_cast<const char*>(this->strm.next_in);
+		this->inAvail = this->strm.avail_in;
+		out = reinterpret_cast<char*>(this->strm.next_out);
+		outAvail = this->strm.avail_out;
+
+		switch (ret)
+		{
+			case Z_OK: case Z_BUF_ERROR: return DECODE_OK;
+			case Z_STREAM_END: return DECODE_END;
+			default: return DECODE_ERROR;
+		}
+	}
+
+	bool restart() { return inflateReset(&this->strm) == Z_OK; }
+
+private:
+	z_stream strm;
+	bool bInit;
+};
+
+#ifdef ZDW_HAVE_BZIP2
+//********************************************************
+class Bzip2Input : public DecoderInput
+{
+public:
+	Bzip2Input(FILE* fp, const bool bOwnsFile, const char* prefix, const size_t prefixLen, const size_t capacity)
+		: DecoderInput(fp, bOwnsFile, prefix, prefixLen, capacity)
+		, bInit(false)
+	{
+		restart();
+	}
+	~Bzip2Input() { close(); }
+
+	void close()
+	{
+		end();
+		closeFile();
+	}
+
+	bool is_open() const { return this->bInit && this->fp; }
+
+protected:
+	Status decode(char*& out, size_t& outAvail)
+	{
+		this->strm.next_in = const_cast<char*>(this->in);
+		this->strm.avail_in = this->inAvail;
+		this->strm.next_out = out;
+		this->strm.avail_out = outAvail;
+		const int ret = BZ2_bzDecompress(&this->strm);
+		this->in = this->strm.next_in;
+		this->inAvail = this->strm.avail_in;
+		out = this->strm.next_out;
+		outAvail = this->strm.avail_out;
+
+		switch (ret)
+		{
+			case BZ_OK: return DECODE_OK;
+			case BZ_STREAM_END: return DECODE_END;
+			default: return DECODE_ERROR;
+		}
+	}
+
+	bool restart()
+	{
+		end();
+		memset(&this->strm, 0, sizeof(this->strm));
+		this->bInit = BZ2_bzDecompressInit(&this->strm, 0, 0) == BZ_OK;
+		return this->bInit;
+	}
+
+private:
+	void end()
+	{
+		if (this->bInit) {
+			BZ2_bzDecompressEnd(&this->strm);
+			this->bInit = false;
+		}
+	}
+
+	bz_stream strm;
+	bool bInit;
+};
+#endif
+
+#ifdef ZDW_HAVE_LZMA
+//********************************************************
+class XzInput : public DecoderInput
+{
+public:
+	XzInput(FILE* fp, const bool bOwnsFile, const char* prefix, const size_t prefixLen, const size_t capacity)
+		: DecoderInput(fp, bOwnsFile, prefix, prefixLen, capacity)
+		, bInit(false)
+	{
+		restart();
+	}
+	~XzInput() { close(); }
+
+	void close()
+	{
+		end();
+		closeFile();
+	}
+
+	bool is_open() const { return this->bInit && this->fp; }
+
+protected:
+	Status decode(char*& out, size_t& outAvail)
+	{
+		this->strm.next_in = reinterpret_cast<const uint8_t*>(this->in);
+		this->strm.avail_in = this->inAvail;
+		this->strm.next_out = reinterpret_cast<uint8_t*>(out);
+		this->strm.avail_out = outAvail;
+		//Concatenated streams are decoded until the end of the input is signalled.
+		const lzma_ret ret = lzma_code(&this->strm, this->bInputEOF ? LZMA_FINISH : LZMA_RUN);
+		this->in = reinterpret_cast<const char*>(this->strm.next_in);
+		this->inAvail = this->strm.avail_in;
+		out = reinterpret_cast<char*>(this->strm.next_out);
+		outAvail = this->strm.avail_out;
+
+		switch (ret)
+		{
+			case LZMA_OK: case LZMA_BUF_ERROR: return DECODE_OK;
+			case LZMA_STREAM_END: return DECODE_END;
+			default: return DECODE_ERROR;
+		}
+	}
+
+	bool restart()
+	{
+		end();
+		const lzma_stream init = LZMA_STREAM_INIT;
+		this->strm = init;
+		this->bInit = lzma_stream_decoder(&this->strm, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+		return this->bInit;
+	}
+
+private:
+	void end()
+	{
+		if (this->bInit) {
+			lzma_end(&this->strm);
+			this->bInit = false;
+		}
+	}
+
+	lzma_stream strm;
+	bool bInit;
+};
+#endif
+
+#ifdef ZDW_HAVE_ZSTD
+//********************************************************
+class ZstdInput : public DecoderInput
+{
+public:
+	ZstdInput(FILE* fp, const bool bOwnsFile, const char* prefix, const size_t prefixLen, const size_t capacity)
+		: DecoderInput(fp, bOwnsFile, prefix, prefixLen, capacity)
+		, dctx(ZSTD_createDCtx())
+	{ }
+	~ZstdInput() { close(); }
+
+	void close()
+	{
+		if (this->dctx) {
+			ZSTD_freeDCtx(this->dctx);
+			this->dctx = NULL;
+		}
+		closeFile();
+	}
+
+	bool is_open() const { return this->dctx && this->fp; }
+
+protected:
+	//Concatenated frames are decoded in turn without a restart.
+	Status decode(char*& out, size_t& outAvail)
+	{
+		ZSTD_inBuffer input = { this->in, this->inAvail, 0 };
+		ZSTD_outBuffer output = { out, outAvail, 0 };
+		const size_t ret = ZSTD_decompressStream(this->dctx, &output, &input);
+		this->in += input.pos;
+		this->inAvail -= input.pos;
+		out += output.pos;
+		outAvail -= output.pos;
+		return ZSTD_isError(ret) ? DECODE_ERROR : DECODE_OK;
+	}
+
+	bool restart()
+	{
+		return !ZSTD_isError(ZSTD_DCtx_reset(this->dctx, ZSTD_reset_session_only));
+	}
+
+private:
+	ZSTD_DCtx *dctx;
+};
+#endif
+
+//********************************************************
+//Data piped from the codec's command-line tool, when the codec isn't built in.
+class CommandInput : public BufferedInput
+{
+public:
+	CommandInput(const string& command, const size_t capacity)
+		: BufferedInput(capacity)
+		, command(command)
+		, fp(popen(command.c_str(), "r"))
+	{ }
+	~CommandInput() { close(); }
+
+	void close()
+	{
+		if (this->fp) {
+			pclose(this->fp);
+			this->fp = NULL;
+		}
+	}
+
+	bool is_open() const { return this->fp != NULL; }
+
+protected:
+	size_t readSource(char* data, const size_t size)
+	{
+		return this->fp ? fread(data, 1, size, this->fp) : 0;
+	}
+
+	bool rewindSource()
+	{
+		close();
+		this->fp = popen(this->command.c_str(), "r");
+		return this->fp != NULL;
+	}
+
+private:
+	const string command;
+	FILE *fp;
+};
+
+template <class T>
+BufferedInput* open_input(FILE* fp, const bool bOwnsFile, const char* prefix, const size_t prefixLen, const size_t capacity)
+{
+	T *input = new T(fp, bOwnsFile, prefix, prefixLen, capacity);
+	if (!input->is_open()) {
+		delete input; //closes fp
+		return NULL;
+	}
+	return input;
+}
+
+bool is_built_in(const Format format)
+{
+	switch (format)
+	{
+#ifndef ZDW_HAVE_BZIP2
+		case BZIP2: return false;
+#endif
+#ifndef ZDW_HAVE_LZMA
+		case XZ: return false;
+#endif
+#ifndef ZDW_HAVE_ZSTD
+		case ZSTD: return false;
+#endif
+		default: return true;
+	}
+}
+
+//Returns: a reader for the data in fp, which has been read up to prefix, or NULL if the codec can't be started
+BufferedInput* open_format(const Format format, FILE* fp, const bool bOwnsFile,
+	const char* prefix, const size_t prefixLen, const size_t capacity)
+{
+	switch (format)
+	{
+		default:
+		case PLAIN: return open_input<PlainInput>(fp, bOwnsFile, prefix, prefixLen, capacity);
+		case GZIP: return open_input<GzipInput>(fp, bOwnsFile, prefix, prefixLen, capacity);
+#ifdef ZDW_HAVE_BZIP2
+		case BZIP2: return open_input<Bzip2Input>(fp, bOwnsFile, prefix, prefixLen, capacity);
+#endif
+#ifdef ZDW_HAVE_LZMA
+		case XZ: return open_input<XzInput>(fp, bOwnsFile, prefix, prefixLen, capacity);
+#endif
+#ifdef ZDW_HAVE_ZSTD
+		case ZSTD: return open_input<ZstdInput>(fp, bOwnsFile, prefix, prefixLen, capacity);
+#endif
+	}
+}
+
+}
 
 
 namespace adobe {
 namespace zdw {
 
-// open a pipe via a command and read input from the pipe
-BufferedInput::BufferedInput(const std::string& command, const size_t capacity)
-	: command(command)
-	, fp(NULL)
-	, buffer(NULL)
+const size_t BufferedInput::DEFAULT_CAPACITY = 256 * 1024;
+
+//Opens a ZDW file, uncompressing it as it is read when it begins with a compression format's magic bytes.
+//
+//Returns: NULL if the file can't be read
+BufferedInput* BufferedInput::open(const string& filename, const size_t capacity)
+{
+	FILE *fp = fopen(filename.c_str(), "rb");
+	if (!fp)
+		return NULL;
+
+	char magic[MAGIC_SIZE];
+	const size_t len = fread(magic, 1, MAGIC_SIZE, fp);
+	const Format format = detect_format(reinterpret_cast<const unsigned char*>(magic), len);
+	if (format == PLAIN) {
+		MappedInput *mapped = MappedInput::open(fp);
+		if (mapped) {
+			fclose(fp); //the mapping remains
+			return mapped;
+		}
+	}
+	if (is_built_in(format))
+		return open_format(format, fp, true, magic, len, capacity);
+	fclose(fp);
+
+	//Codec isn't built in -- run its command-line tool instead.
+	string cmd;
+	switch (format)
+	{
+		case BZIP2: cmd = "bzip2 -d --stdout "; break;
+		case XZ: cmd = "xzcat "; break;
+		case ZSTD: cmd = "zstd -d --stdout "; break;
+		default: return NULL;
+	}
+	cmd += filename;
+	cmd.append(" 2>/dev/null"); //we don't need to see any chatter -- we output all relevant error codes ourselves
+
+	CommandInput *command = new CommandInput(cmd, capacity);
+	if (!command->is_open()) {
+		delete command;
+		return NULL;
+	}
+	return command;
+}
+
+//Reads ZDW data from a stream, e.g. stdin, uncompressing it when it begins with a compression format's magic bytes.
+//Data in a format whose codec isn't built in are passed through as is.
+BufferedInput* BufferedInput::open(FILE* fp, const size_t capacity)
+{
+	assert(fp);
+
+	char magic[MAGIC_SIZE];
+	const size_t len = fread(magic, 1, MAGIC_SIZE, fp);
+	Format format = detect_format(reinterpret_cast<const unsigned char*>(magic), len);
+	if (!is_built_in(format))
+		format = PLAIN;
+	return open_format(format, fp, false, magic, len, capacity);
+}
+
+BufferedInput* BufferedInput::openMemory(const char* data, const size_t length)
+{
+	return new MemoryInput(data, length);
+}
+
+//Reads source's data on a separate thread, ahead of the caller.
+//Data held in memory are returned as is, as there is nothing to gain from reading them ahead.
+BufferedInput* BufferedInput::readAhead(BufferedInput* source)
+{
+	assert(source);
+	if (source->is_in_memory())
+		return source;
+
+	BufferedInput *input = ReadAheadInput::open(source, DEFAULT_CAPACITY);
+	return input ? input : source;
+}
+
+BufferedInput::BufferedInput(const size_t capacity)
+	: buffer(new char[capacity])
 	, capacity(capacity)
+	, data(buffer)
 	, index(0), length(0)
+	, offset(0)
 	, bEOF(false)
-	, bFromStdin(false)
+	, bInMemory(false)
 {
-	open();
+	assert(capacity > 0);
 }
 
-// read from standard input
-BufferedInput::BufferedInput()
-	: fp(NULL)
-	, buffer(NULL)
+BufferedInput::BufferedInput(const char* data, const size_t length)
+	: buffer(NULL)
 	, capacity(0)
-	, index(0), length(0)
-	, bEOF(false)
-	, bFromStdin(true)
+	, data(data)
+	, index(0), length(length)
+	, offset(0)
+	, bEOF(true)
+	, bInMemory(true)
 { }
 
 BufferedInput::~BufferedInput()
 {
-	close();
 	delete[] buffer;
 }
 
-void BufferedInput::close()
-{
-	if (fp) {
-		pclose(fp);
-		fp = NULL;
-	}
-}
-
 bool BufferedInput::rewind()
 {
+	if (bInMemory) {
+		index = 0;
+		return true;
+	}
 	bEOF = false;
 	index = length = 0;
-	assert(!command.empty());
-	close();
-	return open();
-}
-
-//Returns: whether any more data can be returned
-bool BufferedInput::eof() const
-{
-	if (this->bFromStdin) {
-		return feof(stdin) != 0;
-	} else {
-		return bEOF && index >= length;
-	}
+	offset = 0;
+	return rewindSource();
 }
 
 bool BufferedInput::can_read_more_data() const
@@ -82,28 +862,23 @@ bool BufferedInput::can_read_more_data() const
 	if (eof()) {
 		return false;
 	}
-	return this->fp != NULL;
+	return is_open();
 }
 
 void BufferedInput::refill_buffer()
 {
-	this->index = this->length = 0;
-	do {
-		//Iterate reads when we don't receive the entire buffer immediately.
-		this->length += fread(this->buffer + this->length,
-				1, this->capacity - this->length, this->fp);
-		this->bEOF = feof(this->fp) != 0;
-	} while (this->length < this->capacity && !this->bEOF);
+	if (this->bInMemory) {
+		return;
+	}
+	this->offset += this->length;
+	this->index = 0;
+	this->length = readSource(this->buffer, this->capacity);
+	this->bEOF = this->length < this->capacity;
 }
 
 //Returns: number of bytes read
 size_t BufferedInput::read(void* data, size_t size)
 {
-	if (this->bFromStdin) {
-		//Reads requested number of bytes from stdin.
-		return fread(data, 1, size, stdin);
-	}
-
 	if (!can_read_more_data()) {
 		return 0;
 	}
@@ -115,10 +890,11 @@ size_t BufferedInput::read(void* data, size_t size)
 	if (size > bytesInBuffer) {
 		//Flush what is available first.
 		if (bytesInBuffer) {
-			memcpy(data, this->buffer + this->index, bytesInBuffer);
+			memcpy(data, this->data + this->index, bytesInBuffer);
 
 			//If we've hit EOF, then there is no more data to read in.
 			if (this->bEOF) {
+				this->index = this->length;
 				return bytesInBuffer;
 			}
 
@@ -128,17 +904,17 @@ size_t BufferedInput::read(void* data, size_t size)
 			bytesRead = bytesInBuffer;
 		}
 
-		//Should we read more into the buffer for this call?
-		if (size >= this->capacity) {
-			//Buffer is not large enough to store the rest of the requested data.
-			//Just pass the rest of the data through without buffering.
-			bytesRead += fread(data, 1, size, this->fp);
-			this->bEOF = feof(this->fp) != 0;
-
-			//Buffer is now empty -- refill next call
-			this->index = this->length = 0;
+		//Buffer is now empty -- refill next call
+		this->offset += this->length;
+		this->index = this->length = 0;
 
-			return bytesRead;
+		//Should we read more into the buffer for this call?
+		if (size >= this->capacity / 2) {
+			//A large request: decode the rest of it straight into the caller's buffer.
+			const size_t bytes = readSource(static_cast<char*>(data), size);
+			this->offset += bytes;
+			this->bEOF = bytes < size;
+			return bytesRead + bytes;
 		}
 
 		refill_buffer();
@@ -150,7 +926,7 @@ size_t BufferedInput::read(void* data, size_t size)
 	if (size > bytesInBuffer) {
 		size = bytesInBuffer;
 	}
-	memcpy(data, this->buffer + this->index, size);
+	memcpy(data, this->data + this->index, size);
 	this->index += size;
 
 	return bytesRead + size; //total bytes returned
@@ -160,28 +936,8 @@ size_t BufferedInput::read(void* data, size_t size)
 //Returns: number of bytes skipped
 size_t BufferedInput::skip(size_t size)
 {
-	//Read blocks for speed.
-	static const size_t BLOCK_SIZE = 4096;
-	char tempBlock[BLOCK_SIZE];
-	size_t i, bytes_read;
-
-	if (this->bFromStdin) {
-		//Skips ahead the requested number of bytes in stdin.
-		size_t advanced = 0;
-
-		const size_t blocks = size/BLOCK_SIZE;
-		for (i = 0; i < blocks; ++i) {
-			bytes_read = fread(tempBlock, 1, BLOCK_SIZE, stdin);
-			advanced += bytes_read;
-			size -= bytes_read;
-		}
-		assert(size < BLOCK_SIZE);
-		advanced += fread(tempBlock, 1, size, stdin);
-		return advanced;
-	}
-
 	//no more data to be read
-	if (eof() || !this->fp) {
+	if (!can_read_more_data()) {
 		return 0;
 	}
 
@@ -195,39 +951,35 @@ size_t BufferedInput::skip(size_t size)
 	//We want to skip more data than what is left in the buffer.
 
 	//1. Advance to the end of the buffer.
-	this->index = this->length;
+	this->offset += this->length;
+	this->index = this->length = 0;
 	size -= bytesInBuffer;
-	size_t advanced = bytesInBuffer;
-
-	//2. Skip ahead the remaining number of bytes.
-	const size_t blocks = size / BLOCK_SIZE;
-	for (i = 0; i < blocks; ++i) {
-		bytes_read = fread(tempBlock, 1, BLOCK_SIZE, this->fp);
-		advanced += bytes_read;
-		size -= bytes_read;
+	if (this->bEOF) {
+		return bytesInBuffer;
 	}
-	assert(size < BLOCK_SIZE);
-	advanced += fread(tempBlock, 1, size, this->fp);
 
-	this->bEOF = feof(this->fp) != 0;
+	//2. Skip ahead the remaining number of bytes.
+	const size_t skipped = skipSource(size);
+	this->offset += skipped;
+	this->bEOF = skipped < size;
 
-	return advanced;
+	return bytesInBuffer + skipped;
 }
 
-bool BufferedInput::open()
+//Default: reads data through the buffer and discards it.
+size_t BufferedInput::skipSource(size_t size)
 {
-	assert(!fp);
-
-	fp = popen(command.c_str(), "r");
-
-	if (fp) {
-		if (!this->buffer) {
-			assert(capacity > 0);
-			this->buffer = new char[capacity];
+	size_t advanced = 0;
+	while (size) {
+		const size_t len = size < this->capacity ? size : this->capacity;
+		const size_t bytes = readSource(this->buffer, len);
+		advanced += bytes;
+		size -= bytes;
+		if (bytes < len) {
+			break;
 		}
-		return true;
 	}
-	return false;
+	return advanced;
 }
 
 // Obtains a line of data (or as much of a line as can fit) into the supplied buffer.
@@ -244,10 +996,6 @@ const char* BufferedInput::getline(char* buf, const size_t size)
 	assert(buf);
 	assert(size);
 
-	if (this->bFromStdin) {
-		return fgets(buf, size, stdin);
-	}
-
 	const size_t size_minus_1 = size - 1;
 	size_t out_pos = 0;
 	while (can_read_more_data()) {
@@ -257,7 +1005,7 @@ const char* BufferedInput::getline(char* buf, const size_t size)
 				buf[out_pos] = 0;
 				return buf;
 			}
-			const char ch = this->buffer[this->index++];
+			const char ch = this->data[this->index++];
 			buf[out_pos++] = ch;
 			if (ch == '\n') {
 				buf[out_pos] = 0;
@@ -265,12 +1013,18 @@ const char* BufferedInput::getline(char* buf, const size_t size)
 			}
 		}
 
+		if (this->bEOF) {
+			break;
+		}
 		refill_buffer();
 	}
 
-	return out_pos ? buf : NULL;
+	if (out_pos) {
+		buf[out_pos] = 0;
+		return buf;
+	}
+	return NULL;
 }
 
 } // namespace zdw
 } // namespace adobe
-
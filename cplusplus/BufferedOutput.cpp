@@ -11,14 +11,145 @@
  */
 
 #include "zdw/BufferedOutput.h"
+#include "ring_buffer.h"
 #include <assert.h>
+#include <new>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+
+namespace {
+
+const size_t WRITER_CHUNK_SIZE = 1024 * 1024; //bytes written to the file at once
+const size_t WRITER_CHUNKS = 4;
+
+}
 
 
 namespace adobe {
 namespace zdw {
 
+//********************************************************
+//Writes output to a file on a separate thread, in large page-aligned chunks,
+//so that the caller can format more output while the last chunk is being written.
+class OutputWriter
+{
+public:
+	//Returns: a writer to fp, or NULL if the thread can't be started
+	static OutputWriter* start(FILE* fp)
+	{
+		OutputWriter *writer;
+		try {
+			writer = new OutputWriter(fp);
+		} catch (const std::bad_alloc&) {
+			return NULL;
+		}
+		if (pthread_create(&writer->thread, NULL, writeThread, writer) != 0) {
+			writer->bRunning = false;
+			delete writer;
+			return NULL;
+		}
+		return writer;
+	}
+
+	~OutputWriter() { finish(); }
+
+	//Returns: false if the data can't be written
+	bool write(const void* data, size_t size)
+	{
+		while (size)
+		{
+			if (!this->current)
+				return false; //an earlier write failed
+			size_t len = WRITER_CHUNK_SIZE - this->current->length;
+			if (len > size)
+				len = size;
+			memcpy(this->current->data + this->current->length, data, len);
+			this->current->length += len;
+			data = static_cast<const char*>(data) + len;
+			size -= len;
+			if (this->current->length == WRITER_CHUNK_SIZE)
+				pushChunk();
+		}
+		return true;
+	}
+
+	//Writes out any remaining output and stops the thread.
+	//Returns: whether all output was written
+	bool finish()
+	{
+		if (this->bRunning) {
+			if (this->current && this->current->length)
+				pushChunk();
+			this->chunks.close();
+			pthread_join(this->thread, NULL);
+			this->bRunning = false;
+		}
+		return !__atomic_load_n(&this->bFailed, __ATOMIC_SEQ_CST);
+	}
+
+private:
+	struct Chunk
+	{
+		Chunk() : data(NULL), length(0) { }
+		~Chunk() { free(data); }
+
+		char *data;
+		size_t length;
+	};
+
+	explicit OutputWriter(FILE* fp)
+		: fp(fp)
+		, chunks(WRITER_CHUNKS)
+		, current(NULL)
+		, bFailed(false)
+		, bRunning(true)
+	{
+		const size_t alignment = sysconf(_SC_PAGESIZE);
+		for (size_t i = 0; i < this->chunks.size(); ++i)
+		{
+			void *data = NULL;
+			if (posix_memalign(&data, alignment, WRITER_CHUNK_SIZE) != 0)
+				throw std::bad_alloc();
+			this->chunks.slot(i).data = static_cast<char*>(data);
+		}
+		this->current = this->chunks.beginPush();
+	}
+
+	void pushChunk()
+	{
+		this->chunks.push();
+		this->current = this->chunks.beginPush(); //NULL once the thread stops on a write error
+		if (this->current)
+			this->current->length = 0;
+	}
+
+	static void* writeThread(void* arg)
+	{
+		OutputWriter *writer = static_cast<OutputWriter*>(arg);
+		Chunk *chunk;
+		while ((chunk = writer->chunks.front()) != NULL)
+		{
+			if (fwrite(chunk->data, chunk->length, 1, writer->fp) != 1) {
+				__atomic_store_n(&writer->bFailed, true, __ATOMIC_SEQ_CST);
+				writer->chunks.close();
+				break;
+			}
+			writer->chunks.pop();
+		}
+		return NULL;
+	}
+
+	FILE *fp;
+	RingBuffer<Chunk> chunks;
+	Chunk *current; //being filled
+	pthread_t thread;
+	bool bFailed, bRunning;
+};
+
 BufferedOrderedOutput::ByteBuffer::ByteBuffer(int unsigned startSize)
 	: pBuffer(new char[startSize])
 	, pos(0)
@@ -87,6 +218,8 @@ inline void BufferedOrderedOutput::ByteBuffer::print(std::string& str) const
 
 BufferedOrderedOutput::BufferedOrderedOutput(FILE* fp)
 	: fp(fp)
+	, text(NULL)
+	, writer(NULL)
 	, curColumnIndex(0)
 {
 	if (fp) {
@@ -95,8 +228,40 @@ BufferedOrderedOutput::BufferedOrderedOutput(FILE* fp)
 	this->outStr.reserve(16 * 1024);
 }
 
+BufferedOrderedOutput::BufferedOrderedOutput(std::string* text)
+	: fp(NULL)
+	, text(text)
+	, writer(NULL)
+	, curColumnIndex(0)
+{
+	this->outStr.reserve(16 * 1024);
+}
+
+bool BufferedOrderedOutput::writeOut(const void* data, const size_t size)
+{
+	if (this->text) {
+		this->text->append(static_cast<const char*>(data), size);
+		return true;
+	}
+	if (this->writer)
+		return this->writer->write(data, size);
+	return fwrite(data, size, 1, this->fp) == 1;
+}
+
 BufferedOrderedOutput::~BufferedOrderedOutput()
-{ }
+{
+	delete this->writer;
+}
+
+//Hands output lines to a thread that writes them to the file in large chunks.
+//Returns: whether the thread was started
+bool BufferedOrderedOutput::startWriter()
+{
+	if (!this->fp || this->writer)
+		return false;
+	this->writer = OutputWriter::start(this->fp);
+	return this->writer != NULL;
+}
 
 bool BufferedOrderedOutput::write(const void* data, const size_t size)
 {
@@ -144,7 +309,7 @@ bool BufferedOrderedOutput::writeEndline(const void* data, const size_t size)
 {
 	this->curColumnIndex = 0; //ready to receive next line
 
-	if (!this->fp) {
+	if (!this->fp && !this->text) {
 		return true; //nothing to do
 	}
 
@@ -161,16 +326,26 @@ bool BufferedOrderedOutput::writeEndline(const void* data, const size_t size)
 		colBuf->print(this->outStr);
 	}
 	this->outStr.append(static_cast<const char*>(data), size); //append the endline chars
-	return (fwrite(this->outStr.c_str(), this->outStr.size(), 1, this->fp) == 1);
+	return writeOut(this->outStr.c_str(), this->outStr.size());
+}
+
+bool BufferedOrderedOutput::repeatLine()
+{
+	//outStr still holds the previous line.
+	if (this->curColumnIndex || this->outStr.empty())
+		return false;
+
+	writeOut(this->outStr.c_str(), this->outStr.size());
+	return true;
 }
 
 bool BufferedOrderedOutput::writeRawLine(const void* data, const size_t size)
 {
-	if (!this->fp) {
+	if (!this->fp && !this->text) {
 		return true; //nothing to do
 	}
 
-	return fwrite(data, size, 1, this->fp) == 1;
+	return writeOut(data, size);
 }
 
 //Call to reorder column outputs in each row/line of text.
@@ -208,21 +383,49 @@ bool BufferedOrderedOutput::setOutputColumnOrder(const int* pOutputOrder, const
 
 BufferedOutput::BufferedOutput(FILE* fp, const size_t capacity)
 	: fp(fp)
+	, text(NULL)
+	, writer(NULL)
 	, capacity(capacity)
 	, buffer(fp ? new char[capacity] : NULL)
 	, index(0)
+	, lineBegin(0)
+	, lastLineBegin(0), lastLineEnd(0)
 {
 	if (fp) {
 		setbuf(fp, NULL); //disable additional buffering layer
 	}
 }
 
+BufferedOutput::BufferedOutput(std::string* text, const size_t capacity)
+	: fp(NULL)
+	, text(text)
+	, writer(NULL)
+	, capacity(capacity)
+	, buffer(new char[capacity])
+	, index(0)
+	, lineBegin(0)
+	, lastLineBegin(0), lastLineEnd(0)
+{ }
+
 BufferedOutput::~BufferedOutput()
 {
 	flush();
+	delete writer;
 	delete[] buffer;
 }
 
+//Hands output to a thread that writes it to the file in large chunks.
+//Returns: whether the thread was started
+bool BufferedOutput::startWriter()
+{
+	if (!this->fp || this->writer)
+		return false;
+	if (!flush())
+		return false;
+	this->writer = OutputWriter::start(this->fp);
+	return this->writer != NULL;
+}
+
 //Returns: whether operation succeeded
 bool BufferedOutput::flush()
 {
@@ -230,17 +433,31 @@ bool BufferedOutput::flush()
 		return true; //nothing to write
 	}
 
-	assert(this->fp);
-	const size_t out = fwrite(buffer, this->index, 1, this->fp);
+	assert(this->fp || this->text);
+	const bool bRet = writeOut(buffer, this->index);
 	this->index = 0;
-	return out == 1;
+	this->lineBegin = NO_LINE;
+	this->lastLineBegin = this->lastLineEnd = 0;
+	return bRet;
+}
+
+bool BufferedOutput::writeOut(const void* data, const size_t size)
+{
+	if (this->text) {
+		this->text->append(static_cast<const char*>(data), size);
+		return true;
+	}
+	return fwrite(data, size, 1, this->fp) == 1;
 }
 
 bool BufferedOutput::write(const void* data, const size_t size)
 {
-	if (!this->fp) {
+	if (!this->fp && !this->text) {
 		return true; //nowhere to write -- nothing to do
 	}
+	if (this->writer) {
+		return this->writer->write(data, size); //the writer does the buffering
+	}
 
 	bool bRet = true;
 	if (this->index + size >= this->capacity) {
@@ -248,8 +465,8 @@ bool BufferedOutput::write(const void* data, const size_t size)
 	}
 	if (size >= this->capacity) {
 		//Buffer is not large enough to store -- write the data immediately.
-		const size_t out = fwrite(data, size, 1, this->fp);
-		bRet &= (out == 1);
+		bRet &= writeOut(data, size);
+		this->lineBegin = NO_LINE;
 	} else {
 		//Store for a later write to the file.
 		memcpy(this->buffer + this->index, data, size);
@@ -258,6 +475,34 @@ bool BufferedOutput::write(const void* data, const size_t size)
 	return bRet;
 }
 
+bool BufferedOutput::writeEndline(const void* data, const size_t size)
+{
+	const bool bRet = write(data, size);
+
+	//Note where the line sits in the buffer, for repeatLine.
+	if (this->lineBegin != NO_LINE) {
+		this->lastLineBegin = this->lineBegin;
+		this->lastLineEnd = this->index;
+	} else {
+		this->lastLineBegin = this->lastLineEnd = 0;
+	}
+	this->lineBegin = this->index;
+	return bRet;
+}
+
+bool BufferedOutput::repeatLine()
+{
+	const size_t size = this->lastLineEnd - this->lastLineBegin;
+	if (!size || this->writer || this->lineBegin != this->index || this->index + size >= this->capacity)
+		return false;
+
+	memcpy(this->buffer + this->index, this->buffer + this->lastLineBegin, size);
+	this->lastLineBegin = this->index;
+	this->index += size;
+	this->lastLineEnd = this->lineBegin = this->index;
+	return true;
+}
+
 
 int compareByIndex(const void* first, const void* second)
 {
@@ -13,19 +13,28 @@
 #include "ConvertToZDW.h"
 
 #include "getnextrow.h"
+#include "memory.h"
+#include "tokenizer.h"
 
 #include "zdw_column_type_constants.h"
 
+#include <algorithm>
 #include <cstring>
 #include <cassert>
+#include <deque>
 #include <fstream>
 #include <sstream>
 #include <math.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <strings.h>
 #include <unistd.h>
 
 using namespace adobe::zdw::internal;
+using adobe::zdw::CompressedOutput;
+using adobe::zdw::TextSpan;
+using adobe::zdw::ULONG;
+using adobe::zdw::ULONGLONG;
 using std::map;
 using std::strchr;
 using std::string;
@@ -56,15 +65,38 @@ using std::vector;
 //version 11 -- add metadata block to file header
 //version 11a -- add fxz support
 //version 11b -- add zstd support
+//version 11c -- add multithreaded parsing of the first pass (--threads)
+//version 11d -- add single-pass conversion, caching parsed rows in memory (--single-pass)
+//version 11e -- read input files through a memory mapping, when possible
+//version 11f -- split rows and columns with a vectorized delimiter scan
+//version 11g -- compress output in-process when the codec library is built in, instead of piping to the compression command
+//version 11h -- optionally write a version 12 file ending with an index of its blocks (--block-index)
+//version 11i -- add per-column zone maps (value ranges, non-empty counts, distinct count sketches) to block index entries
+//version 11j -- optionally add Bloom filters of text columns' values to block index entries (--bloom)
+//version 11k -- optionally store each block's rows by column (--columnar)
+//version 11l -- optionally start a keyframe every N rows of a block, listing their offsets in the block index (--keyframes)
+//version 11m -- with --threads, tokenize the second pass over a block in parallel, and compress output on its own thread
+//version 11n -- count --columnar blocks' column segments against the memory limit
+//version 11o -- optionally leave the output uncompressed (-u), so readers can use its block index in place
 
 
 namespace {
 
 static const int unsigned BAD_FIELD = static_cast<int unsigned>(-1);
 
+//Multithreaded parsing.
+const size_t PARSE_CHUNK_SIZE = 8 * 1024 * 1024; //bytes of input read per thread for each batch
+const size_t PARSE_CHUNK_HEAP_BLOCK_SIZE = 1024 * 1024; //per-thread dictionaries and row caches are transient -- keep them small
+const ULONG ROW_BATCH_SIZE = 4096; //rows of the second pass handed to a thread at a time
 
-inline void get_next_column(char*& col);
-inline bool dump_trimmed_row_to_temp_file(FILE* fp, const vector<char*>& rowColumns);
+//Columnar mode.
+const size_t COLUMN_SEGMENT_RESERVE_SIZE = 1024 * 1024; //bytes of a block's column segments reserved against the memory limit at a time
+
+
+inline ULONGLONG parse_unsigned(const TextSpan& field);
+inline ULONGLONG char_field_value(const TextSpan& field);
+inline const char* find_last_row_end(const char* const begin, const char* end);
+inline bool dump_trimmed_row_to_temp_file(CompressedOutput* out, const vector<TextSpan>& rowColumns);
 
 }
 
@@ -73,7 +105,7 @@ namespace adobe {
 namespace zdw {
 
 const int ConvertToZDW::CONVERT_ZDW_CURRENT_VERSION = 11;
-const char ConvertToZDW::CONVERT_ZDW_VERSION_TAIL[3] = "b";
+const char ConvertToZDW::CONVERT_ZDW_VERSION_TAIL[3] = "o";
 
 const char ConvertToZDW::ERR_CODE_TEXTS[ERR_CODE_COUNT][30] = {
 	"OK","NO_ARGS","CONVERSION_FAILED","UNTAR_FAILED","MISSING_DESC_FILE","MISSING_SQL_FILE",
@@ -264,62 +296,160 @@ int ConvertToZDW::loadMetadataFile(const char* filepath,
 //Returns: number of columns in returned row
 size_t ConvertToZDW::GetDataRow(
 	FILE* f, char *&row,
-	vector<char*>& rowColumns) // read the next line from f into row and set rowColumns to point to columns
+	vector<TextSpan>& rowColumns) // read the next line from f into row and set rowColumns to point to columns
 {
-	rowColumns.clear();
+	//Rows of a mapped input file are read in place.
+	const char *text;
+	size_t len = 0;
+	if (this->mappedInput.is_open())
+	{
+		text = this->mappedInput.getNextRow(len, m_LongestLine);
+	} else {
+		len = GetNextRow(f, row, m_LongestLine);
+		if (len)
+			--len; //exclude the truncated newline
+		text = row;
+	}
 
-	if (GetNextRow(f, row, m_LongestLine))
+	if (text && len)
 	{
 		//If we're streaming data in, store this data to a temp file
-		if (this->tmp_fp &&
+		if (this->tmp_out &&
 			!this->bTrimTrailingSpaces) //trimming whitespace here is expensive -- output row below after trimming
 		{
-			const size_t len = strlen(row);
-
-			if (fwrite(row, 1, len, this->tmp_fp) != len)
+			if (!this->tmp_out->write(text, len))
 				return 0; //had an error writing to the temp file
-			if (fwrite("\n", 1, 1, this->tmp_fp) != 1) //reinsert trailing newline that was truncated
+			if (!this->tmp_out->put('\n')) //reinsert trailing newline that was truncated
 				return 0;
 		}
 
-		char *col = row, *temp;
-		while (col)
+		SplitRowIntoColumns(text, len, rowColumns, this->bTrimTrailingSpaces);
+
+		//now dump trimmed fields to temp file
+		if (this->bTrimTrailingSpaces && this->tmp_out) {
+			if (!dump_trimmed_row_to_temp_file(this->tmp_out, rowColumns))
+				return 0;
+		}
+	} else {
+		rowColumns.clear();
+	}
+	return rowColumns.size();
+}
+
+//A text value added to a chunk's dictionary.
+//A chunk's values are listed in the order its rows added them, so they can be added to the block's dictionary as parseInput would.
+struct ConvertToZDW::NewValue
+{
+	const DictionaryEntry* entry;
+	ULONG row;     //the chunk row in which the value first appears
+	size_t column;
+};
+
+//Adds the values of a parsed row to a block's dictionary and column value ranges.
+//
+//Returns: true if additional memory is available, or false if memory limit has been exceeded
+bool ConvertToZDW::addRowValues(
+	const vector<TextSpan>& rowColumns,
+	Dictionary& dictionary,     //(in/out) unique text values
+	char unsigned* minmaxset,   //(in/out) flags whether a column has any non-empty value
+	ULONGLONG* columnMin, ULONGLONG* columnMax, //(in/out) numeric column value ranges
+	RowValue* rowValues,        //(out) if not NULL, the parsed value of each column
+	const bool bStopWhenLowOnMemory, //if set, the rest of the row is skipped once memory runs low
+	vector<NewValue>* newValues) const //(out) if not NULL, text values added to the dictionary are appended here
+{
+	bool hadEnoughMemory = true;
+	ULONGLONG val;
+	const size_t n = rowColumns.size();
+	for (size_t c = 0; (hadEnoughMemory || !bStopWhenLowOnMemory) && c < n; ++c)
+	{
+		if (rowValues)
+			rowValues[c].n = 0;
+		const TextSpan& field = rowColumns[c];
+		if (!field.len)
+			continue; //skip empty values
+
+		switch (m_ColumnType[c])
 		{
-			rowColumns.push_back(col);
-			get_next_column(col);
-			if (col) // replace the tab with an end of string null
-			{
-				*col = 0;
-				++col;
-
-				if (this->bTrimTrailingSpaces) {
-					temp = col - 2; //last character of field just parsed
-					while (*temp == ' ' && temp >= row) {
-						*temp = 0;
-						--temp;
+			case DECIMAL:
+			case VARCHAR:
+			case TEXT:
+			case TINYTEXT:
+			case MEDIUMTEXT:
+			case LONGTEXT:
+			case DATETIME:
+			case CHAR_2:
+				minmaxset[c] = 1;
+				if (rowValues || newValues)
+				{
+					const ULONG numEntries = dictionary.getNumEntries();
+					const DictionaryEntry *entry;
+					hadEnoughMemory = dictionary.insert(field.str, field.len, entry) && hadEnoughMemory;
+					if (rowValues)
+						rowValues[c].entry = entry;
+					if (newValues && dictionary.getNumEntries() != numEntries)
+					{
+						NewValue value;
+						value.entry = entry;
+						value.row = 0; //set by the caller
+						value.column = c;
+						newValues->push_back(value);
 					}
 				}
-			} //and move on to the next field
-		}
+				else
+					hadEnoughMemory = dictionary.insert(field.str, field.len) && hadEnoughMemory;
+			break;
+			case CHAR:
+			{
+				if (rowValues)
+					rowValues[c].n = char_field_value(field); //as stored by writeBlockRows
 
-		if (this->bTrimTrailingSpaces) {
-			//trim final field
-			char *final_field = rowColumns.back();
-			temp = final_field;
-			temp += strlen(temp) - 1;
-			while (*temp == ' ' && temp >= final_field) {
-				*temp = 0;
-				--temp;
+				val = field.str[0];
+				if (field.str[0] == '\\' && field.len > 1) //include escaped chars verbatim
+					val += (field.str[1] * 256);
+				if (val > 0)
+				{
+					if (minmaxset[c])
+					{
+						if (val > columnMax[c])
+							columnMax[c] = val;
+						else if (val < columnMin[c])
+							columnMin[c] = val;
+					} else {
+						columnMax[c] = columnMin[c] = val;
+						minmaxset[c] = 1;
+					}
+				}
 			}
-
-			//now dump trimmed fields to temp file
-			if (this->tmp_fp) {
-				if (!dump_trimmed_row_to_temp_file(this->tmp_fp, rowColumns))
-					return 0;
+			break;
+			case TINY: case TINY_SIGNED:
+			case SHORT: case SHORT_SIGNED:
+			case LONG: case LONG_SIGNED:
+			case LONGLONG: case LONGLONG_SIGNED:
+			{
+				//Signed values can be considered as unsigned values
+				//when gathering the range (though it is technically inaccurate).
+				val = parse_unsigned(field);
+				if (rowValues)
+					rowValues[c].n = val;
+				if (val > 0)
+				{
+					if (minmaxset[c])
+					{
+						if (val > columnMax[c])
+							columnMax[c] = val;
+						else if (val < columnMin[c])
+							columnMin[c] = val;
+					} else {
+						columnMax[c] = columnMin[c] = val;
+						minmaxset[c] = 1;
+					}
+				}
 			}
+			break;
+			default: assert(!"Unrecognized column type"); break;
 		}
 	}
-	return rowColumns.size();
+	return hadEnoughMemory;
 }
 
 //******************************************
@@ -331,18 +461,694 @@ ConvertToZDW::INPUT_STATUS ConvertToZDW::parseInput(FILE* in)
 	bool hadEnoughMemory = true;
 	size_t n;
 	const size_t numColumns = m_ColumnType.size();
-	while (hadEnoughMemory && (n = GetDataRow(in, m_row, this->rowColumns)))
+	RowValue *values = this->bSinglePass ? &this->rowValues[0] : NULL;
+	while (hadEnoughMemory &&
+		(n = this->bPendingRow ? this->rowColumns.size() : GetDataRow(in, m_row, this->rowColumns)))
 	{
+		this->bPendingRow = false;
 		if (n != numColumns)
 			return IS_WRONG_NUM_OF_COLUMNS_ON_A_ROW;
-		for (size_t c = 0; hadEnoughMemory && c < n; ++c)
+		if (this->bColumnar && reserveColumnSegments(this->numRows + 1) == this->numRows)
+		{
+			//The row's column segments don't fit -- the block ends before it, unless it can't hold even one row.
+			if (!this->numRows)
+				return IS_NOT_ENOUGH_MEMORY;
+			this->bPendingRow = this->bSinglePass;
+			hadEnoughMemory = false;
+			break;
+		}
+		hadEnoughMemory = addRowValues(this->rowColumns, this->uniques, minmaxset, &columnMin[0], &columnMax[0], values, true);
+		if (!hadEnoughMemory && this->bSinglePass)
+		{
+			//The input won't be re-read for this block, so hold on to this row for the next one.
+			this->bPendingRow = true;
+		}
+		if (hadEnoughMemory)
+		{
+			if (this->bSinglePass && !this->rowCache.append(values))
+			{
+				//The row is stored, and ends the block -- unless the block can't hold even one row.
+				if (!this->numRows)
+					return IS_NOT_ENOUGH_MEMORY;
+				hadEnoughMemory = false;
+			}
+			++this->numRows;
+			if (!(this->numRows % 10000) && !this->bQuiet)
+			{
+				statusOutput(INFO, "\r%u rows", this->numRows);
+			}
+		}
+	}
+	if (!hadEnoughMemory && this->bSinglePass && !this->bPendingRow)
+	{
+		//The row cache filled up with the block's last row.  Hold on to the row that follows, if any, for the next block.
+		if (!GetDataRow(in, m_row, this->rowColumns))
+			return IS_DONE;
+		this->bPendingRow = true;
+	}
+	return hadEnoughMemory ? IS_DONE : IS_NOT_ENOUGH_MEMORY;
+}
+
+//A row-aligned portion of an input batch, parsed by one thread.
+struct ConvertToZDW::ParseChunk
+{
+	ParseChunk(const ConvertToZDW* convert, const size_t numColumns)
+		: convert(convert)
+		, dictionary(PARSE_CHUNK_HEAP_BLOCK_SIZE)
+		, rowCache(PARSE_CHUNK_HEAP_BLOCK_SIZE)
+		, minmaxset(numColumns), columnMin(numColumns), columnMax(numColumns)
+		, begin(NULL), end(NULL)
+		, numRows(0), longestRow(0)
+		, bWrongNumOfColumns(false), bOutOfMemory(false)
+	{ }
+
+	const ConvertToZDW* convert;
+
+	Dictionary dictionary; //unique values in this chunk
+	vector<NewValue> newValues; //the entries of 'dictionary', in the order they were added
+	RowCache rowCache;     //rows of this chunk, when caching rows (in single-pass mode)
+	vector<char unsigned> minmaxset;
+	vector<ULONGLONG> columnMin, columnMax;
+	vector<TextSpan> rowColumns;
+	vector<RowValue> rowValues;
+
+	const char *begin, *end; //input text to parse
+
+	ULONG numRows;     //number of rows parsed
+	size_t longestRow; //including newline
+	bool bWrongNumOfColumns; //if set, parsing stopped on the row following 'numRows'
+	bool bOutOfMemory;
+};
+
+//Parses the rows in the indicated chunk of input text.
+void ConvertToZDW::parseChunk(ParseChunk& chunk) const
+{
+	const size_t numColumns = m_ColumnType.size();
+
+	chunk.dictionary.clear();
+	chunk.newValues.clear();
+	RowValue *values = NULL;
+	if (this->bSinglePass) {
+		chunk.rowCache.init(numColumns);
+		chunk.rowValues.resize(numColumns);
+		values = &chunk.rowValues[0];
+	}
+	memset(&chunk.minmaxset[0], 0, numColumns);
+	chunk.numRows = 0;
+	chunk.longestRow = 0;
+	chunk.bWrongNumOfColumns = chunk.bOutOfMemory = false;
+
+	try {
+		const char *row = chunk.begin, *rowEnd;
+		while (row < chunk.end && (rowEnd = FindRowEnd(row, chunk.end, row)))
+		{
+			const size_t len = rowEnd - row + 1; //include newline
+			if (len > chunk.longestRow)
+				chunk.longestRow = len;
+
+			if (len >= 2) //skip empty lines, as GetNextRow does
+			{
+				SplitRowIntoColumns(row, len - 1, chunk.rowColumns, this->bTrimTrailingSpaces);
+				if (chunk.rowColumns.size() != numColumns) {
+					chunk.bWrongNumOfColumns = true;
+					return;
+				}
+
+				//memory is limited by the block's dictionary -- every value of the row is kept here
+				const size_t numNewValues = chunk.newValues.size();
+				addRowValues(chunk.rowColumns, chunk.dictionary,
+					&chunk.minmaxset[0], &chunk.columnMin[0], &chunk.columnMax[0], values, false, &chunk.newValues);
+				for (size_t i = numNewValues; i < chunk.newValues.size(); ++i)
+					chunk.newValues[i].row = chunk.numRows;
+				if (values)
+					chunk.rowCache.append(values);
+				++chunk.numRows;
+			}
+			row = rowEnd + 1;
+		}
+	}
+	catch (const std::bad_alloc&) {
+		chunk.bOutOfMemory = true;
+	}
+}
+
+void* ConvertToZDW::parseChunkThread(void* arg)
+{
+	ParseChunk *chunk = static_cast<ParseChunk*>(arg);
+	chunk->convert->parseChunk(*chunk);
+	return NULL;
+}
+
+namespace {
+
+//Points cached text values at entries of the block's dictionary, instead of the chunk's.
+struct RemapDictionaryEntries
+{
+	RemapDictionaryEntries(const Dictionary& dictionary, const vector<char unsigned>& columnType)
+		: dictionary(dictionary), columnType(columnType)
+	{ }
+
+	void operator()(const size_t c, RowValue& value)
+	{
+		switch (columnType[c])
+		{
+			case DECIMAL:
+			case VARCHAR:
+			case TEXT:
+			case TINYTEXT:
+			case MEDIUMTEXT:
+			case LONGTEXT:
+			case DATETIME:
+			case CHAR_2:
+				if (value.entry)
+					value.entry = dictionary.find(*value.entry);
+			break;
+			default: break;
+		}
+	}
+
+	const Dictionary& dictionary;
+	const vector<char unsigned>& columnType;
+};
+
+}
+
+//Adds the values of a parsed chunk to the block's dictionary in the order parseInput would,
+//stopping where it would run out of memory.  In single-pass mode, the chunk's rows are also cached for the block.
+//
+//Returns: the number of leading rows of the chunk that are included in the block.
+//If the block ends on a row whose values were being added, numPartialColumns is set to the number of its columns that were.
+ULONG ConvertToZDW::mergeChunk(
+	const ParseChunk& chunk,
+	bool& bBlockFull, //(in/out) set once the row cache (or column segments) is full -- no further rows are included
+	size_t& numPartialColumns)
+{
+	numPartialColumns = 0;
+	if (bBlockFull)
+		return 0;
+
+	const DictionaryEntry *entry;
+	vector<NewValue>::const_iterator value = chunk.newValues.begin();
+	if (!this->bSinglePass)
+	{
+		for ( ; value != chunk.newValues.end(); ++value)
+		{
+			if (this->bColumnar) {
+				const ULONG numRows = reserveColumnSegments(this->numRows + value->row + 1) - this->numRows;
+				if (numRows <= value->row) {
+					bBlockFull = true;
+					return numRows;
+				}
+			}
+			if (!this->uniques.insert(*value->entry, entry)) {
+				numPartialColumns = value->column + 1;
+				return value->row;
+			}
+		}
+		if (this->bColumnar) {
+			const ULONG numRows = reserveColumnSegments(this->numRows + chunk.numRows) - this->numRows;
+			if (numRows < chunk.numRows) {
+				bBlockFull = true;
+				return numRows;
+			}
+		}
+		return chunk.numRows;
+	}
+
+	RemapDictionaryEntries remap(this->uniques, m_ColumnType);
+	RowCache::Reader reader(chunk.rowCache);
+	const size_t numColumns = m_ColumnType.size();
+	for (ULONG r = 0; r < chunk.numRows; ++r)
+	{
+		if (this->bColumnar && reserveColumnSegments(this->numRows + r + 1) == this->numRows + r) {
+			bBlockFull = true;
+			return r;
+		}
+		for ( ; value != chunk.newValues.end() && value->row == r; ++value)
+		{
+			if (!this->uniques.insert(*value->entry, entry)) {
+				numPartialColumns = value->column + 1;
+				return r;
+			}
+		}
+
+		reader.next();
+		const RowValue *chunkValues = reader.values();
+		for (size_t c = 0; c < numColumns; ++c)
+		{
+			this->rowValues[c] = chunkValues[c];
+			remap(c, this->rowValues[c]);
+		}
+		if (!this->rowCache.append(&this->rowValues[0])) {
+			//As in parseInput, the row ends the block -- unless the block can't hold even one row.
+			bBlockFull = true;
+			return this->numRows || r ? r + 1 : 0;
+		}
+	}
+	return chunk.numRows;
+}
+
+//Ends the block partway through a parsed chunk, before the indicated row, as parseInput would.
+//The column value ranges of the preceding rows of the chunk, and of the first numPartialColumns values
+//of the indicated row, are added to the block's, and the lines read up to the end of the row are measured.
+//
+//Returns: the beginning of the row, where the next block starts
+const char* ConvertToZDW::endBlockInChunk(const ParseChunk& chunk, const ULONG row, const size_t numPartialColumns)
+{
+	size_t longestRow = 0;
+	ULONG r = 0;
+	const char *line = chunk.begin, *lineEnd;
+	while ((lineEnd = FindRowEnd(line, chunk.end, line)) != NULL)
+	{
+		const size_t len = lineEnd - line + 1; //include newline
+		if (len > longestRow)
+			longestRow = len;
+
+		if (len >= 2)
+		{
+			if (r == row)
+				break;
+			//all of these values are already in the block's dictionary
+			SplitRowIntoColumns(line, len - 1, this->rowColumns, this->bTrimTrailingSpaces);
+			addRowValues(this->rowColumns, this->uniques, minmaxset, &columnMin[0], &columnMax[0], NULL, false);
+			++r;
+		}
+		line = lineEnd + 1;
+	}
+	assert(lineEnd);
+
+	if (numPartialColumns)
+	{
+		SplitRowIntoColumns(line, lineEnd - line, this->rowColumns, this->bTrimTrailingSpaces);
+		this->rowColumns.resize(numPartialColumns);
+		addRowValues(this->rowColumns, this->uniques, minmaxset, &columnMin[0], &columnMax[0], NULL, false);
+	}
+
+	while (longestRow >= m_LongestLine)
+		m_LongestLine *= 2; //as GetNextRow grows its buffer
+
+	return line;
+}
+
+//******************************************
+//Multithreaded variant of parseInput.
+//The input is read in large batches, each split into row-aligned chunks that are parsed in parallel.
+//The values and column value ranges of each chunk are then merged into those of the block, in input order,
+//ending the block on the same row as parseInput does.
+//
+//Returns: error enum indicating whether we completed parsing the input file, and if not, what happened
+ConvertToZDW::INPUT_STATUS ConvertToZDW::parseInputParallel(FILE* in)
+{
+	const size_t numColumns = m_ColumnType.size();
+	const int numThreads = this->numThreads;
+	const ULONG prevLongestLine = m_LongestLine;
+
+	//A mapped input file is parsed in place.  Otherwise, batches are read into a buffer.
+	const bool bMapped = this->mappedInput.is_open();
+	size_t batchCapacity = numThreads * PARSE_CHUNK_SIZE;
+
+	//The parsing buffers and the threads' memory are transient.  Only what is kept for the block
+	//counts against the memory limit, so the block ends where it would when parsed serially.
+	vector<ParseChunk*> chunks(numThreads);
+	vector<char> buffer;
+	{
+		UntrackedMemoryScope memory;
+		for (int t = 0; t < numThreads; ++t)
+			chunks[t] = new ParseChunk(this, numColumns);
+		if (!bMapped)
+			buffer.resize(batchCapacity);
+	}
+	vector<pthread_t> threads(numThreads);
+	vector<char> bThreadStarted(numThreads);
+
+	size_t length = 0; //bytes of input in the batch
+	bool bEOF = false, bOutOfMemory = false;
+	bool bBlockFull = false; //set once the row cache (or column segments) is full
+	const char *nextBlock = NULL; //where the next block begins, when this one ends before the input does
+	INPUT_STATUS status = IS_DONE;
+
+	while (!bEOF)
+	{
+		const char *begin, *batchEnd;
+		{
+			UntrackedMemoryScope memory;
+
+			if (bMapped) {
+				begin = this->mappedInput.tell();
+				length = this->mappedInput.end() - begin;
+				if (length > batchCapacity)
+					length = batchCapacity;
+				bEOF = begin + length == this->mappedInput.end();
+			} else {
+				length += fread(&buffer[length], 1, buffer.size() - length, in);
+				bEOF = feof(in) || ferror(in);
+				begin = &buffer[0];
+			}
+
+			//Parse only complete rows.
+			batchEnd = find_last_row_end(begin, begin + length);
+			if (!batchEnd) {
+				if (!bEOF) {
+					//a single row is larger than the batch
+					batchCapacity *= 2;
+					if (!bMapped)
+						buffer.resize(batchCapacity);
+				}
+				continue; //at EOF, an unterminated final row is ignored, as in GetNextRow
+			}
+			++batchEnd;
+
+			//Split the batch into row-aligned chunks of roughly equal size.
+			const size_t batchSize = batchEnd - begin;
+			const char *chunkBegin = begin;
+			for (int t = 0; t < numThreads; ++t)
+			{
+				ParseChunk& chunk = *chunks[t];
+				chunk.begin = chunkBegin;
+				chunk.end = batchEnd;
+				if (t < numThreads - 1) {
+					const char *target = begin + batchSize * (t + 1) / numThreads;
+					if (target < chunkBegin)
+						target = chunkBegin;
+					const char *rowEnd = FindRowEnd(target, batchEnd, begin);
+					if (rowEnd)
+						chunk.end = rowEnd + 1;
+				}
+				chunkBegin = chunk.end;
+			}
+
+			//Every chunk is parsed on a worker thread, keeping the transient memory apart from the block's.
+			for (int t = 0; t < numThreads; ++t)
+				bThreadStarted[t] = pthread_create(&threads[t], NULL, parseChunkThread, chunks[t]) == 0;
+			for (int t = 0; t < numThreads; ++t) {
+				if (bThreadStarted[t])
+					pthread_join(threads[t], NULL);
+				else
+					parseChunk(*chunks[t]); //couldn't spawn a thread -- parse the chunk here
+			}
+		}
+
+		//Merge chunk results into the block, in input order.
+		const ULONG prevNumRows = this->numRows;
+		for (int t = 0; t < numThreads; ++t)
+		{
+			const ParseChunk& chunk = *chunks[t];
+			if (chunk.bOutOfMemory) {
+				bOutOfMemory = true;
+				break;
+			}
+
+			size_t numPartialColumns;
+			const ULONG numChunkRows = mergeChunk(chunk, bBlockFull, numPartialColumns);
+			if (numChunkRows < chunk.numRows || (bBlockFull && chunk.bWrongNumOfColumns)) {
+				//The block ends within this chunk.  A malformed row following a full block is left for the next block.
+				nextBlock = endBlockInChunk(chunk, numChunkRows, numPartialColumns);
+				this->numRows += numChunkRows;
+				break;
+			}
+
+			while (chunk.longestRow >= m_LongestLine)
+				m_LongestLine *= 2; //as GetNextRow grows its buffer
+
+			this->numRows += chunk.numRows;
+			if (chunk.bWrongNumOfColumns) {
+				status = IS_WRONG_NUM_OF_COLUMNS_ON_A_ROW;
+				break;
+			}
+
+			for (size_t c = 0; c < numColumns; ++c)
+			{
+				if (!chunk.minmaxset[c])
+					continue;
+
+				if (minmaxset[c])
+				{
+					if (chunk.columnMax[c] > columnMax[c])
+						columnMax[c] = chunk.columnMax[c];
+					if (chunk.columnMin[c] < columnMin[c])
+						columnMin[c] = chunk.columnMin[c];
+				} else {
+					columnMax[c] = chunk.columnMax[c];
+					columnMin[c] = chunk.columnMin[c];
+					minmaxset[c] = 1;
+				}
+			}
+		}
+		if (bOutOfMemory || status != IS_DONE)
+			break;
+
+		if ((this->numRows / 10000 != prevNumRows / 10000) && !this->bQuiet)
+			statusOutput(INFO, "\r%u rows", this->numRows);
+
+		//Retain the rest of the batch following the block, or any partial row at its end, for what follows.
+		const char *retained = nextBlock ? nextBlock : batchEnd;
+		length = begin + length - retained;
+		if (bMapped)
+			this->mappedInput.seek(retained);
+		else
+			memmove(&buffer[0], retained, length);
+		if (nextBlock)
+			break;
+	}
+
+	{
+		UntrackedMemoryScope memory;
+		for (int t = 0; t < numThreads; ++t)
+			delete chunks[t];
+		vector<char>().swap(buffer);
+	}
+
+	if (bOutOfMemory)
+		throw std::bad_alloc();
+
+	//The input won't be re-read for this block, so the next block resumes after its final row.
+	if (this->bSinglePass && !bMapped && length && (nextBlock || !bEOF))
+		fseeko(in, -static_cast<off_t>(length), SEEK_CUR);
+
+	//The second pass reads rows with GetNextRow -- provide a buffer that fits the longest row.
+	if (m_LongestLine != prevLongestLine) {
+		delete[] m_row;
+		m_row = NULL;
+		m_row = new char[m_LongestLine];
+	}
+
+	if (status != IS_DONE)
+		return status;
+	return nextBlock ? IS_NOT_ENOUGH_MEMORY : IS_DONE;
+}
+
+//Returns: number of columns with non-default values.
+size_t ConvertToZDW::writeLookupColumnStats(CompressedOutput* out, const size_t numColumns)
+{
+	const char offsetSize = static_cast<char>(this->uniques.getBytesInOffset());
+
+	ULONGLONG *usedColumnMin = new ULONGLONG[numColumns];
+
+	//Determine size of columns in this block.  If column is empty, mark it unused.
+	size_t numColumnsUsed = 0;
+	ULONGLONG val;
+	for (size_t c = 0; c < numColumns; ++c)
+	{
+		if (!minmaxset[c])
+		{
+			//column empty everywhere
+			columnSize[c] = 0;
+//			statusOutput(INFO, "%s not used\n", m_DWColumns[c].c_str());
+			continue;
+		}
+
+		switch (m_ColumnType[c])
+		{
+			default: assert(!"Unrecognized type"); break;
+			case VARCHAR:
+			case TEXT:
+			case TINYTEXT:
+			case MEDIUMTEXT:
+			case LONGTEXT:
+			case DATETIME:
+			case CHAR_2:
+			case DECIMAL:
+				columnSize[c] = offsetSize;
+				columnMin[c] = 0;
+				break;
+			case CHAR:
+			case TINY: case TINY_SIGNED:
+			case SHORT: case SHORT_SIGNED:
+			case LONG: case LONG_SIGNED:
+			case LONGLONG: case LONGLONG_SIGNED:
+				--columnMin[c];
+
+				//Determine # of bytes required to store this value.
+				val = columnMax[c] - columnMin[c];
+				columnSize[c] = 1;
+				while (val >= 256)
+				{
+					++columnSize[c];
+					val /= 256;
+				}
+				break;
+		}
+
+//		statusOutput(INFO, "%s type %d stored in %d bytes\n", m_DWColumns[c].c_str(), (int)m_ColumnType[c], columnSize[c]);
+		usedColumn[numColumnsUsed] = c;
+		usedColumnMin[numColumnsUsed] = columnMin[c];
+		++numColumnsUsed;
+	}
+
+	//Write byte size required for each column index.
+	out->write(columnSize, numColumns);
+
+	//Write minimum value of each column index.
+	assert(sizeof(ULONGLONG) == 8);
+	out->write(usedColumnMin, 8 * numColumnsUsed);
+	delete[] usedColumnMin;
+
+	return numColumnsUsed;
+}
+
+//Outputs an encoded row, whose values are in columnStoredVal[r].
+void ConvertToZDW::writeRow(
+	CompressedOutput* out,
+	const size_t numColumnsUsed,
+	const size_t r, //(in) index of the current row's values in columnStoredVal (the previous row's are in the other)
+	const ULONG rowNum, //(in) row's position in the block
+	const bool bKeyframe, //(in) if set, every column's value is written, regardless of the previous row's
+	char unsigned* setColumns, const size_t numSetColumnBytes, //(in) buffer for the column bitmap
+	char* rowIndexOut) //(in) buffer for the row's changed values
+{
+	size_t c, u;
+	int j;
+	UCHAR b; //for bit packing
+	ULONG p = 0;
+
+	if (this->bColumnar) {
+		appendColumnarRow(numColumnsUsed, r, rowNum);
+		return;
+	}
+
+	memset(setColumns, 0, numSetColumnBytes);
+
+	for (u = 0; u < numColumnsUsed; u++)
+	{
+		c = usedColumn[u];
+		if (bKeyframe || columnStoredVal[0][c].n != columnStoredVal[1][c].n)
 		{
-			if (!this->rowColumns[c][0])
-				continue; //skip empty values
+			const storageBytes& storedVal = this->columnStoredVal[r][c];
+			b = 1u << (u % 8);
+			setColumns[u / 8] |= b;
+			for (j = 0; j < columnSize[c]; j++)
+			{
+				rowIndexOut[p++] = storedVal.c[j];
+			}
+		}
+	}
 
+	//Output encoded row.
+	//A row is encoded as:
+	//1. A set of bits, one per column, representing which column values were the same
+	//   as those of the previous row.
+	//2. A series of indices into the lookup tables for columns whose values were
+	//   not the same as those in the previous row.
+//	buffer.write(setColumns, numSetColumnBytes);
+//	buffer.write(rowIndexOut, p);
+	out->write(setColumns, numSetColumnBytes);
+	out->write(rowIndexOut, p);
+}
+
+//Columnar mode: reserves room against the memory limit for the column segments of a block's rows, a little at a time,
+//as they are gathered in memory by the second pass (see writeColumnSegments).
+//
+//Returns: the number of the block's rows, up to numRows, whose column segments fit within the memory limit
+ULONG ConvertToZDW::reserveColumnSegments(const ULONG numRows)
+{
+	const ULONG reserveRows = COLUMN_SEGMENT_RESERVE_SIZE > this->columnSegmentRowSize ?
+			static_cast<ULONG>(COLUMN_SEGMENT_RESERVE_SIZE / this->columnSegmentRowSize) : 1;
+	while (this->numColumnSegmentRowsReserved < numRows)
+	{
+		const long long unsigned bytes = static_cast<long long unsigned>(reserveRows) * this->columnSegmentRowSize;
+		if (!Memory::CanAllocateMemory(bytes))
+			return this->numColumnSegmentRowsReserved;
+		Memory::add_untracked_bytes(-static_cast<long long>(bytes)); //counted until released by the second pass
+		this->numColumnSegmentRowsReserved += reserveRows;
+	}
+	return numRows;
+}
+
+//Columnar mode: returns the memory reserved for the column segments of the block's rows.
+void ConvertToZDW::releaseColumnSegments()
+{
+	Memory::add_untracked_bytes(static_cast<long long>(this->numColumnSegmentRowsReserved) * this->columnSegmentRowSize);
+	this->numColumnSegmentRowsReserved = 0;
+}
+
+//Columnar mode: appends a row's values, in columnStoredVal[r], to the segments of the used columns.
+void ConvertToZDW::appendColumnarRow(const size_t numColumnsUsed, const size_t r, const ULONG rowNum)
+{
+	const size_t byte = rowNum / 8;
+	const UCHAR bit = 1u << (rowNum % 8);
+	for (size_t u = 0; u < numColumnsUsed; ++u)
+	{
+		const size_t c = usedColumn[u];
+		if (columnStoredVal[0][c].n != columnStoredVal[1][c].n)
+		{
+			this->columnBits[u][byte] |= bit;
+			this->columnValues[u].append(this->columnStoredVal[r][c].c, columnSize[c]);
+		}
+	}
+}
+
+//Columnar mode: outputs the block's column segments, preceded by their lengths.
+void ConvertToZDW::writeColumnSegments(CompressedOutput* out, const size_t numColumnsUsed)
+{
+	size_t u;
+	for (u = 0; u < numColumnsUsed; ++u)
+	{
+		const ULONGLONG length = this->columnBits[u].size() + this->columnValues[u].size();
+		out->write(&length, 8);
+	}
+	for (u = 0; u < numColumnsUsed; ++u)
+	{
+		if (!this->columnBits[u].empty())
+			out->write(&this->columnBits[u][0], this->columnBits[u].size());
+		out->write(this->columnValues[u].data(), this->columnValues[u].size());
+	}
+
+	this->columnBits.clear();
+	this->columnValues.clear();
+}
+
+//Returns: the number of rows outputted.
+ULONG ConvertToZDW::writeBlockRows(
+	FILE* in, CompressedOutput* out,
+	const size_t numColumns, const size_t numColumnsUsed)
+{
+	size_t k, u, c, r = 1;
+
+	assert(in);
+	assert(out);
+
+	char *rowIndexOut = new char[numColumnsUsed * 8];
+//	BufferedOutput buffer(out); //commented out -- not needed when writing to a pipe
+
+	const size_t numSetColumnBytes = static_cast<size_t>(ceil(numColumnsUsed / 8.0));
+	unsigned char *setColumns = new unsigned char[numSetColumnBytes];
+
+	//Use default values of 0 for the previous row check.
+	for (k = 0; k < numColumns; ++k)
+		this->columnStoredVal[0][k].n = 0;
+
+	ZoneMapBuilder *zoneMaps = this->bBlockIndex ? &this->zoneMaps : NULL;
+
+	//Each iteration writes out one row for this block.
+	ULONG cnt = 0;
+	while (cnt < this->numRows && GetDataRow(in, m_row, this->rowColumns) > 0)
+	{
+		for (u = 0; u < numColumnsUsed; u++)
+		{
+			c = usedColumn[u];
+			storageBytes& storedVal = this->columnStoredVal[r][c];
 			switch (m_ColumnType[c])
 			{
-				case DECIMAL:
 				case VARCHAR:
 				case TEXT:
 				case TINYTEXT:
@@ -350,92 +1156,123 @@ ConvertToZDW::INPUT_STATUS ConvertToZDW::parseInput(FILE* in)
 				case LONGTEXT:
 				case DATETIME:
 				case CHAR_2:
-					minmaxset[c] = 1;
-					hadEnoughMemory = this->uniques.insert(this->rowColumns[c]);
-				break;
+				case DECIMAL:
+					if (this->rowColumns[c].len) {
+						const DictionaryEntry *entry = this->uniques.getEntry(this->rowColumns[c].str, this->rowColumns[c].len);
+						storedVal.n = entry->offset; // - columnMin[c]; -- now hardcoded to 0
+						if (zoneMaps)
+							zoneMaps->add(c, entry);
+					} else
+						storedVal.n = 0;
+					break;
 				case CHAR:
-				{
-					ULONGLONG& val = columnVal[c];
-					val = this->rowColumns[c][0];
-					if (this->rowColumns[c][0] == '\\') //include escaped chars verbatim
-						val += (this->rowColumns[c][1] * 256);
-					if (val > 0)
-					{
-						if (minmaxset[c])
-						{
-							if (val > columnMax[c])
-								columnMax[c] = val;
-							else if (val < columnMin[c])
-								columnMin[c] = val;
-						} else {
-							columnMax[c] = columnMin[c] = val;
-							minmaxset[c] = 1;
-						}
-					}
-				}
-				break;
+					storedVal.n = char_field_value(this->rowColumns[c]);
+					if (zoneMaps)
+						zoneMaps->add(c, storedVal.n);
+					if (storedVal.n)
+						storedVal.n -= columnMin[c];
+					break;
 				case TINY: case TINY_SIGNED:
 				case SHORT: case SHORT_SIGNED:
 				case LONG: case LONG_SIGNED:
 				case LONGLONG: case LONGLONG_SIGNED:
-				{
-					//Signed values can be considered as unsigned values
-					//when gathering the range (though it is technically inaccurate).
-					ULONGLONG& val = columnVal[c];
-					val = strtoull(this->rowColumns[c], NULL, 10);
-					if (val > 0)
-					{
-						if (minmaxset[c])
-						{
-							if (val > columnMax[c])
-								columnMax[c] = val;
-							else if (val < columnMin[c])
-								columnMin[c] = val;
-						} else {
-							columnMax[c] = columnMin[c] = val;
-							minmaxset[c] = 1;
-						}
-					}
-				}
-				break;
-				default: assert(!"Unrecognized column type"); break;
+					//Signed values can be stored as unsigned values
+					//as long as we flag to unpack them correctly.
+					storedVal.n = this->rowColumns[c].len ? parse_unsigned(this->rowColumns[c]) : 0;
+					if (zoneMaps)
+						zoneMaps->add(c, storedVal.n);
+					if (storedVal.n > 0)
+						storedVal.n -= columnMin[c];
+					break;
 			}
 		}
-		if (hadEnoughMemory)
+
+		//A keyframe row includes every column's value, so reading can begin at it.
+		const bool bKeyframe = this->keyframeInterval && cnt && !(cnt % this->keyframeInterval);
+		if (bKeyframe)
+			this->keyframeOffsets.push_back(out->tell());
+		writeRow(out, numColumnsUsed, r, cnt, bKeyframe, setColumns, numSetColumnBytes, rowIndexOut);
+
+		//Toggle to track field values that match those of the previous row.
+		r = (r ? 0 : 1);
+
+		cnt++;
+		if (!(cnt % 10000) && !this->bQuiet)
 		{
-			++this->numRows;
-			if (!(this->numRows % 10000) && !this->bQuiet)
-			{
-				statusOutput(INFO, "\r%u rows", this->numRows);
-			}
+			statusOutput(INFO, "\r%u", cnt);
 		}
 	}
-	return hadEnoughMemory ? IS_DONE : IS_NOT_ENOUGH_MEMORY;
+
+	//Clean up.
+	delete[] rowIndexOut;
+	delete[] setColumns;
+
+	return cnt;
 }
 
-//Returns: number of columns with non-default values.
-size_t ConvertToZDW::writeLookupColumnStats(FILE* out, const size_t numColumns)
-{
-	const char offsetSize = static_cast<char>(this->uniques.getBytesInOffset());
+//Variant of writeBlockRows that encodes the rows cached during the first pass (in single-pass mode).
+//
+//Returns: the number of rows outputted.
+ULONG ConvertToZDW::writeCachedBlockRows(CompressedOutput* out, const size_t numColumnsUsed)
+{
+	size_t u, r = 1;
+
+	assert(out);
+
+	char *rowIndexOut = new char[numColumnsUsed * 8];
+
+	const size_t numSetColumnBytes = static_cast<size_t>(ceil(numColumnsUsed / 8.0));
+	unsigned char *setColumns = new unsigned char[numSetColumnBytes];
 
-	ULONGLONG *usedColumnMin = new ULONGLONG[numColumns];
+	//Use default values of 0 for the previous row check.
+	for (u = 0; u < numColumnsUsed; ++u)
+		this->columnStoredVal[0][usedColumn[u]].n = 0;
 
-	//Determine size of columns in this block.  If column is empty, mark it unused.
-	size_t numColumnsUsed = 0;
-	ULONGLONG val;
-	for (size_t c = 0; c < numColumns; ++c)
+	ZoneMapBuilder *zoneMaps = this->bBlockIndex ? &this->zoneMaps : NULL;
+
+	//Each iteration writes out one row for this block.
+	ULONG cnt = 0;
+	RowCache::Reader reader(this->rowCache);
+	while (cnt < this->numRows && reader.next())
 	{
-		if (!minmaxset[c])
+		storeRowValues(reader.values(), numColumnsUsed, r, zoneMaps);
+
+		//A keyframe row includes every column's value, so reading can begin at it.
+		const bool bKeyframe = this->keyframeInterval && cnt && !(cnt % this->keyframeInterval);
+		if (bKeyframe)
+			this->keyframeOffsets.push_back(out->tell());
+		writeRow(out, numColumnsUsed, r, cnt, bKeyframe, setColumns, numSetColumnBytes, rowIndexOut);
+
+		//Toggle to track field values that match those of the previous row.
+		r = (r ? 0 : 1);
+
+		cnt++;
+		if (!(cnt % 10000) && !this->bQuiet)
 		{
-			//column empty everywhere
-			columnSize[c] = 0;
-//			statusOutput(INFO, "%s not used\n", m_DWColumns[c].c_str());
-			continue;
+			statusOutput(INFO, "\r%u", cnt);
 		}
+	}
+
+	//Clean up.
+	delete[] rowIndexOut;
+	delete[] setColumns;
 
+	return cnt;
+}
+
+//Sets the stored values of a row's used columns, in columnStoredVal[r], from the row's parsed values.
+void ConvertToZDW::storeRowValues(
+	const RowValue* values, //(in) the parsed value of each column
+	const size_t numColumnsUsed,
+	const size_t r,
+	ZoneMapBuilder* zoneMaps) //(in/out) if not NULL, gathers the block's column values
+{
+	for (size_t u = 0; u < numColumnsUsed; u++)
+	{
+		const size_t c = usedColumn[u];
+		storageBytes& storedVal = this->columnStoredVal[r][c];
 		switch (m_ColumnType[c])
 		{
-			default: assert(!"Unrecognized type"); break;
 			case VARCHAR:
 			case TEXT:
 			case TINYTEXT:
@@ -444,77 +1281,116 @@ size_t ConvertToZDW::writeLookupColumnStats(FILE* out, const size_t numColumns)
 			case DATETIME:
 			case CHAR_2:
 			case DECIMAL:
-				columnSize[c] = offsetSize;
-				columnMin[c] = 0;
+				//dictionary offsets were assigned when the dictionary was written
+				storedVal.n = values[c].entry ? values[c].entry->offset : 0;
+				if (zoneMaps)
+					zoneMaps->add(c, values[c].entry);
 				break;
 			case CHAR:
 			case TINY: case TINY_SIGNED:
 			case SHORT: case SHORT_SIGNED:
 			case LONG: case LONG_SIGNED:
 			case LONGLONG: case LONGLONG_SIGNED:
-				--columnMin[c];
-
-				//Determine # of bytes required to store this value.
-				val = columnMax[c] - columnMin[c];
-				columnSize[c] = 1;
-				while (val >= 256)
-				{
-					++columnSize[c];
-					val /= 256;
-				}
+				storedVal.n = values[c].n;
+				if (zoneMaps)
+					zoneMaps->add(c, storedVal.n);
+				if (storedVal.n > 0)
+					storedVal.n -= columnMin[c];
 				break;
 		}
-
-//		statusOutput(INFO, "%s type %d stored in %d bytes\n", m_DWColumns[c].c_str(), (int)m_ColumnType[c], columnSize[c]);
-		usedColumn[numColumnsUsed] = c;
-		usedColumnMin[numColumnsUsed] = columnMin[c];
-		++numColumnsUsed;
 	}
-
-	//Write byte size required for each column index.
-	fwrite(columnSize, 1, numColumns, out);
-
-	//Write minimum value of each column index.
-	assert(sizeof(ULONGLONG) == 8);
-	fwrite(usedColumnMin, 8, numColumnsUsed, out);
-	delete[] usedColumnMin;
-
-	return numColumnsUsed;
 }
 
-//Returns: the number of rows outputted.
-ULONG ConvertToZDW::writeBlockRows(
-	FILE* in, FILE* out,
-	const size_t numColumns, const size_t numColumnsUsed)
+//Rows of the second pass, split into columns and looked up in the block's dictionary by a worker thread.
+struct ConvertToZDW::RowBatch
 {
-	size_t k, u, c, r = 1;
-	int j;
-	UCHAR b; //for bit packing
-
-	assert(in);
-	assert(out);
+	RowBatch() : numRows(0), bDone(false) { }
+
+	string text;              //copies of rows read from a stream (mapped rows are used in place)
+	vector<TextSpan> rows;    //each row's text, excluding its newline
+	vector<TextSpan> rowColumns;
+	vector<RowValue> values;  //the parsed value of each column of each row
+	ULONG numRows;
+	bool bDone; //set once the rows are parsed
+};
 
-	char *rowIndexOut = new char[numColumnsUsed * 8];
-//	BufferedOutput buffer(out); //commented out -- not needed when writing to a pipe
+struct ConvertToZDW::RowBatchQueue
+{
+	RowBatchQueue(const ConvertToZDW* convert)
+		: convert(convert)
+		, bClosed(false)
+	{
+		pthread_mutex_init(&this->mutex, NULL);
+		pthread_cond_init(&this->batchReady, NULL);
+		pthread_cond_init(&this->batchDone, NULL);
+	}
+	~RowBatchQueue()
+	{
+		pthread_cond_destroy(&this->batchDone);
+		pthread_cond_destroy(&this->batchReady);
+		pthread_mutex_destroy(&this->mutex);
+	}
 
-	const size_t numSetColumnBytes = static_cast<size_t>(ceil(numColumnsUsed / 8.0));
-	unsigned char *setColumns = new unsigned char[numSetColumnBytes];
+	const ConvertToZDW* convert;
+	std::deque<RowBatch*> batches;
+	bool bClosed; //set when no more batches are coming
+	pthread_mutex_t mutex;
+	pthread_cond_t batchReady, batchDone;
+};
 
-	//Use default values of 0 for the previous row check.
-	for (k = 0; k < numColumns; ++k)
-		this->columnStoredVal[0][k].n = 0;
+//Reads up to maxRows rows of the block for the second pass.
+//
+//Returns: the number of rows read
+ULONG ConvertToZDW::readRowBatch(FILE* in, RowBatch& batch, const ULONG maxRows)
+{
+	const bool bMapped = this->mappedInput.is_open();
+	batch.text.clear();
+	batch.rows.clear();
+	while (batch.rows.size() < maxRows)
+	{
+		TextSpan row;
+		if (bMapped)
+		{
+			row.str = this->mappedInput.getNextRow(row.len, m_LongestLine);
+			if (!row.str || !row.len)
+				break;
+		} else {
+			const size_t len = GetNextRow(in, m_row, m_LongestLine);
+			if (!len)
+				break;
+			row.str = NULL; //set below, once the batch's text is no longer growing
+			row.len = len - 1; //exclude the truncated newline
+			batch.text.append(m_row, row.len);
+		}
+		batch.rows.push_back(row);
+	}
+	if (!bMapped)
+	{
+		const char *str = batch.text.data();
+		for (size_t i = 0; i < batch.rows.size(); ++i)
+		{
+			batch.rows[i].str = str;
+			str += batch.rows[i].len;
+		}
+	}
+	batch.numRows = batch.rows.size();
+	return batch.numRows;
+}
 
-	//Each iteration writes out one row for this block.
-	ULONG cnt = 0;
-	while (cnt < this->numRows && GetDataRow(in, m_row, this->rowColumns) > 0)
+//Parses the value of each column of the batch's rows, as addRowValues does for the row cache.
+void ConvertToZDW::tokenizeRowBatch(RowBatch& batch) const
+{
+	const size_t numColumns = m_ColumnType.size();
+	batch.values.resize(batch.numRows * numColumns);
+	for (ULONG i = 0; i < batch.numRows; ++i)
 	{
-		ULONG p = 0;
-		memset(setColumns, 0, numSetColumnBytes);
+		SplitRowIntoColumns(batch.rows[i].str, batch.rows[i].len, batch.rowColumns, this->bTrimTrailingSpaces);
+		batch.rowColumns.resize(numColumns); //the first pass checked the number of columns
 
-		for (u = 0; u < numColumnsUsed; u++)
+		RowValue *values = &batch.values[i * numColumns];
+		for (size_t c = 0; c < numColumns; ++c)
 		{
-			c = usedColumn[u];
-			storageBytes& storedVal = this->columnStoredVal[r][c];
+			const TextSpan& field = batch.rowColumns[c];
 			switch (m_ColumnType[c])
 			{
 				case VARCHAR:
@@ -525,77 +1401,150 @@ ULONG ConvertToZDW::writeBlockRows(
 				case DATETIME:
 				case CHAR_2:
 				case DECIMAL:
-					if (this->rowColumns[c][0])
-						storedVal.n = this->uniques.getOffset(this->rowColumns[c]); // - columnMin[c]; -- now hardcoded to 0
-					else
-						storedVal.n = 0;
-					if (columnStoredVal[0][c].n != columnStoredVal[1][c].n)
-					{
-						b = 1u << (u % 8);
-						setColumns[u / 8] |= b;
-						for (j = 0; j < columnSize[c]; j++)
-						{
-							rowIndexOut[p++] = storedVal.c[j];
-						}
-					}
+					values[c].entry = field.len ? this->uniques.getEntry(field.str, field.len) : NULL;
 					break;
 				case CHAR:
-					storedVal.n = this->rowColumns[c][0];
-					if (storedVal.n) {
-						storedVal.n += this->rowColumns[c][1] * 256; //will either be NULL or an escaped char
-						storedVal.n -= columnMin[c];
-					}
-					if (columnStoredVal[0][c].n != columnStoredVal[1][c].n)
-					{
-						b = 1u << (u % 8);
-						setColumns[u / 8] |= b;
-						for (j = 0; j < columnSize[c]; j++)
-						{
-							rowIndexOut[p++] = storedVal.c[j];
-						}
-					}
+					values[c].n = char_field_value(field);
 					break;
 				case TINY: case TINY_SIGNED:
 				case SHORT: case SHORT_SIGNED:
 				case LONG: case LONG_SIGNED:
 				case LONGLONG: case LONGLONG_SIGNED:
-					//Signed values can be stored as unsigned values
-					//as long as we flag to unpack them correctly.
-					storedVal.n = strtoull(this->rowColumns[c], NULL, 10);
-					if (storedVal.n > 0)
-						storedVal.n -= columnMin[c];
-					if (columnStoredVal[0][c].n != columnStoredVal[1][c].n)
-					{
-						b = 1u << (u % 8);
-						setColumns[u / 8] |= b;
-						for (j = 0; j < columnSize[c]; j++)
-						{
-							rowIndexOut[p++] = storedVal.c[j];
-						}
-					}
+					values[c].n = field.len ? parse_unsigned(field) : 0;
 					break;
+				default: assert(!"Unrecognized column type"); break;
 			}
 		}
+	}
+}
 
-		//Output encoded row.
-		//A row is encoded as:
-		//1. A set of bits, one per column, representing which column values were the same
-		//   as those of the previous row.
-		//2. A series of indices into the lookup tables for columns whose values were
-		//   not the same as those in the previous row.
-//		buffer.write(setColumns, numSetColumnBytes);
-//		buffer.write(rowIndexOut, p);
-		fwrite(setColumns, numSetColumnBytes, 1, out);
-		fwrite(rowIndexOut, p, 1, out);
+void* ConvertToZDW::tokenizeRowBatchesThread(void* arg)
+{
+	RowBatchQueue& queue = *static_cast<RowBatchQueue*>(arg);
+	pthread_mutex_lock(&queue.mutex);
+	for (;;)
+	{
+		while (queue.batches.empty() && !queue.bClosed)
+			pthread_cond_wait(&queue.batchReady, &queue.mutex);
+		if (queue.batches.empty())
+			break;
+		RowBatch *batch = queue.batches.front();
+		queue.batches.pop_front();
+		pthread_mutex_unlock(&queue.mutex);
 
-		//Toggle to track field values that match those of the previous row.
-		r = (r ? 0 : 1);
+		queue.convert->tokenizeRowBatch(*batch);
 
-		cnt++;
-		if (!(cnt % 10000) && !this->bQuiet)
+		pthread_mutex_lock(&queue.mutex);
+		batch->bDone = true;
+		pthread_cond_broadcast(&queue.batchDone);
+	}
+	pthread_mutex_unlock(&queue.mutex);
+	return NULL;
+}
+
+//Multithreaded variant of writeBlockRows.
+//This thread reads the block's rows in batches, which are split into columns and looked up in the
+//block's dictionary on numThreads threads, then encodes the parsed batches in order.
+//A window of 2 * numThreads batches bounds the rows held in memory.
+//
+//Returns: the number of rows outputted.
+ULONG ConvertToZDW::writeBlockRowsParallel(FILE* in, CompressedOutput* out, const size_t numColumnsUsed)
+{
+	size_t u, r = 1;
+
+	assert(out);
+
+	const size_t numColumns = m_ColumnType.size();
+	char *rowIndexOut = new char[numColumnsUsed * 8];
+
+	const size_t numSetColumnBytes = static_cast<size_t>(ceil(numColumnsUsed / 8.0));
+	unsigned char *setColumns = new unsigned char[numSetColumnBytes];
+
+	//Use default values of 0 for the previous row check.
+	for (u = 0; u < numColumnsUsed; ++u)
+		this->columnStoredVal[0][usedColumn[u]].n = 0;
+
+	ZoneMapBuilder *zoneMaps = this->bBlockIndex ? &this->zoneMaps : NULL;
+
+	const size_t window = 2 * this->numThreads;
+	vector<RowBatch> batches(window);
+	RowBatchQueue queue(this);
+	vector<pthread_t> threads(this->numThreads);
+	int numStarted = 0;
+	{
+		UntrackedMemoryScope memory; //thread stacks don't count against the memory limit
+		while (numStarted < this->numThreads &&
+				!pthread_create(&threads[numStarted], NULL, tokenizeRowBatchesThread, &queue))
+			++numStarted;
+	}
+
+	//Each iteration refills the window with batches of rows, then writes out the oldest batch.
+	ULONG cnt = 0, numRead = 0;
+	size_t numQueued = 0, numWritten = 0; //batches
+	bool bInputDone = false;
+	for (;;)
+	{
+		while (!bInputDone && numQueued - numWritten < window)
 		{
-			statusOutput(INFO, "\r%u", cnt);
+			RowBatch& batch = batches[numQueued % window];
+			const ULONG n = readRowBatch(in, batch, std::min(ROW_BATCH_SIZE, this->numRows - numRead));
+			if (!n) {
+				bInputDone = true;
+				break;
+			}
+			numRead += n;
+
+			if (numStarted) {
+				pthread_mutex_lock(&queue.mutex);
+				queue.batches.push_back(&batch);
+				pthread_cond_signal(&queue.batchReady);
+				pthread_mutex_unlock(&queue.mutex);
+			} else {
+				tokenizeRowBatch(batch);
+				batch.bDone = true;
+			}
+			++numQueued;
+		}
+		if (numWritten == numQueued)
+			break;
+
+		RowBatch& batch = batches[numWritten % window];
+		pthread_mutex_lock(&queue.mutex);
+		while (!batch.bDone)
+			pthread_cond_wait(&queue.batchDone, &queue.mutex);
+		batch.bDone = false;
+		pthread_mutex_unlock(&queue.mutex);
+
+		for (ULONG i = 0; i < batch.numRows; ++i)
+		{
+			storeRowValues(&batch.values[i * numColumns], numColumnsUsed, r, zoneMaps);
+
+			//A keyframe row includes every column's value, so reading can begin at it.
+			const bool bKeyframe = this->keyframeInterval && cnt && !(cnt % this->keyframeInterval);
+			if (bKeyframe)
+				this->keyframeOffsets.push_back(out->tell());
+			writeRow(out, numColumnsUsed, r, cnt, bKeyframe, setColumns, numSetColumnBytes, rowIndexOut);
+
+			//Toggle to track field values that match those of the previous row.
+			r = (r ? 0 : 1);
+
+			cnt++;
+			if (!(cnt % 10000) && !this->bQuiet)
+			{
+				statusOutput(INFO, "\r%u", cnt);
+			}
 		}
+		++numWritten;
+	}
+
+	pthread_mutex_lock(&queue.mutex);
+	queue.bClosed = true;
+	pthread_cond_broadcast(&queue.batchReady);
+	pthread_mutex_unlock(&queue.mutex);
+	{
+		UntrackedMemoryScope memory;
+		for (int t = 0; t < numStarted; ++t)
+			pthread_join(threads[t], NULL);
 	}
 
 	//Clean up.
@@ -605,6 +1554,63 @@ ULONG ConvertToZDW::writeBlockRows(
 	return cnt;
 }
 
+//Opens the ZDW output file, compressing in-process when the compressor is built in.
+//Otherwise, or when zArgs can't be mapped onto the codec's settings, output is piped to the compression command.
+//Uncompressed output (NONE) takes no zArgs.
+//
+//Returns: NULL if the output couldn't be opened
+CompressedOutput* ConvertToZDW::openCompressedOutput(const string& filename, const char* zArgs)
+{
+	CompressedOutput *out = NULL;
+	switch (compressor)
+	{
+		case GZIP: out = CompressedOutput::open(CompressedOutput::GZIP, filename.c_str(), zArgs, this->numThreads); break;
+		case BZIP2: out = CompressedOutput::open(CompressedOutput::BZIP2, filename.c_str(), zArgs, this->numThreads); break;
+		case XZ: out = CompressedOutput::open(CompressedOutput::XZ, filename.c_str(), zArgs, this->numThreads); break;
+		case ZSTD: out = CompressedOutput::open(CompressedOutput::ZSTD, filename.c_str(), zArgs, this->numThreads); break;
+		case NONE:
+			out = CompressedOutput::open(CompressedOutput::NONE, filename.c_str());
+			if (!out)
+				statusOutput(ERROR, "Could not create the file '%s'!\n", filename.c_str());
+			return out;
+		default: break; //no native codec
+	}
+	if (out)
+		return out;
+
+	string cmd = getCompressionCommand();
+	if (zArgs) {
+		cmd += " ";
+		cmd += zArgs;
+	}
+	cmd += " > ";
+	cmd += filename;
+	out = CompressedOutput::openCommand(cmd.c_str());
+	if (!out)
+		statusOutput(ERROR, "Could not open the process '%s' for writing!\n", cmd.c_str());
+	return out;
+}
+
+//Version 12+: Write the index of the blocks written (see block_index.h).
+void ConvertToZDW::writeBlockIndex(CompressedOutput* out) const
+{
+	const ULONGLONG indexBegin = out->tell();
+	string entry;
+	for (vector<BlockIndexEntry>::const_iterator it = this->blockIndexEntries.begin();
+			it != this->blockIndexEntries.end(); ++it)
+	{
+		entry.clear();
+		AppendBlockIndexEntry(*it, &m_ColumnType[0], entry);
+		out->write(entry.data(), entry.size());
+	}
+
+	const ULONG numBlocks = this->blockIndexEntries.size();
+	const ULONGLONG indexSize = out->tell() - indexBegin + BLOCK_INDEX_TAIL_SIZE;
+	out->write(&numBlocks, 4);
+	out->write(&indexSize, 8);
+	out->write(BLOCK_INDEX_MAGIC, 4);
+}
+
 //Returns: whether file was completely processed successfully
 ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 	FILE* f_in,              //(in) input file handle -- may be stdin or a file on disk
@@ -644,7 +1650,7 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 
 	const string outfile_basepath = zdwFile;
 
-	//The ZDW file will be named "<outputDir><basefilename>.zdw.[xz|gz|bz2|etc]"
+	//The ZDW file will be named "<outputDir><basefilename>.zdw[.xz|.gz|.bz2|etc]"
 	zdwFile += ".zdw";
 	zdwFile += getExtensionForCompressor();
 
@@ -656,22 +1662,12 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 	temp_outfile_name += ".zdw";
 	temp_outfile_name += getExtensionForCompressor();
 
-	string cmd = getCompressionCommand();
-	if (zArgs) {
-		cmd += " ";
-		cmd += zArgs;
-	}
-	cmd += " > ";
-	cmd += temp_outfile_name;
-	FILE *out = popen(cmd.c_str(), "w");
+	CompressedOutput *out = openCompressedOutput(temp_outfile_name, zArgs);
 	if (!out)
-	{
-		statusOutput(ERROR, "Could not open the process '%s' for writing!\n", cmd.c_str());
 		return FILE_CREATION_ERR;
-	}
 
 	//Write version #.
-	fwrite(&m_Version, 1, 2, out);
+	out->write(&m_Version, 2);
 
 	//Write metadata block.
 	{
@@ -682,14 +1678,14 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 			metadata_length += it->second.length();
 			metadata_length += 2; //two null terminators
 		}
-		fwrite(&metadata_length, 1, 4, out);
+		out->write(&metadata_length, 4);
 
 		for (it = metadata.begin(); it != metadata.end(); ++it) {
 			const string &key = it->first, &value = it->second;
-			fwrite(key.c_str(), 1, key.length(), out);
-			fputc('\0', out);
-			fwrite(value.c_str(), 1, value.length(), out);
-			fputc('\0', out);
+			out->write(key.c_str(), key.length());
+			out->put('\0');
+			out->write(value.c_str(), value.length());
+			out->put('\0');
 		}
 	}
 
@@ -711,7 +1707,7 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 				n += m_DWColumns[c].length() + 1; //skip over null char
 			}
 			line[n++] = 0;
-			fwrite(line, 1, n, out);
+			out->write(line, n);
 			delete[] line;
 		}
 
@@ -721,7 +1717,7 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 			for (int unsigned k = 0; k < numColumns; ++k)
 				temp[k] = m_ColumnType[k];
 			assert(sizeof(char unsigned) == 1);
-			fwrite(temp, 1, numColumns, out);
+			out->write(temp, numColumns);
 			delete[] temp;
 		}
 
@@ -731,11 +1727,15 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 			short unsigned *temp = new USHORT[numColumns];
 			for (int unsigned k = 0; k < numColumns; ++k)
 				temp[k] = static_cast<USHORT>(this->columnCharSize[k]);
-			fwrite(temp, 2, numColumns, out);
+			out->write(temp, 2 * numColumns);
 			delete[] temp;
 		}
 	}
 
+	//The rows of each block are encoded while the previous ones are compressed.
+	if (this->numThreads > 1)
+		out->startThread();
+
 	//Each iteration generates a block of information.
 	//A block contains:
 	//1.  Header info.
@@ -762,10 +1762,12 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 	}
 
 	ULONGLONG total_rows = 0;
+	this->blockIndexEntries.clear();
 	do
 	{
 		INPUT_STATUS inputStatus;
 		fpos_t fbegin;
+		const char *mappedBegin = NULL;
 		string tmp_filename;
 
 		++blocks;
@@ -783,39 +1785,54 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 		this->numRows = 0;
 		memset(minmaxset, 0, numColumns);
 
-		if (this->bStreamingInput) {
+		if (this->bStreamingInput && (!this->bSinglePass || bValidate)) {
 			//Open a temp file in the output dir in order to store
-			//the data being streamed in for the second read pass.
-			assert(!this->tmp_fp);
+			//the data being streamed in for the second read pass (or, in single-pass mode, for validation).
+			assert(!this->tmp_out);
 			std::ostringstream str;
 			str << outfile_basepath << ".tmp." << file_pieces << ".gz";
 			tmp_filename = str.str();
-			string cmd = "gzip > "; //compress the data to reduce disk writes
-			cmd += tmp_filename;
-			this->tmp_fp = popen(cmd.c_str(), "w");
-			if (!this->tmp_fp) {
+			this->tmp_out = CompressedOutput::open(CompressedOutput::GZIP, tmp_filename.c_str()); //compress the data to reduce disk writes
+			if (!this->tmp_out) {
+				string cmd = "gzip > ";
+				cmd += tmp_filename;
+				this->tmp_out = CompressedOutput::openCommand(cmd.c_str());
+			}
+			if (!this->tmp_out) {
 				res = CANT_OPEN_TEMP_FILE;
 				goto Done;
 			}
-		} else {
+		} else if (!this->bStreamingInput && !this->bSinglePass) {
 			//mark current spot in input file -- we will rewind to here for the second pass
-			fgetpos(f_in, &fbegin);
+			if (this->mappedInput.is_open())
+				mappedBegin = this->mappedInput.tell();
+			else
+				fgetpos(f_in, &fbegin);
 		}
 
-		inputStatus = parseInput(f_in);
+		if (this->numThreads > 1 && !this->bStreamingInput)
+			inputStatus = parseInputParallel(f_in);
+		else
+			inputStatus = parseInput(f_in);
 		switch (inputStatus)
 		{
 			case IS_DONE: hadEnoughMemory = true; break;
 			case IS_NOT_ENOUGH_MEMORY: hadEnoughMemory = false; break;
 			case IS_WRONG_NUM_OF_COLUMNS_ON_A_ROW:
 				statusOutput(ERROR, "\nRow %u had the problem\n", this->numRows + 1); //one past the last good row
-				return WRONG_NUM_OF_COLUMNS_ON_A_ROW;
+				res = WRONG_NUM_OF_COLUMNS_ON_A_ROW;
+				goto Done;
 		}
-		if (this->bStreamingInput) {
+		if (this->tmp_out) {
 			//We are now done writing to the temp file.
-			assert(this->tmp_fp);
-			pclose(this->tmp_fp);
-			this->tmp_fp = NULL;
+			const bool bWritten = this->tmp_out->close();
+			delete this->tmp_out;
+			this->tmp_out = NULL;
+			if (!bWritten) {
+				statusOutput(ERROR, "Could not write %s\n", tmp_filename.c_str());
+				res = CANT_OPEN_TEMP_FILE;
+				goto Done;
+			}
 		}
 
 		if (!this->bQuiet)
@@ -836,23 +1853,32 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 		}
 
 		//Write header info for this block.
-		fwrite(&this->numRows, 1, 4, out);
-		fwrite(&m_LongestLine, 1, 4, out);
-		char unsigned done = hadEnoughMemory ? 1 : 0;
-		fwrite(&done, 1, 1, out); //if 0, indicates another block will follow this one
+		BlockIndexEntry blockEntry;
+		blockEntry.offset = out->tell();
+		blockEntry.dictionarySize = this->uniques.empty() ? 0 : this->uniques.getSize();
+		out->write(&this->numRows, 4);
+		out->write(&m_LongestLine, 4);
+		{
+			UCHAR flags = hadEnoughMemory ? BLOCK_FLAG_LAST : 0; //if 0, indicates another block will follow this one
+			if (this->bColumnar)
+				flags |= BLOCK_FLAG_COLUMNAR;
+			out->put(flags);
+		}
 
 		//Write dictionary.
 		if (!this->bQuiet)
 			statusOutput(INFO, "\nWriting dictionary:\n%u bytes being stored for %u unique entries.  Generating %d-byte offsets...\n",
 				this->uniques.getSize(), this->uniques.getNumEntries(), this->uniques.getBytesInOffset());
-		this->uniques.write(out); //side-effect: populates offsets for second pass below
+		this->uniques.write(out, this->numThreads); //side-effect: populates offsets for second pass below
 
 		//Write column field info for these lookup tables.
 		const size_t numColumnsUsed = writeLookupColumnStats(out, numColumns);
 
 		//Second pass: parse rows for encoding to the output file.
 		FILE *p_second_in = NULL;
-		if (this->bStreamingInput) {
+		if (this->bSinglePass) {
+			//rows were cached during the first pass
+		} else if (this->bStreamingInput) {
 			//Begin reading from the temp file.
 			string cmd = "zcat ";
 			cmd += tmp_filename;
@@ -864,24 +1890,57 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 			}
 		} else {
 			//rewind to the marked spot in the input file
-			fsetpos(f_in, &fbegin);
+			if (this->mappedInput.is_open())
+				this->mappedInput.seek(mappedBegin);
+			else
+				fsetpos(f_in, &fbegin);
 		}
 		if (!this->bQuiet)
 			statusOutput(INFO, "\nWriting rows\n");
 
-		cnt = writeBlockRows(this->bStreamingInput ? p_second_in : f_in,
-				out, numColumns, numColumnsUsed);
+		const ULONGLONG rowsBegin = out->tell();
+		if (this->bColumnar) {
+			//Each used column's rows are gathered in memory, to be written after the block's rows are encoded.
+			//They take the place of the memory reserved for them by the first pass.
+			releaseColumnSegments();
+			this->columnBits.assign(numColumnsUsed, vector<UCHAR>((this->numRows + 7) / 8));
+			this->columnValues.assign(numColumnsUsed, string());
+			for (size_t u = 0; u < numColumnsUsed; ++u)
+				this->columnValues[u].reserve(static_cast<size_t>(this->numRows) * columnSize[usedColumn[u]]);
+		}
+		if (this->bSinglePass)
+			cnt = writeCachedBlockRows(out, numColumnsUsed);
+		else if (this->numThreads > 1)
+			cnt = writeBlockRowsParallel(this->bStreamingInput ? p_second_in : f_in, out, numColumnsUsed);
+		else
+			cnt = writeBlockRows(this->bStreamingInput ? p_second_in : f_in,
+					out, numColumns, numColumnsUsed);
+		if (this->bColumnar)
+			writeColumnSegments(out, numColumnsUsed);
 		totalCnt += cnt;
 
+		blockEntry.rowDataLength = out->tell() - rowsBegin;
+		blockEntry.numRows = cnt;
+		if (!this->keyframeOffsets.empty()) {
+			blockEntry.keyframeInterval = this->keyframeInterval;
+			for (size_t k = 0; k < this->keyframeOffsets.size(); ++k)
+				blockEntry.keyframes.push_back(this->keyframeOffsets[k] - rowsBegin);
+			this->keyframeOffsets.clear();
+		}
+		if (this->bBlockIndex)
+			this->zoneMaps.getZoneMaps(blockEntry.zoneMaps, blockEntry.bloomFilters); //before the dictionary entries are freed
+		this->blockIndexEntries.push_back(blockEntry);
+
 		if (!this->bQuiet)
 			statusOutput(INFO, "\r%u\nDone with block %d -- cleaning up...\n", cnt, blocks);
 
 		//Clean up.
 		this->uniques.clear();
-		if (this->bStreamingInput) {
-			//Done reading the temp file -- either save it for validatation or delete it.
-			assert(p_second_in);
+		this->rowCache.clear();
+		if (p_second_in)
 			pclose(p_second_in);
+		if (!tmp_filename.empty()) {
+			//Done reading the temp file -- either save it for validatation or delete it.
 			if (bValidate) {
 				tmp_filenames.push_back(tmp_filename);
 			} else {
@@ -893,9 +1952,20 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 		total_rows += this->numRows;
 	} while (!hadEnoughMemory);
 
+	if (this->bBlockIndex && !this->blockIndexEntries.empty())
+		writeBlockIndex(out);
+
 	//Done writing out the ZDW file.
-	pclose(out);
-	out = NULL;
+	{
+		const bool bWritten = out->close();
+		delete out;
+		out = NULL;
+		if (!bWritten) {
+			statusOutput(ERROR, "Could not write %s\n", temp_outfile_name.c_str());
+			res = FILE_CREATION_ERR;
+			goto Done;
+		}
+	}
 
 	if (bValidate)
 	{
@@ -914,9 +1984,16 @@ ConvertToZDW::ERR_CODE ConvertToZDW::processFile(
 	}
 
 Done:
-	//Ensure we've closed this process, in case we are erroring out.
-	if (out)
-		pclose(out);
+	//Ensure we've closed the output, in case we are erroring out.
+	if (out) {
+		out->close();
+		delete out;
+	}
+	if (this->tmp_out) {
+		this->tmp_out->close();
+		delete this->tmp_out;
+		this->tmp_out = NULL;
+	}
 	//Delete the temp files created during streaming input.
 	if (this->bStreamingInput) {
 		for (size_t i = 0; i < tmp_filenames.size(); ++i)
@@ -962,6 +2039,14 @@ ConvertToZDW::ERR_CODE ConvertToZDW::convertFile(
 	assert(exeName);
 	assert(filestub);
 
+	if (this->keyframeInterval && this->bColumnar) {
+		statusOutput(ERROR, "Keyframes can't be used with columnar blocks\n");
+		return BAD_PARAMETER;
+	}
+
+	//Blocks end when the process runs low on memory -- keep its memory usage in step with what is allocated.
+	Memory::release_freed_allocations();
+
 	m_LongestLine = 16 * 1024; //16K default
 	delete[] m_row;
 	m_row = new char[m_LongestLine];
@@ -1002,14 +2087,50 @@ ConvertToZDW::ERR_CODE ConvertToZDW::convertFile(
 	this->rowColumns.reserve(numColumns);
 	delete[] minmaxset;
 	minmaxset = new char unsigned[numColumns];
-	columnMin.reserve(numColumns);
-	columnMax.reserve(numColumns);
+	columnMin.resize(numColumns);
+	columnMax.resize(numColumns);
 	delete[] columnSize;
 	columnSize = new char unsigned[numColumns];
-	columnVal.reserve(numColumns);
-	columnStoredVal[0].reserve(numColumns);
-	columnStoredVal[1].reserve(numColumns);
-	usedColumn.reserve(numColumns);
+	columnStoredVal[0].resize(numColumns);
+	columnStoredVal[1].resize(numColumns);
+	usedColumn.resize(numColumns);
+	if (this->bBlockIndex) {
+		vector<bool> bloomColumns(numColumns, false);
+		for (size_t i = 0; i < this->bloomColumnNames.size(); ++i)
+		{
+			size_t c = 0;
+			while (c < numColumns && strcasecmp(m_DWColumns[c].c_str(), this->bloomColumnNames[i].c_str()))
+				++c;
+			if (c == numColumns || IsNumericZoneMapType(m_ColumnType[c])) {
+				statusOutput(ERROR, "Bloom filter column '%s' is not a text column of %s\n", this->bloomColumnNames[i].c_str(), infile);
+				return BAD_PARAMETER;
+			}
+			bloomColumns[c] = true;
+		}
+		this->zoneMaps.init(m_ColumnType, bloomColumns);
+	}
+	if (this->bSinglePass) {
+		this->rowCache.init(numColumns);
+		this->rowValues.resize(numColumns);
+	}
+	this->bPendingRow = false;
+	if (this->bColumnar) {
+		releaseColumnSegments(); //of a previous file that wasn't converted
+		//The most a row can add to the column segments: a sameness bit and a changed value for each column,
+		//whose size is the most bytes its type's range of values can be stored in (see writeLookupColumnStats).
+		this->columnSegmentRowSize = (numColumns + 7) / 8;
+		for (size_t c = 0; c < numColumns; ++c)
+		{
+			switch (m_ColumnType[c])
+			{
+				case TINY: case TINY_SIGNED: this->columnSegmentRowSize += 2; break;
+				case CHAR: case SHORT: case SHORT_SIGNED: this->columnSegmentRowSize += 3; break;
+				case LONG: case LONG_SIGNED: this->columnSegmentRowSize += 5; break;
+				case LONGLONG: case LONGLONG_SIGNED: this->columnSegmentRowSize += 8; break;
+				default: this->columnSegmentRowSize += sizeof(ULONG); break; //dictionary offset
+			}
+		}
+	}
 
 	//Open input file handle.
 	if (this->bStreamingInput) {
@@ -1021,6 +2142,9 @@ ConvertToZDW::ERR_CODE ConvertToZDW::convertFile(
 		in = fopen(command.c_str(), "r");
 		if (!in)
 			return MISSING_SQL_FILE; //couldn't read file
+
+		//Read rows straight out of memory when the file can be mapped.
+		this->mappedInput.open(in);
 	}
 
 	ERR_CODE conversionResult = UNKNOWN_ERROR;
@@ -1032,8 +2156,10 @@ ConvertToZDW::ERR_CODE ConvertToZDW::convertFile(
 	}
 
 	//Clean-up.
-	if (!this->bStreamingInput)
+	if (!this->bStreamingInput) {
+		this->mappedInput.close();
 		fclose(in);
+	}
 
 	return conversionResult;
 }
@@ -1044,46 +2170,51 @@ ConvertToZDW::ERR_CODE ConvertToZDW::convertFile(
 
 namespace {
 
-//Skip over embedded tabs.
-inline void get_next_column(char*& col)
+//Returns: the value of a numeric field, as parsed by strtoull
+inline ULONGLONG parse_unsigned(const TextSpan& field)
+{
+	//Fields aren't null-terminated -- copy to a terminated buffer first.
+	char buf[64];
+	if (field.len < sizeof(buf)) {
+		memcpy(buf, field.str, field.len);
+		buf[field.len] = 0;
+		return strtoull(buf, NULL, 10);
+	}
+	return strtoull(string(field.str, field.len).c_str(), NULL, 10);
+}
+
+//Returns: the value stored for a CHAR field -- its character, plus the escaped character, if any
+inline ULONGLONG char_field_value(const TextSpan& field)
+{
+	ULONGLONG val = field.len ? field.str[0] : 0;
+	if (val && field.len > 1)
+		val += field.str[1] * 256; //an escaped char
+	return val;
+}
+
+//Returns: the last newline in [begin, end) not escaped by an odd number of backslashes, or NULL if none
+inline const char* find_last_row_end(const char* const begin, const char* end)
 {
-	col = strchr(col, '\t'); // embedded tabs are escaped by an odd number of backslashes.
-	if (col && col[-1] == '\\')
+	while ((end = static_cast<const char*>(memrchr(begin, '\n', end - begin))))
 	{
-		char* slash = col - 2;
-		while (*slash == '\\')
-			--slash;
-		while (col && ((col - slash) % 2) == 0)
-		{
-			col = strchr(col + 1, '\t');
-			if (col)
-			{
-				slash = col - 1;
-				while (*slash == '\\')
-					--slash;
-			}
-		}
+		if (!adobe::zdw::IsEscaped(end, begin))
+			return end;
 	}
+	return NULL;
 }
 
-inline bool dump_trimmed_row_to_temp_file(FILE* fp, const vector<char*>& rowColumns)
+inline bool dump_trimmed_row_to_temp_file(CompressedOutput* out, const vector<TextSpan>& rowColumns)
 {
-	const int size_minus_one = rowColumns.size() - 1;
-	char *field;
-	size_t len;
-	for (int i = 0; i < size_minus_one; ++i) {
-		field = rowColumns[i];
-		len = strlen(field);
-		if (len > 0 && fwrite(field, 1, len, fp) != len)
+	const size_t size_minus_one = rowColumns.size() - 1;
+	for (size_t i = 0; i < size_minus_one; ++i) {
+		if (!out->write(rowColumns[i].str, rowColumns[i].len))
 			return false; //has an error writing to the temp file
-		if (fwrite("\t", 1, 1, fp) != 1) //reinsert tab separators
+		if (!out->put('\t')) //reinsert tab separators
 			return false;
 	}
-	field = rowColumns[size_minus_one];
-	len = strlen(field);
-	if (len > 0 && fwrite(field, 1, len, fp) != len)
+	if (!out->write(rowColumns[size_minus_one].str, rowColumns[size_minus_one].len))
 		return false;
-	if (fwrite("\n", 1, 1, fp) != 1) //reinsert trailing newline that was truncated
+	if (!out->put('\n')) //reinsert trailing newline that was truncated
 		return false;
 	return true;
 }
@@ -13,7 +13,12 @@
 #ifndef CONVERTTOZDW_H
 #define CONVERTTOZDW_H
 
+#include "compressedoutput.h"
 #include "dictionary.h"
+#include "getnextrow.h"
+#include "rowcache.h"
+#include "zonemap.h"
+#include "zdw/block_index.h"
 #include "zdw/status_output.h"
 
 #include <map>
@@ -37,7 +42,8 @@ public:
 		BZIP2 = 1,
 		XZ    = 2, //lzma
 		FXZ   = 3, //fastlzma2
-		ZSTD  = 4  //zstandard
+		ZSTD  = 4, //zstandard
+		NONE  = 5  //uncompressed
 	};
 
 	//Error codes
@@ -80,7 +86,15 @@ public:
 		, bQuiet(bQuiet)
 		, bTrimTrailingSpaces(false)
 		, bStreamingInput(bStreamingInput)
-		, tmp_fp(NULL)
+		, tmp_out(NULL)
+		, numThreads(1)
+		, bSinglePass(false)
+		, bPendingRow(false)
+		, bBlockIndex(false)
+		, bColumnar(false)
+		, columnSegmentRowSize(0)
+		, numColumnSegmentRowsReserved(0)
+		, keyframeInterval(0)
 	{ }
 	~ConvertToZDW()
 	{
@@ -92,6 +106,12 @@ public:
 	void setStatusOutputCallback(StatusOutputCallback cb) { statusOutput = cb; }
 
 	void trimTrailingSpaces(bool val = true) { bTrimTrailingSpaces = val; }
+	void singlePass(bool val = true) { bSinglePass = val; }
+	void blockIndex(bool val = true) { bBlockIndex = val; m_Version = val ? BLOCK_INDEX_VERSION : CONVERT_ZDW_CURRENT_VERSION; }
+	void columnar(bool val = true) { bColumnar = val; if (val) blockIndex(); }
+	void setKeyframeInterval(const ULONG rows) { keyframeInterval = rows; if (rows) blockIndex(); }
+	void setBloomFilterColumns(const std::vector<std::string>& names) { bloomColumnNames = names; if (!names.empty()) blockIndex(); }
+	void setNumThreads(const int threads) { numThreads = threads > 1 ? threads : 1; }
 	const char* getInputFileExtension() const { return "sql"; }
 
 	static int loadMetadataFile(const char* filepath, std::map<std::string, std::string>& metadata);
@@ -137,10 +157,20 @@ private:
 	}
 
 
-	size_t GetDataRow(FILE* f, char *&row, std::vector<char*>& rowColumns);
-	ULONG writeBlockRows(FILE* in, FILE* out,
+	size_t GetDataRow(FILE* f, char *&row, std::vector<TextSpan>& rowColumns);
+	ULONG writeBlockRows(FILE* in, CompressedOutput* out,
 		const size_t numColumns, const size_t numColumnsUsed);
-	size_t writeLookupColumnStats(FILE* out, const size_t numColumns);
+	ULONG writeCachedBlockRows(CompressedOutput* out, const size_t numColumnsUsed);
+	ULONG writeBlockRowsParallel(FILE* in, CompressedOutput* out, const size_t numColumnsUsed);
+	void storeRowValues(const RowValue* values, const size_t numColumnsUsed, const size_t r, ZoneMapBuilder* zoneMaps);
+	void writeRow(CompressedOutput* out, const size_t numColumnsUsed, const size_t r, const ULONG rowNum,
+		const bool bKeyframe, char unsigned* setColumns, const size_t numSetColumnBytes, char* rowIndexOut);
+	ULONG reserveColumnSegments(const ULONG numRows);
+	void releaseColumnSegments();
+	void appendColumnarRow(const size_t numColumnsUsed, const size_t r, const ULONG rowNum);
+	void writeColumnSegments(CompressedOutput* out, const size_t numColumnsUsed);
+	size_t writeLookupColumnStats(CompressedOutput* out, const size_t numColumns);
+	void writeBlockIndex(CompressedOutput* out) const;
 
 	enum INPUT_STATUS
 	{
@@ -149,7 +179,26 @@ private:
 		IS_WRONG_NUM_OF_COLUMNS_ON_A_ROW=2
 	};
 
+	struct ParseChunk; //a portion of the input parsed by one thread
+	struct NewValue;   //a text value added to a chunk's dictionary
+	struct RowBatch;   //a run of input rows tokenized by one thread in the second pass
+	struct RowBatchQueue;
+
+	bool addRowValues(const std::vector<TextSpan>& rowColumns, Dictionary& dictionary,
+		char unsigned* minmaxset, ULONGLONG* columnMin, ULONGLONG* columnMax,
+		RowValue* rowValues, const bool bStopWhenLowOnMemory,
+		std::vector<NewValue>* newValues = NULL) const;
+	void parseChunk(ParseChunk& chunk) const;
+	static void* parseChunkThread(void* arg);
+	ULONG mergeChunk(const ParseChunk& chunk, bool& bBlockFull, size_t& numPartialColumns);
+	const char* endBlockInChunk(const ParseChunk& chunk, const ULONG row, const size_t numPartialColumns);
+	ULONG readRowBatch(FILE* in, RowBatch& batch, const ULONG maxRows);
+	void tokenizeRowBatch(RowBatch& batch) const;
+	static void* tokenizeRowBatchesThread(void* arg);
+
 	INPUT_STATUS parseInput(FILE* in);
+	INPUT_STATUS parseInputParallel(FILE* in);
+	CompressedOutput* openCompressedOutput(const std::string& filename, const char* zArgs);
 	ERR_CODE processFile(FILE* in, const char* filestub, const size_t numColumns,
 			const bool bValidate, const char* exeName,
 			const char* outputDir = NULL, const char* zArgs = NULL,
@@ -172,12 +221,11 @@ private:
 
 	Dictionary uniques;
 
-	std::vector<char*> rowColumns;
+	std::vector<TextSpan> rowColumns;
 	char unsigned *minmaxset;
 	std::vector<ULONGLONG> columnMin;
 	std::vector<ULONGLONG> columnMax;
 	char unsigned *columnSize;
-	std::vector<ULONGLONG> columnVal;
 	std::vector<internal::storageBytes> columnStoredVal[2];
 	std::vector<short> usedColumn;
 
@@ -187,7 +235,29 @@ private:
 	bool bTrimTrailingSpaces; //TODO refactor outside of process
 
 	const bool bStreamingInput; //if set, reading data from stdin
-	FILE *tmp_fp; //used when streaming data in -- stores data for second pass
+	CompressedOutput *tmp_out; //used when streaming data in -- stores data for second pass
+	MappedRowReader mappedInput; //used instead of reading the input file when it can be memory-mapped
+
+	int numThreads; //if more than one, each block is parsed in parallel, and its rows are tokenized, encoded and compressed concurrently
+
+	bool bSinglePass; //if set, parsed rows are cached during the first pass instead of re-reading the input
+	RowCache rowCache;
+	std::vector<RowValue> rowValues;
+	bool bPendingRow; //the last row parsed did not fit in the previous block -- it starts the next one
+
+	bool bBlockIndex; //if set, a version 12 file is written, ending with an index of its blocks
+	std::vector<BlockIndexEntry> blockIndexEntries;
+	ZoneMapBuilder zoneMaps; //statistics of the block being written, for its index entry
+	std::vector<std::string> bloomColumnNames; //text columns whose values are added to a Bloom filter in each index entry
+
+	bool bColumnar; //if set, each block's rows are stored by column (see BLOCK_FLAG_COLUMNAR)
+	std::vector<std::vector<UCHAR> > columnBits; //sameness bits of each used column in the block being written
+	std::vector<std::string> columnValues;       //changed values of each used column in the block being written
+	size_t columnSegmentRowSize; //the most bytes a row adds to the column segments
+	ULONG numColumnSegmentRowsReserved; //rows of the block being parsed whose column segments are reserved against the memory limit
+
+	ULONG keyframeInterval; //if set, every this many rows of a block starts a keyframe (see BlockIndexEntry)
+	std::vector<ULONGLONG> keyframeOffsets; //of the keyframes in the block being written
 };
 
 } // namespace zdw
@@ -17,8 +17,12 @@
 #include "zdw/UnconvertFromZDW.h"
 
 #include <algorithm>
+#include <ctype.h>
+#include <deque>
+#include <errno.h>
 #include <math.h>
 #include <ostream>
+#include <pthread.h>
 #include <set>
 #include <sstream>
 #include <stdint.h>
@@ -64,6 +68,25 @@ using std::vector;
 //version 11a -- fix virtual_export_row output
 //version 11b -- add zstandard support
 //version 11c -- fix invalid buffer reuse bug from ZSTD pr series.
+//version 11d -- uncompress input in-process, recognizing the compression format by its magic bytes instead of the file extension
+//version 11e -- memory-map uncompressed input, using its dictionary in place
+//version 12 -- read the block index ending version 12 files; -s skips the rows of indexed blocks
+//version 12a -- read zone maps from block index entries; added blockCanMatch API
+//version 12b -- read Bloom filters from block index entries; added blockMayContain API
+//version 12c -- read columnar blocks, reading only the segments of the columns being output
+//version 12d -- read keyframe offsets from block index entries; added skipToRow API
+//version 12e -- decode blocks in parallel (setNumThreads), outputting their text in order
+//version 12f -- read input ahead and write output on separate threads (setPipelined)
+//version 12g -- decode rows by a plan compiled for each block, with kernels specialized by column kind and value width
+//version 12h -- read each row's changed values at once, visiting its sameness flags 64 at a time, for output, -t and -s
+//version 12i -- re-emit the cached text of unchanged values and rows; find dictionary entry lengths from a bitmap of their ends
+//version 12j -- skip the dictionary when no column being output takes text from it, or when testing
+//version 12k -- decode only the changed values of the columns being output, jumping past the others
+//version 12l -- typed access to rows' values through UnconvertFromZDWToMemory::nextRow
+//version 12m -- batches of rows' values by column through UnconvertFromZDWToMemory::getBatch
+//version 12n -- filter rows by predicates on their encoded values (setRowPredicates, unconvertDWfile --where)
+//version 12o -- loadBlockIndex reads compressed files through to their index
+//version 12p -- skip blocks whose index entries rule out --where, including columnar blocks and blocks decoded in parallel
 
 
 namespace {
@@ -74,6 +97,10 @@ static const char tab[] = "\t";
 const int IGNORE = -1;
 const int USE_VIRTUAL_COLUMN = -2;
 
+const adobe::zdw::ULONG COLUMNAR_BATCH_ROWS = 256; //rows of a columnar block decoded at a time
+const adobe::zdw::UCHAR INVALID_FLAGS = 0xFF; //marks sameness flags set for no column in flagByteWidths
+const size_t BLOCK_INDEX_READ_SIZE = 1024 * 1024; //the last bytes of a compressed file kept when reading its block index
+
 char const* const VIRTUAL_EXPORT_BASENAME_COLUMN_NAME = "virtual_export_basename";
 char const* const VIRTUAL_EXPORT_ROW_COLUMN_NAME = "virtual_export_row";
 
@@ -138,8 +165,8 @@ void InitDirAndBasenameFromFileName(string const& inFileNameStr, char * &sourceD
 namespace adobe {
 namespace zdw {
 
-const int UnconvertFromZDW_Base::UNCONVERT_ZDW_VERSION = 11;
-const char UnconvertFromZDW_Base::UNCONVERT_ZDW_VERSION_TAIL[3] = "c";
+const int UnconvertFromZDW_Base::UNCONVERT_ZDW_VERSION = 12;
+const char UnconvertFromZDW_Base::UNCONVERT_ZDW_VERSION_TAIL[3] = "p";
 
 const size_t UnconvertFromZDW_Base::DEFAULT_LINE_LENGTH = 16 * 1024; //16K default
 
@@ -186,6 +213,7 @@ UnconvertFromZDW_Base::UnconvertFromZDW_Base(const string &fileName,
 		const bool bTestOnly, const bool bOutputDescFileOnly) //[default=false, false]
 	: exportFileLineLength(0)
 	, virtualLineLength(0)
+	, bDictionaryInPlace(false)
 	, uniques(NULL)
 	, visitors(NULL)
 	, version(UNCONVERT_ZDW_VERSION)
@@ -217,6 +245,13 @@ UnconvertFromZDW_Base::UnconvertFromZDW_Base(const string &fileName,
 	, dictionarySize(0), numVisitors(0)
 	, rowsRead(0)
 	, numSetColumns(0)
+	, blocksRead(0)
+	, rowDataBegin(0)
+	, bRowCached(false)
+	, bRowFiltered(false)
+	, bColumnarBlock(false)
+	, columnarRowsBegin(0), columnarRowsEnd(0)
+	, blockEntry(NULL)
 	, statusOutput(NULL)
 	, eState(ZDW_BEGIN)
 	, currentRowNumber(0)
@@ -230,36 +265,74 @@ UnconvertFromZDW_Base::UnconvertFromZDW_Base(const string &fileName,
 		const int exists = stat(inFileName.c_str(), &buf);
 		if (exists >= 0)
 		{
-			string cmd;
-			const size_t len = inFileName.size();
-			if (len >= 4 && !strcmp(inFileName.c_str() + len - 3, ".gz")) {
-				cmd = "zcat ";
-				cmd += inFileName;
-				cmd.append(" 2>/dev/null"); //we don't need to see any chatter -- we output all relevant error codes ourselves
-			} else if (len >= 5 && !strcmp(inFileName.c_str() + len - 4, ".bz2")) {
-				//Streaming uncompression of .bz2 files.
-				cmd = "bzip2 -d --stdout ";
-				cmd += inFileName;
-				cmd.append(" 2>/dev/null"); //we don't need to see any chatter -- we output all relevant error codes ourselves
-			} else if (len >= 4 && !strcmp(inFileName.c_str() + len - 3, ".xz")) {
-				cmd = "xzcat ";
-				cmd += inFileName;
-			} else if (len >= 5 && !strcmp(inFileName.c_str() + len - 4, ".zst")) {
-				//Streaming uncompression of .zst files.
-				cmd = "zstd -d --stdout ";
-				cmd += inFileName;
-				cmd.append(" 2>/dev/null"); //we don't need to see any chatter -- we output all relevant error codes ourselves
-			} else {
-				//Streaming text.
-				cmd = "cat ";
-				cmd += inFileName;
-			}
-
-			input = new BufferedInput(cmd);
+			//Compression is recognized from the file's contents.
+			input = BufferedInput::open(inFileName);
 		}
 	} else {
 		//No filename specified -- read ZDW data from stdin.
-		input = new BufferedInput();
+		input = BufferedInput::open(stdin);
+	}
+}
+
+//***********************************************
+UnconvertFromZDW_Base::UnconvertFromZDW_Base(const UnconvertFromZDW_Base* header)
+	: exportFileLineLength(0)
+	, virtualLineLength(header->virtualLineLength)
+	, bDictionaryInPlace(false)
+	, uniques(NULL)
+	, visitors(NULL)
+	, version(header->version)
+	, decimalFactor(header->decimalFactor)
+	, numLines(0)
+	, numColumnsInExportFile(header->numColumnsInExportFile)
+	, numColumns(header->numColumns)
+	, lastBlock(1)
+	, row(new char[DEFAULT_LINE_LENGTH])
+	, exeName(header->exeName)
+	, inFileName(header->inFileName)
+	, inFileBaseName(header->inFileBaseName)
+	, input(NULL)
+	, bOutputDescFileOnly(false)
+	, bShowStatus(false), bQuiet(true) //progress is shown by the header's reader
+	, bTestOnly(header->bTestOnly)
+	, bOutputNonEmptyColumnHeader(header->bOutputNonEmptyColumnHeader)
+	, bShowBasicStatisticsOnly(false)
+	, bFailOnInvalidColumns(header->bFailOnInvalidColumns)
+	, namesOfColumnsToOutput(header->namesOfColumnsToOutput)
+	, bExcludeSpecifiedColumns(header->bExcludeSpecifiedColumns)
+	, bOutputEmptyMissingColumns(header->bOutputEmptyMissingColumns)
+	, indexForVirtualBaseNameColumn(header->indexForVirtualBaseNameColumn)
+	, indexForVirtualRowColumn(header->indexForVirtualRowColumn)
+	, columnNames(header->columnNames)
+	, columnType(new UCHAR[header->numColumns])
+	, columnCharSize(NULL)
+	, outputColumns(new int[header->numColumns])
+	, blankColumnNames(header->blankColumnNames)
+	, columnSize(NULL), setColumns(NULL)
+	, columnBase(NULL), columnVal(NULL)
+	, dictionarySize(0), numVisitors(0)
+	, rowsRead(0)
+	, numSetColumns(0)
+	, blocksRead(0)
+	, rowDataBegin(0)
+	, bRowCached(false)
+	, rowPredicates(header->rowPredicates)
+	, rowFilters(header->rowFilters)
+	, bRowFiltered(false)
+	, bColumnarBlock(false)
+	, columnarRowsBegin(0), columnarRowsEnd(0)
+	, blockEntry(NULL)
+	, statusOutput(header->statusOutput)
+	, eState(ZDW_PARSE_BLOCK_HEADER)
+	, currentRowNumber(0)
+{
+	temp_buf[TEMP_BUF_LAST_POS] = '\0';
+
+	memcpy(this->columnType, header->columnType, this->numColumns);
+	memcpy(this->outputColumns, header->outputColumns, this->numColumns * sizeof(int));
+	if (header->columnCharSize) {
+		this->columnCharSize = new USHORT[this->numColumns];
+		memcpy(this->columnCharSize, header->columnCharSize, this->numColumns * sizeof(USHORT));
 	}
 }
 
@@ -288,7 +361,12 @@ size_t UnconvertFromZDW_Base::readBytes(
 	const size_t len, //(in) # of bytes to read in
 	const bool bHaltOnReadError) //[default=true]
 {
-	//Read from input source.
+	//Read from input source, directly from its buffer when possible.
+	const char *bytes = this->input->readInPlace(len);
+	if (bytes) {
+		memcpy(buf, bytes, len);
+		return len;
+	}
 	const size_t result = this->input->read(buf, len);
 
 	if ((result != len) && bHaltOnReadError)
@@ -301,6 +379,108 @@ size_t UnconvertFromZDW_Base::readBytes(
 	return result;
 }
 
+//**********************************************
+//Copies a value of width bytes into val.
+static inline void loadValue(storageBytes& val, const char* bytes, const size_t width)
+{
+	val.n = 0;
+	switch (width)
+	{
+		case 1: val.c[0] = bytes[0]; break;
+		case 2: memcpy(val.c, bytes, 2); break;
+		case 3: memcpy(val.c, bytes, 3); break;
+		case 4: memcpy(val.c, bytes, 4); break;
+		case 5: memcpy(val.c, bytes, 5); break;
+		case 6: memcpy(val.c, bytes, 6); break;
+		case 7: memcpy(val.c, bytes, 7); break;
+		case 8: memcpy(val.c, bytes, 8); break;
+	}
+}
+
+//**********************************************
+//Reads the values of the columns whose sameness flags are set in setColumns,
+//i.e., those whose value changed from that of the previous row.
+//The row's length is summed from a table lookup for each byte of flags, so its values may be read at once,
+//and the set flags are then visited 64 at a time.
+//Only the values of tracked columns (see trackedFlags) are decoded, unless
+//each column's changes are counted in changesInColumn, or the values are checked against the lookup tables.
+//
+//Returns: CORRUPTED_DATA_ERROR if a flag is set for no column, or a value is out of range
+inline ERR_CODE UnconvertFromZDW_Base::readChangedValues(ULONG* changesInColumn, const bool bValidate)
+{
+	const UCHAR *flags = this->setColumns;
+	const long numFlagBytes = this->numSetColumns;
+	if (!numFlagBytes)
+		return OK;
+
+	//Note where the values flagged by each byte begin.
+	size_t length = 0;
+	const UCHAR *widths = &this->flagByteWidths[0];
+	ULONG *offsets = &this->flagByteOffsets[0];
+	for (long i = 0; i < numFlagBytes; ++i, widths += 256)
+	{
+		const UCHAR width = widths[flags[i]];
+		if (width == INVALID_FLAGS)
+			return CORRUPTED_DATA_ERROR;
+		offsets[i] = length;
+		length += width;
+	}
+	if (!length)
+		return OK;
+
+	const char *values = this->input->readInPlace(length);
+	if (!values) {
+		if (this->rowValues.size() < length)
+			this->rowValues.resize(length);
+		readBytes(&this->rowValues[0], length);
+		values = &this->rowValues[0];
+	}
+
+	const bool bAllColumns = changesInColumn || bValidate;
+	const ULONG *columns = &this->usedColumns[0];
+	for (long i = 0; i < numFlagBytes; i += 8)
+	{
+		ULONGLONG word, tracked;
+		memcpy(&word, flags + i, sizeof(word)); //flags are padded with zeros to a multiple of 8 bytes
+		memcpy(&tracked, &this->trackedFlags[i], sizeof(tracked));
+		ULONGLONG bits = bAllColumns ? word : word & tracked;
+		if (bits == word) {
+			//Every changed value among these 64 columns is decoded, so they are consecutive.
+			const char *value = values + offsets[i];
+			while (bits)
+			{
+				const size_t u = i * 8 + __builtin_ctzll(bits);
+				bits &= bits - 1;
+
+				const ULONG c = columns[u];
+				const size_t width = this->columnSize[c];
+				storageBytes& val = this->columnVal[c];
+				loadValue(val, value, width);
+				value += width;
+
+				if (changesInColumn)
+					++changesInColumn[u];
+				if (bValidate && !isValidColumnValue(c, val.n))
+					return CORRUPTED_DATA_ERROR;
+			}
+		} else {
+			//Jump to each tracked value, past the values of the columns before it in its byte of flags.
+			while (bits)
+			{
+				const size_t u = i * 8 + __builtin_ctzll(bits);
+				bits &= bits - 1;
+
+				const size_t byte = u / 8;
+				const UCHAR before = flags[byte] & ((1u << (u % 8)) - 1);
+				const ULONG c = columns[u];
+				loadValue(this->columnVal[c], values + offsets[byte] + this->flagByteWidths[byte * 256 + before],
+					this->columnSize[c]);
+			}
+		}
+	}
+	return OK;
+}
+
 //**********************************************
 size_t UnconvertFromZDW_Base::skipBytes(
 	const size_t len) //(in) # of bytes to skip
@@ -356,9 +536,19 @@ size_t UnconvertFromZDW_Base::lltoa(SLONGLONG value)
 }
 
 //**********************************************
-char* UnconvertFromZDW_Base::GetWord(ULONG index, char* row)
+//Returns: the dictionary entry at index, and its length
+const char* UnconvertFromZDW_Base::GetWord(ULONG index, char* row, size_t& length)
 {
 	if (this->version >= 9) {
+		if (!this->dictionaryEnds.empty()) {
+			//The entry ends at the next null terminator marked at or after its offset.
+			const ULONGLONG *ends = &this->dictionaryEnds[index / 64];
+			ULONGLONG bits = *ends & (~0ULL << (index % 64));
+			while (!bits)
+				bits = *++ends;
+			length = (ends - &this->dictionaryEnds[0]) * 64 + __builtin_ctzll(bits) - index;
+		}
+
 		//Determine in-memory dictionary block and relative offset.
 		size_t dict_memblock = 0;
 		while (index >= this->dictionary_memblock_size[dict_memblock]) {
@@ -367,7 +557,10 @@ char* UnconvertFromZDW_Base::GetWord(ULONG index, char* row)
 			assert(dict_memblock < this->dictionary_memblock_size.size());
 		}
 
-		return this->dictionary[dict_memblock] + index;
+		const char *word = this->dictionary[dict_memblock] + index;
+		if (this->dictionaryEnds.empty())
+			length = strlen(word);
+		return word;
 	}
 
 	//Build string backwards -- start with the null terminator.
@@ -393,6 +586,7 @@ char* UnconvertFromZDW_Base::GetWord(ULONG index, char* row)
 		index = this->uniques[index].m_PrevChar.n;
 	} while (index > 0);
 
+	length = strlen(out);
 	return out;
 }
 
@@ -735,8 +929,10 @@ ERR_CODE UnconvertFromZDW_Base::outputMetadata(FILE *out) const
 void UnconvertFromZDW_Base::cleanupBlock()
 {
 	//Deinit for this block.
-	for (size_t i = 0; i < this->dictionary.size(); ++i)
-		delete[] this->dictionary[i];
+	if (!this->bDictionaryInPlace) {
+		for (size_t i = 0; i < this->dictionary.size(); ++i)
+			delete[] this->dictionary[i];
+	}
 	delete[] this->uniques;
 	delete[] this->visitors;
 	delete[] this->columnSize;
@@ -746,12 +942,65 @@ void UnconvertFromZDW_Base::cleanupBlock()
 
 	this->dictionary.clear();
 	this->dictionary_memblock_size.clear();
+	this->bDictionaryInPlace = false;
+	this->blockEntry = NULL;
+	this->dictionaryEnds.clear();
 	this->uniques = NULL;
 	this->visitors = NULL;
 	this->columnSize = NULL;
 	this->setColumns = NULL;
 	this->columnBase = NULL;
 	this->columnVal = NULL;
+
+	this->decodePlan.clear();
+	this->formattedValues.clear();
+	this->usedColumns.clear();
+	this->columnFlags.clear();
+	this->flagByteWidths.clear();
+	this->trackedFlags.clear();
+	this->bRowCached = false;
+
+	this->bColumnarBlock = false;
+	this->columnSegments.clear();
+	this->columnarOutputColumns.clear();
+	this->columnarData.clear();
+	this->columnarRows.clear();
+}
+
+//Exchanges the current block, whose rows haven't been read yet, with that of another reader of the same file.
+void UnconvertFromZDW_Base::swapBlock(UnconvertFromZDW_Base& other)
+{
+	assert(!this->bColumnarBlock || this->columnSegments.empty());
+	assert(!other.bColumnarBlock || other.columnSegments.empty());
+
+	std::swap(this->exportFileLineLength, other.exportFileLineLength);
+	std::swap(this->numLines, other.numLines);
+	std::swap(this->lastBlock, other.lastBlock);
+	std::swap(this->bColumnarBlock, other.bColumnarBlock);
+	this->dictionary.swap(other.dictionary);
+	this->dictionary_memblock_size.swap(other.dictionary_memblock_size);
+	std::swap(this->bDictionaryInPlace, other.bDictionaryInPlace);
+	this->dictionaryEnds.swap(other.dictionaryEnds);
+	std::swap(this->uniques, other.uniques);
+	std::swap(this->visitors, other.visitors);
+	std::swap(this->dictionarySize, other.dictionarySize);
+	std::swap(this->numVisitors, other.numVisitors);
+	std::swap(this->columnSize, other.columnSize);
+	std::swap(this->setColumns, other.setColumns);
+	std::swap(this->columnBase, other.columnBase);
+	std::swap(this->columnVal, other.columnVal);
+	std::swap(this->numSetColumns, other.numSetColumns);
+	std::swap(this->rowsRead, other.rowsRead);
+	this->decodePlan.swap(other.decodePlan);
+	this->formattedValues.swap(other.formattedValues);
+	this->usedColumns.swap(other.usedColumns);
+	this->columnFlags.swap(other.columnFlags);
+	this->flagByteWidths.swap(other.flagByteWidths);
+	this->trackedFlags.swap(other.trackedFlags);
+	this->flagByteOffsets.swap(other.flagByteOffsets);
+	std::swap(this->bRowCached, other.bRowCached);
+	this->rowFilters.swap(other.rowFilters);
+	std::swap(this->blockEntry, other.blockEntry);
 }
 
 //****************************************************
@@ -775,10 +1024,561 @@ ERR_CODE UnconvertFromZDW_Base::parseBlockHeader()
 
 	readColumnFieldStats();
 
+	this->rowDataBegin = this->input->tell();
 	this->rowsRead = 0;
+	++this->blocksRead;
+	const size_t block = this->blocksRead - 1;
+	this->blockEntry = block < this->blockIndex.size() && this->blockIndex[block].numRows == this->numLines ?
+			&this->blockIndex[block] : NULL;
+	return compileDecodePlan();
+}
+
+//Reads past the current block's rows without decoding them.
+//Their length is taken from the block index when it lists the block, or else found by scanning
+//the rows' sameness bits (or a columnar block's segment lengths).
+//
+//Returns: the rows, in place when the input is held in memory, or else copied into rowData
+ERR_CODE UnconvertFromZDW_Base::readRowData(vector<char>& rowData, const char*& rows, ULONGLONG& length)
+{
+	const bool bInMemory = this->input->is_in_memory();
+	const ULONGLONG begin = this->input->tell();
+	rowData.clear();
+
+	if (this->blockEntry && this->rowDataBegin == begin)
+	{
+		length = this->blockEntry->rowDataLength;
+		rows = readRowBytes(rowData, length);
+		return rows ? OK : CORRUPTED_DATA_ERROR;
+	}
+
+	const size_t numUsed = this->usedColumns.size();
+
+	if (this->bColumnarBlock) {
+		if (numUsed) {
+			const char *bytes = readRowBytes(rowData, 8 * numUsed);
+			if (!bytes)
+				return CORRUPTED_DATA_ERROR;
+			vector<ULONGLONG> lengths(numUsed);
+			memcpy(&lengths[0], bytes, 8 * numUsed);
+			for (size_t u = 0; u < numUsed; ++u)
+			{
+				if (!readRowBytes(rowData, lengths[u]))
+					return CORRUPTED_DATA_ERROR;
+			}
+		}
+	} else {
+		for (ULONG r = 0; r < this->numLines; ++r)
+		{
+			const UCHAR *bits = reinterpret_cast<const UCHAR*>(readRowBytes(rowData, this->numSetColumns));
+			if (!bits)
+				return CORRUPTED_DATA_ERROR;
+			ULONGLONG rowLength = 0;
+			const UCHAR *widths = &this->flagByteWidths[0];
+			for (long i = 0; i < this->numSetColumns; ++i, widths += 256)
+			{
+				const UCHAR width = widths[bits[i]];
+				if (width == INVALID_FLAGS)
+					return CORRUPTED_DATA_ERROR;
+				rowLength += width;
+			}
+			if (!readRowBytes(rowData, rowLength))
+				return CORRUPTED_DATA_ERROR;
+		}
+	}
+
+	length = this->input->tell() - begin;
+	rows = bInMemory ? this->input->memory() + begin : (rowData.empty() ? NULL : &rowData[0]);
+	return OK;
+}
+
+//Reads the next len bytes of the current block's rows for readRowData.
+//Returns: the bytes, which remain valid until the next call, or NULL if the input ends first
+const char* UnconvertFromZDW_Base::readRowBytes(vector<char>& rowData, const size_t len)
+{
+	if (this->input->is_in_memory())
+		return this->input->readInPlace(len);
+
+	const size_t pos = rowData.size();
+	rowData.resize(pos + len);
+	if (len)
+		readBytes(&rowData[pos], len);
+	return rowData.empty() ? "" : &rowData[0] + pos;
+}
+
+//Version 12+: Reads the segment lengths of a columnar block, then the segments of the columns being read,
+//skipping over the rest.  Segments are used in place when the input is held in memory.
+ERR_CODE UnconvertFromZDW_Base::readColumnSegments(const bool bAllColumns)
+{
+	assert(this->bColumnarBlock);
+	assert(this->columnSegments.empty());
+
+	vector<ULONG> usedColumns;
+	for (ULONG c = 0; c < this->numColumnsInExportFile; ++c)
+	{
+		if (this->columnSize[c])
+			usedColumns.push_back(c);
+	}
+	const size_t numUsed = usedColumns.size();
+	vector<ULONGLONG> lengths(numUsed);
+	if (numUsed)
+		readBytes(&lengths[0], 8 * numUsed);
+
+	const ULONGLONG bitsLength = (this->numLines + 7) / 8;
+	ULONGLONG bytesToRead = 0;
+	size_t u;
+	for (u = 0; u < numUsed; ++u)
+	{
+		const ULONG c = usedColumns[u];
+		if (lengths[u] < bitsLength || (lengths[u] - bitsLength) / this->columnSize[c] > this->numLines ||
+				(lengths[u] - bitsLength) % this->columnSize[c])
+			return CORRUPTED_DATA_ERROR;
+
+		if (bAllColumns || this->outputColumns[c] != IGNORE || isFilterColumn(c)) {
+			const ColumnSegment segment = { c, NULL, NULL, NULL, 0 };
+			this->columnSegments.push_back(segment);
+			bytesToRead += lengths[u];
+		}
+	}
+
+	const bool bInPlace = this->input->is_in_memory();
+	if (!bInPlace)
+		this->columnarData.resize(bytesToRead);
+	char *dest = this->columnarData.empty() ? NULL : &this->columnarData[0];
+	vector<ColumnSegment>::iterator segment = this->columnSegments.begin();
+	for (u = 0; u < numUsed; ++u)
+	{
+		if (segment == this->columnSegments.end() || segment->column != usedColumns[u]) {
+			if (skipBytes(lengths[u]) != lengths[u])
+				return CORRUPTED_DATA_ERROR;
+			continue;
+		}
+
+		const char *data = dest;
+		if (bInPlace) {
+			data = this->input->readInPlace(lengths[u]);
+			if (!data)
+				return CORRUPTED_DATA_ERROR;
+		} else {
+			readBytes(dest, lengths[u]);
+			dest += lengths[u];
+		}
+		segment->bits = reinterpret_cast<const UCHAR*>(data);
+		segment->values = data + bitsLength;
+		segment->valuesEnd = data + lengths[u];
+		++segment;
+	}
+
+	//Values are decoded ahead of each row, so no sameness flags are read with it.
+	memset(this->setColumns, 0, this->numSetColumns);
+	for (ULONG c = 0; c < this->numColumns; ++c)
+	{
+		if (this->outputColumns[c] != IGNORE)
+			this->columnarOutputColumns.push_back(c);
+	}
+	this->columnarRows.resize(this->columnSegments.size() * COLUMNAR_BATCH_ROWS);
+	this->columnarRowsBegin = this->columnarRowsEnd = 0;
+	return OK;
+}
+
+//Decodes the next batch of rows of the columns being read, one column at a time.
+ERR_CODE UnconvertFromZDW_Base::decodeColumnarRows()
+{
+	const ULONG begin = this->columnarRowsEnd;
+	const ULONG end = std::min(this->numLines, begin + COLUMNAR_BATCH_ROWS);
+	ULONGLONG *out = this->columnarRows.empty() ? NULL : &this->columnarRows[0];
+	for (vector<ColumnSegment>::iterator segment = this->columnSegments.begin();
+			segment != this->columnSegments.end(); ++segment, out += COLUMNAR_BATCH_ROWS)
+	{
+		const size_t size = this->columnSize[segment->column];
+		const UCHAR *bits = segment->bits;
+		const char *values = segment->values;
+		storageBytes val;
+		val.n = segment->value;
+		for (ULONG r = begin; r < end; ++r)
+		{
+			if (bits[r / 8] & (1u << (r % 8))) //is the bit for this row set?
+			{
+				if (static_cast<size_t>(segment->valuesEnd - values) < size)
+					return CORRUPTED_DATA_ERROR;
+				val.n = 0;
+				memcpy(val.c, values, size);
+				values += size;
+			}
+			out[r - begin] = val.n;
+		}
+		segment->values = values;
+		segment->value = val.n;
+	}
+	this->columnarRowsBegin = begin;
+	this->columnarRowsEnd = end;
+	return OK;
+}
+
+//Advances past the current block's rows before the indicated row of the block without outputting them.
+//When the block index lists the block, all of its rows are skipped at once, and reading jumps to
+//a keyframe at or before that row.
+ERR_CODE UnconvertFromZDW_Base::skipRowsInBlock(const ULONG target)
+{
+	assert(target <= this->numLines);
+	if (target <= this->rowsRead)
+		return OK;
+	const ULONG begin = this->rowsRead;
+
+	if (this->blockEntry && target == this->numLines && this->input->tell() == this->rowDataBegin) {
+		//None of the rows (nor a columnar block's segments) have been read yet.
+		const ULONGLONG length = this->blockEntry->rowDataLength;
+		if (skipBytes(length) != length)
+			return CORRUPTED_DATA_ERROR;
+		this->rowsRead = target;
+	} else if (this->bColumnarBlock) {
+		//Step each segment past the rows that haven't been decoded yet.
+		if (target > this->columnarRowsEnd) {
+			const ULONG from = this->columnarRowsEnd;
+			for (vector<ColumnSegment>::iterator segment = this->columnSegments.begin();
+					segment != this->columnSegments.end(); ++segment)
+			{
+				const size_t size = this->columnSize[segment->column];
+				const char *values = segment->values;
+				for (ULONG r = from; r < target; ++r)
+				{
+					if (segment->bits[r / 8] & (1u << (r % 8)))
+						values += size;
+				}
+				if (values > segment->valuesEnd)
+					return CORRUPTED_DATA_ERROR;
+				if (values != segment->values) {
+					storageBytes val;
+					val.n = 0;
+					memcpy(val.c, values - size, size);
+					segment->value = val.n;
+				}
+				segment->values = values;
+			}
+			this->columnarRowsBegin = this->columnarRowsEnd = target;
+		}
+		this->rowsRead = target;
+	} else {
+		if (this->blockEntry && this->blockEntry->keyframeInterval) {
+			const BlockIndexEntry& entry = *this->blockEntry;
+			const size_t k = std::min<size_t>(target / entry.keyframeInterval, entry.keyframes.size());
+			if (k && k * entry.keyframeInterval > this->rowsRead) {
+				//A keyframe row holds every column's value, so no earlier row need be read.
+				const ULONGLONG keyframe = this->rowDataBegin + entry.keyframes[k - 1];
+				const ULONGLONG pos = this->input->tell();
+				if (keyframe < pos || skipBytes(keyframe - pos) != keyframe - pos)
+					return CORRUPTED_DATA_ERROR;
+				this->rowsRead = k * entry.keyframeInterval;
+			}
+		}
+
+		while (this->rowsRead < target)
+		{
+			readBytes(this->setColumns, this->numSetColumns);
+			const ERR_CODE eRet = readChangedValues(NULL, false);
+			if (eRet != OK)
+				return eRet;
+			++this->rowsRead;
+		}
+	}
+
+	this->bRowCached = false;
+	AdvanceCurrentRowNumber(target - begin);
+	return OK;
+}
+
+//Reads the values of the current block's next row for the columns being output, without outputting them.
+//The sameness flags tell which values were stored with the row (see columnFlags).
+ERR_CODE UnconvertFromZDW_Base::readRowValues()
+{
+	IncrementCurrentRowNumber();
+
+	if (this->bColumnarBlock) {
+		if (this->rowsRead >= this->columnarRowsEnd) {
+			const ERR_CODE eRet = this->decodeColumnarRows();
+			if (eRet != OK)
+				return eRet;
+		}
+		const ULONG r = this->rowsRead;
+		const ULONG k = r - this->columnarRowsBegin;
+		for (size_t s = 0; s < this->columnSegments.size(); ++s)
+		{
+			const ColumnSegment& segment = this->columnSegments[s];
+			this->columnVal[segment.column].n = this->columnarRows[s * COLUMNAR_BATCH_ROWS + k];
+
+			//Columnar rows are read without sameness flags, so copy the segment's.
+			const long u = this->columnFlags[segment.column];
+			const UCHAR bit = 1u << (u % 8);
+			if (segment.bits[r / 8] & (1u << (r % 8)))
+				this->setColumns[u / 8] |= bit;
+			else
+				this->setColumns[u / 8] &= ~bit;
+		}
+	} else {
+		readBytes(this->setColumns, this->numSetColumns);
+		const ERR_CODE eRet = this->readChangedValues(NULL, false);
+		if (eRet != OK)
+			return eRet;
+	}
+
+	this->bRowCached = false; //the plan's caches don't hold this row
+	++this->rowsRead;
+	return OK;
+}
+
+//Reads through every column segment of a columnar block without outputting anything,
+//validating the values when testing and counting the changed values when showing statistics.
+ERR_CODE UnconvertFromZDW_Base::scanColumnarBlock(ULONGLONG& equalityBitsSet, vector<ULONG>& equalityBitsInColumn)
+{
+	for (size_t u = 0; u < this->columnSegments.size(); ++u)
+	{
+		const ColumnSegment& segment = this->columnSegments[u];
+		const size_t size = this->columnSize[segment.column];
+		const char *values = segment.values;
+		ULONG numChanged = 0;
+		storageBytes val;
+		for (ULONG r = 0; r < this->numLines; ++r)
+		{
+			if (segment.bits[r / 8] & (1u << (r % 8)))
+			{
+				if (static_cast<size_t>(segment.valuesEnd - values) < size)
+					return CORRUPTED_DATA_ERROR;
+				val.n = 0;
+				memcpy(val.c, values, size);
+				values += size;
+				++numChanged;
+				if (this->bTestOnly && !isValidColumnValue(segment.column, val.n))
+					return CORRUPTED_DATA_ERROR;
+			}
+		}
+		if (values != segment.valuesEnd)
+			return CORRUPTED_DATA_ERROR;
+
+		if (this->bShowBasicStatisticsOnly) {
+			equalityBitsSet += numChanged;
+			equalityBitsInColumn[u] += numChanged;
+		}
+	}
+	this->rowsRead = this->numLines;
+	return OK;
+}
+
+//Returns: whether a value of column c read from a block refers to a valid lookup table entry
+bool UnconvertFromZDW_Base::isValidColumnValue(const size_t c, const ULONGLONG n) const
+{
+	ULONG index;
+	switch (this->columnType[c])
+	{
+		case VIRTUAL_EXPORT_FILE_BASENAME: assert(!"VIRTUAL_EXPORT_FILE_BASENAME should only get default value"); break;
+		case VISID_LOW: assert(!"VISID_LOW should be skipped"); break;
+		case VARCHAR:
+		case TEXT:
+		case TINYTEXT:
+		case MEDIUMTEXT:
+		case LONGTEXT:
+		case DATETIME:
+		case CHAR_2:
+			if (n)
+			{
+				index = n + this->columnBase[c];
+				if (index > this->dictionarySize)
+					return false;
+			}
+			break;
+		case VISID_HIGH:
+			index = n + this->columnBase[c];
+			if (index > this->numVisitors)
+				return false;
+			break;
+		case CHAR:
+		case TINY: case TINY_SIGNED:
+		case SHORT: case SHORT_SIGNED:
+		case LONG: case LONG_SIGNED:
+		case LONGLONG: case LONGLONG_SIGNED:
+			break; //nothing to test
+		case DECIMAL:
+			if (n && this->version >= 4)
+			{
+				index = n + this->columnBase[c];
+				if (index > this->dictionarySize)
+					return false;
+			}
+			break;
+	}
+	return true;
+}
+
+//Version 12+: Reads the block index following the last block,
+//checking that it lists the blocks that were read.
+ERR_CODE UnconvertFromZDW_Base::readBlockIndex()
+{
+	vector<BlockIndexEntry> entries(this->blocksRead);
+	ULONGLONG indexSize = BLOCK_INDEX_TAIL_SIZE;
+	vector<char> entry;
+	for (vector<BlockIndexEntry>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		ULONG entryLength;
+		readBytes(&entryLength, 4);
+		if (entryLength < BLOCK_INDEX_ENTRY_SIZE)
+			return CORRUPTED_DATA_ERROR;
+		entry.resize(entryLength);
+		readBytes(&entry[0], entryLength);
+		if (!ParseBlockIndexEntry(&entry[0], entryLength, this->columnType, this->numColumnsInExportFile, *it))
+			return CORRUPTED_DATA_ERROR;
+		indexSize += 4 + entryLength;
+	}
+
+	ULONG numBlocks;
+	ULONGLONG storedIndexSize;
+	char magic[sizeof(BLOCK_INDEX_MAGIC)];
+	readBytes(&numBlocks, 4);
+	readBytes(&storedIndexSize, 8);
+	readBytes(magic, sizeof(magic));
+	if (numBlocks != this->blocksRead || storedIndexSize != indexSize ||
+			memcmp(magic, BLOCK_INDEX_MAGIC, sizeof(magic)))
+		return CORRUPTED_DATA_ERROR;
+
+	this->blockIndex.swap(entries);
 	return OK;
 }
 
+//Returns: whether the index was loaded
+bool UnconvertFromZDW_Base::loadBlockIndex()
+{
+	if (!this->blockIndex.empty())
+		return true;
+
+	if (this->eState == ZDW_BEGIN && readHeader() != OK)
+		return false;
+	if (this->version < BLOCK_INDEX_VERSION)
+		return false;
+
+	//The index is found from the end of the file.
+	vector<BlockIndexEntry> entries;
+	if (this->input->is_in_memory()) {
+		const char *file = this->input->memory();
+		const size_t fileSize = this->input->memory_size();
+		ULONG numBlocks;
+		ULONGLONG indexSize;
+		if (fileSize < BLOCK_INDEX_TAIL_SIZE ||
+				!ParseBlockIndexTail(file + fileSize - BLOCK_INDEX_TAIL_SIZE, numBlocks, indexSize) || indexSize > fileSize ||
+				!ParseBlockIndex(file + fileSize - indexSize, indexSize, fileSize, this->columnType, this->numColumnsInExportFile, entries))
+			return false;
+	} else if (!readBlockIndexFromEnd(entries)) {
+		return false;
+	}
+
+	this->blockIndex.swap(entries);
+	return true;
+}
+
+//Reads the block index at the end of a compressed file, uncompressing the whole file through a reader of its own.
+//The index is usually among the last bytes read, which are kept.  Otherwise, the file is read again up to it.
+//
+//Returns: whether the index was read
+bool UnconvertFromZDW_Base::readBlockIndexFromEnd(vector<BlockIndexEntry>& entries) const
+{
+	if (this->inFileName.empty())
+		return false; //stdin can't be read twice
+
+	BufferedInput *file = BufferedInput::open(this->inFileName);
+	if (!file)
+		return false;
+
+	bool bRead = false;
+	try {
+		vector<char> tail(2 * BLOCK_INDEX_READ_SIZE);
+		size_t tailSize = 0, len;
+		do {
+			if (tailSize == tail.size()) {
+				memcpy(&tail[0], &tail[BLOCK_INDEX_READ_SIZE], BLOCK_INDEX_READ_SIZE);
+				tailSize = BLOCK_INDEX_READ_SIZE;
+			}
+			len = file->read(&tail[tailSize], tail.size() - tailSize);
+			tailSize += len;
+		} while (len);
+		const ULONGLONG fileSize = file->tell();
+
+		ULONG numBlocks;
+		ULONGLONG indexSize;
+		if (tailSize >= BLOCK_INDEX_TAIL_SIZE &&
+				ParseBlockIndexTail(&tail[tailSize - BLOCK_INDEX_TAIL_SIZE], numBlocks, indexSize) && indexSize <= fileSize)
+		{
+			if (indexSize <= tailSize) {
+				bRead = ParseBlockIndex(&tail[tailSize - indexSize], indexSize, fileSize,
+						this->columnType, this->numColumnsInExportFile, entries);
+			} else if (file->rewind() && file->skip(fileSize - indexSize) == fileSize - indexSize) {
+				tail.resize(indexSize);
+				bRead = file->read(&tail[0], indexSize) == indexSize &&
+					ParseBlockIndex(&tail[0], indexSize, fileSize, this->columnType, this->numColumnsInExportFile, entries);
+			}
+		}
+	} catch (const std::bad_alloc&) {
+		//a corrupt index length
+	}
+	delete file;
+	return bRead;
+}
+
+//The operand is compared as a value of the column's type.
+bool UnconvertFromZDW_Base::blockCanMatch(const size_t block, const string& columnName,
+	const PREDICATE_OP op, const string& operand) const
+{
+	if (block >= this->blockIndex.size())
+		return true;
+	const int c = findFileColumn(columnName);
+	return c < 0 || entryCanMatch(this->blockIndex[block], c, op, operand);
+}
+
+bool UnconvertFromZDW_Base::blockMayContain(const size_t block, const string& columnName,
+	const vector<string>& values) const
+{
+	if (block >= this->blockIndex.size())
+		return true;
+	const int c = findFileColumn(columnName);
+	return c < 0 || entryMayContain(this->blockIndex[block], c, values);
+}
+
+//Returns: false only when a block index entry's zone maps show that none of its rows
+//  has a value in column c satisfying (value op operand)
+bool UnconvertFromZDW_Base::entryCanMatch(const BlockIndexEntry& entry, const size_t c,
+	const PREDICATE_OP op, const string& operand) const
+{
+	if (entry.zoneMaps.empty())
+		return true;
+	return ZoneMapCanMatch(entry.zoneMaps[c], this->columnType[c], entry.numRows, op, operand);
+}
+
+//Returns: false only when a block index entry's zone maps or Bloom filter show that none of its rows
+//  has any of the values in column c
+bool UnconvertFromZDW_Base::entryMayContain(const BlockIndexEntry& entry, const size_t c,
+	const vector<string>& values) const
+{
+	if (entry.zoneMaps.empty())
+		return true;
+
+	const map<ULONG, BloomFilter>::const_iterator filter = entry.bloomFilters.find(c);
+	for (vector<string>::const_iterator it = values.begin(); it != values.end(); ++it)
+	{
+		//The zone map is checked first, as it also covers empty values, which aren't in the filter.
+		if (!ZoneMapCanMatch(entry.zoneMaps[c], this->columnType[c], entry.numRows, EQUAL, *it))
+			continue;
+		if (it->empty() || filter == entry.bloomFilters.end() || filter->second.mayContain(*it))
+			return true;
+	}
+	return false;
+}
+
+//Returns: index of the named column stored in the file, or -1 if there isn't one
+int UnconvertFromZDW_Base::findFileColumn(const string& name) const
+{
+	for (size_t c = 0; c < this->numColumnsInExportFile; ++c)
+	{
+		if (!strcasecmp(this->columnNames[c].c_str(), name.c_str()))
+			return c;
+	}
+	return -1;
+}
+
 void UnconvertFromZDW_Base::readLineLength()
 {
 	if (this->version >= 3)
@@ -797,6 +1597,10 @@ void UnconvertFromZDW_Base::readLineLength()
 			this->exportFileLineLength = t_version;
 		}
 		readBytes(&this->lastBlock, 1);
+		if (this->version >= BLOCK_INDEX_VERSION) {
+			this->bColumnarBlock = (this->lastBlock & BLOCK_FLAG_COLUMNAR) != 0;
+			this->lastBlock &= BLOCK_FLAG_LAST;
+		}
 
 		if (this->exportFileLineLength > DEFAULT_LINE_LENGTH)
 		{
@@ -824,15 +1628,30 @@ void UnconvertFromZDW_Base::readDictionary()
 		this->dictionarySize = sb.n;
 	}
 
-	//Read dictionary.
+	//Read dictionary, unless no column being output takes its text from it.
+	const bool bDictionaryNeeded = isDictionaryNeeded();
 	if (this->version >= 9) {
 		if (!this->bQuiet)
 			this->statusOutput(INFO, "Reading %" PF_LLU " byte dictionary\n", this->dictionarySize);
-		if (this->bShowBasicStatisticsOnly) {
+		//Create large dictionary as smaller memory chunks to work around memory fragmentation.
+		const size_t MAX_DICTIONARY_CHUNK = 500000000; //500M -- should be much larger than any single possible entry
+		const char *text = NULL;
+		if (!bDictionaryNeeded) {
 			skipBytes(this->dictionarySize);
-		} else {
-			//Create large dictionary as smaller memory chunks to work around memory fragmentation.
-			const size_t MAX_DICTIONARY_CHUNK = 500000000; //500M -- should be much larger than any single possible entry
+		} else if (this->input->is_in_memory()) {
+			text = this->input->readInPlace(this->dictionarySize);
+		}
+
+		if (text) {
+			//Use the dictionary where it sits in the memory-mapped file.
+			//The chunks are contiguous there, so entries may span them.
+			this->bDictionaryInPlace = true;
+			for (ULONGLONG offset = 0; offset < this->dictionarySize; offset += MAX_DICTIONARY_CHUNK) {
+				this->dictionary.push_back(text + offset);
+				this->dictionary_memblock_size.push_back(
+					std::min<ULONGLONG>(this->dictionarySize - offset, MAX_DICTIONARY_CHUNK));
+			}
+		} else if (bDictionaryNeeded) {
 			const size_t numChunks = size_t(ceil(this->dictionarySize / float(MAX_DICTIONARY_CHUNK)));
 			this->dictionary.reserve(numChunks);
 			this->dictionary_memblock_size.reserve(numChunks);
@@ -844,15 +1663,17 @@ void UnconvertFromZDW_Base::readDictionary()
 			}
 			readDictionaryChunk(sizeLeft);
 		}
+		if (bDictionaryNeeded)
+			indexDictionary();
 	} else {
-		if (!this->bShowBasicStatisticsOnly) {
+		if (bDictionaryNeeded) {
 			this->uniques = new UniquesPart[this->dictionarySize + 1];
 			memset(this->uniques, 0, (this->dictionarySize + 1) * sizeof(UniquesPart));
 		}
 		if (!this->bQuiet)
 			this->statusOutput(INFO, "Reading %" PF_LLU " uniques\n", this->dictionarySize);
 
-		if (this->bShowBasicStatisticsOnly) {
+		if (!bDictionaryNeeded) {
 			//Just skip through this data.
 			skipBytes(this->dictionarySize * (BLOCKSIZE + indexSize));
 		} else {
@@ -877,6 +1698,44 @@ void UnconvertFromZDW_Base::readDictionary()
 	readVisitorDictionary();
 }
 
+//Returns: whether the text of dictionary entries is output, i.e., a column being output holds them.
+//Testing and statistics only check values against the dictionary's size.
+bool UnconvertFromZDW_Base::isDictionaryNeeded() const
+{
+	if (this->bTestOnly || this->bShowBasicStatisticsOnly)
+		return false;
+
+	for (size_t c = 0; c < this->numColumnsInExportFile; ++c)
+	{
+		if (this->outputColumns[c] == IGNORE)
+			continue;
+		switch (this->columnType[c])
+		{
+			case VARCHAR:
+			case TEXT:
+			case TINYTEXT:
+			case MEDIUMTEXT:
+			case LONGTEXT:
+			case DATETIME:
+			case CHAR_2:
+				return true;
+			case DECIMAL:
+				if (this->version >= 4)
+					return true;
+				break;
+		}
+	}
+
+	//Text predicates are resolved against the dictionary.
+	for (size_t i = 0; i < this->rowFilters.size(); ++i)
+	{
+		const UCHAR kind = this->rowFilters[i].kind;
+		if (kind == FILTER_DICTIONARY || kind == FILTER_TEXT || kind == FILTER_DECIMAL)
+			return true;
+	}
+	return false;
+}
+
 void UnconvertFromZDW_Base::readDictionaryChunk(const size_t size)
 {
 	if (!size)
@@ -918,6 +1777,48 @@ void UnconvertFromZDW_Base::readDictionaryChunk(const size_t size)
 	this->dictionary_memblock_size.push_back(size + bytesToStitch);
 }
 
+//Marks the null terminator of each dictionary entry in dictionaryEnds,
+//so an entry's length is found without scanning its text (see GetWord).
+void UnconvertFromZDW_Base::indexDictionary()
+{
+	this->dictionaryEnds.assign(this->dictionarySize / 64 + 2, 0);
+	ULONGLONG *ends = &this->dictionaryEnds[0];
+
+	ULONGLONG offset = 0;
+	for (size_t chunk = 0; chunk < this->dictionary.size(); ++chunk)
+	{
+		const char *text = this->dictionary[chunk];
+		const size_t size = this->dictionary_memblock_size[chunk];
+		size_t i = 0;
+		for ( ; i + 8 <= size; i += 8)
+		{
+			//Find the null bytes among the next 8, and gather a bit for each.
+			const ULONGLONG low7 = 0x7F7F7F7F7F7F7F7FULL;
+			ULONGLONG bytes;
+			memcpy(&bytes, text + i, 8);
+			const ULONGLONG nulls = ~(((bytes & low7) + low7) | bytes | low7); //0x80 in each null byte
+			if (nulls) {
+				const ULONGLONG bits = ((nulls >> 7) * 0x0102040810204080ULL) >> 56;
+				const ULONGLONG o = offset + i;
+				ends[o / 64] |= bits << (o % 64);
+				if (o % 64 > 56)
+					ends[o / 64 + 1] |= bits >> (64 - o % 64);
+			}
+		}
+		for ( ; i < size; ++i)
+		{
+			if (!text[i]) {
+				const ULONGLONG o = offset + i;
+				ends[o / 64] |= 1ULL << (o % 64);
+			}
+		}
+		offset += size;
+	}
+
+	//Also mark the end of the dictionary, in case its final entry is unterminated.
+	ends[this->dictionarySize / 64] |= 1ULL << (this->dictionarySize % 64);
+}
+
 void UnconvertFromZDW_Base::readVisitorDictionary()
 {
 	if (this->version < 8)
@@ -981,7 +1882,10 @@ void UnconvertFromZDW_Base::readColumnFieldStats()
 	}
 	assert(numColumnsUsedFromExportFile <= this->numColumnsInExportFile);
 	this->numSetColumns = static_cast<long>(ceil(numColumnsUsedFromExportFile / 8.0));
-	this->setColumns = new unsigned char[this->numSetColumns];
+	//padded with zeros to a multiple of 8 bytes, for reading the flags 64 at a time
+	const size_t setColumnsSize = (this->numSetColumns + 7) & ~7;
+	this->setColumns = new unsigned char[setColumnsSize];
+	memset(this->setColumns, 0, setColumnsSize);
 	this->columnVal = new storageBytes[this->numColumns];
 	memset(this->columnVal, 0, this->numColumns * sizeof(storageBytes));
 
@@ -999,6 +1903,541 @@ void UnconvertFromZDW_Base::readColumnFieldStats()
 	}
 }
 
+//Compiles the steps to output each row of the block, so the column types and output selection
+//are considered once per block instead of for every row (see readNextRow),
+//along with the tables for reading each row's changed values (see readChangedValues).
+ERR_CODE UnconvertFromZDW_Base::compileDecodePlan()
+{
+	this->decodePlan.clear();
+	this->usedColumns.clear();
+	this->bRowCached = false;
+
+	//VISID_HIGH values are needed to output the VISID_LOW column.
+	bool bVisidLowOutput = false;
+	for (ULONG c = 0; c < this->numColumns; ++c)
+	{
+		if (this->columnType[c] == VISID_LOW && this->outputColumns[c] != IGNORE)
+			bVisidLowOutput = true;
+	}
+
+	//Only the changed values of the columns in the plan are decoded; the others are only read past.
+	this->trackedFlags.assign((this->numSetColumns + 7) & ~7, 0);
+	this->columnFlags.assign(this->numColumns, -1);
+
+	bool bColumnWritten = false;
+	for (ULONG c = 0; c < this->numColumns; ++c)
+	{
+		const UCHAR ct = this->columnType[c];
+		const bool bOutput = this->outputColumns[c] != IGNORE;
+		DecodeOp op;
+		op.column = c;
+		op.bOutput = bOutput;
+		op.bSeparator = bOutput && bColumnWritten;
+		op.base = this->columnBase[c];
+		op.cache = NULL;
+
+		if (ct == VISID_LOW) {
+			//output along with the adjacent VISID_HIGH column, which sets its value
+			if (bOutput) {
+				op.kind = DECODE_VISID_LOW;
+				this->decodePlan.push_back(op);
+			}
+			continue;
+		}
+		if (this->columnSize[c] > sizeof(storageBytes))
+			return CORRUPTED_DATA_ERROR;
+
+		if (!this->columnSize[c]) {
+			op.kind = DECODE_DEFAULT;
+		} else {
+			this->columnFlags[c] = this->usedColumns.size();
+			this->usedColumns.push_back(c);
+			switch (ct)
+			{
+				case VARCHAR:
+				case TEXT:
+				case TINYTEXT:
+				case MEDIUMTEXT:
+				case LONGTEXT:
+				case DATETIME:
+				case CHAR_2:
+					op.kind = this->version >= 9 ? DECODE_TEXT : DECODE_OTHER;
+				break;
+				case TINY: case SHORT: case LONG: case LONGLONG:
+					op.kind = DECODE_UNSIGNED;
+				break;
+				case TINY_SIGNED: case SHORT_SIGNED: case LONG_SIGNED: case LONGLONG_SIGNED:
+					op.kind = DECODE_SIGNED;
+				break;
+				case CHAR:
+					op.kind = this->version >= 5 ? DECODE_CHAR : DECODE_OTHER;
+				break;
+				case VISID_HIGH:
+					op.kind = DECODE_VISID_HIGH;
+				break;
+				default:
+					op.kind = DECODE_OTHER;
+				break;
+			}
+		}
+
+		if (!bOutput) {
+			//A VISID_HIGH column sets the value of the VISID_LOW column, even when not output.
+			if (op.kind != DECODE_VISID_HIGH || !bVisidLowOutput)
+				continue;
+		} else {
+			bColumnWritten = true;
+		}
+		if (this->columnSize[c]) {
+			const size_t u = this->usedColumns.size() - 1;
+			this->trackedFlags[u / 8] |= 1u << (u % 8);
+		}
+		this->decodePlan.push_back(op);
+	}
+	for (size_t i = 0; i < this->rowFilters.size(); ++i)
+	{
+		const long u = this->columnFlags[this->rowFilters[i].column];
+		if (u >= 0)
+			this->trackedFlags[u / 8] |= 1u << (u % 8);
+	}
+	this->flagByteOffsets.resize(this->numSetColumns);
+	compileRowFilters();
+
+	FormattedValue empty;
+	empty.bValid = false;
+	empty.value = 0;
+	empty.text = NULL;
+	empty.length = 0;
+	this->formattedValues.assign(this->decodePlan.size(), empty);
+	for (size_t i = 0; i < this->decodePlan.size(); ++i)
+		this->decodePlan[i].cache = &this->formattedValues[i];
+
+	//For each byte of the sameness flags, sum the widths of the values flagged by each of its values.
+	//Flags set beyond the last used column mark the row as corrupt.
+	const size_t numUsed = this->usedColumns.size();
+	this->flagByteWidths.assign(this->numSetColumns * 256, 0);
+	for (long i = 0; i < this->numSetColumns; ++i)
+	{
+		UCHAR *widths = &this->flagByteWidths[i * 256];
+		for (unsigned int bits = 1; bits < 256; ++bits)
+		{
+			const unsigned int b = __builtin_ctz(bits);
+			const size_t u = i * 8 + b;
+			const UCHAR rest = widths[bits & (bits - 1)];
+			widths[bits] = (u >= numUsed || rest == INVALID_FLAGS) ? INVALID_FLAGS :
+				rest + this->columnSize[this->usedColumns[u]];
+		}
+	}
+	return OK;
+}
+
+//Returns: whether a value comparing to an operand as cmp (<0, 0, >0) satisfies op
+static inline bool satisfiesComparison(const int cmp, const PREDICATE_OP op)
+{
+	switch (op)
+	{
+		case EQUAL: return cmp == 0;
+		case LESS: return cmp < 0;
+		case LESS_EQUAL: return cmp <= 0;
+		case GREATER: return cmp > 0;
+		case GREATER_EQUAL: return cmp >= 0;
+	}
+	return true;
+}
+
+//Returns: strcmp order of text and operand
+static inline int compareText(const char* text, const size_t length, const string& operand)
+{
+	const int cmp = memcmp(text, operand.data(), std::min(length, operand.size()));
+	if (cmp)
+		return cmp;
+	return length < operand.size() ? -1 : (length > operand.size() ? 1 : 0);
+}
+
+//The digits of a decimal number, without leading zeros of the integer part or trailing zeros of the fraction.
+struct DecimalDigits
+{
+	bool bNegative;
+	const char *integer, *fraction;
+	size_t integerLength, fractionLength;
+};
+
+//Returns: whether text is a decimal number, e.g. "-12.50"
+static bool parseDecimal(const char* text, const size_t length, DecimalDigits& digits)
+{
+	const char *pos = text, *end = text + length;
+	digits.bNegative = pos != end && *pos == '-';
+	if (pos != end && (*pos == '-' || *pos == '+'))
+		++pos;
+	const char *integer = pos;
+	while (pos != end && isdigit(static_cast<UCHAR>(*pos)))
+		++pos;
+	const char *integerEnd = pos, *fraction = pos, *fractionEnd = pos;
+	if (pos != end && *pos == '.') {
+		fraction = ++pos;
+		while (pos != end && isdigit(static_cast<UCHAR>(*pos)))
+			++pos;
+		fractionEnd = pos;
+	}
+	if (pos != end || (integer == integerEnd && fraction == fractionEnd))
+		return false;
+
+	while (integer != integerEnd && *integer == '0')
+		++integer;
+	while (fractionEnd != fraction && fractionEnd[-1] == '0')
+		--fractionEnd;
+	digits.integer = integer;
+	digits.integerLength = integerEnd - integer;
+	digits.fraction = fraction;
+	digits.fractionLength = fractionEnd - fraction;
+	if (!digits.integerLength && !digits.fractionLength)
+		digits.bNegative = false; //-0 is 0
+	return true;
+}
+
+//Returns: numeric order (<0, 0, >0) of two decimal numbers
+static int compareDecimals(const DecimalDigits& a, const DecimalDigits& b)
+{
+	if (a.bNegative != b.bNegative)
+		return a.bNegative ? -1 : 1;
+
+	int cmp;
+	if (a.integerLength != b.integerLength) {
+		cmp = a.integerLength < b.integerLength ? -1 : 1;
+	} else {
+		cmp = memcmp(a.integer, b.integer, a.integerLength);
+		if (!cmp) {
+			cmp = memcmp(a.fraction, b.fraction, std::min(a.fractionLength, b.fractionLength));
+			if (!cmp)
+				cmp = a.fractionLength < b.fractionLength ? -1 : (a.fractionLength > b.fractionLength ? 1 : 0);
+		}
+	}
+	cmp = (cmp > 0) - (cmp < 0);
+	return a.bNegative ? -cmp : cmp;
+}
+
+//Returns: whether a decimal value satisfies the comparison with any of the filter's operands
+static bool satisfiesDecimal(const DecimalDigits& value, const RowFilter& filter)
+{
+	for (size_t i = 0; i < filter.texts.size(); ++i)
+	{
+		DecimalDigits operand;
+		if (parseDecimal(filter.texts[i].data(), filter.texts[i].size(), operand) &&
+				satisfiesComparison(compareDecimals(value, operand), filter.op))
+			return true;
+	}
+	return false;
+}
+
+template <typename N>
+static inline bool satisfiesNumber(const N value, const RowFilter& filter)
+{
+	if (filter.op != EQUAL) {
+		const N operand = static_cast<N>(filter.numbers[0]);
+		return satisfiesComparison(value < operand ? -1 : (operand < value ? 1 : 0), filter.op);
+	}
+	for (size_t i = 0; i < filter.numbers.size(); ++i)
+	{
+		if (value == static_cast<N>(filter.numbers[i]))
+			return true;
+	}
+	return false;
+}
+
+//Resolves the row predicates against the file's columns, parsing their operands by the columns' types.
+ERR_CODE UnconvertFromZDW_Base::resolveRowPredicates()
+{
+	this->rowFilters.clear();
+	for (vector<RowPredicate>::const_iterator predicate = this->rowPredicates.begin();
+			predicate != this->rowPredicates.end(); ++predicate)
+	{
+		const int c = findFileColumn(predicate->column);
+		if (c < 0)
+			return BAD_REQUESTED_COLUMN;
+		const vector<string>& operands = predicate->operands;
+		if (operands.empty() || (predicate->op != EQUAL && operands.size() > 1))
+			return BAD_PARAMETER;
+
+		RowFilter filter;
+		filter.column = c;
+		filter.op = predicate->op;
+		filter.bEmptyMatches = false;
+		filter.bCached = false;
+		filter.stored = 0;
+		filter.bResult = false;
+
+		const UCHAR ct = this->columnType[c];
+		switch (ct)
+		{
+			case TINY: case SHORT: case LONG: case LONGLONG:
+			case TINY_SIGNED: case SHORT_SIGNED: case LONG_SIGNED: case LONGLONG_SIGNED:
+			{
+				const bool bSigned = ct == TINY_SIGNED || ct == SHORT_SIGNED || ct == LONG_SIGNED || ct == LONGLONG_SIGNED;
+				filter.kind = bSigned ? FILTER_SIGNED : FILTER_UNSIGNED;
+				for (size_t i = 0; i < operands.size(); ++i)
+				{
+					const char *operand = operands[i].c_str();
+					char *end;
+					if (!*operand || isspace(static_cast<UCHAR>(*operand)) || (!bSigned && *operand == '-'))
+						return BAD_PARAMETER;
+					errno = 0;
+					filter.numbers.push_back(bSigned ? strtoll(operand, &end, 10) : strtoull(operand, &end, 10));
+					if (*end || errno == ERANGE)
+						return BAD_PARAMETER; //not a number, or out of range
+				}
+			}
+			break;
+			case CHAR:
+				if (predicate->op != EQUAL || this->version < 5)
+					return BAD_PARAMETER;
+				filter.kind = FILTER_CHAR;
+				for (size_t i = 0; i < operands.size(); ++i)
+				{
+					//a character code, plus any escaped character (see outputValue)
+					const string& operand = operands[i];
+					if (operand.size() > 2)
+						return BAD_PARAMETER;
+					ULONGLONG code = 0;
+					for (size_t j = operand.size(); j--; )
+						code = code * 256 + static_cast<UCHAR>(operand[j]);
+					filter.numbers.push_back(code);
+				}
+			break;
+			case DECIMAL:
+			{
+				if (this->version < 4)
+					return BAD_PARAMETER;
+				//Decimals are compared numerically, with an empty value as 0 (as it is output).
+				filter.kind = FILTER_DECIMAL;
+				filter.texts = operands;
+				DecimalDigits zero, operand;
+				parseDecimal("0", 1, zero);
+				for (size_t i = 0; i < operands.size(); ++i)
+				{
+					if (!parseDecimal(operands[i].data(), operands[i].size(), operand))
+						return BAD_PARAMETER; //not a number
+				}
+				filter.bEmptyMatches = satisfiesDecimal(zero, filter);
+			}
+			break;
+			case VARCHAR:
+			case TEXT:
+			case TINYTEXT:
+			case MEDIUMTEXT:
+			case LONGTEXT:
+			case DATETIME:
+			case CHAR_2:
+				filter.kind = this->version >= 9 ? FILTER_DICTIONARY : FILTER_TEXT;
+				filter.texts = operands;
+				if (predicate->op == EQUAL) {
+					filter.bEmptyMatches = std::find(operands.begin(), operands.end(), string()) != operands.end();
+				} else {
+					filter.bEmptyMatches = satisfiesComparison(compareText("", 0, operands[0]), predicate->op);
+				}
+			break;
+			default:
+				return BAD_PARAMETER; //visitor IDs aren't supported
+		}
+		this->rowFilters.push_back(filter);
+	}
+	return OK;
+}
+
+bool UnconvertFromZDW_Base::isFilterColumn(const size_t c) const
+{
+	for (size_t i = 0; i < this->rowFilters.size(); ++i)
+	{
+		if (this->rowFilters[i].column == c)
+			return true;
+	}
+	return false;
+}
+
+//Version 9+: Binary search of the block's sorted dictionary.
+//Returns: the offset of the first entry not less than text (or greater than it, if bPastEqual),
+//  or the dictionary's size when there is none
+ULONGLONG UnconvertFromZDW_Base::findDictionaryEntry(const string& text, const bool bPastEqual)
+{
+	assert(!this->dictionaryEnds.empty());
+	const ULONGLONG *ends = &this->dictionaryEnds[0];
+
+	//Both bounds are kept at the start of an entry (or the dictionary's end).
+	ULONGLONG lo = 0, hi = this->dictionarySize;
+	while (lo < hi)
+	{
+		//Find the entry holding the middle offset: it follows the last null terminator before it.
+		const ULONGLONG mid = lo + (hi - lo) / 2;
+		ULONGLONG start = lo;
+		if (mid > lo) {
+			size_t w = (mid - 1) / 64;
+			ULONGLONG bits = ends[w] & (~0ULL >> (63 - (mid - 1) % 64));
+			while (!bits && w > lo / 64)
+				bits = ends[--w];
+			if (bits) {
+				const ULONGLONG end = w * 64 + 63 - __builtin_clzll(bits);
+				if (end >= lo)
+					start = end + 1;
+			}
+		}
+
+		size_t length;
+		const char *entry = GetWord(start, this->row, length);
+		const int cmp = compareText(entry, length, text);
+		if (cmp < 0 || (bPastEqual && !cmp))
+			lo = start + length + 1;
+		else
+			hi = start;
+	}
+	return std::min(lo, this->dictionarySize);
+}
+
+//Resolves the text operands of the row filters against the block's dictionary.
+void UnconvertFromZDW_Base::compileRowFilters()
+{
+	for (vector<RowFilter>::iterator filter = this->rowFilters.begin(); filter != this->rowFilters.end(); ++filter)
+	{
+		filter->bCached = false;
+		filter->offsets.clear();
+		if (filter->kind != FILTER_DICTIONARY || this->dictionaryEnds.empty())
+			continue;
+
+		switch (filter->op)
+		{
+			case EQUAL:
+				for (size_t i = 0; i < filter->texts.size(); ++i)
+				{
+					const string& text = filter->texts[i];
+					const ULONGLONG offset = findDictionaryEntry(text, false);
+					if (text.empty() || offset >= this->dictionarySize)
+						continue;
+					size_t length;
+					const char *entry = GetWord(offset, this->row, length);
+					if (!compareText(entry, length, text))
+						filter->offsets.push_back(offset);
+				}
+				std::sort(filter->offsets.begin(), filter->offsets.end());
+			break;
+			case LESS:
+			case GREATER_EQUAL:
+				filter->offsets.push_back(findDictionaryEntry(filter->texts[0], false));
+			break;
+			case LESS_EQUAL:
+			case GREATER:
+				filter->offsets.push_back(findDictionaryEntry(filter->texts[0], true));
+			break;
+		}
+	}
+}
+
+//Returns: false when no row of the block can satisfy the row filters, e.g., when a text value sought is absent
+//  from its dictionary, or (when the block index is loaded) the block's zone maps rule it out
+bool UnconvertFromZDW_Base::blockMaySatisfyFilters() const
+{
+	for (vector<RowFilter>::const_iterator filter = this->rowFilters.begin(); filter != this->rowFilters.end(); ++filter)
+	{
+		if (filter->kind == FILTER_DICTIONARY && filter->op == EQUAL && filter->offsets.empty() &&
+				!filter->bEmptyMatches && !this->dictionaryEnds.empty())
+			return false;
+
+		if (this->blockEntry && filter->kind != FILTER_DECIMAL) { //a decimal's statistics are of its text
+			const vector<string>& operands = this->rowPredicates[filter - this->rowFilters.begin()].operands;
+			if (filter->op == EQUAL ? !entryMayContain(*this->blockEntry, filter->column, operands) :
+					!entryCanMatch(*this->blockEntry, filter->column, filter->op, operands[0]))
+				return false;
+		}
+	}
+	return true;
+}
+
+//Evaluates a row filter for a stored value of its column.
+ERR_CODE UnconvertFromZDW_Base::evaluateFilter(const RowFilter& filter, const ULONGLONG stored, bool& bSatisfied)
+{
+	const ULONGLONG value = stored ? stored + this->columnBase[filter.column] : 0;
+	switch (filter.kind)
+	{
+		case FILTER_UNSIGNED:
+		case FILTER_CHAR:
+			bSatisfied = satisfiesNumber<ULONGLONG>(value, filter);
+		break;
+		case FILTER_SIGNED:
+			bSatisfied = satisfiesNumber<SLONGLONG>(static_cast<SLONGLONG>(value), filter);
+		break;
+		case FILTER_DICTIONARY:
+			if (!stored) {
+				bSatisfied = filter.bEmptyMatches;
+				break;
+			}
+			switch (filter.op)
+			{
+				case EQUAL:
+					bSatisfied = std::binary_search(filter.offsets.begin(), filter.offsets.end(), value);
+				break;
+				case LESS:
+				case LESS_EQUAL:
+					bSatisfied = value < filter.offsets[0];
+				break;
+				case GREATER:
+				case GREATER_EQUAL:
+					bSatisfied = value >= filter.offsets[0];
+				break;
+			}
+		break;
+		case FILTER_DECIMAL:
+		{
+			if (!stored) {
+				bSatisfied = filter.bEmptyMatches;
+				break;
+			}
+			if (value > this->dictionarySize)
+				return CORRUPTED_DATA_ERROR;
+			size_t length;
+			const char *text = GetWord(value, this->row, length);
+			DecimalDigits digits;
+			bSatisfied = parseDecimal(text, length, digits) && satisfiesDecimal(digits, filter);
+		}
+		break;
+		case FILTER_TEXT:
+		{
+			if (!stored) {
+				bSatisfied = filter.bEmptyMatches;
+				break;
+			}
+			if (value > this->dictionarySize)
+				return CORRUPTED_DATA_ERROR;
+			size_t length;
+			const char *text = GetWord(value, this->row, length);
+			bSatisfied = false;
+			for (size_t i = 0; i < filter.texts.size() && !bSatisfied; ++i)
+				bSatisfied = satisfiesComparison(compareText(text, length, filter.texts[i]), filter.op);
+		}
+		break;
+	}
+	return OK;
+}
+
+//Checks the current row's values against the row filters.
+//A filter is only evaluated again when its column's value has changed.
+inline ERR_CODE UnconvertFromZDW_Base::filterRow(bool& bSatisfied)
+{
+	for (vector<RowFilter>::iterator filter = this->rowFilters.begin(); filter != this->rowFilters.end(); ++filter)
+	{
+		const ULONGLONG stored = this->columnVal[filter->column].n;
+		if (!filter->bCached || stored != filter->stored) {
+			const ERR_CODE eRet = evaluateFilter(*filter, stored, filter->bResult);
+			if (eRet != OK)
+				return eRet;
+			filter->stored = stored;
+			filter->bCached = true;
+		}
+		if (!filter->bResult) {
+			bSatisfied = false;
+			return OK;
+		}
+	}
+	bSatisfied = true;
+	return OK;
+}
+
 string UnconvertFromZDW_Base::getBlockHeaderString() const
 {
 	string header = "***ZDW BLOCK HEADER*** NON-EMPTY COLUMNS: ";
@@ -1214,7 +2653,17 @@ ERR_CODE UnconvertFromZDW_Base::readHeader()
 		}
 	}
 
+	//6. Resolve the row predicates.
+	const ERR_CODE eRet = resolveRowPredicates();
+	if (eRet != OK)
+		return eRet;
+
 	setState(ZDW_PARSE_BLOCK_HEADER);
+
+	//Blocks whose zone maps or Bloom filters rule out the row filters are skipped via the block index,
+	//when it can be read in place.
+	if (!this->rowFilters.empty() && this->input->is_in_memory())
+		loadBlockIndex();
 	return OK;
 }
 
@@ -1266,195 +2715,360 @@ void UnconvertFromZDW<T>::outputDefault(T& buffer, const UCHAR type)
 }
 
 //****************************************************
+//Outputs a column's (non-default) value, based on type.
 template <typename T>
-ERR_CODE UnconvertFromZDW<T>::readNextRow(T& buffer)
+ERR_CODE UnconvertFromZDW<T>::outputValue(T& buffer, const size_t c, const storageBytes& val)
 {
-	long u = 0;
-	char *pos;
+	const char *pos;
+	size_t length;
 	ULONG index;
-	ULONGLONG visid_low = 0;
 	int tempLength;
 	char temp[64];
-	bool bColumnWritten = false;
-
-	IncrementCurrentRowNumber();
-
-	//1. Read 'sameness' bit flags.
-	readBytes(this->setColumns, this->numSetColumns); //bit flags -- are field values the same as in the previous row?
 
-	//2. Output column values.
-	for (size_t c = 0; c < this->numColumns; ++c)
+	const UCHAR ct = this->columnType[c];
+	switch (ct)
 	{
-		const UCHAR ct = this->columnType[c];
-		if (ct == VISID_LOW) {
-			//Output the visid_low value, if selected for output.
-			if (this->outputColumns[c] != IGNORE) {
-				if (bColumnWritten)
-					buffer.writeSeparator(tab, 1);
-				tempLength = llutoa(visid_low);
-				buffer.write(this->temp_buf + TEMP_BUF_LAST_POS - tempLength, tempLength);
+		case VIRTUAL_EXPORT_FILE_BASENAME: assert(!"VIRTUAL_EXPORT_FILE_BASENAME should only get default value"); break;
+		case VIRTUAL_EXPORT_ROW: assert(!"VIRTUAL_EXPORT_ROW should only get default value"); break;
+		case VISID_HIGH: assert(!"VISID_HIGH is decoded by its own kernel"); break;
+		case VISID_LOW: assert(!"VISID_LOW should be skipped"); break;
+		case VARCHAR:
+		case TEXT:
+		case TINYTEXT:
+		case MEDIUMTEXT:
+		case LONGTEXT:
+		case DATETIME:
+		case CHAR_2:
+			if (val.n)
+			{
+				index = val.n + this->columnBase[c];
+				if (index > this->dictionarySize)
+					return CORRUPTED_DATA_ERROR;
+				pos = GetWord(index, row, length);
+
+				// In ZDW v9 or higher, all of the column strings are stored
+				// in a large persistent map that isn't modified throughout the
+				// ZDW process.  Thus, we can simply adjust our buffer pointers
+				// in v9.  However, in earlier formats the data is stored in
+				// a dictionary tree, which requires copying/reversing in
+				// order to extract data from correctly.  This reversed copy
+				// of the data is stored in `row`, which is reused from column
+				// to column.  Thus, we must copy the data out.
+				if (this->version >= 9) {
+					buffer.writePtr(pos, length);
+				} else {
+					buffer.write(pos, length);
+				}
+			} else {
+				//There's an empty field value.
+				outputDefault(buffer, ct);
 			}
-			continue; //handled along with the adjacent VISID_HIGH column
-		}
-
-		if (this->outputColumns[c] == IGNORE) //if we don't need to output this column index, skip it
-		{
-			//Parse only to maintain position in source file -- skip the rest of processing.
-			if (this->columnSize[c])
+			break;
+		case CHAR:
+			if (val.n) {
+				if (this->version >= 5) {
+					//Deserialize character text (possibly an escaped character sequence).
+					const ULONGLONG chartuple = val.n + this->columnBase[c];
+					temp[0] = static_cast<char>(chartuple);
+					if (temp[0] != '\\') {
+						if (!temp[0]) //there's an empty field for this column-row
+							outputDefault(buffer, ct);
+						else
+							buffer.write(temp, 1);
+					} else {
+						//Output escaped character (e.g. "\\\t")
+						temp[1] = static_cast<char>(chartuple / 256);
+						buffer.write(temp, 2);
+					}
+				} else {
+					//Before version 5, the converter included no more than one byte per char field.
+					temp[0] = static_cast<char>(val.n);
+					buffer.write(temp, 1);
+				}
+			} else {
+				outputDefault(buffer, CHAR);
+			}
+			break;
+		case TINY:
+		case SHORT:
+		case LONG:
+		case LONGLONG:
+			tempLength = llutoa(val.n ? val.n + this->columnBase[c] : 0);
+			buffer.write(this->temp_buf + TEMP_BUF_LAST_POS - tempLength, tempLength);
+			break;
+		case TINY_SIGNED:
+		case SHORT_SIGNED:
+		case LONG_SIGNED:
+		case LONGLONG_SIGNED:
+			tempLength = lltoa(val.n ? val.n + this->columnBase[c] : 0);
+			buffer.write(this->temp_buf + TEMP_BUF_LAST_POS - tempLength, tempLength);
+			break;
+		case DECIMAL:
+			if (val.n)
 			{
-				storageBytes& val = this->columnVal[c];
-				if (this->setColumns[u / 8] & (1u << (u % 8))) //is the bit for this column set?
+				if (this->version >= 4)
 				{
-					//This column's value is different from that of the previous row,
-					//so we need to read the new value to stay current in the data stream.
-					val.n = 0;
-					readBytes(val.c, this->columnSize[c]);
-				}
-				++u;
-
-				if (ct == VISID_HIGH) {
-					//Store the value for visid_low, to output when we get to its column index (if it's not excluded).
 					index = val.n + this->columnBase[c];
-					if (index > this->numVisitors)
+					if (index > this->dictionarySize)
 						return CORRUPTED_DATA_ERROR;
-
-					visid_low = this->visitors[this->visitors[index].m_PrevID.n].m_VID;
+					pos = GetWord(index, row, length);
+					buffer.write(pos, length);
+				} else { //version 1-3
+					tempLength = sprintf(temp, "%0.12lf", (val.n + this->columnBase[c]) / this->decimalFactor);
+					buffer.write(temp, tempLength);
 				}
+			} else {
+				outputDefault(buffer, DECIMAL);
 			}
-			continue;
-		}
-
-		if (bColumnWritten) //tab-delineated columns
-			buffer.writeSeparator(tab, 1);
+			break;
+	}
+	return OK;
+}
 
-		if (!this->columnSize[c])
+//****************************************************
+//Formats a number in decimal, ending at end.
+//Returns: the text
+static inline char* formatDecimal(char* end, ULONGLONG value)
+{
+	do
+	{
+		*--end = static_cast<char>('0' + value % 10);
+		value /= 10;
+	} while (value != 0);
+	return end;
+}
+
+static inline char* formatSignedDecimal(char* end, const SLONGLONG value)
+{
+	if (value >= 0)
+		return formatDecimal(end, value);
+	char *text = formatDecimal(end, -static_cast<ULONGLONG>(value));
+	*--text = '-';
+	return text;
+}
+
+//Outputs the text a step of the decode plan cached for its column's last value.
+template <typename T>
+static inline void writeCachedValue(T& buffer, const DecodeOp& op)
+{
+	const FormattedValue& cache = *op.cache;
+	if (!cache.length)
+		buffer.writeEmpty();
+	else if (op.kind == DECODE_TEXT)
+		buffer.writePtr(cache.text, cache.length); //in the dictionary, which persists through the block
+	else
+		buffer.write(cache.text, cache.length);
+}
+
+//Runs a step of the block's decode plan, outputting the column's current value.
+//Kernels are specialized by the kind of step.
+//The text of a value is cached in the step, so it is only formatted when the column's value changes.
+template <typename T>
+template <int KIND>
+ERR_CODE UnconvertFromZDW<T>::decodeColumn(T& buffer, const DecodeOp& op, ULONGLONG& visid_low)
+{
+	const storageBytes& val = this->columnVal[op.column];
+
+	if (op.bSeparator) //tab-delineated columns
+		buffer.writeSeparator(tab, 1);
+
+	ULONG index = 0;
+	switch (KIND)
+	{
+		case DECODE_DEFAULT:
+			outputDefault(buffer, this->columnType[op.column]);
+			return OK;
+		case DECODE_OTHER:
+			return outputValue(buffer, op.column, val);
+		case DECODE_VISID_HIGH:
+			index = val.n + op.base;
+			if (index > this->numVisitors)
+				return CORRUPTED_DATA_ERROR;
+
+			//Store the value for visid_low, to output when we get to its column index (if it's not excluded).
+			visid_low = this->visitors[this->visitors[index].m_PrevID.n].m_VID;
+			if (!op.bOutput)
+				return OK;
+			break;
+	}
+
+	const ULONGLONG value = KIND == DECODE_VISID_LOW ? visid_low : val.n;
+	FormattedValue& cache = *op.cache;
+	if (!cache.bValid || value != cache.value) {
+		char *const formattedEnd = cache.formatted + sizeof(cache.formatted);
+		cache.text = cache.formatted;
+		size_t length = 0;
+		switch (KIND)
 		{
-			outputDefault(buffer, ct);
-			//if (ct == VISID_HIGH) visid_low = 0;
-			//in order to write out a default value for visid_low, this logic should technically happen here, and in the "if (this->outputColumns[c] == IGNORE)" block above.
-			//However, since visid_low already defaults to 0 above, we don't actually need to execute this check and assignment and slow things down.
-		} else {
-			//3. Read new value of this column when it is not the same as that of the previous row.
-			storageBytes& val = this->columnVal[c];
-			if (this->setColumns[u / 8] & (1u << (u % 8))) //is the bit for this column set?
+			case DECODE_TEXT:
+				if (value) {
+					index = value + op.base;
+					if (index > this->dictionarySize)
+						return CORRUPTED_DATA_ERROR;
+					cache.text = GetWord(index, row, length);
+				}
+				break;
+			case DECODE_UNSIGNED:
+				cache.text = formatDecimal(formattedEnd, value ? value + op.base : 0);
+				length = formattedEnd - cache.text;
+				break;
+			case DECODE_SIGNED:
+				cache.text = formatSignedDecimal(formattedEnd, value ? value + op.base : 0);
+				length = formattedEnd - cache.text;
+				break;
+			case DECODE_CHAR:
 			{
-				//This column's value is different from that of the previous row,
-				//so read the new value.
-				val.n = 0;
-				readBytes(val.c, this->columnSize[c]);
+				const ULONGLONG chartuple = value ? value + op.base : 0;
+				cache.formatted[0] = static_cast<char>(chartuple);
+				if (!cache.formatted[0]) {
+					length = 0;
+				} else if (cache.formatted[0] != '\\') {
+					length = 1;
+				} else {
+					//Output escaped character (e.g. "\\\t")
+					cache.formatted[1] = static_cast<char>(chartuple / 256);
+					length = 2;
+				}
 			}
-			++u;
+			break;
+			case DECODE_VISID_HIGH:
+				cache.text = formatDecimal(formattedEnd, this->visitors[index].m_VID);
+				length = formattedEnd - cache.text;
+				break;
+			case DECODE_VISID_LOW:
+				cache.text = formatDecimal(formattedEnd, value);
+				length = formattedEnd - cache.text;
+				break;
+		}
+		cache.length = length;
+		cache.value = value;
+		cache.bValid = true;
+	}
+	writeCachedValue(buffer, op);
+	return OK;
+}
 
-			//4. Output this column's value, based on type.
-			switch (ct)
+//Outputs a row whose values are all the same as those of the previous row,
+//which the decode plan output, from the text cached in the plan's steps.
+template <typename T>
+ERR_CODE UnconvertFromZDW<T>::outputCachedRow(T& buffer)
+{
+	for (size_t i = 0; i < this->decodePlan.size(); ++i)
+	{
+		const DecodeOp& op = this->decodePlan[i];
+		if (op.bSeparator)
+			buffer.writeSeparator(tab, 1);
+		switch (op.kind)
+		{
+			case DECODE_DEFAULT:
+				outputDefault(buffer, this->columnType[op.column]);
+				break;
+			case DECODE_OTHER:
 			{
-				case VIRTUAL_EXPORT_FILE_BASENAME: assert(!"VIRTUAL_EXPORT_FILE_BASENAME should only get default value"); break;
-				case VIRTUAL_EXPORT_ROW: assert(!"VIRTUAL_EXPORT_ROW should only get default value"); break;
-				case VISID_LOW: assert(!"VISID_LOW should be skipped"); break;
-				case VARCHAR:
-				case TEXT:
-				case TINYTEXT:
-				case MEDIUMTEXT:
-				case LONGTEXT:
-				case DATETIME:
-				case CHAR_2:
-					if (val.n)
-					{
-						index = val.n + this->columnBase[c];
-						if (index > this->dictionarySize)
-							return CORRUPTED_DATA_ERROR;
-						pos = GetWord(index, row);
-
-						// In ZDW v9 or higher, all of the column strings are stored
-						// in a large persistent map that isn't modified throughout the
-						// ZDW process.  Thus, we can simply adjust our buffer pointers
-						// in v9.  However, in earlier formats the data is stored in
-						// a dictionary tree, which requires copying/reversing in
-						// order to extract data from correctly.  This reversed copy
-						// of the data is stored in `row`, which is reused from column
-						// to column.  Thus, we must copy the data out.
-						if (this->version >= 9) {
-							buffer.writePtr(pos, strlen(pos));
-						} else {
-							buffer.write(pos, strlen(pos));
-						}
-					} else {
-						//There's an empty field value.
-						outputDefault(buffer, ct);
-					}
-					break;
-				case VISID_HIGH:
-					index = val.n + this->columnBase[c];
-					if (index > this->numVisitors)
-						return CORRUPTED_DATA_ERROR;
+				const ERR_CODE eRet = outputValue(buffer, op.column, this->columnVal[op.column]);
+				if (eRet != OK)
+					return eRet;
+			}
+			break;
+			default:
+				if (op.bOutput)
+					writeCachedValue(buffer, op);
+				break;
+		}
+	}
+	return OK;
+}
 
-					tempLength = llutoa(this->visitors[index].m_VID);
-					buffer.write(this->temp_buf + TEMP_BUF_LAST_POS - tempLength, tempLength);
-					//Store the value for visid_low, to output when we get to its column index (if it's not excluded).
-					visid_low = this->visitors[this->visitors[index].m_PrevID.n].m_VID;
-					break;
-				case CHAR:
-					if (this->columnVal[c].n) {
-						if (this->version >= 5) {
-							//Deserialize character text (possibly an escaped character sequence).
-							const ULONGLONG chartuple = val.n + this->columnBase[c];
-							temp[0] = static_cast<char>(chartuple);
-							if (temp[0] != '\\') {
-								if (!temp[0]) //there's an empty field for this column-row
-									outputDefault(buffer, ct);
-								else
-									buffer.write(temp, 1);
-							} else {
-								//Output escaped character (e.g. "\\\t")
-								temp[1] = static_cast<char>(chartuple / 256);
-								buffer.write(temp, 2);
-							}
-						} else {
-							//Before version 5, the converter included no more than one byte per char field.
-							temp[0] = static_cast<char>(val.n);
-							buffer.write(temp, 1);
-						}
-					} else {
-						outputDefault(buffer, CHAR);
-					}
-					break;
-				case TINY:
-				case SHORT:
-				case LONG:
-				case LONGLONG:
-					tempLength = llutoa(val.n ? val.n + this->columnBase[c] : 0);
-					buffer.write(this->temp_buf + TEMP_BUF_LAST_POS - tempLength, tempLength);
-					break;
-				case TINY_SIGNED:
-				case SHORT_SIGNED:
-				case LONG_SIGNED:
-				case LONGLONG_SIGNED:
-					tempLength = lltoa(val.n ? val.n + this->columnBase[c] : 0);
-					buffer.write(this->temp_buf + TEMP_BUF_LAST_POS - tempLength, tempLength);
-					break;
-				case DECIMAL:
-					if (val.n)
-					{
-						if (this->version >= 4)
-						{
-							index = val.n + this->columnBase[c];
-							if (index > this->dictionarySize)
-								return CORRUPTED_DATA_ERROR;
-							pos = GetWord(index, row);
-							buffer.write(pos, strlen(pos));
-						} else { //version 1-3
-							tempLength = sprintf(temp, "%0.12lf", (val.n + this->columnBase[c]) / this->decimalFactor);
-							buffer.write(temp, tempLength);
-						}
-					} else {
-						outputDefault(buffer, DECIMAL);
-					}
-					break;
+template <typename T>
+const typename UnconvertFromZDW<T>::DecodeKernel UnconvertFromZDW<T>::decodeKernels[DECODE_KIND_COUNT] = {
+	&UnconvertFromZDW<T>::template decodeColumn<DECODE_DEFAULT>,
+	&UnconvertFromZDW<T>::template decodeColumn<DECODE_TEXT>,
+	&UnconvertFromZDW<T>::template decodeColumn<DECODE_UNSIGNED>,
+	&UnconvertFromZDW<T>::template decodeColumn<DECODE_SIGNED>,
+	&UnconvertFromZDW<T>::template decodeColumn<DECODE_CHAR>,
+	&UnconvertFromZDW<T>::template decodeColumn<DECODE_VISID_HIGH>,
+	&UnconvertFromZDW<T>::template decodeColumn<DECODE_VISID_LOW>,
+	&UnconvertFromZDW<T>::template decodeColumn<DECODE_OTHER>
+};
+
+//****************************************************
+template <typename T>
+ERR_CODE UnconvertFromZDW<T>::readNextRow(T& buffer)
+{
+	ULONGLONG visid_low = 0;
+
+	//A block none of whose rows can satisfy the row filters is read past at once.
+	this->bRowFiltered = false;
+	if (!this->rowFilters.empty() && !this->rowsRead && !this->blockMaySatisfyFilters()) {
+		this->bRowFiltered = true;
+		return this->skipRowsInBlock(this->numLines);
+	}
+
+	IncrementCurrentRowNumber();
+
+	//1. Read 'sameness' bit flags.
+	if (this->bColumnarBlock) {
+		//Columnar block: take the row's values from those decoded for its batch of rows.
+		if (this->rowsRead >= this->columnarRowsEnd) {
+			const ERR_CODE eRet = this->decodeColumnarRows();
+			if (eRet != OK)
+				return eRet;
+		}
+		const ULONG k = this->rowsRead - this->columnarRowsBegin;
+		for (size_t s = 0; s < this->columnSegments.size(); ++s)
+			this->columnVal[this->columnSegments[s].column].n = this->columnarRows[s * COLUMNAR_BATCH_ROWS + k];
+	} else {
+		readBytes(this->setColumns, this->numSetColumns); //bit flags -- are field values the same as in the previous row?
+
+		//A row the same as the previous one repeats its output:
+		//the whole line when the output keeps it (and no row number is output), or else each column's cached text.
+		if (this->bRowCached) {
+			long i = 0;
+			while (i < this->numSetColumns && !this->setColumns[i])
+				++i;
+			if (i == this->numSetColumns) {
+				if (this->UseVirtualExportRowColumn() || !buffer.repeatLine()) {
+					const ERR_CODE eRet = outputCachedRow(buffer);
+					if (eRet != OK)
+						return eRet;
+					buffer.writeEndline(newline, 1);
+				}
+				++this->rowsRead;
+				return OK;
 			}
 		}
-		bColumnWritten = true;
+
+		//2. Read new column values.
+		const ERR_CODE eRet = this->readChangedValues(NULL, false);
+		if (eRet != OK)
+			return eRet;
 	}
 
+	//Leave out a row that doesn't satisfy the row filters, before formatting any of its text.
+	if (!this->rowFilters.empty()) {
+		bool bSatisfied;
+		const ERR_CODE eRet = this->filterRow(bSatisfied);
+		if (eRet != OK)
+			return eRet;
+		if (!bSatisfied) {
+			this->bRowFiltered = true;
+			this->bRowCached = false; //the plan's caches don't hold this row
+			++this->rowsRead;
+			return OK;
+		}
+	}
+
+	//3. Output the columns, by the block's decode plan.
+	const DecodeOp *op = this->decodePlan.empty() ? NULL : &this->decodePlan[0];
+	const DecodeOp *const end = op + this->decodePlan.size();
+	for ( ; op != end; ++op)
+	{
+		const ERR_CODE eRet = (this->*decodeKernels[op->kind])(buffer, *op, visid_low);
+		if (eRet != OK)
+			return eRet;
+	}
+	this->bRowCached = true;
+
 	//Done with line.
 	buffer.writeEndline(newline, 1);
 
@@ -1471,10 +3085,19 @@ ERR_CODE UnconvertFromZDW<T>::readNextRow(T& buffer)
 template <typename T>
 ERR_CODE UnconvertFromZDW<T>::parseNextBlock(T& buffer)
 {
-	ERR_CODE eRet = parseBlockHeader();
+	const ERR_CODE eRet = parseBlockHeader();
 	if (eRet != OK)
 		return eRet;
 
+	return parseBlockRows(buffer);
+}
+
+//Parses the rows of the block whose header was just read.
+template <typename T>
+ERR_CODE UnconvertFromZDW<T>::parseBlockRows(T& buffer)
+{
+	ERR_CODE eRet = OK;
+
 	printBlockHeader(buffer);
 
 	if (!this->bQuiet)
@@ -1484,12 +3107,25 @@ ERR_CODE UnconvertFromZDW<T>::parseNextBlock(T& buffer)
 	ULONGLONG equalityBitsSet = 0;
 	vector<ULONG> equalityBitsInColumn(this->numSetColumns * 8, 0);
 
+	//When showing stats, an indexed block's rows may be skipped without being scanned.
+	if (this->bShowBasicStatisticsOnly && !this->bTestOnly && !isLastBlock() && this->blockEntry)
+	{
+		const ULONGLONG rowDataLength = this->blockEntry->rowDataLength;
+		if (skipBytes(rowDataLength) == rowDataLength)
+			this->rowsRead = this->numLines;
+	}
 	//If testing, or showing stats, don't actually uncompress any data.
-	if (this->bTestOnly ||
+	else if (this->bTestOnly ||
 		//when showing stats, note we only need to scan through this block if there is another one following
 		(this->bShowBasicStatisticsOnly && !isLastBlock()))
 	{
-		ULONG index;
+		if (this->bColumnarBlock) {
+			eRet = this->readColumnSegments(true);
+			if (eRet == OK)
+				eRet = this->scanColumnarBlock(equalityBitsSet, equalityBitsInColumn);
+			if (eRet != OK)
+				return eRet;
+		}
 
 		//Read in the data and ensure lookup indices are valid, but output nothing.
 		//This code should mirror the read format of the non-test code below.
@@ -1498,83 +3134,43 @@ ERR_CODE UnconvertFromZDW<T>::parseNextBlock(T& buffer)
 			//Process a row.
 			readBytes(this->setColumns, this->numSetColumns); //bit flags -- are fields same as last row?
 
-			long u = 0;
-			for (size_t c = 0; c < this->numColumnsInExportFile; ++c)
-			{
-				if (this->columnType[c] == VISID_LOW)
-					continue; //handled along with the adjacent VISID_HIGH column
-
-				if (!this->columnSize[c])
-					continue;
-
-				storageBytes& val = this->columnVal[c];
-				if (this->setColumns[u / 8] & (1u << (u % 8))) //is the bit for this column set?
+			//Validate the field codes.  Values that didn't change were validated when read,
+			//except for the empty values of the block's first row.
+			if (this->bTestOnly && !this->rowsRead) {
+				for (size_t u = 0; u < this->usedColumns.size(); ++u)
 				{
-					//This column's value is different from that of the previous row,
-					//so read the new value.
-					val.n = 0;
-					readBytes(val.c, this->columnSize[c]);
-					if (this->bShowBasicStatisticsOnly) {
-						++equalityBitsSet;
-						++equalityBitsInColumn[u];
-					}
-				}
-				++u;
-
-				//Validate the field code.
-				if (this->bTestOnly) {
-					switch (this->columnType[c])
-					{
-						case VIRTUAL_EXPORT_FILE_BASENAME: assert(!"VIRTUAL_EXPORT_FILE_BASENAME should only get default value"); break;
-						case VISID_LOW: assert(!"VISID_LOW should be skipped"); break;
-						case VARCHAR:
-						case TEXT:
-						case TINYTEXT:
-						case MEDIUMTEXT:
-						case LONGTEXT:
-						case DATETIME:
-						case CHAR_2:
-							if (val.n)
-							{
-								index = val.n + this->columnBase[c];
-								if (index > this->dictionarySize)
-									return CORRUPTED_DATA_ERROR;
-							}
-							break;
-						case VISID_HIGH:
-							index = val.n + this->columnBase[c];
-							if (index > this->numVisitors)
-								return CORRUPTED_DATA_ERROR;
-							break;
-						case CHAR:
-						case TINY: case TINY_SIGNED:
-						case SHORT: case SHORT_SIGNED:
-						case LONG: case LONG_SIGNED:
-						case LONGLONG: case LONGLONG_SIGNED:
-							break; //nothing to test
-						case DECIMAL:
-							if (val.n)
-							{
-								if (this->version >= 4)
-								{
-									index = val.n + this->columnBase[c];
-									if (index > this->dictionarySize)
-										return CORRUPTED_DATA_ERROR;
-								}
-							}
-							break;
-					}
+					if (!(this->setColumns[u / 8] & (1u << (u % 8))) && !this->isValidColumnValue(this->usedColumns[u], 0))
+						return CORRUPTED_DATA_ERROR;
 				}
 			}
 
+			//Read the values that differ from those of the previous row.
+			eRet = this->readChangedValues(this->bShowBasicStatisticsOnly ? &equalityBitsInColumn[0] : NULL, this->bTestOnly);
+			if (eRet != OK)
+				return eRet;
+
 			//Done with line.
 			++this->rowsRead;
 		}
+		if (this->bShowBasicStatisticsOnly && !this->bColumnarBlock) {
+			for (size_t u = 0; u < equalityBitsInColumn.size(); ++u)
+				equalityBitsSet += equalityBitsInColumn[u];
+		}
 	} else if (!this->bShowBasicStatisticsOnly) {
 		//Normal parsing and output of the data.
+		if (this->bColumnarBlock) {
+			//An indexed block none of whose rows can satisfy the row filters is read past whole (see readNextRow),
+			//so its segments aren't read.
+			if (!this->blockEntry || this->rowFilters.empty() || this->blockMaySatisfyFilters()) {
+				eRet = this->readColumnSegments(false);
+				if (eRet != OK)
+					return eRet;
+			}
+		}
 
 		//Each iteration processes one row.
-		while (this->rowsRead < this->numLines && !isFinished())
+		//(A columnar block's segments have all been read, which may have reached the end of the input.)
+		while (this->rowsRead < this->numLines && (this->bColumnarBlock || !isFinished()))
 		{
 			//Process a row.
 			eRet = readNextRow(buffer);
@@ -1646,6 +3242,262 @@ bool UnconvertFromZDW<T>::printBlockHeader(T& buffer)
 	return true;
 }
 
+//*********************************************************************************
+namespace {
+
+//Decodes a block handed to it by the file's reader (see parseBlocksInParallel),
+//formatting its text into a private buffer.
+template<typename BufferedOutput_T>
+class BlockDecoder : public UnconvertFromZDW<BufferedOutput_T>
+{
+public:
+	explicit BlockDecoder(const UnconvertFromZDW_Base* header)
+		: UnconvertFromZDW<BufferedOutput_T>(header)
+		, eRet(OK)
+		, bDone(false)
+	{ }
+
+	//Prepares to decode the rows at [rows, rows + length), after the block's header has been swapped in.
+	void setRows(const char* rows, const size_t length, const size_t firstRow)
+	{
+		delete this->input;
+		this->input = BufferedInput::openMemory(rows, length);
+		this->SetCurrentRowNumber(firstRow);
+	}
+
+	void decode(const vector<int>& outputOrder)
+	{
+		{
+			BufferedOutput_T buffer(&this->text);
+			if (!outputOrder.empty())
+				buffer.setOutputColumnOrder(&outputOrder[0], outputOrder.size());
+			try {
+				this->eRet = this->parseBlockRows(buffer);
+			} catch (ZDWException& ex) {
+				this->eRet = ex.code;
+			}
+		}
+		this->cleanupBlock();
+	}
+
+	vector<char> rowData; //the block's rows, when they aren't held in memory by the reader
+	string text; //the block's output
+	ERR_CODE eRet;
+	bool bDone; //set when text is ready to output
+};
+
+//Blocks waiting for a decoding thread.
+template<typename BufferedOutput_T>
+struct BlockQueue
+{
+	BlockQueue(const vector<int>& outputOrder)
+		: outputOrder(outputOrder)
+		, bClosed(false)
+	{
+		pthread_mutex_init(&this->mutex, NULL);
+		pthread_cond_init(&this->blockReady, NULL);
+		pthread_cond_init(&this->blockDone, NULL);
+	}
+	~BlockQueue()
+	{
+		pthread_cond_destroy(&this->blockDone);
+		pthread_cond_destroy(&this->blockReady);
+		pthread_mutex_destroy(&this->mutex);
+	}
+
+	const vector<int>& outputOrder;
+	std::deque<BlockDecoder<BufferedOutput_T>*> blocks;
+	bool bClosed; //set when no more blocks are coming
+	pthread_mutex_t mutex;
+	pthread_cond_t blockReady, blockDone;
+};
+
+template<typename BufferedOutput_T>
+void* decodeBlocksThread(void* arg)
+{
+	BlockQueue<BufferedOutput_T>& queue = *static_cast<BlockQueue<BufferedOutput_T>*>(arg);
+	pthread_mutex_lock(&queue.mutex);
+	for (;;)
+	{
+		while (queue.blocks.empty() && !queue.bClosed)
+			pthread_cond_wait(&queue.blockReady, &queue.mutex);
+		if (queue.blocks.empty())
+			break;
+		BlockDecoder<BufferedOutput_T> *decoder = queue.blocks.front();
+		queue.blocks.pop_front();
+		pthread_mutex_unlock(&queue.mutex);
+
+		decoder->decode(queue.outputOrder);
+
+		pthread_mutex_lock(&queue.mutex);
+		decoder->bDone = true;
+		pthread_cond_broadcast(&queue.blockDone);
+	}
+	pthread_mutex_unlock(&queue.mutex);
+	return NULL;
+}
+
+//Waits for a block to be decoded, then outputs its text.
+template<typename BufferedOutput_T>
+ERR_CODE outputDecodedBlock(BlockQueue<BufferedOutput_T>& queue, BlockDecoder<BufferedOutput_T>& decoder, FILE* out)
+{
+	pthread_mutex_lock(&queue.mutex);
+	while (!decoder.bDone)
+		pthread_cond_wait(&queue.blockDone, &queue.mutex);
+	decoder.bDone = false;
+	pthread_mutex_unlock(&queue.mutex);
+
+	if (decoder.eRet == OK && out && !decoder.text.empty())
+		fwrite(decoder.text.data(), decoder.text.size(), 1, out);
+	decoder.text.clear();
+	return decoder.eRet;
+}
+
+} // namespace
+
+//*********************************************************************************
+//Returns: the output position of each column (and then each blank column) when an output ordering is specified,
+//  or else nothing
+template<typename BufferedOutput_T>
+void UnconvertFromZDWToFile<BufferedOutput_T>::getOutputColumnOrder(vector<int>& outputOrder) const
+{
+	outputOrder.clear();
+	if (this->namesOfColumnsToOutput.empty())
+		return;
+
+	const size_t num_output_columns = this->numColumns + this->blankColumnNames.size();
+	outputOrder.resize(num_output_columns);
+	memcpy(&outputOrder[0], this->outputColumns, this->numColumns * sizeof(int));
+	//If there are blank columns, define them at the end of the input buffer, each outputting to its specified position in the column list.
+	size_t index = this->numColumns;
+	for (map<int, string>::const_iterator iter = this->blankColumnNames.begin(); iter != this->blankColumnNames.end(); ++iter)
+	{
+		outputOrder[index++] = iter->first;
+	}
+}
+
+//*********************************************************************************
+//
+// Decodes the file's blocks on numThreads threads, outputting their text in order.
+//    This thread reads each block's header and locates its rows, then hands them to a BlockDecoder.
+//    A window of 2 * numThreads decoders bounds the blocks held in memory.
+//
+template<typename BufferedOutput_T>
+ERR_CODE UnconvertFromZDWToFile<BufferedOutput_T>::parseBlocksInParallel(const vector<int>& outputOrder)
+{
+	const size_t window = 2 * this->numThreads;
+	vector<BlockDecoder<BufferedOutput_T>*> decoders(window);
+	for (size_t i = 0; i < window; ++i)
+		decoders[i] = new BlockDecoder<BufferedOutput_T>(this);
+
+	BlockQueue<BufferedOutput_T> queue(outputOrder);
+	vector<pthread_t> threads(this->numThreads);
+	int numStarted = 0;
+	while (numStarted < this->numThreads &&
+			!pthread_create(&threads[numStarted], NULL, decodeBlocksThread<BufferedOutput_T>, &queue))
+		++numStarted;
+
+	//An uncompressed file's rows are located from its block index, when it has one.
+	//Decoders use the blocks where they sit in memory, so the file is read through a view of it
+	//that can be dropped on a read error without unmapping their data.
+	BufferedInput *file = NULL;
+	if (this->input->is_in_memory()) {
+		this->loadBlockIndex();
+		file = this->input;
+		this->input = BufferedInput::openMemory(file->memory(), file->memory_size());
+		this->input->skip(file->tell());
+	}
+
+	ERR_CODE eRet = numStarted ? OK : PROCESSING_ERROR;
+	size_t numBlocks = 0, numOutput = 0;
+	size_t firstRow = this->GetCurrentRowNumber();
+	bool bLastBlock = false;
+	try {
+		while (eRet == OK && !bLastBlock)
+		{
+			BlockDecoder<BufferedOutput_T>& decoder = *decoders[numBlocks % window];
+			if (numBlocks - numOutput == window) {
+				//The window is full -- output the oldest block to free its decoder.
+				eRet = outputDecodedBlock(queue, decoder, this->out);
+				++numOutput;
+				if (eRet != OK)
+					break;
+			}
+
+			eRet = this->parseBlockHeader();
+			if (eRet != OK)
+				break;
+			if (!this->bQuiet)
+				this->statusOutput(INFO, "Reading %u rows\n", this->numLines);
+			const char *rows;
+			ULONGLONG length;
+			eRet = this->readRowData(decoder.rowData, rows, length);
+			if (eRet != OK)
+				break;
+
+			bLastBlock = this->isLastBlock();
+			const size_t numLines = this->numLines;
+			this->swapBlock(decoder);
+			decoder.setRows(rows, length, firstRow);
+			firstRow += numLines;
+			assert(bLastBlock || this->version >= 3); //version 3+ supports multiple blocks
+
+			pthread_mutex_lock(&queue.mutex);
+			queue.blocks.push_back(&decoder);
+			pthread_cond_signal(&queue.blockReady);
+			pthread_mutex_unlock(&queue.mutex);
+			++numBlocks;
+		}
+	} catch (ZDWException& ex) {
+		eRet = ex.code;
+	}
+
+	//Output the remaining blocks in order, or if an error occurred, just wait for them.
+	if (eRet != OK) {
+		pthread_mutex_lock(&queue.mutex);
+		while (!queue.blocks.empty()) {
+			queue.blocks.back()->bDone = true;
+			queue.blocks.pop_back();
+		}
+		pthread_mutex_unlock(&queue.mutex);
+	}
+	for ( ; numOutput < numBlocks; ++numOutput)
+	{
+		BlockDecoder<BufferedOutput_T>& decoder = *decoders[numOutput % window];
+		if (eRet == OK) {
+			eRet = outputDecodedBlock(queue, decoder, this->out);
+			if (this->bShowStatus)
+				this->statusOutput(INFO, "\r%u\n", decoder.getNumLines());
+		} else {
+			outputDecodedBlock(queue, decoder, NULL); //blocks not yet decoded are freed with their decoders
+		}
+	}
+
+	pthread_mutex_lock(&queue.mutex);
+	queue.bClosed = true;
+	pthread_cond_broadcast(&queue.blockReady);
+	pthread_mutex_unlock(&queue.mutex);
+	for (int t = 0; t < numStarted; ++t)
+		pthread_join(threads[t], NULL);
+	for (size_t i = 0; i < window; ++i)
+		delete decoders[i];
+	if (file) {
+		if (this->input)
+			file->skip(this->input->tell() - file->tell());
+		delete this->input;
+		this->input = file;
+	}
+
+	if (eRet == OK)
+		this->lastBlock = 1;
+	if (eRet == OK && !this->bQuiet)
+	{
+		this->statusOutput(INFO, "%s %s\n\n",
+				getInputFilename(this->inFileName).c_str(), this->bTestOnly ? "tested good" : "uncompressed");
+	}
+	return eRet;
+}
+
 //*********************************************************************************
 //
 // Performs the entire decompression of a ZDW file
@@ -1719,6 +3571,10 @@ ERR_CODE UnconvertFromZDWToFile<BufferedOutput_T>::unconvert(
 		this->statusOutput(INFO, "\n%s %s\n", filestub, status);
 	}
 
+	//Decompression runs ahead of decoding on its own thread.
+	if (this->bPipelined)
+		this->input = BufferedInput::readAhead(this->input);
+
 	//1. Read header info.
 	eRet = this->readHeader();
 	if (eRet != OK)
@@ -1728,6 +3584,14 @@ ERR_CODE UnconvertFromZDWToFile<BufferedOutput_T>::unconvert(
 		goto Done;
 	}
 
+	if (this->bShowBasicStatisticsOnly && this->input->is_in_memory() && this->loadBlockIndex()) {
+		ULONGLONG totalRows = 0;
+		for (size_t i = 0; i < this->blockIndex.size(); ++i)
+			totalRows += this->blockIndex[i].numRows;
+		this->statusOutput(INFO, "Blocks = %lu, rows = %" PF_LLU "\n",
+			static_cast<long unsigned>(this->blockIndex.size()), totalRows);
+	}
+
 	//2. Begin extracting to SQL export file/stdout.
 	if (!this->bTestOnly && !this->bShowBasicStatisticsOnly && !this->bOutputDescFileOnly && !this->metadataOptions.bOutputOnlyMetadata) //...except in these cases
 	{
@@ -1790,17 +3654,10 @@ ERR_CODE UnconvertFromZDWToFile<BufferedOutput_T>::unconvert(
 	{
 		BufferedOutput_T buffer(this->out);
 		//if a output ordering is specified, prepare it in the output buffer
-		if (!this->namesOfColumnsToOutput.empty()) {
-			const size_t num_output_columns = this->numColumns + this->blankColumnNames.size();
-			vector<int> all_output_columns(num_output_columns);
-			memcpy(&all_output_columns[0], this->outputColumns, num_output_columns * sizeof(int));
-			//If there are blank columns, define them at the end of the input buffer, each outputting to its specified position in the column list.
-			size_t index = this->numColumns;
-			for (map<int, string>::const_iterator iter = this->blankColumnNames.begin(); iter != this->blankColumnNames.end(); ++iter)
-			{
-				all_output_columns[index++] = iter->first;
-			}
-			const bool bRes = buffer.setOutputColumnOrder(&all_output_columns[0], num_output_columns);
+		vector<int> all_output_columns;
+		this->getOutputColumnOrder(all_output_columns);
+		if (!all_output_columns.empty()) {
+			const bool bRes = buffer.setOutputColumnOrder(&all_output_columns[0], all_output_columns.size());
 
 			if (!bRes) {
 				eRet = BAD_REQUESTED_COLUMN; //column ordering is bad -- don't attempt to process further.
@@ -1810,20 +3667,35 @@ ERR_CODE UnconvertFromZDWToFile<BufferedOutput_T>::unconvert(
 			}
 		}
 
-		//3. Parse a block of data.
-		do {
-			eRet = this->parseNextBlock(buffer);
-			this->cleanupBlock();
+		//3. Parse the blocks of data, in parallel when requested.
+		//(Formats before version 9 are always read serially.)
+		if (this->numThreads > 1 && this->version >= 9 && !this->bShowBasicStatisticsOnly) {
+			eRet = parseBlocksInParallel(all_output_columns);
 			if (eRet != OK)
 				goto Done;
-			assert(this->isLastBlock() || this->version >= 3); //version 3+ supports multiple blocks
-		} while (!this->isLastBlock());
+		} else {
+			if (this->bPipelined)
+				buffer.startWriter();
+			do {
+				eRet = this->parseNextBlock(buffer);
+				this->cleanupBlock();
+				if (eRet != OK)
+					goto Done;
+				assert(this->isLastBlock() || this->version >= 3); //version 3+ supports multiple blocks
+			} while (!this->isLastBlock());
+		}
 	}
 
 	//Ensure we're at EOF at this point.
 	if (this->bShowBasicStatisticsOnly) {
 		assert(this->isLastBlock());
 	} else {
+		if (this->version >= BLOCK_INDEX_VERSION) {
+			eRet = this->readBlockIndex();
+			if (eRet != OK)
+				goto Done;
+		}
+
 		UCHAR dummy;
 		this->readBytes(&dummy, 1, false); //a dummy read to set eof if we're at the end
 		if (!this->isFinished())
@@ -1934,6 +3806,8 @@ ERR_CODE UnconvertFromZDWToMemory::getRow(char** buffer, size_t *size, const cha
 
 					this->pBufferedOutput->setOutputColumnPtrs(outColumns);
 					ERR_CODE eRet = readNextRow(*this->pBufferedOutput);
+					if (eRet == OK && this->bRowFiltered)
+						break; //nothing was output -- read on
 					ERR_CODE eRetForNumColumns = this->getNumOutputColumns(numColumns);
 					if (eRetForNumColumns != OK)
 						numColumns = 0;
@@ -1949,18 +3823,482 @@ ERR_CODE UnconvertFromZDWToMemory::getRow(char** buffer, size_t *size, const cha
 				}
 			break;
 			case ZDW_FINISHING:
-				assert(!this->pBufferedOutput.get()); //should no longer exist
+				return finishReading();
+			case ZDW_END:
+				return AT_END_OF_FILE;
+		}
+	}
+}
+
+//Reads past the last block.
+ERR_CODE UnconvertFromZDWToMemory::finishReading()
+{
+	assert(!this->pBufferedOutput.get()); //should no longer exist
+
+	if (this->version >= BLOCK_INDEX_VERSION) {
+		ERR_CODE eRet = readBlockIndex();
+		if (eRet != OK) {
+			setState(ZDW_END);
+			return eRet;
+		}
+	}
+
+	//Ensure we're at EOF at this point.
+	UCHAR dummy;
+	readBytes(&dummy, 1, false); //a dummy read to set eof if we're at the end
+
+	setState(ZDW_END);
+	return isFinished() ? AT_END_OF_FILE : ZDW_LONGER_THAN_EXPECTED_ERR;
+}
+
+//***************************************************************
+//
+// Used by the typed and batch APIs to step through the rows of a ZDW file.
+// The values are read, but not formatted as text.
+//
+ERR_CODE UnconvertFromZDWToMemory::nextRow()
+{
+	for (;;) {
+		ERR_CODE eRet = beginRow();
+		if (eRet != OK)
+			return eRet;
+		if (!this->rowFilters.empty() && !this->rowsRead && !this->blockMaySatisfyFilters()) {
+			eRet = skipRowsInBlock(this->numLines);
+			if (eRet != OK)
+				return eRet;
+			continue;
+		}
+
+		eRet = readRowValues();
+		if (eRet != OK || this->rowFilters.empty())
+			return eRet;
+		bool bSatisfied;
+		eRet = filterRow(bSatisfied);
+		if (eRet != OK || bSatisfied)
+			return eRet;
+	}
+}
+
+//Advances through the file's headers until the current block has a row left to read.
+ERR_CODE UnconvertFromZDWToMemory::beginRow()
+{
+	for (;;) {
+		switch (this->eState)
+		{
+			case ZDW_BEGIN:
+			{
+				ERR_CODE eRet = readHeader();
+				if (eRet != OK)
+					return eRet;
+			}
+			break;
+			case ZDW_PARSE_BLOCK_HEADER:
+			{
+				ERR_CODE eRet = handleZDWParseBlockHeader();
+				if (eRet != OK)
+					return eRet;
+			}
+			break;
+			case ZDW_OUTPUT_BLOCK_HEADER:
+				setState(ZDW_GET_NEXT_ROW); //there is no header line among typed rows
+			break;
+			case ZDW_GET_NEXT_ROW:
+				if (this->rowsRead < this->numLines)
+				{
+					if (isFinished())
+						return ROW_COUNT_ERR; //premature exit (truncated file?)
+					return OK;
+				}
+				this->cleanupBlock();
+				this->pBufferedOutput.reset();
+				setState(isLastBlock() ? ZDW_FINISHING : ZDW_PARSE_BLOCK_HEADER);
+			break;
+			case ZDW_FINISHING:
+				return finishReading();
+			case ZDW_END:
+				return AT_END_OF_FILE;
+		}
+	}
+}
+
+ERR_CODE UnconvertFromZDWToMemory::getBatch(const size_t maxRows, RowBatch& batch)
+{
+	//Read on past a block whose rows all failed the row filters.
+	ERR_CODE eRet;
+	do {
+		eRet = readBatch(maxRows, batch);
+	} while (eRet == OK && !batch.numRows && maxRows && !this->rowFilters.empty());
+	return eRet;
+}
+
+//Reads the next batch of rows of the current block.
+ERR_CODE UnconvertFromZDWToMemory::readBatch(const size_t maxRows, RowBatch& batch)
+{
+	batch.numRows = 0;
+	ERR_CODE eRet;
+	for (;;) {
+		eRet = beginRow();
+		if (eRet != OK) {
+			for (size_t j = 0; j < batch.columns.size(); ++j)
+			{
+				batch.columns[j].values.clear();
+				batch.columns[j].validity.clear();
+			}
+			return eRet;
+		}
+
+		//A block none of whose rows can satisfy the row filters is read past at once.
+		if (this->rowFilters.empty() || this->rowsRead || this->blockMaySatisfyFilters())
+			break;
+		eRet = skipRowsInBlock(this->numLines);
+		if (eRet != OK)
+			return eRet;
+	}
+
+	size_t numBatchColumns = 0;
+	for (ULONG c = 0; c < this->numColumnsInExportFile; ++c)
+	{
+		if (this->outputColumns[c] != IGNORE)
+			++numBatchColumns;
+	}
+	batch.columns.resize(numBatchColumns);
+
+	size_t numRows = std::min<size_t>(maxRows, this->numLines - this->rowsRead);
+	vector<ULONGLONG*> values(numBatchColumns);
+	vector<UCHAR*> validity(numBatchColumns);
+	size_t j = 0;
+	for (ULONG c = 0; c < this->numColumnsInExportFile; ++c)
+	{
+		if (this->outputColumns[c] == IGNORE)
+			continue;
+		ColumnBatch& column = batch.columns[j];
+		column.column = c;
+		column.type = this->columnType[c];
+		column.values.resize(numRows);
+		column.validity.assign((numRows + 7) / 8, 0);
+		values[j] = numRows ? &column.values[0] : NULL;
+		validity[j] = numRows ? &column.validity[0] : NULL;
+		++j;
+	}
+
+	if (this->bColumnarBlock && this->rowFilters.empty()) {
+		//Copy each segment's values, a batch of decoded rows at a time.
+		vector<size_t> segmentColumns(this->columnSegments.size());
+		j = 0;
+		for (size_t s = 0; s < this->columnSegments.size(); ++s)
+		{
+			while (batch.columns[j].column != this->columnSegments[s].column)
+				++j;
+			segmentColumns[s] = j;
+		}
+		for (size_t r = 0; r < numRows; )
+		{
+			if (this->rowsRead >= this->columnarRowsEnd) {
+				eRet = this->decodeColumnarRows();
+				if (eRet != OK)
+					return eRet;
+			}
+			const ULONG k = this->rowsRead - this->columnarRowsBegin;
+			const size_t n = std::min<size_t>(numRows - r, this->columnarRowsEnd - this->rowsRead);
+			for (size_t s = 0; s < this->columnSegments.size(); ++s)
+			{
+				const ULONGLONG *stored = &this->columnarRows[s * COLUMNAR_BATCH_ROWS + k];
+				const ULONGLONG base = this->columnBase[this->columnSegments[s].column];
+				ULONGLONG *out = values[segmentColumns[s]] + r;
+				UCHAR *valid = validity[segmentColumns[s]];
+				for (size_t i = 0; i < n; ++i)
+				{
+					if (stored[i]) {
+						out[i] = stored[i] + base;
+						valid[(r + i) / 8] |= 1u << ((r + i) % 8);
+					} else {
+						out[i] = 0;
+					}
+				}
+			}
+			r += n;
+			this->rowsRead += n;
+			AdvanceCurrentRowNumber(n);
+		}
+		if (numRows) {
+			//Leave the last row's values current, as for nextRow.
+			const ULONG k = this->rowsRead - 1 - this->columnarRowsBegin;
+			for (size_t s = 0; s < this->columnSegments.size(); ++s)
+				this->columnVal[this->columnSegments[s].column].n = this->columnarRows[s * COLUMNAR_BATCH_ROWS + k];
+		}
+		this->bRowCached = false;
+	} else {
+		size_t r = 0;
+		while (r < numRows && this->rowsRead < this->numLines)
+		{
+			eRet = readRowValues();
+			if (eRet != OK)
+				return eRet;
+			if (!this->rowFilters.empty()) {
+				bool bSatisfied;
+				eRet = filterRow(bSatisfied);
+				if (eRet != OK)
+					return eRet;
+				if (!bSatisfied)
+					continue;
+			}
+			for (j = 0; j < numBatchColumns; ++j)
+			{
+				const ULONG c = batch.columns[j].column;
+				const ULONGLONG stored = this->columnVal[c].n;
+				if (stored) {
+					values[j][r] = stored + this->columnBase[c];
+					validity[j][r / 8] |= 1u << (r % 8);
+				} else {
+					values[j][r] = 0;
+				}
+			}
+			++r;
+		}
+		if (r < numRows) {
+			//Some rows didn't satisfy the row filters.
+			for (j = 0; j < numBatchColumns; ++j)
+			{
+				batch.columns[j].values.resize(r);
+				batch.columns[j].validity.resize((r + 7) / 8);
+			}
+			numRows = r;
+		}
+	}
+	batch.numRows = numRows;
+	return OK;
+}
+
+ERR_CODE UnconvertFromZDWToMemory::getDictionaryText(const ULONGLONG offset, const char*& text, size_t& length)
+{
+	if (this->version < 9)
+		return UNSUPPORTED_OPERATION;
+	if (this->eState != ZDW_GET_NEXT_ROW || this->dictionary.empty())
+		return PROCESSING_ERROR;
+	if (offset > this->dictionarySize)
+		return BAD_PARAMETER;
+	text = GetWord(offset, this->row, length);
+	return OK;
+}
+
+bool UnconvertFromZDWToMemory::isChanged(const size_t column) const
+{
+	if (this->eState != ZDW_GET_NEXT_ROW || column >= this->columnFlags.size())
+		return false;
+	const long u = this->columnFlags[column];
+	return u >= 0 && (this->setColumns[u / 8] & (1u << (u % 8)));
+}
+
+bool UnconvertFromZDWToMemory::isEmpty(const size_t column) const
+{
+	ULONGLONG value;
+	return getStoredValue(column, value) == OK && !value;
+}
+
+//Gets a column's value as stored in the block, i.e., 0 for an empty value, or else relative to the column's base.
+ERR_CODE UnconvertFromZDWToMemory::getStoredValue(const size_t column, ULONGLONG& value) const
+{
+	if (this->eState != ZDW_GET_NEXT_ROW || !this->rowsRead)
+		return PROCESSING_ERROR; //no current row
+	if (column >= this->numColumnsInExportFile || this->outputColumns[column] == IGNORE)
+		return BAD_REQUESTED_COLUMN;
+	value = this->columnVal[column].n;
+	return OK;
+}
+
+ERR_CODE UnconvertFromZDWToMemory::getUnsigned(const size_t column, uint64_t& value) const
+{
+	ULONGLONG stored;
+	const ERR_CODE eRet = getStoredValue(column, stored);
+	if (eRet != OK)
+		return eRet;
+	switch (this->columnType[column])
+	{
+		case TINY: case SHORT: case LONG: case LONGLONG:
+			value = stored ? stored + this->columnBase[column] : 0;
+			return OK;
+		default:
+			return UNSUPPORTED_OPERATION;
+	}
+}
+
+ERR_CODE UnconvertFromZDWToMemory::getSigned(const size_t column, int64_t& value) const
+{
+	ULONGLONG stored;
+	const ERR_CODE eRet = getStoredValue(column, stored);
+	if (eRet != OK)
+		return eRet;
+	switch (this->columnType[column])
+	{
+		case TINY_SIGNED: case SHORT_SIGNED: case LONG_SIGNED: case LONGLONG_SIGNED:
+			value = static_cast<SLONGLONG>(stored ? stored + this->columnBase[column] : 0);
+			return OK;
+		default:
+			return UNSUPPORTED_OPERATION;
+	}
+}
+
+ERR_CODE UnconvertFromZDWToMemory::getText(const size_t column, const char*& text, size_t& length)
+{
+	ULONGLONG stored;
+	const ERR_CODE eRet = getStoredValue(column, stored);
+	if (eRet != OK)
+		return eRet;
+	switch (this->columnType[column])
+	{
+		case VARCHAR: case TEXT: case TINYTEXT: case MEDIUMTEXT: case LONGTEXT:
+		case DATETIME: case CHAR_2:
+		break;
+		case DECIMAL:
+			if (this->version >= 4)
+				break;
+			return UNSUPPORTED_OPERATION;
+		case CHAR:
+			if (this->version >= 5) {
+				//A single (or escaped) character, rather than an offset into the dictionary.
+				const ULONGLONG chartuple = stored ? stored + this->columnBase[column] : 0;
+				this->temp_buf[0] = static_cast<char>(chartuple);
+				this->temp_buf[1] = static_cast<char>(chartuple / 256);
+				text = this->temp_buf;
+				length = !this->temp_buf[0] ? 0 : this->temp_buf[0] == '\\' ? 2 : 1;
+				return OK;
+			}
+			return UNSUPPORTED_OPERATION;
+		default:
+			return UNSUPPORTED_OPERATION;
+	}
+
+	if (!stored) {
+		text = "";
+		length = 0;
+		return OK;
+	}
+	const ULONGLONG index = stored + this->columnBase[column];
+	if (index > this->dictionarySize)
+		return CORRUPTED_DATA_ERROR;
+	text = GetWord(index, this->row, length);
+	return OK;
+}
 
-				//Ensure we're at EOF at this point.
-				UCHAR dummy;
-				readBytes(&dummy, 1, false); //a dummy read to set eof if we're at the end
+//Parses MySQL's "YYYY-MM-DD[ HH:MM:SS]" text, ignoring any fraction of a second.
+//Returns: whether the text is a valid date
+static bool parseDateTime(const char* text, const size_t length, int64_t& seconds)
+{
+	int field[6] = { 0, 0, 0, 0, 0, 0 };
+	static const size_t digits[6] = { 4, 2, 2, 2, 2, 2 };
+	size_t pos = 0;
+	for (int f = 0; f < 6 && pos < length; ++f)
+	{
+		if (f && ++pos > length) //skip a separator
+			return false;
+		for (size_t d = 0; d < digits[f]; ++d, ++pos)
+		{
+			if (pos >= length || text[pos] < '0' || text[pos] > '9')
+				return false;
+			field[f] = field[f] * 10 + (text[pos] - '0');
+		}
+		if (f == 2 && pos < length && text[pos] != ' ' && text[pos] != 'T')
+			return false;
+	}
+	const int year = field[0], month = field[1], day = field[2];
+	if (month < 1 || month > 12 || day < 1 || day > 31 || field[3] > 23 || field[4] > 59 || field[5] > 60)
+		return false;
 
-				setState(ZDW_END);
-				return isFinished() ? AT_END_OF_FILE : ZDW_LONGER_THAN_EXPECTED_ERR;
+	//Count the days since 1970-01-01 in the proleptic Gregorian calendar, with years beginning in March.
+	const int y = year - (month <= 2);
+	const int era = (y >= 0 ? y : y - 399) / 400;
+	const int yearOfEra = y - era * 400;
+	const int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	const int64_t days = static_cast<int64_t>(era) * 146097 + dayOfEra - 719468;
+	seconds = days * 86400 + field[3] * 3600 + field[4] * 60 + field[5];
+	return true;
+}
+
+ERR_CODE UnconvertFromZDWToMemory::getDateTime(const size_t column, int64_t& seconds)
+{
+	ULONGLONG stored;
+	ERR_CODE eRet = getStoredValue(column, stored);
+	if (eRet != OK)
+		return eRet;
+	if (this->columnType[column] != DATETIME)
+		return UNSUPPORTED_OPERATION;
+
+	const char *text;
+	size_t length;
+	eRet = getText(column, text, length);
+	if (eRet != OK)
+		return eRet;
+	seconds = 0;
+	if (length && !parseDateTime(text, length, seconds))
+		return BAD_PARAMETER;
+	return OK;
+}
+
+ERR_CODE UnconvertFromZDWToMemory::skipToRow(const ULONGLONG row)
+{
+	if (this->eState == ZDW_BEGIN) {
+		const ERR_CODE eRet = readHeader();
+		if (eRet != OK)
+			return eRet;
+	}
+	if (this->input->is_in_memory())
+		loadBlockIndex(); //without it, each row before the requested one is read
+
+	if (row < GetCurrentRowNumber())
+		return BAD_PARAMETER;
+
+	while (GetCurrentRowNumber() < row)
+	{
+		switch (this->eState)
+		{
+			case ZDW_PARSE_BLOCK_HEADER:
+			{
+				const size_t block = this->blocksRead;
+				if (block < this->blockIndex.size() && row - GetCurrentRowNumber() >= this->blockIndex[block].numRows)
+				{
+					//Skip the entire block.
+					ERR_CODE eRet = parseBlockHeader();
+					if (eRet != OK)
+						return eRet;
+					const ULONGLONG rowDataLength = this->blockIndex[block].rowDataLength;
+					if (skipBytes(rowDataLength) != rowDataLength)
+						return CORRUPTED_DATA_ERROR;
+					AdvanceCurrentRowNumber(this->numLines);
+					this->cleanupBlock();
+					setState(isLastBlock() ? ZDW_FINISHING : ZDW_PARSE_BLOCK_HEADER);
+				} else {
+					const ERR_CODE eRet = handleZDWParseBlockHeader();
+					if (eRet != OK)
+						return eRet;
+				}
+			}
+			break;
+			case ZDW_OUTPUT_BLOCK_HEADER:
+				setState(ZDW_GET_NEXT_ROW); //the block header line is skipped along with the rows
+			break;
+			case ZDW_GET_NEXT_ROW:
+				if (this->rowsRead < this->numLines)
+				{
+					const ULONGLONG rowsLeft = row - GetCurrentRowNumber();
+					const ULONG target = rowsLeft < this->numLines - this->rowsRead ?
+						static_cast<ULONG>(this->rowsRead + rowsLeft) : this->numLines;
+					const ERR_CODE eRet = skipRowsInBlock(target);
+					if (eRet != OK)
+						return eRet;
+				} else {
+					this->cleanupBlock();
+					this->pBufferedOutput.reset();
+					setState(isLastBlock() ? ZDW_FINISHING : ZDW_PARSE_BLOCK_HEADER);
+				}
+			break;
+			case ZDW_BEGIN:
+			case ZDW_FINISHING:
 			case ZDW_END:
 				return AT_END_OF_FILE;
 		}
 	}
+	return OK;
 }
 
 ERR_CODE UnconvertFromZDWToMemory::getNumOutputColumns(size_t& num)
@@ -2009,6 +4347,15 @@ ERR_CODE UnconvertFromZDWToMemory::handleZDWParseBlockHeader()
 	ERR_CODE eRet = parseBlockHeader();
 	if (eRet != OK)
 		return eRet;
+	if (this->bColumnarBlock) {
+		//An indexed block none of whose rows can satisfy the row filters is read past whole (see getRow),
+		//so its segments aren't read.
+		if (!this->blockEntry || this->rowFilters.empty() || blockMaySatisfyFilters()) {
+			eRet = readColumnSegments(false);
+			if (eRet != OK)
+				return eRet;
+		}
+	}
 
 	assert(!this->pBufferedOutput.get());
 	size_t headerLineLength = 0;
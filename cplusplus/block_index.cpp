@@ -0,0 +1,473 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#include "zdw/block_index.h"
+#include "zdw_column_type_constants.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace adobe::zdw;
+using std::string;
+
+
+namespace {
+
+template <typename T>
+void append(string& out, const T& val)
+{
+	out.append(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+//Reads consecutive fields from an index entry, failing once past its end.
+class EntryReader
+{
+public:
+	EntryReader(const char* data, const size_t len) : pos(data), end(data + len) { }
+
+	bool read(void* val, const size_t size)
+	{
+		if (static_cast<size_t>(end - pos) < size)
+			return false;
+		memcpy(val, pos, size);
+		pos += size;
+		return true;
+	}
+
+	size_t remaining() const { return end - pos; }
+	const char* tell() const { return pos; }
+	void skip(const size_t size) { pos += size; }
+
+	bool readText(string& text, bool& bTruncated)
+	{
+		USHORT len;
+		if (!read(&len, 2))
+			return false;
+		bTruncated = (len & 0x8000) != 0;
+		len &= 0x7FFF;
+		if (static_cast<size_t>(end - pos) < len)
+			return false;
+		text.assign(pos, len);
+		pos += len;
+		return true;
+	}
+
+private:
+	const char *pos, *end;
+};
+
+void appendText(string& out, const string& text, const bool bTruncated)
+{
+	const USHORT len = static_cast<USHORT>(text.size() | (bTruncated ? 0x8000 : 0));
+	append(out, len);
+	out.append(text);
+}
+
+//Returns: whether a column value comparing to the operand as cmp (<0, 0, >0) satisfies op
+bool satisfies(const int cmp, const PREDICATE_OP op)
+{
+	switch (op)
+	{
+		case EQUAL: return cmp == 0;
+		case LESS: return cmp < 0;
+		case LESS_EQUAL: return cmp <= 0;
+		case GREATER: return cmp > 0;
+		case GREATER_EQUAL: return cmp >= 0;
+	}
+	return true;
+}
+
+//Returns: whether some value in [min, max] can satisfy op, given how each bound compares to the operand
+bool rangeCanMatch(const int minCmp, const int maxCmp, const PREDICATE_OP op)
+{
+	switch (op)
+	{
+		case EQUAL: return minCmp <= 0 && maxCmp >= 0;
+		case LESS: return minCmp < 0;
+		case LESS_EQUAL: return minCmp <= 0;
+		case GREATER: return maxCmp > 0;
+		case GREATER_EQUAL: return maxCmp >= 0;
+	}
+	return true;
+}
+
+template <typename T>
+int compare(const T lhs, const T rhs)
+{
+	return lhs < rhs ? -1 : (rhs < lhs ? 1 : 0);
+}
+
+//Returns: strcmp order of lhs and rhs
+int compareText(const string& lhs, const string& rhs)
+{
+	const int cmp = memcmp(lhs.data(), rhs.data(), std::min(lhs.size(), rhs.size()));
+	return cmp ? cmp : compare(lhs.size(), rhs.size());
+}
+
+bool numericCanMatch(const ColumnZoneMap& zoneMap, const UCHAR columnType,
+	const bool bHasEmpty, const PREDICATE_OP op, const string& operand)
+{
+	const bool bSigned = columnType == TINY_SIGNED || columnType == SHORT_SIGNED ||
+		columnType == LONG_SIGNED || columnType == LONGLONG_SIGNED;
+
+	char *end;
+	const ULONGLONG val = bSigned ? strtoll(operand.c_str(), &end, 10) : strtoull(operand.c_str(), &end, 10);
+	if (operand.empty() || *end)
+		return true; //not a number -- can't tell
+
+	//Empty values are output as 0.
+	if (bHasEmpty) {
+		const int cmp = bSigned ? compare<SLONGLONG>(0, val) : compare<ULONGLONG>(0, val);
+		if (satisfies(cmp, op))
+			return true;
+	}
+	if (!zoneMap.nonEmptyRows)
+		return false;
+
+	if (bSigned)
+		return rangeCanMatch(
+			compare<SLONGLONG>(zoneMap.min, val), compare<SLONGLONG>(zoneMap.max, val), op);
+	return rangeCanMatch(compare(zoneMap.min, val), compare(zoneMap.max, val), op);
+}
+
+bool textCanMatch(const ColumnZoneMap& zoneMap,
+	const bool bHasEmpty, const PREDICATE_OP op, const string& operand)
+{
+	if (bHasEmpty && satisfies(compareText(string(), operand), op))
+		return true;
+	if (!zoneMap.nonEmptyRows)
+		return false;
+
+	//A truncated min is still a lower bound.  A truncated max only bounds values beginning with other prefixes.
+	const int minCmp = compareText(zoneMap.minText, operand);
+	int maxCmp;
+	if (zoneMap.bMaxTextTruncated) {
+		maxCmp = compareText(zoneMap.maxText, operand.substr(0, zoneMap.maxText.size()));
+		if (!maxCmp)
+			maxCmp = 1; //the max could be greater than the operand
+	} else {
+		maxCmp = compareText(zoneMap.maxText, operand);
+	}
+	return rangeCanMatch(minCmp, maxCmp, op);
+}
+
+//Bloom filter salts: each is multiplied by the hash's lower half to pick the bit set in one word of a block.
+const ULONG BLOOM_SALT[8] = {
+	0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+	0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+const size_t BLOOM_BITS_PER_VALUE = 12; //about a 0.5% false positive rate
+
+}
+
+
+namespace adobe {
+namespace zdw {
+
+void BloomFilter::init(const size_t numValues)
+{
+	this->numBlocks = std::max<size_t>(1, (numValues * BLOOM_BITS_PER_VALUE + BLOCK_SIZE * 8 - 1) / (BLOCK_SIZE * 8));
+	this->words.assign(this->numBlocks * WORDS_PER_BLOCK, 0);
+}
+
+void BloomFilter::assign(const ULONG numBlocks, const char* data)
+{
+	this->numBlocks = numBlocks;
+	this->words.resize(numBlocks * WORDS_PER_BLOCK);
+	memcpy(&this->words[0], data, numBlocks * BLOCK_SIZE);
+}
+
+//FNV-1a, with a MurmurHash3 finalizer to spread it over all 64 bits.
+ULONGLONG BloomFilter::hash(const char* str, const size_t len)
+{
+	ULONGLONG h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; ++i)
+	{
+		h ^= static_cast<UCHAR>(str[i]);
+		h *= 1099511628211ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+void BloomFilter::insert(const ULONGLONG h)
+{
+	ULONG *blockWords = &this->words[blockStart(h)];
+	const ULONG key = static_cast<ULONG>(h);
+	for (size_t i = 0; i < WORDS_PER_BLOCK; ++i)
+		blockWords[i] |= 1u << ((key * BLOOM_SALT[i]) >> 27);
+}
+
+bool BloomFilter::mayContain(const ULONGLONG h) const
+{
+	const ULONG *blockWords = &this->words[blockStart(h)];
+	const ULONG key = static_cast<ULONG>(h);
+#if defined(__AVX2__)
+	const __m256i bits = _mm256_srli_epi32(
+		_mm256_mullo_epi32(_mm256_set1_epi32(key), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(BLOOM_SALT))), 27);
+	const __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+	return _mm256_testc_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(blockWords)), mask);
+#else
+	ULONG missing = 0;
+	for (size_t i = 0; i < WORDS_PER_BLOCK; ++i)
+		missing |= ~blockWords[i] & (1u << ((key * BLOOM_SALT[i]) >> 27));
+	return !missing;
+#endif
+}
+
+double ColumnZoneMap::estimateDistinct() const
+{
+	if (this->sketch.size() != ZONE_MAP_SKETCH_SIZE)
+		return this->nonEmptyRows ? 1 : 0;
+
+	const double m = ZONE_MAP_SKETCH_SIZE;
+	double sum = 0;
+	size_t zeros = 0;
+	for (size_t i = 0; i < ZONE_MAP_SKETCH_SIZE; ++i) {
+		sum += ldexp(1.0, -this->sketch[i]);
+		if (!this->sketch[i])
+			++zeros;
+	}
+	double estimate = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+	if (estimate <= 2.5 * m && zeros)
+		estimate = m * log(m / zeros); //small range correction
+	return std::min<double>(estimate, this->nonEmptyRows);
+}
+
+bool IsNumericZoneMapType(const UCHAR columnType)
+{
+	switch (columnType)
+	{
+		case CHAR:
+		case TINY: case TINY_SIGNED:
+		case SHORT: case SHORT_SIGNED:
+		case LONG: case LONG_SIGNED:
+		case LONGLONG: case LONGLONG_SIGNED:
+			return true;
+		default:
+			return false;
+	}
+}
+
+void AppendBlockIndexEntry(const BlockIndexEntry& entry, const UCHAR* columnType, string& out)
+{
+	const size_t begin = out.size();
+	append(out, ULONG(0)); //entry length, filled in below
+	append(out, entry.offset);
+	append(out, entry.rowDataLength);
+	append(out, entry.numRows);
+	append(out, entry.dictionarySize);
+
+	for (size_t c = 0; c < entry.zoneMaps.size(); ++c)
+	{
+		const ColumnZoneMap& zoneMap = entry.zoneMaps[c];
+		append(out, zoneMap.nonEmptyRows);
+		if (!zoneMap.nonEmptyRows)
+			continue;
+
+		if (IsNumericZoneMapType(columnType[c])) {
+			append(out, zoneMap.min);
+			append(out, zoneMap.max);
+		} else {
+			appendText(out, zoneMap.minText, false);
+			appendText(out, zoneMap.maxText, zoneMap.bMaxTextTruncated);
+		}
+		out.append(reinterpret_cast<const char*>(&zoneMap.sketch[0]), ZONE_MAP_SKETCH_SIZE);
+	}
+
+	if (!entry.bloomFilters.empty() || !entry.keyframes.empty()) {
+		append(out, static_cast<ULONG>(entry.bloomFilters.size()));
+		for (std::map<ULONG, BloomFilter>::const_iterator it = entry.bloomFilters.begin();
+				it != entry.bloomFilters.end(); ++it)
+		{
+			append(out, it->first);
+			append(out, it->second.getNumBlocks());
+			out.append(reinterpret_cast<const char*>(it->second.data()), it->second.getNumBlocks() * BloomFilter::BLOCK_SIZE);
+		}
+	}
+
+	if (!entry.keyframes.empty()) {
+		append(out, entry.keyframeInterval);
+		append(out, static_cast<ULONG>(entry.keyframes.size()));
+		out.append(reinterpret_cast<const char*>(&entry.keyframes[0]), entry.keyframes.size() * 8);
+	}
+
+	const ULONG len = out.size() - begin - 4;
+	memcpy(&out[begin], &len, 4);
+}
+
+//Returns: whether an entry of length len could be parsed
+bool ParseBlockIndexEntry(
+	const char* data, const size_t len, //(in) the entry, following its length field
+	const UCHAR* columnType, const size_t numColumns,
+	BlockIndexEntry& entry) //(out)
+{
+	EntryReader in(data, len);
+	if (!(in.read(&entry.offset, 8) && in.read(&entry.rowDataLength, 8) &&
+			in.read(&entry.numRows, 4) && in.read(&entry.dictionarySize, 8)))
+		return false;
+
+	entry.zoneMaps.clear();
+	entry.bloomFilters.clear();
+	entry.keyframeInterval = 0;
+	entry.keyframes.clear();
+	if (len == BLOCK_INDEX_ENTRY_SIZE)
+		return true; //no zone maps
+
+	entry.zoneMaps.resize(numColumns);
+	for (size_t c = 0; c < numColumns; ++c)
+	{
+		ColumnZoneMap& zoneMap = entry.zoneMaps[c];
+		if (!in.read(&zoneMap.nonEmptyRows, 4))
+			return false;
+		if (!zoneMap.nonEmptyRows)
+			continue;
+
+		bool bTruncated;
+		if (IsNumericZoneMapType(columnType[c])) {
+			if (!(in.read(&zoneMap.min, 8) && in.read(&zoneMap.max, 8)))
+				return false;
+		} else {
+			if (!(in.readText(zoneMap.minText, bTruncated) && in.readText(zoneMap.maxText, zoneMap.bMaxTextTruncated)))
+				return false;
+		}
+		zoneMap.sketch.resize(ZONE_MAP_SKETCH_SIZE);
+		if (!in.read(&zoneMap.sketch[0], ZONE_MAP_SKETCH_SIZE))
+			return false;
+	}
+
+	if (!in.remaining())
+		return true; //no Bloom filters
+	ULONG numFilters;
+	if (!in.read(&numFilters, 4))
+		return false;
+	for (ULONG i = 0; i < numFilters; ++i)
+	{
+		ULONG c, numBlocks;
+		if (!(in.read(&c, 4) && in.read(&numBlocks, 4)) || c >= numColumns || !numBlocks ||
+				in.remaining() / BloomFilter::BLOCK_SIZE < numBlocks)
+			return false;
+		entry.bloomFilters[c].assign(numBlocks, in.tell());
+		in.skip(numBlocks * BloomFilter::BLOCK_SIZE);
+	}
+
+	if (!in.remaining())
+		return true; //no keyframes
+	ULONG numKeyframes;
+	if (!(in.read(&entry.keyframeInterval, 4) && in.read(&numKeyframes, 4)) || !entry.keyframeInterval ||
+			numKeyframes != (entry.numRows ? (entry.numRows - 1) / entry.keyframeInterval : 0) ||
+			in.remaining() / 8 < numKeyframes)
+		return false;
+	entry.keyframes.resize(numKeyframes);
+	for (ULONG i = 0; i < numKeyframes; ++i)
+	{
+		in.read(&entry.keyframes[i], 8);
+		if (entry.keyframes[i] >= entry.rowDataLength || (i && entry.keyframes[i] <= entry.keyframes[i - 1]))
+			return false;
+	}
+	return true; //any remaining data were added by a later version
+}
+
+bool ParseBlockIndexTail(const char* tail, ULONG& numBlocks, ULONGLONG& indexSize)
+{
+	memcpy(&numBlocks, tail, 4);
+	memcpy(&indexSize, tail + 4, 8);
+	return !memcmp(tail + 12, BLOCK_INDEX_MAGIC, sizeof(BLOCK_INDEX_MAGIC)) && indexSize >= BLOCK_INDEX_TAIL_SIZE;
+}
+
+bool ParseBlockIndex(
+	const char* index, const ULONGLONG indexSize, //(in) from the first entry through the end of the file
+	const ULONGLONG fileSize,
+	const UCHAR* columnType, const size_t numColumns,
+	std::vector<BlockIndexEntry>& entries) //(out)
+{
+	if (indexSize < BLOCK_INDEX_TAIL_SIZE || indexSize > fileSize)
+		return false;
+	const char *tail = index + indexSize - BLOCK_INDEX_TAIL_SIZE;
+	ULONG numBlocks;
+	ULONGLONG storedIndexSize;
+	if (!ParseBlockIndexTail(tail, numBlocks, storedIndexSize) || storedIndexSize != indexSize || !numBlocks ||
+			numBlocks > (indexSize - BLOCK_INDEX_TAIL_SIZE) / (4 + BLOCK_INDEX_ENTRY_SIZE))
+		return false;
+
+	entries.resize(numBlocks);
+	const char *pos = index;
+	ULONGLONG blockEnd = 0; //blocks are contiguous and in order
+	for (std::vector<BlockIndexEntry>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		ULONG entryLength;
+		if (tail - pos < 4)
+			return false;
+		memcpy(&entryLength, pos, 4);
+		pos += 4;
+		if (entryLength < BLOCK_INDEX_ENTRY_SIZE || static_cast<size_t>(tail - pos) < entryLength)
+			return false;
+		if (!ParseBlockIndexEntry(pos, entryLength, columnType, numColumns, *it))
+			return false;
+		pos += entryLength;
+
+		if (it->offset < blockEnd || it->offset > fileSize - indexSize ||
+				it->rowDataLength > fileSize - indexSize - it->offset)
+			return false;
+		blockEnd = it->offset + it->rowDataLength;
+	}
+	return pos == tail;
+}
+
+bool ZoneMapCanMatch(const ColumnZoneMap& zoneMap, const UCHAR columnType, const ULONG numRows,
+	const PREDICATE_OP op, const string& operand)
+{
+	const bool bHasEmpty = zoneMap.nonEmptyRows < numRows;
+	switch (columnType)
+	{
+		case TINY: case TINY_SIGNED:
+		case SHORT: case SHORT_SIGNED:
+		case LONG: case LONG_SIGNED:
+		case LONGLONG: case LONGLONG_SIGNED:
+			return numericCanMatch(zoneMap, columnType, bHasEmpty, op, operand);
+		case VARCHAR:
+		case TEXT:
+		case TINYTEXT:
+		case MEDIUMTEXT:
+		case LONGTEXT:
+		case DATETIME:
+		case CHAR_2:
+			return textCanMatch(zoneMap, bHasEmpty, op, operand);
+		case CHAR:
+		{
+			//Only equality can be decided: values are stored as a character code, plus any escaped character.
+			if (op != EQUAL)
+				return true;
+			if (operand.empty())
+				return bHasEmpty;
+			ULONGLONG val = operand[0];
+			if (operand.size() > 1)
+				val += operand[1] * 256;
+			return zoneMap.nonEmptyRows && zoneMap.min <= val && val <= zoneMap.max;
+		}
+		default:
+			return true; //e.g., DECIMAL text doesn't sort numerically
+	}
+}
+
+} // namespace zdw
+} // namespace adobe
@@ -0,0 +1,710 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#include "compressedoutput.h"
+#include "memory.h"
+#include "ring_buffer.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#ifdef ZDW_HAVE_BZIP2
+#include <bzlib.h>
+#endif
+#ifdef ZDW_HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef ZDW_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using adobe::zdw::CompressedOutput;
+using adobe::zdw::UntrackedMemoryScope;
+using std::string;
+
+
+namespace {
+
+const size_t OUT_BUFFER_SIZE = 1024 * 1024; //compressed bytes written to the file at once
+const size_t COMPRESS_THREAD_CHUNKS = 2; //buffers queued for the compression thread
+
+//Settings given to a codec.
+struct CodecOptions
+{
+	int level;
+	bool bExtreme; //xz only
+	int threads;
+};
+
+//Returns: whether str is a non-empty run of digits
+bool is_number(const string& str)
+{
+	if (str.empty())
+		return false;
+	for (size_t i = 0; i < str.size(); ++i)
+		if (!isdigit(static_cast<unsigned char>(str[i])))
+			return false;
+	return true;
+}
+
+int thread_count(const int threads)
+{
+	if (threads > 0)
+		return threads;
+	const long cores = sysconf(_SC_NPROCESSORS_ONLN); //0 means one per core, as for the xz and zstd commands
+	return cores > 0 ? static_cast<int>(cores) : 1;
+}
+
+//Maps the arguments meant for the codec's command-line tool (i.e. --zargs) onto native codec settings.
+//
+//Returns: false if an argument isn't understood, in which case the command should be run instead
+bool parse_codec_args(const CompressedOutput::Codec codec, const char* zArgs, const int numThreads, CodecOptions& opts)
+{
+	static const int DEFAULT_LEVEL[] = { 6, 9, 6, 3, 0 }; //as for the gzip, bzip2, xz and zstd commands
+
+	opts.level = DEFAULT_LEVEL[codec];
+	opts.bExtreme = false;
+	opts.threads = numThreads;
+	if (!zArgs || codec == CompressedOutput::NONE)
+		return true;
+
+	const bool bThreaded = codec == CompressedOutput::XZ || codec == CompressedOutput::ZSTD;
+	bool bUltra = false;
+	std::istringstream args(zArgs);
+	string arg;
+	while (args >> arg)
+	{
+		if (arg == "-q" || arg == "-c" || arg == "-f")
+			continue; //doesn't affect the output
+		if (arg == "--fast") {
+			opts.level = codec == CompressedOutput::XZ ? 0 : (codec == CompressedOutput::ZSTD ? -1 : 1);
+			continue;
+		}
+		if (arg == "--best" && codec != CompressedOutput::ZSTD) {
+			opts.level = 9;
+			continue;
+		}
+		if (codec == CompressedOutput::XZ && (arg == "-e" || arg == "--extreme")) {
+			opts.bExtreme = true;
+			continue;
+		}
+		if (codec == CompressedOutput::ZSTD) {
+			if (arg == "--ultra") {
+				bUltra = true;
+				continue;
+			}
+			if (!arg.compare(0, 7, "--fast=") && is_number(arg.substr(7))) {
+				opts.level = -atoi(arg.c_str() + 7);
+				continue;
+			}
+		}
+		if (bThreaded) {
+			string threads;
+			if (arg == "-T") {
+				if (!(args >> threads))
+					return false;
+			} else if (!arg.compare(0, 2, "-T")) {
+				threads = arg.substr(2);
+			} else if (!arg.compare(0, 10, "--threads=")) {
+				threads = arg.substr(10);
+			}
+			if (!threads.empty()) {
+				if (!is_number(threads))
+					return false;
+				opts.threads = thread_count(atoi(threads.c_str()));
+				continue;
+			}
+		}
+
+		//Compression level, e.g. "-9" (and "-9e" for xz).
+		if (arg.size() >= 2 && arg[0] == '-' && isdigit(static_cast<unsigned char>(arg[1])))
+		{
+			string level = arg.substr(1);
+			if (codec == CompressedOutput::XZ && level[level.size() - 1] == 'e') {
+				opts.bExtreme = true;
+				level.resize(level.size() - 1);
+			}
+			if (!is_number(level))
+				return false;
+			opts.level = atoi(level.c_str());
+			continue;
+		}
+
+		return false;
+	}
+
+	switch (codec)
+	{
+		case CompressedOutput::GZIP:
+		case CompressedOutput::BZIP2:
+			return opts.level >= 1 && opts.level <= 9;
+		case CompressedOutput::XZ:
+			return opts.level >= 0 && opts.level <= 9;
+		case CompressedOutput::ZSTD:
+			return opts.level != 0 && opts.level <= (bUltra ? 22 : 19);
+		case CompressedOutput::NONE:
+			break;
+	}
+	return false;
+}
+
+//Writes the output of a native codec to a file.
+class NativeOutput : public CompressedOutput
+{
+protected:
+	explicit NativeOutput(FILE* fp) : fp(fp), outBuffer(new char[OUT_BUFFER_SIZE]) { }
+	~NativeOutput()
+	{
+		if (this->fp)
+			fclose(this->fp);
+		delete[] this->outBuffer;
+	}
+
+	bool writeOut(const size_t len)
+	{
+		return fwrite(this->outBuffer, 1, len, this->fp) == len;
+	}
+
+	bool closeFile()
+	{
+		if (!this->fp)
+			return true;
+		const bool bOK = fclose(this->fp) == 0;
+		this->fp = NULL;
+		return bOK;
+	}
+
+	FILE *fp;
+	char *outBuffer;
+};
+
+//********************************************************
+class GzipOutput : public NativeOutput
+{
+public:
+	GzipOutput(FILE* fp, const CodecOptions& opts)
+		: NativeOutput(fp)
+	{
+		memset(&this->strm, 0, sizeof(this->strm));
+		this->bInit = deflateInit2(&this->strm, opts.level, Z_DEFLATED,
+			15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK; //+16: write a gzip wrapper
+	}
+	~GzipOutput() { end(); }
+
+	bool is_open() const { return this->bInit; }
+
+protected:
+	bool compress(const char* data, const size_t len, const bool bFinish)
+	{
+		this->strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+		this->strm.avail_in = len;
+		for (;;)
+		{
+			this->strm.next_out = reinterpret_cast<Bytef*>(this->outBuffer);
+			this->strm.avail_out = OUT_BUFFER_SIZE;
+			const int ret = deflate(&this->strm, bFinish ? Z_FINISH : Z_NO_FLUSH);
+			if (ret == Z_STREAM_ERROR || !writeOut(OUT_BUFFER_SIZE - this->strm.avail_out))
+				return false;
+			if (bFinish ? ret == Z_STREAM_END : this->strm.avail_out != 0)
+				return true;
+		}
+	}
+
+	bool end()
+	{
+		if (this->bInit) {
+			deflateEnd(&this->strm);
+			this->bInit = false;
+		}
+		return closeFile();
+	}
+
+private:
+	z_stream strm;
+	bool bInit;
+};
+
+#ifdef ZDW_HAVE_BZIP2
+//********************************************************
+class Bzip2Output : public NativeOutput
+{
+public:
+	Bzip2Output(FILE* fp, const CodecOptions& opts)
+		: NativeOutput(fp)
+	{
+		memset(&this->strm, 0, sizeof(this->strm));
+		this->bInit = BZ2_bzCompressInit(&this->strm, opts.level, 0, 0) == BZ_OK; //level is the block size, in 100K
+	}
+	~Bzip2Output() { end(); }
+
+	bool is_open() const { return this->bInit; }
+
+protected:
+	bool compress(const char* data, const size_t len, const bool bFinish)
+	{
+		this->strm.next_in = const_cast<char*>(data);
+		this->strm.avail_in = len;
+		for (;;)
+		{
+			this->strm.next_out = this->outBuffer;
+			this->strm.avail_out = OUT_BUFFER_SIZE;
+			const int ret = BZ2_bzCompress(&this->strm, bFinish ? BZ_FINISH : BZ_RUN);
+			if (ret < 0 || !writeOut(OUT_BUFFER_SIZE - this->strm.avail_out))
+				return false;
+			if (bFinish ? ret == BZ_STREAM_END : this->strm.avail_in == 0)
+				return true;
+		}
+	}
+
+	bool end()
+	{
+		if (this->bInit) {
+			BZ2_bzCompressEnd(&this->strm);
+			this->bInit = false;
+		}
+		return closeFile();
+	}
+
+private:
+	bz_stream strm;
+	bool bInit;
+};
+#endif
+
+#ifdef ZDW_HAVE_LZMA
+//********************************************************
+class XzOutput : public NativeOutput
+{
+public:
+	XzOutput(FILE* fp, const CodecOptions& opts)
+		: NativeOutput(fp)
+	{
+		memset(&this->strm, 0, sizeof(this->strm)); //same as LZMA_STREAM_INIT
+		const uint32_t preset = opts.level | (opts.bExtreme ? LZMA_PRESET_EXTREME : 0);
+		lzma_ret ret;
+		if (opts.threads > 1) {
+			lzma_mt mt;
+			memset(&mt, 0, sizeof(mt));
+			mt.threads = opts.threads;
+			mt.preset = preset;
+			mt.check = LZMA_CHECK_CRC64;
+			ret = lzma_stream_encoder_mt(&this->strm, &mt);
+		} else {
+			ret = lzma_easy_encoder(&this->strm, preset, LZMA_CHECK_CRC64);
+		}
+		this->bInit = ret == LZMA_OK;
+	}
+	~XzOutput() { end(); }
+
+	bool is_open() const { return this->bInit; }
+
+protected:
+	bool compress(const char* data, const size_t len, const bool bFinish)
+	{
+		this->strm.next_in = reinterpret_cast<const uint8_t*>(data);
+		this->strm.avail_in = len;
+		for (;;)
+		{
+			this->strm.next_out = reinterpret_cast<uint8_t*>(this->outBuffer);
+			this->strm.avail_out = OUT_BUFFER_SIZE;
+			const lzma_ret ret = lzma_code(&this->strm, bFinish ? LZMA_FINISH : LZMA_RUN);
+			if ((ret != LZMA_OK && ret != LZMA_STREAM_END) ||
+					!writeOut(OUT_BUFFER_SIZE - this->strm.avail_out))
+				return false;
+			if (bFinish ? ret == LZMA_STREAM_END : (this->strm.avail_in == 0 && this->strm.avail_out != 0))
+				return true;
+		}
+	}
+
+	bool end()
+	{
+		if (this->bInit) {
+			lzma_end(&this->strm);
+			this->bInit = false;
+		}
+		return closeFile();
+	}
+
+private:
+	lzma_stream strm;
+	bool bInit;
+};
+#endif
+
+#ifdef ZDW_HAVE_ZSTD
+//********************************************************
+class ZstdOutput : public NativeOutput
+{
+public:
+	ZstdOutput(FILE* fp, const CodecOptions& opts)
+		: NativeOutput(fp)
+		, cctx(ZSTD_createCCtx())
+	{
+		if (this->cctx) {
+			ZSTD_CCtx_setParameter(this->cctx, ZSTD_c_compressionLevel, opts.level);
+			ZSTD_CCtx_setParameter(this->cctx, ZSTD_c_checksumFlag, 1); //as the zstd command does
+			if (opts.threads > 1)
+				ZSTD_CCtx_setParameter(this->cctx, ZSTD_c_nbWorkers, opts.threads); //ignored by single-threaded libzstd builds
+		}
+	}
+	~ZstdOutput() { end(); }
+
+	bool is_open() const { return this->cctx != NULL; }
+
+protected:
+	bool compress(const char* data, const size_t len, const bool bFinish)
+	{
+		ZSTD_inBuffer in = { data, len, 0 };
+		for (;;)
+		{
+			ZSTD_outBuffer out = { this->outBuffer, OUT_BUFFER_SIZE, 0 };
+			const size_t remaining = ZSTD_compressStream2(this->cctx, &out, &in, bFinish ? ZSTD_e_end : ZSTD_e_continue);
+			if (ZSTD_isError(remaining) || !writeOut(out.pos))
+				return false;
+			if (bFinish ? remaining == 0 : in.pos == in.size)
+				return true;
+		}
+	}
+
+	bool end()
+	{
+		if (this->cctx) {
+			ZSTD_freeCCtx(this->cctx);
+			this->cctx = NULL;
+		}
+		return closeFile();
+	}
+
+private:
+	ZSTD_CCtx *cctx;
+};
+#endif
+
+//********************************************************
+//Pipes output through an external compression command.
+class CommandOutput : public CompressedOutput
+{
+public:
+	explicit CommandOutput(const char* cmd) : fp(popen(cmd, "w")) { }
+	~CommandOutput() { end(); }
+
+	bool is_open() const { return this->fp != NULL; }
+
+protected:
+	bool compress(const char* data, const size_t len, const bool)
+	{
+		return fwrite(data, 1, len, this->fp) == len;
+	}
+
+	bool end()
+	{
+		if (!this->fp)
+			return true;
+		const int status = pclose(this->fp);
+		this->fp = NULL;
+		return status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+
+private:
+	FILE *fp;
+};
+
+//********************************************************
+//Writes data to the file uncompressed.
+class PlainOutput : public NativeOutput
+{
+public:
+	PlainOutput(FILE* fp, const CodecOptions&)
+		: NativeOutput(fp)
+	{ }
+	~PlainOutput() { end(); }
+
+	bool is_open() const { return true; }
+
+protected:
+	bool compress(const char* data, const size_t len, const bool /*bFinish*/)
+	{
+		return fwrite(data, 1, len, this->fp) == len;
+	}
+
+	bool end() { return closeFile(); }
+};
+
+template <class T>
+CompressedOutput* open_output(FILE* fp, const CodecOptions& opts)
+{
+	T *out = new T(fp, opts);
+	if (!out->is_open()) {
+		delete out; //closes fp
+		return NULL;
+	}
+	return out;
+}
+
+}
+
+
+namespace adobe {
+namespace zdw {
+
+const size_t CompressedOutput::DEFAULT_BUFFER_SIZE = 4 * 1024 * 1024;
+
+//Creates filename and compresses output to it in-process.
+//
+//Returns: NULL if the codec isn't built in, zArgs can't be applied to it, or the file can't be created
+//  -- use openCommand instead
+CompressedOutput* CompressedOutput::open(
+	const Codec codec, const char* filename,
+	const char* zArgs,    //(in) arguments for the codec's command-line tool [default=NULL]
+	const int numThreads) //(in) threads to compress with, when supported [default=1]
+{
+	assert(filename);
+
+	CodecOptions opts;
+	if (!parse_codec_args(codec, zArgs, numThreads, opts))
+		return NULL;
+
+	switch (codec)
+	{
+		case GZIP:
+		case NONE: break;
+#ifdef ZDW_HAVE_BZIP2
+		case BZIP2: break;
+#endif
+#ifdef ZDW_HAVE_LZMA
+		case XZ: break;
+#endif
+#ifdef ZDW_HAVE_ZSTD
+		case ZSTD: break;
+#endif
+		default: return NULL;
+	}
+
+	FILE *fp = fopen(filename, "wb");
+	if (!fp)
+		return NULL;
+
+	//Compression used to run in a child process -- the codecs' memory is not counted against the converter's limit.
+	UntrackedMemoryScope memory;
+	switch (codec)
+	{
+		default:
+		case GZIP: return open_output<GzipOutput>(fp, opts);
+		case NONE: return open_output<PlainOutput>(fp, opts);
+#ifdef ZDW_HAVE_BZIP2
+		case BZIP2: return open_output<Bzip2Output>(fp, opts);
+#endif
+#ifdef ZDW_HAVE_LZMA
+		case XZ: return open_output<XzOutput>(fp, opts);
+#endif
+#ifdef ZDW_HAVE_ZSTD
+		case ZSTD: return open_output<ZstdOutput>(fp, opts);
+#endif
+	}
+}
+
+//Compresses output by piping it to a shell command, e.g. "gzip > file.gz".
+//
+//Returns: NULL if the process couldn't be started
+CompressedOutput* CompressedOutput::openCommand(const char* cmd)
+{
+	assert(cmd);
+
+	CommandOutput *out = new CommandOutput(cmd);
+	if (!out->is_open()) {
+		delete out;
+		return NULL;
+	}
+	return out;
+}
+
+struct CompressedOutput::Chunk
+{
+	Chunk() : data(NULL), length(0) { }
+	~Chunk() { delete[] data; }
+
+	char *data;
+	size_t length;
+};
+
+CompressedOutput::CompressedOutput(const size_t capacity)
+	: capacity(capacity)
+	, buffer(new char[capacity])
+	, used(0)
+	, written(0)
+	, bFailed(false), bClosed(false)
+	, chunks(NULL)
+{ }
+
+//Derived classes release their output in their own destructors.
+//NOTE: close() should be called first to complete the output, and to account for codec memory.
+CompressedOutput::~CompressedOutput()
+{
+	assert(!this->chunks); //stopped by close()
+	delete[] this->buffer;
+}
+
+//The data written so far are compressed here first, so the codec has set up its state,
+//which is kept out of the memory limit along with the thread's buffers.
+bool CompressedOutput::startThread()
+{
+	if (this->chunks || this->bClosed)
+		return false;
+
+	UntrackedMemoryScope memory;
+	if (!flush(false))
+		return false;
+
+	this->chunks = new RingBuffer<Chunk>(COMPRESS_THREAD_CHUNKS);
+	for (size_t i = 0; i < this->chunks->size(); ++i)
+		this->chunks->slot(i).data = new char[this->capacity];
+	if (pthread_create(&this->thread, NULL, compressThread, this) != 0) {
+		delete this->chunks;
+		this->chunks = NULL;
+		return false;
+	}
+	return true;
+}
+
+//Waits for the data queued so far to be compressed, then stops the thread.
+void CompressedOutput::stopThread()
+{
+	if (!this->chunks)
+		return;
+	this->chunks->close();
+	pthread_join(this->thread, NULL);
+	delete this->chunks;
+	this->chunks = NULL;
+}
+
+void* CompressedOutput::compressThread(void* arg)
+{
+	CompressedOutput *out = static_cast<CompressedOutput*>(arg);
+	Chunk *chunk;
+	while ((chunk = out->chunks->front()) != NULL)
+	{
+		if (!out->compress(chunk->data, chunk->length, false)) {
+			__atomic_store_n(&out->bFailed, true, __ATOMIC_SEQ_CST);
+			out->chunks->close(); //no more data will be taken
+			break;
+		}
+		out->chunks->pop();
+	}
+	return NULL;
+}
+
+//Hands the buffer to the compression thread, taking an empty one in its place.
+bool CompressedOutput::pushBuffer()
+{
+	Chunk *chunk = this->chunks->beginPush();
+	if (!chunk)
+		return false; //the thread stopped on an error
+	std::swap(chunk->data, this->buffer);
+	chunk->length = this->used;
+	this->chunks->push();
+	this->written += this->used;
+	this->used = 0;
+	return true;
+}
+
+//Completes the compressed output.
+//
+//Returns: whether all output was written successfully
+bool CompressedOutput::close()
+{
+	if (this->bClosed)
+		return !this->bFailed;
+	this->bClosed = true;
+
+	if (this->chunks) {
+		if (this->used)
+			pushBuffer();
+		stopThread();
+	}
+	flush(true);
+
+	UntrackedMemoryScope memory;
+	if (!end())
+		this->bFailed = true;
+	return !this->bFailed;
+}
+
+//Writes data that doesn't fit in the rest of the buffer.
+bool CompressedOutput::writeLarge(const void* data, const size_t len)
+{
+	if (this->chunks) {
+		//Fill buffers in turn for the compression thread.
+		const char *pos = static_cast<const char*>(data);
+		size_t remaining = len;
+		while (remaining > this->capacity - this->used)
+		{
+			const size_t fill = this->capacity - this->used;
+			memcpy(this->buffer + this->used, pos, fill);
+			this->used += fill;
+			pos += fill;
+			remaining -= fill;
+			if (!pushBuffer())
+				return false;
+		}
+		memcpy(this->buffer + this->used, pos, remaining);
+		this->used += remaining;
+		return true;
+	}
+
+	if (!flush(false))
+		return false;
+
+	const char *pos = static_cast<const char*>(data);
+	size_t remaining = len;
+	while (remaining >= this->capacity)
+	{
+		//Too big to buffer -- compress it directly, a buffer-full at a time.
+		UntrackedMemoryScope memory;
+		if (!compress(pos, this->capacity, false)) {
+			this->bFailed = true;
+			return false;
+		}
+		pos += this->capacity;
+		remaining -= this->capacity;
+		this->written += this->capacity;
+	}
+	memcpy(this->buffer, pos, remaining);
+	this->used = remaining;
+	return true;
+}
+
+bool CompressedOutput::flush(const bool bFinish)
+{
+	if (__atomic_load_n(&this->bFailed, __ATOMIC_SEQ_CST))
+		return false;
+	if (this->chunks) {
+		assert(!bFinish); //the thread is stopped first
+		return pushBuffer();
+	}
+
+	UntrackedMemoryScope memory;
+	if (!compress(this->buffer, this->used, bFinish))
+		this->bFailed = true;
+	this->written += this->used;
+	this->used = 0;
+	return !this->bFailed;
+}
+
+} // namespace zdw
+} // namespace adobe
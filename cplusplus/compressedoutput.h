@@ -0,0 +1,98 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#ifndef COMPRESSEDOUTPUT_H
+#define COMPRESSEDOUTPUT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+
+namespace adobe {
+namespace zdw {
+
+template <typename T> class RingBuffer;
+
+//A buffered output stream that compresses everything written to it.
+//
+//Data are compressed in-process when the codec was compiled in (see ZDW_HAVE_* in CMakeLists.txt),
+//or else piped through an external compression command.  NONE writes them to the file as is.
+class CompressedOutput
+{
+private:
+	//not implemented
+	CompressedOutput(CompressedOutput const &);
+	CompressedOutput &operator=(CompressedOutput const &);
+
+public:
+	static const size_t DEFAULT_BUFFER_SIZE;
+
+	enum Codec { GZIP, BZIP2, XZ, ZSTD, NONE };
+
+	static CompressedOutput* open(const Codec codec, const char* filename,
+		const char* zArgs = NULL, const int numThreads = 1);
+	static CompressedOutput* openCommand(const char* cmd);
+
+	virtual ~CompressedOutput();
+
+	//Returns: whether operation succeeded
+	bool write(const void* data, const size_t len)
+	{
+		if (len > this->capacity - this->used)
+			return writeLarge(data, len);
+		memcpy(this->buffer + this->used, data, len);
+		this->used += len;
+		return true;
+	}
+	bool put(const char c) { return write(&c, 1); }
+
+	//Returns: number of (uncompressed) bytes written so far
+	uint64_t tell() const { return this->written + this->used; }
+
+	//Compresses buffered data on a separate thread from now on, while the caller fills the next buffer.
+	//Returns: whether the thread was started
+	bool startThread();
+
+	bool close();
+
+protected:
+	explicit CompressedOutput(const size_t capacity = DEFAULT_BUFFER_SIZE);
+
+	//Compresses len bytes of data to the output.  If bFinish is set, the stream is completed.
+	virtual bool compress(const char* data, const size_t len, const bool bFinish) = 0;
+	virtual bool end() = 0; //releases the output
+
+private:
+	struct Chunk; //a buffer-full of data waiting to be compressed
+
+	bool writeLarge(const void* data, const size_t len);
+	bool flush(const bool bFinish);
+	bool pushBuffer();
+	void stopThread();
+	static void* compressThread(void* arg);
+
+	const size_t capacity;
+	char *buffer;
+	size_t used;
+	uint64_t written; //bytes passed on to be compressed
+	bool bFailed, bClosed;
+
+	RingBuffer<Chunk> *chunks; //when compressing on a separate thread
+	pthread_t thread;
+};
+
+} // namespace zdw
+} // namespace adobe
+
+#endif
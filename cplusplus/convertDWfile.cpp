@@ -15,6 +15,7 @@
 
 #include <cstring>
 #include <cassert>
+#include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -23,6 +24,7 @@ using namespace adobe::zdw;
 using std::map;
 using std::strcmp;
 using std::string;
+using std::vector;
 
 
 //******************************************************************
@@ -41,12 +43,13 @@ void usage(const char* executable)
 	else
 		exe = executable;
 
-	printf("Usage: %s [-d <dir>] [-(b|J|Jf|z|q|r|v)] [other options] file1 [file2] ...\n", exe);
+	printf("Usage: %s [-d <dir>] [-(b|J|Jf|z|u|q|r|v)] [other options] file1 [file2] ...\n", exe);
 	printf(
 		"\t-b  compress .zdw with bzip2 [default=use gzip]\n"
 		"\t-J  compress .zdw with xz [default=use gzip]\n"
 		"\t -Jf  compress to .zdw.xz file via fsx (applying fastlzma2 algorithm)\n"
 		"\t-z  compress .zdw with zstd\n"
+		"\t-u  leave .zdw uncompressed, so readers can load its block index and read its data in place\n"
 		"\t-d  output to directory <dir> [default=same directory as source file]\n"
 		"\t-i  streaming input from stdin; file1 is used as the implied name for the input stream\n"
 		"\t-q  quiet operation (no status or progress messages) [default=not quiet]\n"
@@ -54,8 +57,14 @@ void usage(const char* executable)
 		"\t-t  trim trailing spaces from fields (for MySQL 5 exports)\n"
 		"\t-v  validate the new file\n"
 		"\n"
-		"\t--zargs=X          arguments to pass in to the file compression process\n"
+		"\t--zargs=X          arguments to pass in to the file compressor (e.g. level and threads); arguments not supported in-process run the compression command instead\n"
 		"\t--mem-limit=<MB>   limit the MB of RAM used (default=3072 MB)\n"
+		"\t--threads=N        parse input, sort dictionaries and compress xz/zstd output on N threads, encoding rows while they are compressed (default=1; the first pass over input is serial with -i)\n"
+		"\t--single-pass      parse input only once, caching parsed rows in memory (no temp file is written for -i unless validating)\n"
+		"\t--block-index      write a version 12 file, ending with an index of the byte offsets and row counts of its blocks\n"
+		"\t--bloom=<col>,...  add a Bloom filter of the listed text columns' values to each block's index entry (implies --block-index)\n"
+		"\t--columnar         store each block's rows by column, so readers of a few columns can skip the others (implies --block-index)\n"
+		"\t--keyframes=N      start a keyframe every N rows of a block, so readers can begin decoding mid-block (e.g. 65536; implies --block-index)\n"
 		"\n"
 		"\t--metadata:<key>=<value>   supply a key-value pair to store as file metadata for every file being converted\n"
 		"\t--metadata-file=<filename> supply a filepath to specify key-value pairs (formatted as '<key>=<value>' pairs, each on a separate line) to store as file metadata for every file being converted\n"
@@ -108,11 +117,17 @@ int main(int argc, char* argv[])
 	bool bStreamingInput = false;
 	bool removeOldFiles = false;
 	bool trimTrailingSpaces = false;
+	bool singlePass = false;
+	bool blockIndex = false;
+	bool columnar = false;
+	ULONG keyframeInterval = 0;
+	vector<string> bloomColumns;
 	bool validate = false;
 	bool bQuiet = false;
 	ConvertToZDW::Compressor compressor = ConvertToZDW::GZIP;
 	const char* pOutputDir = NULL; //default = current dir
 	const char* zArgs = NULL;
+	int numThreads = 1;
 	map<string, string> metadata;
 
 	//Parse flags.
@@ -133,6 +148,7 @@ int main(int argc, char* argv[])
 					}
 					break;
 				case 'z': compressor = ConvertToZDW::ZSTD; break;
+				case 'u': compressor = ConvertToZDW::NONE; break;
 				case 'd':
 					if (++i >= argc)
 					{
@@ -180,6 +196,40 @@ int main(int argc, char* argv[])
 							}
 							break;
 						}
+						if (!strcmp(flag, "block-index")) {
+							blockIndex = true;
+							break;
+						}
+						if (!strcmp(flag, "columnar")) {
+							columnar = true;
+							break;
+						}
+						if (!strncmp(flag, "keyframes=", 10)) {
+							keyframeInterval = strtoul(flag + 10, NULL, 10);
+							if (!keyframeInterval)
+								return badParam(program, argv[i]);
+							break;
+						}
+						if (!strncmp(flag, "bloom=", 6)) {
+							std::istringstream names(flag + 6);
+							string name;
+							while (std::getline(names, name, ','))
+								if (!name.empty())
+									bloomColumns.push_back(name);
+							if (bloomColumns.empty())
+								return badParam(program, argv[i]);
+							break;
+						}
+						if (!strcmp(flag, "single-pass")) {
+							singlePass = true;
+							break;
+						}
+						if (!strncmp(flag, "threads=", 8)) {
+							numThreads = atoi(flag + 8);
+							if (numThreads < 1)
+								return badParam(program, argv[i]);
+							break;
+						}
 						if (!strncmp(flag, "zargs=", 6)) {
 							zArgs = flag + 6;
 							break;
@@ -225,6 +275,15 @@ int main(int argc, char* argv[])
 			convert.compressor = compressor;
 			if (trimTrailingSpaces)
 				convert.trimTrailingSpaces();
+			if (singlePass)
+				convert.singlePass();
+			if (blockIndex)
+				convert.blockIndex();
+			if (columnar)
+				convert.columnar();
+			convert.setKeyframeInterval(keyframeInterval);
+			convert.setBloomFilterColumns(bloomColumns);
+			convert.setNumThreads(numThreads);
 			const ConvertToZDW::ERR_CODE res = convert.convertFile(argv[i], program, validate, filestub, pOutputDir, zArgs, metadata);
 
 			if (res != ConvertToZDW::OK)
@@ -12,9 +12,171 @@
 
 #include "dictionary.h"
 #include "memory.h"
+#include <algorithm>
 #include <cassert>
+#include <pthread.h>
 
 using namespace adobe::zdw::internal;
+using adobe::zdw::ULONG;
+using adobe::zdw::UntrackedMemoryScope;
+
+
+namespace {
+
+const size_t INITIAL_TABLE_SIZE = 1024; //must be a power of 2
+
+//Heap entries are padded to keep each entry header aligned.
+const size_t ENTRY_ALIGNMENT = sizeof(ULONG);
+
+//FNV-1a
+inline ULONG hash_string(const char* str, const ULONG len)
+{
+	ULONG hash = 2166136261u;
+	const char* end = str + len;
+	for (const char* c = str; c != end; ++c)
+	{
+		hash ^= static_cast<char unsigned>(*c);
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+//Dictionary sorting.
+const size_t NUM_SORT_BUCKETS = 256 * 256; //entries are first distributed by their leading two bytes
+const size_t MIN_ENTRIES_TO_SORT_IN_PARALLEL = 64 * 1024;
+const size_t INSERTION_SORT_THRESHOLD = 16;
+
+inline int char_at(const DictionaryEntry* entry, const size_t depth)
+{
+	return static_cast<char unsigned>(entry->str()[depth]);
+}
+
+//Bucket index for an entry's leading two bytes, in strcmp order.
+inline size_t sort_bucket(const DictionaryEntry* entry)
+{
+	const int c0 = char_at(entry, 0);
+	return c0 ? (c0 << 8) | char_at(entry, 1) : 0;
+}
+
+//Sorts entries sharing their first 'depth' bytes.
+void insertion_sort(DictionaryEntry** entries, const size_t n, const size_t depth)
+{
+	for (size_t i = 1; i < n; ++i)
+	{
+		DictionaryEntry *entry = entries[i];
+		const char *str = entry->str() + depth;
+		size_t j = i;
+		for ( ; j > 0 && strcmp(entries[j - 1]->str() + depth, str) > 0; --j)
+			entries[j] = entries[j - 1];
+		entries[j] = entry;
+	}
+}
+
+//Multikey quicksort (Bentley & Sedgewick) of entries sharing their first 'depth' bytes.
+void multikey_quicksort(DictionaryEntry** entries, size_t n, size_t depth)
+{
+	while (n > INSERTION_SORT_THRESHOLD)
+	{
+		//Median-of-three pivot character.
+		int a = char_at(entries[0], depth), b = char_at(entries[n / 2], depth), c = char_at(entries[n - 1], depth);
+		if (a > b) std::swap(a, b);
+		if (b > c) std::swap(b, c);
+		if (a > b) std::swap(a, b);
+		const int pivot = b;
+
+		//Three-way partition on the character at 'depth'.
+		size_t lt = 0, i = 0, gt = n;
+		while (i < gt)
+		{
+			const int ch = char_at(entries[i], depth);
+			if (ch < pivot)
+				std::swap(entries[lt++], entries[i++]);
+			else if (ch > pivot)
+				std::swap(entries[i], entries[--gt]);
+			else
+				++i;
+		}
+
+		multikey_quicksort(entries, lt, depth);
+		multikey_quicksort(entries + gt, n - gt, depth);
+
+		//Entries equal at 'depth' continue on the next character, unless they have ended.
+		if (!pivot)
+			return;
+		entries += lt;
+		n = gt - lt;
+		++depth;
+	}
+	insertion_sort(entries, n, depth);
+}
+
+//Bucketed entries, sorted concurrently bucket by bucket.
+struct SortJob
+{
+	DictionaryEntry** entries;
+	const size_t* bucketStart; //NUM_SORT_BUCKETS + 1 bucket boundaries
+	size_t nextBucket;         //next bucket to be claimed by a thread
+};
+
+void* sort_buckets(void* arg)
+{
+	SortJob *job = static_cast<SortJob*>(arg);
+	size_t b;
+	while ((b = __sync_fetch_and_add(&job->nextBucket, 1)) < NUM_SORT_BUCKETS)
+	{
+		const size_t n = job->bucketStart[b + 1] - job->bucketStart[b];
+		if (n > 1) //entries are unique, so a bucket of strings ending within the leading bytes holds one entry
+			multikey_quicksort(job->entries + job->bucketStart[b], n, 2);
+	}
+	return NULL;
+}
+
+//Sorts entries in strcmp order, using up to numThreads threads.
+void sort_entries(std::vector<DictionaryEntry*>& entries, int numThreads)
+{
+	const size_t n = entries.size();
+	if (n < MIN_ENTRIES_TO_SORT_IN_PARALLEL)
+		numThreads = 1;
+	if (numThreads <= 1) {
+		multikey_quicksort(n ? &entries[0] : NULL, n, 0);
+		return;
+	}
+
+	//MSD radix pass: distribute entries into buckets by their leading two bytes.
+	std::vector<size_t> bucketStart(NUM_SORT_BUCKETS + 1);
+	for (size_t i = 0; i < n; ++i)
+		++bucketStart[sort_bucket(entries[i]) + 1];
+	for (size_t b = 0; b < NUM_SORT_BUCKETS; ++b)
+		bucketStart[b + 1] += bucketStart[b];
+
+	std::vector<DictionaryEntry*> bucketed(n);
+	std::vector<size_t> pos(bucketStart.begin(), bucketStart.end() - 1);
+	for (size_t i = 0; i < n; ++i)
+		bucketed[pos[sort_bucket(entries[i])]++] = entries[i];
+	entries.swap(bucketed);
+
+	SortJob job;
+	job.entries = &entries[0];
+	job.bucketStart = &bucketStart[0];
+	job.nextBucket = 0;
+
+	std::vector<pthread_t> threads(numThreads);
+	std::vector<char> bThreadStarted(numThreads);
+	{
+		UntrackedMemoryScope memory; //thread stacks don't count against the memory limit
+		for (int t = 1; t < numThreads; ++t)
+			bThreadStarted[t] = pthread_create(&threads[t], NULL, sort_buckets, &job) == 0;
+	}
+	sort_buckets(&job); //this thread works too, and finishes any buckets left unclaimed
+	{
+		UntrackedMemoryScope memory;
+		for (int t = 1; t < numThreads; ++t)
+			if (bThreadStarted[t])
+				pthread_join(threads[t], NULL);
+	}
+}
+
+}
 
 
 namespace adobe {
@@ -22,40 +184,119 @@ namespace zdw {
 
 void Dictionary::clear()
 {
-	stringOffsets.clear();
+	DictionaryT().swap(table); //release table memory
+	numEntries = 0;
 	stringHeap.clear();
 	size = 0;
 }
 
+//Returns: index of the slot holding str (of length len), or else the empty slot where str belongs
+size_t Dictionary::findSlot(const char* str, const ULONG len, const ULONG hash) const
+{
+	assert(!table.empty());
+
+	const size_t mask = table.size() - 1;
+	size_t slot = hash & mask;
+	const DictionaryEntry* entry;
+	while ((entry = table[slot]) != NULL)
+	{
+		if (entry->hash == hash && entry->len == len + 1 && !memcmp(entry->str(), str, len))
+			break;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+//Doubles the size of the hash table, or allocates it when empty.
+void Dictionary::growTable()
+{
+	DictionaryT newTable(table.empty() ? INITIAL_TABLE_SIZE : table.size() * 2);
+
+	const size_t mask = newTable.size() - 1;
+	for (DictionaryT::const_iterator it = table.begin(); it != table.end(); ++it)
+	{
+		DictionaryEntry* entry = *it;
+		if (!entry)
+			continue;
+		size_t slot = entry->hash & mask;
+		while (newTable[slot])
+			slot = (slot + 1) & mask;
+		newTable[slot] = entry;
+	}
+	table.swap(newTable);
+}
+
 //Returns: true if additional memory is available, or false if memory limit has been exceeded
-bool Dictionary::insert(const char* str)
+//str need not be null-terminated.
+bool Dictionary::insert(const char* str, const ULONG len)
+{
+	const DictionaryEntry* entry;
+	return insert(str, len, entry);
+}
+
+bool Dictionary::insert(
+	const char* str, const ULONG len,
+	const DictionaryEntry*& entry) //(out) the dictionary's entry for str
 {
-	std::pair<DictionaryT::iterator, bool> ret =
-		stringOffsets.insert(std::pair<const char*, int unsigned>(str, 0));
+	return insert(str, len, hash_string(str, len), entry);
+}
 
-	if (ret.second) {
-		const size_t len = strlen(str) + 1; //include null terminator
-		char *heapStr = this->stringHeap.copyToHeap(str, len);
-		this->size += len;
+bool Dictionary::insert(const char* str, const ULONG len, const ULONG hash, const DictionaryEntry*& entry)
+{
+	size_t slot = table.empty() ? 0 : findSlot(str, len, hash);
+	if (table.empty() || !table[slot]) {
+		//Keep the load factor under 3/4.  The table grows only as entries are added.
+		//Like the strings, its memory is checked against the limit when the heap next allocates a block.
+		if ((numEntries + 1) * 4 > table.size() * 3) {
+			growTable();
+			slot = findSlot(str, len, hash);
+		}
 
-		//performance optimization: hack map with equivalent key, pointing to the heap string.
-		// This avoids slower operations, e.g., a membership search before inserting into the heap,
-		// or copying the string into the heap before attempting a map insert, then backing it out on map collision
-		const char **strPtr = const_cast<const char**>(&(ret.first->first));
-		*strPtr = heapStr;
+		//Store the entry header and null-terminated string together in the heap.
+		const size_t bytes = (sizeof(DictionaryEntry) + len + 1 + ENTRY_ALIGNMENT - 1) & ~(ENTRY_ALIGNMENT - 1);
+		DictionaryEntry *newEntry = reinterpret_cast<DictionaryEntry*>(this->stringHeap.allocate(bytes));
+		newEntry->hash = hash;
+		newEntry->len = len + 1;
+		newEntry->offset = 0;
+		memcpy(newEntry->str(), str, len);
+		newEntry->str()[len] = 0;
 
+		table[slot] = newEntry;
+		++this->numEntries;
+		this->size += len + 1;
+
+		entry = newEntry;
 		return !this->stringHeap.is_low_on_memory();
 	}
 
+	entry = table[slot];
 	return true;
 }
 
-ULONG Dictionary::getOffset(const char* str) const
+//Adds the string of an entry of another dictionary (e.g., a per-thread dictionary).
+bool Dictionary::insert(
+	const DictionaryEntry& rhsEntry,
+	const DictionaryEntry*& entry) //(out) this dictionary's entry for the string
 {
-	DictionaryT::const_iterator it = stringOffsets.find(str);
-	assert(it != stringOffsets.end());
+	return insert(rhsEntry.str(), rhsEntry.len - 1, rhsEntry.hash, entry);
+}
 
-	return it->second;
+//Returns: this dictionary's entry for the string of an entry in another dictionary
+const DictionaryEntry* Dictionary::find(const DictionaryEntry& entry) const
+{
+	const DictionaryEntry* ourEntry = table.empty() ? NULL : table[findSlot(entry.str(), entry.len - 1, entry.hash)];
+	assert(ourEntry);
+
+	return ourEntry;
+}
+
+//Returns: the entry for str, which must be in the dictionary
+const DictionaryEntry* Dictionary::getEntry(const char* str, const ULONG len) const
+{
+	const DictionaryEntry* entry = table.empty() ? NULL : table[findSlot(str, len, hash_string(str, len))];
+	assert(entry);
+
+	return entry;
 }
 
 //Returns: byte size required to represent largest offset
@@ -72,39 +313,44 @@ ULONG Dictionary::getBytesInOffset() const
 	return indexSize;
 }
 
-//Post-condition: stringOffsets has values populated
-void Dictionary::write(FILE* f)
+//Post-condition: entries have offsets populated
+void Dictionary::write(CompressedOutput* out, const int numThreads) //(in) threads to sort the entries with [default=1]
 {
-	static const char unsigned zero = 0;
-
 	if (empty()) {
 		//Write 0, indicating empty set.
-		fwrite(&zero, 1, 1, f);
+		out->put(0);
 		return;
 	}
 
 	//Write bytes used to store an offset.
 	const ULONG indexSize = getBytesInOffset();
-	fwrite(&indexSize, 1, 1, f);
+	out->put(static_cast<char>(indexSize));
 
 	//Write buffer size.
 	const ULONG bufferSize = getSize();
 	indexBytes val;
 	val.n = bufferSize;
-	fwrite(val.c, indexSize, 1, f);
+	out->write(val.c, indexSize);
 
 	//origin byte offset: only non-zero indices are recognized in the unconverter, so start at 1
-	fwrite(&zero, 1, 1, f);
+	out->put(0);
 	ULONG index = 1;
 
+	//Entries are stored in sorted order.
+	std::vector<DictionaryEntry*> entries;
+	entries.reserve(this->numEntries);
+	for (DictionaryT::const_iterator it = table.begin(); it != table.end(); ++it)
+		if (*it)
+			entries.push_back(*it);
+	sort_entries(entries, numThreads);
+
 	//Populate offsets and dump keys.
-	for (DictionaryT::iterator it = stringOffsets.begin(); it != stringOffsets.end(); ++it)
+	for (std::vector<DictionaryEntry*>::const_iterator it = entries.begin(); it != entries.end(); ++it)
 	{
-		it->second = index;
-		const char* str = it->first;
-		const ULONG len = strlen(str) + 1; //include null terminator
-		fwrite(str, len, 1, f);
-		index += len;
+		DictionaryEntry *entry = *it;
+		entry->offset = index;
+		out->write(entry->str(), entry->len); //include null terminator
+		index += entry->len;
 	}
 
 	assert(index == bufferSize);
@@ -112,4 +358,3 @@ void Dictionary::write(FILE* f)
 
 } // namespace zdw
 } // namespace adobe
-
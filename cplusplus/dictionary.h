@@ -14,11 +14,11 @@
 #define DICTIONARY_H
 
 #include "zdw/includes.h"
+#include "compressedoutput.h"
 #include "stringheap.h"
 
 #include <cstring>
-#include <map>
-#include <string>
+#include <vector>
 
 
 namespace adobe {
@@ -27,13 +27,19 @@ namespace zdw {
 
 namespace internal {
 
-struct cstringComp
+//A dictionary string stored in the string heap, preceded by its hash and length.
+struct DictionaryEntry
 {
-	bool operator() (const char* const& lhs, const char* const& rhs) const { return std::strcmp(lhs, rhs) < 0; }
+	ULONG hash;
+	ULONG len;    //including null terminator
+	ULONG offset; //populated when the dictionary is written
+
+	const char* str() const { return reinterpret_cast<const char*>(this + 1); }
+	char* str() { return reinterpret_cast<char*>(this + 1); }
 };
 
-typedef std::map<const char*, ULONG, cstringComp> DictionaryT;
-//typedef std::map<std::string, ULONG> DictionaryT; //replaced with custom memory management
+//Open-addressed hash table of entries (linear probing).  Empty slots are NULL.
+typedef std::vector<DictionaryEntry*> DictionaryT;
 
 } // namespace internal
 
@@ -42,22 +48,32 @@ typedef std::map<const char*, ULONG, cstringComp> DictionaryT;
 class Dictionary
 {
 public:
-	Dictionary() : size(0) { }
+	explicit Dictionary(const size_t heapBlockSize = StringHeap::DEFAULT_BLOCK_SIZE)
+		: numEntries(0), stringHeap(heapBlockSize), size(0) { }
 
 	void clear();
 
-	bool insert(const char* str);
+	bool insert(const char* str, const ULONG len);
+	bool insert(const char* str, const ULONG len, const internal::DictionaryEntry*& entry);
+	bool insert(const internal::DictionaryEntry& rhsEntry, const internal::DictionaryEntry*& entry);
+	const internal::DictionaryEntry* find(const internal::DictionaryEntry& entry) const;
 
 	bool empty() const { return size == 0; }
 	ULONG getBytesInOffset() const;
-	ULONG getNumEntries() const { return stringOffsets.size(); }
+	ULONG getNumEntries() const { return numEntries; }
 	ULONG getSize() const { return size + 1; } //include origin null byte
-	ULONG getOffset(const char* str) const;
+	ULONG getOffset(const char* str, const ULONG len) const { return getEntry(str, len)->offset; }
+	const internal::DictionaryEntry* getEntry(const char* str, const ULONG len) const;
 
-	void write(FILE* f); //populates values in stringOffsets
+	void write(CompressedOutput* out, const int numThreads = 1); //populates entry offsets
 
 private:
-	internal::DictionaryT stringOffsets;
+	size_t findSlot(const char* str, const ULONG len, const ULONG hash) const;
+	bool insert(const char* str, const ULONG len, const ULONG hash, const internal::DictionaryEntry*& entry);
+	void growTable();
+
+	internal::DictionaryT table;
+	ULONG numEntries;
 	StringHeap stringHeap;
 	ULONG size;
 };
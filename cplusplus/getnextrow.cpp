@@ -12,8 +12,13 @@
 
 #include "getnextrow.h"
 
+#include "memory.h"
+#include "tokenizer.h"
+
 #include <assert.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 namespace adobe {
@@ -83,6 +88,72 @@ int GetNextRow(
 	return len;
 }
 
+//Maps the regular file read by f, from its start.
+//
+//Returns: whether the file could be mapped -- if not, the file should be read through f
+bool MappedRowReader::open(FILE* f)
+{
+	close();
+
+	struct stat st;
+	const int fd = fileno(f);
+	if (fd < 0 || fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return false;
+
+	void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED)
+		return false;
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+	this->data = static_cast<char*>(addr);
+	this->size = st.st_size;
+	this->pos = this->data;
+
+	//The mapping is backed by the file -- don't count it toward the process memory limit.
+	Memory::add_untracked_bytes(this->size);
+
+	return true;
+}
+
+void MappedRowReader::close()
+{
+	if (this->data) {
+		munmap(this->data, this->size);
+		Memory::add_untracked_bytes(-static_cast<long long>(this->size));
+	}
+	this->data = NULL;
+	this->size = 0;
+	this->pos = NULL;
+}
+
+//Mapped variant of GetNextRow.
+//rowSize is grown as GetNextRow would grow its buffer to hold each row.
+//
+//Returns: pointer to the next row, of length len (excluding the trailing newline), or NULL at end of file
+const char* MappedRowReader::getNextRow(size_t& len, ULONG& rowSize)
+{
+	const char *fileEnd = end();
+	while (this->pos < fileEnd)
+	{
+		const char *row = this->pos;
+		const char *rowEnd = FindRowEnd(row, fileEnd, row);
+		if (!rowEnd) {
+			this->pos = fileEnd;
+			return NULL; //eof -- an unterminated final row is ignored
+		}
+		this->pos = rowEnd + 1;
+
+		len = rowEnd - row;
+		if (!len)
+			continue; //skip empty lines
+
+		while (len + 1 >= rowSize) //newline included
+			rowSize *= 2;
+		return row;
+	}
+	return NULL;
+}
+
 } // namespace zdw
 } // namespace adobe
 
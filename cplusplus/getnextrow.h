@@ -19,8 +19,39 @@
 namespace adobe {
 namespace zdw {
 
+//A span of text within an input row (not null-terminated).
+struct TextSpan
+{
+	const char* str;
+	size_t len;
+};
+
 int GetNextRow(FILE* f, char*& row, ULONG& rowSize);
 
+//Reads rows directly out of a memory-mapped input file, without copying them.
+class MappedRowReader
+{
+public:
+	MappedRowReader() : data(NULL), size(0), pos(NULL) { }
+	~MappedRowReader() { close(); }
+
+	bool open(FILE* f);
+	void close();
+	bool is_open() const { return data != NULL; }
+
+	const char* getNextRow(size_t& len, ULONG& rowSize);
+
+	//Current read position, for rewinding.
+	const char* tell() const { return pos; }
+	void seek(const char* newPos) { pos = newPos; }
+	const char* end() const { return data + size; }
+
+private:
+	char *data;
+	size_t size;
+	const char *pos;
+};
+
 } // namespace zdw
 } // namespace adobe
 
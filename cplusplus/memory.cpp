@@ -13,6 +13,9 @@
 #include "memory.h"
 #include <fstream>
 #include <string>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 using std::string;
 
@@ -28,6 +31,7 @@ namespace adobe {
 namespace zdw {
 
 float Memory::memory_threshold_mb = DEFAULT_PROCESS_MEMORY_THRESHOLD;
+long long Memory::untracked_bytes = 0;
 
 //Returns: allocated memory, in MB
 double Memory::process_memory_usage()
@@ -51,7 +55,7 @@ double Memory::process_memory_usage()
 
 		stat_stream.close();
 
-		vm_usage = vsize / (1024.0 * 1024.0); //bytes --> MB
+		vm_usage = (static_cast<long long>(vsize) - untracked_bytes) / (1024.0 * 1024.0); //bytes --> MB (negative while untracked memory is being freed)
 	}
 
 	return vm_usage;
@@ -72,6 +76,35 @@ bool Memory::set_memory_threshold_MB(const float mb)
 	return false;
 }
 
+//Returns: the size of a memory block to allocate -- blockSize, or near the memory limit, half of the whole MBs still available
+//(at least 1MB, and minSize), rather than overshooting the limit by most of a block.  The other half is left for what else
+//the block being built takes memory for (e.g., its row cache or column segments).
+size_t Memory::get_block_size(const size_t blockSize, const size_t minSize)
+{
+	const double availableMB = get_memory_usage_limit_MB() - process_memory_usage();
+	const size_t size = (availableMB >= 2.0 ? static_cast<size_t>(availableMB / 2) : 1) * 1024 * 1024;
+	if (size < blockSize)
+		return size > minSize ? size : minSize;
+	return blockSize;
+}
+
+//Excludes (or with negative bytes, re-includes) address space from the process memory usage,
+//e.g., for memory-mapped input files, whose pages are backed by the file rather than by RAM.
+void Memory::add_untracked_bytes(const long long bytes)
+{
+	Memory::untracked_bytes += bytes;
+}
+
+//Has large allocations returned to the system as soon as they are freed, so process memory usage
+//follows the memory in use.  Otherwise glibc raises its mmap threshold whenever a large allocation is freed
+//(e.g., by a worker thread), and later ones stay in its heap once freed.
+void Memory::release_freed_allocations()
+{
+#ifdef M_MMAP_THRESHOLD
+	mallopt(M_MMAP_THRESHOLD, 128 * 1024); //glibc's initial threshold, fixed
+#endif
+}
+
 //Returns: whether there is enough RAM available for allocating another block
 bool Memory::CanAllocateMemory(const long long unsigned memNeeded)
 {
@@ -13,6 +13,8 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <cstddef>
+
 
 namespace adobe {
 namespace zdw {
@@ -22,6 +24,7 @@ class Memory
 	Memory(); //unimplemented
 
 	static float memory_threshold_mb;
+	static long long untracked_bytes;
 
 public:
 	static bool CanAllocateMemory(const long long unsigned memNeeded);
@@ -29,6 +32,26 @@ public:
 	static float get_memory_usage_limit_MB();
 	static double process_memory_usage();
 	static bool set_memory_threshold_MB(const float mb);
+	static size_t get_block_size(const size_t blockSize, const size_t minSize);
+
+	static void add_untracked_bytes(const long long bytes);
+	static void release_freed_allocations();
+};
+
+//Address space taken while in scope (e.g., by worker threads' transient buffers and malloc arenas,
+//or by a codec's state) is kept out of the memory limit, so it doesn't shrink the blocks being built.
+class UntrackedMemoryScope
+{
+public:
+	UntrackedMemoryScope() : before(Memory::process_memory_usage()) { }
+	~UntrackedMemoryScope()
+	{
+		Memory::add_untracked_bytes(static_cast<long long>(
+			(Memory::process_memory_usage() - this->before) * 1024 * 1024));
+	}
+
+private:
+	const double before;
 };
 
 } // namespace zdw
@@ -0,0 +1,157 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+
+
+namespace adobe {
+namespace zdw {
+
+//********************************************************
+//A bounded queue of reusable slots between one producer thread and one consumer thread.
+//
+//The producer fills the slot returned by beginPush() and publishes it with push().
+//The consumer reads the slot returned by front() and returns it to the producer with pop().
+//Slots are handed back and forth without locking; a side only takes the mutex when it
+//has to sleep until the other side catches up.
+template <typename T>
+class RingBuffer
+{
+private:
+	//not implemented
+	RingBuffer(RingBuffer const &);
+	RingBuffer &operator=(RingBuffer const &);
+
+public:
+	explicit RingBuffer(const size_t numSlots)
+		: slots(new T[numSlots])
+		, numSlots(numSlots)
+		, head(0), tail(0)
+		, numWaiting(0)
+		, bClosed(false)
+	{
+		assert(numSlots > 0);
+		pthread_mutex_init(&this->mutex, NULL);
+		pthread_cond_init(&this->changed, NULL);
+	}
+
+	~RingBuffer()
+	{
+		pthread_cond_destroy(&this->changed);
+		pthread_mutex_destroy(&this->mutex);
+		delete[] this->slots;
+	}
+
+	size_t size() const { return this->numSlots; }
+	T& slot(const size_t i) { return this->slots[i]; } //e.g., to allocate slots before use
+
+	//Producer: Returns: the next slot to fill, waiting while every slot is in use, or NULL once closed
+	T* beginPush()
+	{
+		wait(&RingBuffer::canPush);
+		if (load(this->bClosed))
+			return NULL;
+		return &this->slots[this->tail % this->numSlots];
+	}
+
+	//Producer: publishes the slot returned by beginPush().
+	void push()
+	{
+		store(this->tail, this->tail + 1);
+		notify();
+	}
+
+	//Consumer: Returns: the oldest published slot, waiting until there is one,
+	//  or NULL when the queue was closed and no published slots remain
+	T* front()
+	{
+		wait(&RingBuffer::canPop);
+		if (load(this->tail) == this->head)
+			return NULL;
+		return &this->slots[this->head % this->numSlots];
+	}
+
+	//Consumer: returns the slot returned by front() to the producer.
+	void pop()
+	{
+		store(this->head, this->head + 1);
+		notify();
+	}
+
+	//Either side: no more slots will be pushed, or (when called by the consumer) popped.
+	void close()
+	{
+		store(this->bClosed, true);
+		notify();
+	}
+
+	//Readies a closed queue for reuse, once neither side is using it.
+	void reset()
+	{
+		this->head = this->tail = 0;
+		this->bClosed = false;
+	}
+
+private:
+	static const int SPIN_COUNT = 1000; //checks made before sleeping
+
+	template <typename V> static V load(const V& v) { return __atomic_load_n(&v, __ATOMIC_SEQ_CST); }
+	template <typename V> static void store(V& v, const V val) { __atomic_store_n(&v, val, __ATOMIC_SEQ_CST); }
+
+	bool canPush() const { return load(this->bClosed) || this->tail - load(this->head) < this->numSlots; }
+	bool canPop() const { return load(this->bClosed) || load(this->tail) != this->head; }
+
+	void wait(bool (RingBuffer::*ready)() const)
+	{
+		for (int i = 0; i < SPIN_COUNT; ++i)
+		{
+			if ((this->*ready)())
+				return;
+		}
+
+		//Announcing the wait before re-checking ensures that the other side either sees the waiter
+		//or made its change before the check.
+		pthread_mutex_lock(&this->mutex);
+		__atomic_add_fetch(&this->numWaiting, 1, __ATOMIC_SEQ_CST);
+		while (!(this->*ready)())
+			pthread_cond_wait(&this->changed, &this->mutex);
+		__atomic_sub_fetch(&this->numWaiting, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&this->mutex);
+	}
+
+	void notify()
+	{
+		if (load(this->numWaiting)) {
+			pthread_mutex_lock(&this->mutex);
+			pthread_cond_broadcast(&this->changed);
+			pthread_mutex_unlock(&this->mutex);
+		}
+	}
+
+	T *slots;
+	const size_t numSlots;
+	size_t head, tail; //count of slots popped and pushed; written only by the consumer and producer, respectively
+	int numWaiting;
+	bool bClosed;
+	pthread_mutex_t mutex;
+	pthread_cond_t changed;
+};
+
+} // namespace zdw
+} // namespace adobe
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#include "rowcache.h"
+#include "memory.h"
+
+#include <cassert>
+#include <cstring>
+#include <new>
+
+
+namespace adobe {
+namespace zdw {
+
+const size_t RowCache::DEFAULT_BLOCK_SIZE = 16 * 1024 * 1024;
+
+//Prepares an empty cache for rows with the given number of columns.
+void RowCache::init(const size_t numColumns)
+{
+	clear();
+	this->numColumns = numColumns;
+	this->numBitmapBytes = (numColumns + 7) / 8;
+	RowValue empty;
+	empty.n = 0;
+	this->prevValues.assign(numColumns, empty);
+}
+
+void RowCache::clear()
+{
+	for (std::vector<Block>::iterator it = blocks.begin(); it != blocks.end(); ++it)
+		delete[] it->data;
+	blocks.clear();
+
+	for (std::vector<RowValue>::iterator it = prevValues.begin(); it != prevValues.end(); ++it)
+		it->n = 0;
+	numRows = 0;
+
+	low_on_memory = false;
+}
+
+//Returns: true if additional memory is available, or false if memory limit has been exceeded
+bool RowCache::append(const RowValue* values)
+{
+	assert(values);
+
+	char *pos = reserve(this->numBitmapBytes + this->numColumns * sizeof(RowValue)); //enough for any row
+	char unsigned *bitmap = reinterpret_cast<char unsigned*>(pos);
+	memset(bitmap, 0, this->numBitmapBytes);
+	pos += this->numBitmapBytes;
+
+	for (size_t c = 0; c < this->numColumns; ++c)
+	{
+		if (values[c].n != this->prevValues[c].n)
+		{
+			bitmap[c / 8] |= 1u << (c % 8);
+			memcpy(pos, values + c, sizeof(RowValue));
+			pos += sizeof(RowValue);
+			this->prevValues[c] = values[c];
+		}
+	}
+
+	Block& block = this->blocks.back();
+	block.used = pos - block.data;
+	++this->numRows;
+
+	return !this->low_on_memory;
+}
+
+//Returns: pointer to at least len bytes at the end of the current block
+char* RowCache::reserve(const size_t len)
+{
+	if (this->blocks.empty() || this->blocks.back().capacity - this->blocks.back().used < len)
+	{
+		try
+		{
+			allocBlock(Memory::get_block_size(len > this->blockSize ? len : this->blockSize, len));
+		}
+		catch (const std::bad_alloc&)
+		{
+			low_on_memory = true;
+			allocBlock(len);
+		}
+	}
+
+	Block& block = this->blocks.back();
+	return block.data + block.used;
+}
+
+void RowCache::allocBlock(const size_t size)
+{
+	Block block;
+	block.data = new char[size];
+	block.capacity = size;
+	block.used = 0;
+	block.bFirstRowIsFull = this->numRows == 0; //rows are stored against the previous row, if any
+
+	this->blocks.push_back(block);
+
+	if (!Memory::CanAllocateMemory(0))
+		low_on_memory = true;
+}
+
+
+//********************************************************
+RowCache::Reader::Reader(const RowCache& cache)
+	: cache(cache)
+	, blockIndex(0)
+	, pos(NULL)
+	, rowValues(cache.numColumns)
+{ }
+
+//Advances to the next row.
+//
+//Returns: false when no rows remain
+bool RowCache::Reader::next()
+{
+	while (this->blockIndex < this->cache.blocks.size())
+	{
+		const Block& block = this->cache.blocks[this->blockIndex];
+		if (!this->pos)
+		{
+			this->pos = block.data;
+			if (block.bFirstRowIsFull)
+			{
+				for (size_t c = 0; c < this->rowValues.size(); ++c)
+					this->rowValues[c].n = 0;
+			}
+		}
+
+		if (this->pos < block.data + block.used)
+		{
+			const size_t numBitmapBytes = this->cache.numBitmapBytes;
+			const char unsigned *bitmap = reinterpret_cast<const char unsigned*>(this->pos);
+			this->pos += numBitmapBytes;
+			for (size_t b = 0; b < numBitmapBytes; ++b)
+			{
+				if (!bitmap[b])
+					continue;
+				for (size_t c = b * 8; c < b * 8 + 8; ++c)
+				{
+					if (bitmap[b] & (1u << (c % 8)))
+					{
+						memcpy(&this->rowValues[c], this->pos, sizeof(RowValue));
+						this->pos += sizeof(RowValue);
+					}
+				}
+			}
+			return true;
+		}
+
+		++this->blockIndex;
+		this->pos = NULL;
+	}
+
+	return false;
+}
+
+} // namespace zdw
+} // namespace adobe
@@ -0,0 +1,99 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#ifndef ROWCACHE_H
+#define ROWCACHE_H
+
+#include "zdw/includes.h"
+#include "dictionary.h"
+
+#include <vector>
+
+
+namespace adobe {
+namespace zdw {
+
+//A value parsed from one column of an input row.
+union RowValue
+{
+	ULONGLONG n; //numeric value
+	const internal::DictionaryEntry* entry; //text value, or NULL when empty
+};
+
+//********************************************************
+//Holds the parsed rows of a block in memory, so they can be encoded
+//without re-reading and re-parsing the input.
+//
+//Each row is stored as a bitmap of the columns whose values differ from those of the previous row,
+//followed by the changed values.
+class RowCache
+{
+public:
+	static const size_t DEFAULT_BLOCK_SIZE;
+
+	explicit RowCache(const size_t blockSize = DEFAULT_BLOCK_SIZE)
+		: blockSize(blockSize)
+		, numColumns(0), numBitmapBytes(0)
+		, numRows(0)
+		, low_on_memory(false)
+		{ }
+	~RowCache() { clear(); }
+
+	void init(const size_t numColumns);
+	void clear();
+
+	bool append(const RowValue* values);
+
+	bool empty() const { return numRows == 0; }
+	ULONG getNumRows() const { return numRows; }
+	bool is_low_on_memory() const { return low_on_memory; }
+
+	//Iterates over the cached rows, in order.
+	class Reader
+	{
+	public:
+		explicit Reader(const RowCache& cache);
+
+		bool next();
+		const RowValue* values() const { return &rowValues[0]; } //values of the current row
+
+	private:
+		const RowCache& cache;
+		size_t blockIndex;
+		const char* pos;
+		std::vector<RowValue> rowValues;
+	};
+
+private:
+	struct Block
+	{
+		char* data;
+		size_t capacity, used;
+		bool bFirstRowIsFull; //the first row in this block is stored against a row of empty values
+	};
+
+	char* reserve(const size_t len);
+	void allocBlock(const size_t size);
+
+	const size_t blockSize;
+	size_t numColumns, numBitmapBytes;
+	std::vector<Block> blocks;
+	std::vector<RowValue> prevValues; //values of the last row appended
+	ULONG numRows;
+
+	bool low_on_memory;
+};
+
+} // namespace zdw
+} // namespace adobe
+
+#endif
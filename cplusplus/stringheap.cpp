@@ -18,37 +18,40 @@
 #include <stdio.h>
 
 
-namespace {
-
-const size_t HEAP_BLOCK_SIZE = 64 * 1024 * 1024;
-
-}
-
-
 namespace adobe {
 namespace zdw {
 
+const size_t StringHeap::DEFAULT_BLOCK_SIZE = 64 * 1024 * 1024;
+
 char* StringHeap::copyToHeap(const char* str, const size_t len)
+{
+	char *heapStr = allocate(len);
+	strcpy(heapStr, str);
+	return heapStr;
+}
+
+//Returns: pointer to len bytes of uninitialized heap memory
+char* StringHeap::allocate(const size_t len)
 {
 	//If we have space to allocate in the current block, use it.
 	if (this->freeBytesInCurrentBlock >= len)
-		return insert(str, len);
+		return reserve(len);
 
 	//Allocate more memory for our heap.
 	//Residual on previous block is wasted.
 	try
 	{
-		const size_t bytes = len > HEAP_BLOCK_SIZE ? len : HEAP_BLOCK_SIZE;
-		allocBlock(bytes);
-		return insert(str, len);
+		const size_t bytes = len > this->blockSize ? len : this->blockSize;
+		allocBlock(Memory::get_block_size(bytes, len));
+		return reserve(len);
 	}
 	catch(const std::bad_alloc&)
 	{
 		flag_low_memory();
-		if (len < HEAP_BLOCK_SIZE) {
+		if (len < this->blockSize) {
 			try {
 				allocBlock(len);
-				return insert(str, len);
+				return reserve(len);
 			}
 			catch(const std::bad_alloc&) {
 				throw;
@@ -58,18 +61,17 @@ char* StringHeap::copyToHeap(const char* str, const size_t len)
 	}
 }
 
-char* StringHeap::insert(const char* str, const size_t len) //includes null terminator
+char* StringHeap::reserve(const size_t len)
 {
 	assert(this->freePtr);
 	assert(this->freeBytesInCurrentBlock >= len);
 
-	char *heapStr = this->freePtr;
-	strcpy(heapStr, str);
+	char *ptr = this->freePtr;
 
 	this->freePtr += len;
 	this->freeBytesInCurrentBlock -= len;
 
-	return heapStr;
+	return ptr;
 }
 
 void StringHeap::allocBlock(const size_t size)
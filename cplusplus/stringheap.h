@@ -23,8 +23,11 @@ namespace zdw {
 class StringHeap
 {
 public:
-	StringHeap()
-		: freePtr(NULL)
+	static const size_t DEFAULT_BLOCK_SIZE;
+
+	explicit StringHeap(const size_t blockSize = DEFAULT_BLOCK_SIZE)
+		: blockSize(blockSize)
+		, freePtr(NULL)
 		, freeBytesInCurrentBlock(0)
 		, low_on_memory(false)
 		{ }
@@ -33,6 +36,7 @@ public:
 	void clear() { FreeMemory(); }
 
 	char* copyToHeap(const char* str, const size_t len);
+	char* allocate(const size_t len);
 
 	bool is_low_on_memory() const { return low_on_memory; }
 
@@ -40,10 +44,11 @@ private:
 	void allocBlock(const size_t size);
 	void FreeMemory();
 
-	char* insert(const char* str, const size_t len);
+	char* reserve(const size_t len);
 
 	void flag_low_memory() { low_on_memory = true; }
 
+	const size_t blockSize;
 	std::list<char*> blocks;
 	char *freePtr;
 	size_t freeBytesInCurrentBlock;
@@ -0,0 +1,377 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+//
+// Tests of the version 12 block index (see zdw/block_index.h):
+// serializing and parsing its entries and footer, zone map predicates and Bloom filters.
+//
+
+#include "zdw/block_index.h"
+#include "zdw_column_type_constants.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace adobe::zdw;
+
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+void check(const bool bOK, const char* expr, const int line)
+{
+	if (!bOK) {
+		fprintf(stderr, "test_block_index.cpp:%d: check failed: %s\n", line, expr);
+		++failures;
+	}
+}
+
+const size_t NUM_COLUMNS = 3;
+const UCHAR COLUMN_TYPES[NUM_COLUMNS] = { LONGLONG_SIGNED, VARCHAR, CHAR };
+
+ColumnZoneMap numericZoneMap(const ULONG nonEmptyRows, const SLONGLONG min, const SLONGLONG max)
+{
+	ColumnZoneMap zoneMap;
+	zoneMap.nonEmptyRows = nonEmptyRows;
+	zoneMap.min = static_cast<ULONGLONG>(min);
+	zoneMap.max = static_cast<ULONGLONG>(max);
+	zoneMap.sketch.assign(ZONE_MAP_SKETCH_SIZE, 1);
+	return zoneMap;
+}
+
+ColumnZoneMap textZoneMap(const ULONG nonEmptyRows, const string& min, const string& max, const bool bMaxTruncated)
+{
+	ColumnZoneMap zoneMap;
+	zoneMap.nonEmptyRows = nonEmptyRows;
+	zoneMap.minText = min;
+	zoneMap.maxText = max;
+	zoneMap.bMaxTextTruncated = bMaxTruncated;
+	zoneMap.sketch.assign(ZONE_MAP_SKETCH_SIZE, 2);
+	return zoneMap;
+}
+
+//An entry with zone maps, a Bloom filter of column 1 and keyframes every 10 rows.
+BlockIndexEntry makeEntry(const ULONGLONG offset, const ULONGLONG rowDataLength)
+{
+	BlockIndexEntry entry;
+	entry.offset = offset;
+	entry.rowDataLength = rowDataLength;
+	entry.numRows = 35;
+	entry.dictionarySize = 1234;
+	entry.zoneMaps.push_back(numericZoneMap(35, -5, 10));
+	entry.zoneMaps.push_back(textZoneMap(30, "apple", "melon", true));
+	entry.zoneMaps.push_back(ColumnZoneMap()); //all empty
+
+	BloomFilter& filter = entry.bloomFilters[1];
+	filter.init(3);
+	filter.insert("apple", 5);
+	filter.insert("kiwi", 4);
+	filter.insert("melon", 5);
+
+	entry.keyframeInterval = 10;
+	entry.keyframes.push_back(rowDataLength / 4);
+	entry.keyframes.push_back(rowDataLength / 2);
+	entry.keyframes.push_back(rowDataLength - 1);
+	return entry;
+}
+
+bool parse(const string& bytes, const size_t len, BlockIndexEntry& entry)
+{
+	return ParseBlockIndexEntry(bytes.data() + 4, len, COLUMN_TYPES, NUM_COLUMNS, entry);
+}
+
+//Returns: the length of an entry as serialized, not counting its length field
+size_t entryLength(const BlockIndexEntry& entry)
+{
+	string bytes;
+	AppendBlockIndexEntry(entry, COLUMN_TYPES, bytes);
+	return bytes.size() - 4;
+}
+
+//Returns: an index of the entries, ending a file of fileSize bytes, listing numBlocks blocks
+string makeIndex(const vector<BlockIndexEntry>& entries, const ULONG numBlocks)
+{
+	string index;
+	for (size_t i = 0; i < entries.size(); ++i)
+		AppendBlockIndexEntry(entries[i], COLUMN_TYPES, index);
+	const ULONGLONG indexSize = index.size() + BLOCK_INDEX_TAIL_SIZE;
+	index.append(reinterpret_cast<const char*>(&numBlocks), 4);
+	index.append(reinterpret_cast<const char*>(&indexSize), 8);
+	index.append(BLOCK_INDEX_MAGIC, 4);
+	return index;
+}
+
+bool parseIndex(const string& index, const ULONGLONG fileSize, vector<BlockIndexEntry>& entries)
+{
+	return ParseBlockIndex(index.data(), index.size(), fileSize, COLUMN_TYPES, NUM_COLUMNS, entries);
+}
+
+void testEntryRoundTrip()
+{
+	const BlockIndexEntry entry = makeEntry(100, 400);
+	string bytes;
+	AppendBlockIndexEntry(entry, COLUMN_TYPES, bytes);
+	ULONG len;
+	memcpy(&len, bytes.data(), 4);
+	CHECK(len == bytes.size() - 4);
+
+	BlockIndexEntry parsed;
+	CHECK(parse(bytes, len, parsed));
+	CHECK(parsed.offset == 100);
+	CHECK(parsed.rowDataLength == 400);
+	CHECK(parsed.numRows == 35);
+	CHECK(parsed.dictionarySize == 1234);
+	CHECK(parsed.zoneMaps.size() == NUM_COLUMNS);
+	CHECK(parsed.zoneMaps[0].nonEmptyRows == 35);
+	CHECK(static_cast<SLONGLONG>(parsed.zoneMaps[0].min) == -5);
+	CHECK(parsed.zoneMaps[0].max == 10);
+	CHECK(parsed.zoneMaps[0].sketch == entry.zoneMaps[0].sketch);
+	CHECK(parsed.zoneMaps[1].minText == "apple");
+	CHECK(parsed.zoneMaps[1].maxText == "melon");
+	CHECK(parsed.zoneMaps[1].bMaxTextTruncated);
+	CHECK(parsed.zoneMaps[2].nonEmptyRows == 0);
+	CHECK(parsed.bloomFilters.size() == 1);
+	CHECK(parsed.bloomFilters[1].getNumBlocks() == entry.bloomFilters.find(1)->second.getNumBlocks());
+	CHECK(parsed.bloomFilters[1].mayContain("kiwi"));
+	CHECK(parsed.keyframeInterval == 10);
+	CHECK(parsed.keyframes == entry.keyframes);
+
+	//Data added by a later version are skipped.
+	string longer = bytes + "later";
+	CHECK(parse(longer, len + 5, parsed));
+	CHECK(parsed.keyframes == entry.keyframes);
+
+	//An entry without zone maps.
+	BlockIndexEntry bare;
+	bare.offset = 7;
+	bare.numRows = 3;
+	bytes.clear();
+	AppendBlockIndexEntry(bare, COLUMN_TYPES, bytes);
+	CHECK(bytes.size() == 4 + BLOCK_INDEX_ENTRY_SIZE);
+	CHECK(parse(bytes, BLOCK_INDEX_ENTRY_SIZE, parsed));
+	CHECK(parsed.offset == 7 && parsed.numRows == 3);
+	CHECK(parsed.zoneMaps.empty() && parsed.bloomFilters.empty() && parsed.keyframes.empty());
+}
+
+//A truncated entry parses only where an older version's entry could end.
+void testEntryTruncated()
+{
+	BlockIndexEntry entry = makeEntry(0, 400);
+	string bytes;
+	AppendBlockIndexEntry(entry, COLUMN_TYPES, bytes);
+	const size_t len = bytes.size() - 4;
+
+	BlockIndexEntry noKeyframes = entry;
+	noKeyframes.keyframes.clear();
+	BlockIndexEntry zoneMapsOnly = noKeyframes;
+	zoneMapsOnly.bloomFilters.clear();
+	const size_t zoneMapsEnd = entryLength(zoneMapsOnly);
+	const size_t bloomFiltersEnd = entryLength(noKeyframes);
+
+	for (size_t cut = 0; cut < len; ++cut)
+	{
+		BlockIndexEntry parsed;
+		const bool bParsed = parse(bytes, cut, parsed);
+		const bool bExpected = cut == BLOCK_INDEX_ENTRY_SIZE || cut == zoneMapsEnd || cut == bloomFiltersEnd;
+		if (bParsed != bExpected)
+			fprintf(stderr, "entry cut at %lu of %lu bytes\n", static_cast<unsigned long>(cut), static_cast<unsigned long>(len));
+		CHECK(bParsed == bExpected);
+	}
+}
+
+void testEntryCorrupt()
+{
+	BlockIndexEntry parsed;
+	string bytes;
+
+	//Keyframes out of order, past the row data, or not one per interval.
+	BlockIndexEntry entry = makeEntry(0, 400);
+	swap(entry.keyframes[0], entry.keyframes[1]);
+	AppendBlockIndexEntry(entry, COLUMN_TYPES, bytes);
+	CHECK(!parse(bytes, bytes.size() - 4, parsed));
+
+	entry = makeEntry(0, 400);
+	entry.keyframes[2] = 400;
+	bytes.clear();
+	AppendBlockIndexEntry(entry, COLUMN_TYPES, bytes);
+	CHECK(!parse(bytes, bytes.size() - 4, parsed));
+
+	entry = makeEntry(0, 400);
+	entry.keyframes.pop_back();
+	bytes.clear();
+	AppendBlockIndexEntry(entry, COLUMN_TYPES, bytes);
+	CHECK(!parse(bytes, bytes.size() - 4, parsed));
+
+	//A Bloom filter of a column that doesn't exist.
+	entry = makeEntry(0, 400);
+	entry.bloomFilters[NUM_COLUMNS] = entry.bloomFilters[1];
+	bytes.clear();
+	AppendBlockIndexEntry(entry, COLUMN_TYPES, bytes);
+	CHECK(!parse(bytes, bytes.size() - 4, parsed));
+}
+
+void testIndex()
+{
+	vector<BlockIndexEntry> entries;
+	entries.push_back(makeEntry(10, 400));
+	entries.push_back(makeEntry(500, 300));
+	const string index = makeIndex(entries, 2);
+	const ULONGLONG fileSize = 1000 + index.size();
+
+	ULONG numBlocks;
+	ULONGLONG indexSize;
+	CHECK(ParseBlockIndexTail(index.data() + index.size() - BLOCK_INDEX_TAIL_SIZE, numBlocks, indexSize));
+	CHECK(numBlocks == 2);
+	CHECK(indexSize == index.size());
+
+	vector<BlockIndexEntry> parsed;
+	CHECK(parseIndex(index, fileSize, parsed));
+	CHECK(parsed.size() == 2);
+	CHECK(parsed[1].offset == 500 && parsed[1].rowDataLength == 300);
+
+	//The footer's magic, stored length and block count must agree with the index.
+	string bad = index;
+	bad[bad.size() - 1] = 'X';
+	CHECK(!ParseBlockIndexTail(bad.data() + bad.size() - BLOCK_INDEX_TAIL_SIZE, numBlocks, indexSize));
+	CHECK(!parseIndex(bad, fileSize, parsed));
+	CHECK(!parseIndex(index.substr(1), fileSize, parsed)); //truncated
+	CHECK(!ParseBlockIndex(index.data(), index.size(), index.size() - 1, COLUMN_TYPES, NUM_COLUMNS, parsed));
+	CHECK(!parseIndex(makeIndex(entries, 0), fileSize, parsed));
+	CHECK(!parseIndex(makeIndex(entries, 1), fileSize, parsed)); //data between the entries and the footer
+	CHECK(!parseIndex(makeIndex(entries, 3), fileSize, parsed));
+	CHECK(!parseIndex(makeIndex(entries, 0xFFFFFFFF), fileSize, parsed));
+
+	bad = index;
+	const ULONGLONG tooSmall = BLOCK_INDEX_TAIL_SIZE - 1;
+	memcpy(&bad[bad.size() - 12], &tooSmall, 8);
+	CHECK(!ParseBlockIndexTail(bad.data() + bad.size() - BLOCK_INDEX_TAIL_SIZE, numBlocks, indexSize));
+
+	//An entry length running past the footer.
+	bad = index;
+	const ULONG entryLength = index.size();
+	memcpy(&bad[0], &entryLength, 4);
+	CHECK(!parseIndex(bad, fileSize, parsed));
+
+	//Blocks overlapping, out of order or past the index.
+	vector<BlockIndexEntry> overlapping = entries;
+	overlapping[1].offset = 409;
+	CHECK(!parseIndex(makeIndex(overlapping, 2), fileSize, parsed));
+	overlapping[1].offset = 410;
+	CHECK(parseIndex(makeIndex(overlapping, 2), fileSize, parsed));
+	vector<BlockIndexEntry> reversed(entries.rbegin(), entries.rend());
+	CHECK(!parseIndex(makeIndex(reversed, 2), fileSize, parsed));
+	CHECK(!parseIndex(index, 799 + index.size(), parsed));
+	CHECK(parseIndex(index, 800 + index.size(), parsed));
+}
+
+void testZoneMaps()
+{
+	//Numeric bounds, compared as signed numbers.
+	const ColumnZoneMap numbers = numericZoneMap(10, -5, 10);
+	CHECK(ZoneMapCanMatch(numbers, LONGLONG_SIGNED, 10, EQUAL, "3"));
+	CHECK(!ZoneMapCanMatch(numbers, LONGLONG_SIGNED, 10, EQUAL, "11"));
+	CHECK(ZoneMapCanMatch(numbers, LONGLONG_SIGNED, 10, EQUAL, "0"));
+	CHECK(!ZoneMapCanMatch(numbers, LONGLONG_SIGNED, 10, LESS, "-5"));
+	CHECK(ZoneMapCanMatch(numbers, LONGLONG_SIGNED, 10, LESS_EQUAL, "-5"));
+	CHECK(!ZoneMapCanMatch(numbers, LONGLONG_SIGNED, 10, GREATER, "10"));
+	CHECK(ZoneMapCanMatch(numbers, LONGLONG_SIGNED, 10, GREATER_EQUAL, "10"));
+	CHECK(ZoneMapCanMatch(numbers, LONGLONG_SIGNED, 10, EQUAL, "x")); //not a number: can't tell
+
+	//Empty values count as 0.
+	const ColumnZoneMap positive = numericZoneMap(8, 5, 10);
+	CHECK(!ZoneMapCanMatch(positive, LONGLONG_SIGNED, 8, EQUAL, "0"));
+	CHECK(ZoneMapCanMatch(positive, LONGLONG_SIGNED, 10, EQUAL, "0"));
+	CHECK(ZoneMapCanMatch(positive, LONGLONG_SIGNED, 10, LESS, "1"));
+	CHECK(!ZoneMapCanMatch(ColumnZoneMap(), LONGLONG, 10, GREATER, "0"));
+
+	//Text bounds in strcmp order.
+	const ColumnZoneMap text = textZoneMap(10, "apple", "melon", false);
+	CHECK(ZoneMapCanMatch(text, VARCHAR, 10, EQUAL, "banana"));
+	CHECK(!ZoneMapCanMatch(text, VARCHAR, 10, EQUAL, "zebra"));
+	CHECK(!ZoneMapCanMatch(text, VARCHAR, 10, LESS, "apple"));
+	CHECK(!ZoneMapCanMatch(text, VARCHAR, 10, GREATER, "melon"));
+	CHECK(ZoneMapCanMatch(text, VARCHAR, 12, EQUAL, ""));
+	CHECK(!ZoneMapCanMatch(text, VARCHAR, 10, EQUAL, ""));
+
+	//A truncated max only bounds values that begin differently.
+	const ColumnZoneMap truncated = textZoneMap(10, "apple", "mel", true);
+	CHECK(ZoneMapCanMatch(truncated, VARCHAR, 10, GREATER, "melz"));
+	CHECK(ZoneMapCanMatch(truncated, VARCHAR, 10, EQUAL, "mellow"));
+	CHECK(!ZoneMapCanMatch(truncated, VARCHAR, 10, GREATER, "men"));
+
+	//CHAR columns decide only equality; decimals can't be decided from their text.
+	ColumnZoneMap chars = numericZoneMap(10, 'a', 'c');
+	CHECK(ZoneMapCanMatch(chars, CHAR, 10, EQUAL, "b"));
+	CHECK(!ZoneMapCanMatch(chars, CHAR, 10, EQUAL, "z"));
+	CHECK(ZoneMapCanMatch(chars, CHAR, 10, GREATER, "z"));
+	CHECK(ZoneMapCanMatch(textZoneMap(10, "1.5", "2.5", false), DECIMAL, 10, EQUAL, "10"));
+}
+
+void testBloomFilter()
+{
+	const size_t NUM_VALUES = 1000;
+	BloomFilter filter;
+	filter.init(NUM_VALUES);
+	char value[32];
+	for (size_t i = 0; i < NUM_VALUES; ++i)
+	{
+		const int len = sprintf(value, "value%lu", static_cast<unsigned long>(i));
+		filter.insert(value, len);
+	}
+
+	//No false negatives, and few false positives.
+	for (size_t i = 0; i < NUM_VALUES; ++i)
+	{
+		sprintf(value, "value%lu", static_cast<unsigned long>(i));
+		CHECK(filter.mayContain(value));
+	}
+	size_t falsePositives = 0;
+	for (size_t i = 0; i < 10 * NUM_VALUES; ++i)
+	{
+		sprintf(value, "other%lu", static_cast<unsigned long>(i));
+		if (filter.mayContain(value))
+			++falsePositives;
+	}
+	CHECK(falsePositives < NUM_VALUES / 5); //under 2%
+
+	//A copy assigned from its serialized form answers the same.
+	BloomFilter copy;
+	copy.assign(filter.getNumBlocks(), reinterpret_cast<const char*>(filter.data()));
+	CHECK(copy.mayContain("value7"));
+	CHECK(copy.mayContain("other0") == filter.mayContain("other0"));
+}
+
+}
+
+
+int main()
+{
+	testEntryRoundTrip();
+	testEntryTruncated();
+	testEntryCorrupt();
+	testIndex();
+	testZoneMaps();
+	testBloomFilter();
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All block index tests passed\n");
+	return 0;
+}
@@ -0,0 +1,499 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+//
+// Round trips of .sql files through ConvertToZDW, with each of its block options,
+// read back by UnconvertFromZDWToFile and UnconvertFromZDWToMemory.
+//
+
+#include "ConvertToZDW.h"
+#include "memory.h"
+#include "zdw/UnconvertFromZDW.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace adobe::zdw;
+
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+void check(const bool bOK, const char* expr, const int line)
+{
+	if (!bOK) {
+		fprintf(stderr, "test_zdw_files.cpp:%d: check failed: %s\n", line, expr);
+		++failures;
+	}
+}
+
+void quietStatusOutput(const StatusOutputLevel, const char*, ...) { }
+
+const char DESC[] =
+	"id\tbigint(20) unsigned\n"
+	"name\tvarchar(255)\n"
+	"num\tint(11)\n"
+	"c\tchar(1)\n"
+	"t\ttext\n"
+	"d\tdatetime\n";
+
+const char* const NAMES[] = { "alpha", "beta", "delta", "epsilon", "gamma" };
+
+//The values of a row of a test file.  With long text, most rows' t values are long and unique,
+//so the file's dictionary fills many megabytes.
+struct Row
+{
+	Row(const size_t i, const bool bLongText)
+		: id(i), name(NAMES[(i / 7) % 5]), num(static_cast<long>(i % 11) * 37 - 150), c('a' + i % 3)
+	{
+		char buf[256];
+		if (i % 10 == 0)
+			buf[0] = 0;
+		else if (bLongText)
+			sprintf(buf, "unique%08lu_%s", static_cast<unsigned long>(i),
+				"xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx");
+		else
+			sprintf(buf, "row%lu", static_cast<unsigned long>(i / 3));
+		t = buf;
+		sprintf(buf, "2019-01-%02lu 12:34:56", static_cast<unsigned long>(1 + (i / 1000) % 28));
+		d = buf;
+	}
+
+	string line() const
+	{
+		char buf[64];
+		sprintf(buf, "%lu\t%s\t%ld\t%c\t", static_cast<unsigned long>(id), name, num, c);
+		return buf + t + "\t" + d + "\n";
+	}
+
+	size_t id;
+	const char *name;
+	long num;
+	char c;
+	string t, d;
+};
+
+string readFile(const string& path)
+{
+	string contents;
+	FILE *f = fopen(path.c_str(), "rb");
+	if (!f)
+		return contents;
+	char buf[64 * 1024];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+		contents.append(buf, len);
+	fclose(f);
+	return contents;
+}
+
+void writeFile(const string& path, const string& contents)
+{
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+		return;
+	fwrite(contents.data(), 1, contents.size(), f);
+	fclose(f);
+}
+
+//Writes <stub>.sql and <stub>.desc.sql of numRows rows.
+//Returns: the .sql file's contents
+string writeSource(const string& stub, const size_t numRows, const bool bLongText)
+{
+	string sql;
+	for (size_t i = 0; i < numRows; ++i)
+		sql += Row(i, bLongText).line();
+	writeFile(stub + ".sql", sql);
+	writeFile(stub + ".desc.sql", DESC);
+	return sql;
+}
+
+//How a test file is converted.
+struct Options
+{
+	Options(const char* name, const ConvertToZDW::Compressor compressor)
+		: name(name), compressor(compressor), bBlockIndex(false), bColumnar(false), bSinglePass(false)
+		, keyframeInterval(0), numThreads(1)
+	{ }
+
+	bool indexed() const { return bBlockIndex || bColumnar || keyframeInterval || !bloomColumns.empty(); }
+
+	const char *name;
+	ConvertToZDW::Compressor compressor;
+	bool bBlockIndex, bColumnar, bSinglePass;
+	ULONG keyframeInterval;
+	vector<string> bloomColumns;
+	int numThreads;
+};
+
+//Converts dir/<source>.sql as <options.name>.zdw[.gz], limiting memory use to extraMB more than is used now
+//so the file has multiple blocks.
+//Returns: the .zdw file's path, or empty on failure
+string convert(const string& dir, const string& source, const Options& options, const float extraMB = 0)
+{
+	const string stub = dir + "/" + options.name;
+	if (symlink((dir + "/" + source + ".sql").c_str(), (stub + ".sql").c_str()) ||
+			symlink((dir + "/" + source + ".desc.sql").c_str(), (stub + ".desc.sql").c_str()))
+		return string();
+
+	ConvertToZDW converter(true);
+	converter.setStatusOutputCallback(quietStatusOutput);
+	converter.compressor = options.compressor;
+	if (options.bBlockIndex)
+		converter.blockIndex();
+	if (options.bColumnar)
+		converter.columnar();
+	if (options.bSinglePass)
+		converter.singlePass();
+	converter.setKeyframeInterval(options.keyframeInterval);
+	converter.setBloomFilterColumns(options.bloomColumns);
+	converter.setNumThreads(options.numThreads);
+
+	const float limitMB = Memory::get_memory_usage_limit_MB();
+	if (extraMB)
+		Memory::set_memory_threshold_MB(Memory::process_memory_usage() + extraMB);
+	char filestub[1024];
+	const ConvertToZDW::ERR_CODE eRet = converter.convertFile((stub + ".sql").c_str(), "test_zdw_files", false, filestub, dir.c_str());
+	Memory::set_memory_threshold_MB(limitMB);
+	CHECK(eRet == ConvertToZDW::OK);
+	if (eRet != ConvertToZDW::OK)
+		return string();
+
+	return stub + ".zdw" + (options.compressor == ConvertToZDW::GZIP ? ".gz" : "");
+}
+
+//Returns: the text of the rows of file satisfying the predicates, output by UnconvertFromZDWToFile
+string unconvert(const string& file, const string& outputDir, const int numThreads, const bool bPipelined,
+	const vector<RowPredicate>& predicates = vector<RowPredicate>())
+{
+	UnconvertFromZDWToFile<BufferedOutput> unconverter(file, false, true);
+	unconverter.setStatusOutputCallback(quietStatusOutput);
+	unconverter.setNumThreads(numThreads);
+	unconverter.setPipelined(bPipelined);
+	unconverter.setRowPredicates(predicates);
+	const ERR_CODE eRet = unconverter.unconvert("test_zdw_files", "out", ".sql", outputDir.c_str(), false);
+	CHECK(eRet == OK);
+	const string text = readFile(outputDir + "/out.sql");
+	unlink((outputDir + "/out.sql").c_str());
+	unlink((outputDir + "/out.desc.sql").c_str());
+	return eRet == OK ? text : string();
+}
+
+string rowText(const char** columns, const size_t numColumns)
+{
+	string line;
+	for (size_t c = 0; c < numColumns; ++c)
+	{
+		if (c)
+			line += '\t';
+		line += columns[c];
+	}
+	return line + "\n";
+}
+
+//Returns: the text of the rows read by getRow, from row firstRow on
+string readRows(const string& file, const ULONGLONG firstRow = 0,
+	const vector<RowPredicate>& predicates = vector<RowPredicate>())
+{
+	UnconvertFromZDWToMemory reader(file);
+	reader.setStatusOutputCallback(quietStatusOutput);
+	reader.setRowPredicates(predicates);
+	if (firstRow && reader.skipToRow(firstRow) != OK)
+		return string("skipToRow failed");
+	size_t numColumns;
+	if (reader.getNumOutputColumns(numColumns) != OK)
+		return string("no columns");
+
+	vector<const char*> columns(numColumns);
+	string text;
+	ERR_CODE eRet;
+	while ((eRet = reader.getRow(&columns[0])) == OK)
+		text += rowText(&columns[0], numColumns);
+	CHECK(eRet == AT_END_OF_FILE);
+	return text;
+}
+
+//Checks the values of every row satisfying the predicates, read by nextRow and by getBatch.
+void checkTypedRows(const string& file, const vector<RowPredicate>& predicates, const vector<size_t>& expectedIds)
+{
+	UnconvertFromZDWToMemory reader(file);
+	reader.setStatusOutputCallback(quietStatusOutput);
+	reader.setRowPredicates(predicates);
+	CHECK(reader.readHeader() == OK);
+	const int id = reader.getColumnIndex("id"), name = reader.getColumnIndex("name"), num = reader.getColumnIndex("num");
+	CHECK(id == 0 && name == 1 && num == 2);
+
+	size_t rows = 0;
+	ERR_CODE eRet;
+	while ((eRet = reader.nextRow()) == OK)
+	{
+		uint64_t value;
+		int64_t number;
+		const char *text;
+		size_t len;
+		if (rows >= expectedIds.size() || reader.getUnsigned(id, value) != OK || value != expectedIds[rows] ||
+				reader.getSigned(num, number) != OK || reader.getText(name, text, len) != OK)
+			break;
+		const Row row(expectedIds[rows], false);
+		CHECK(number == row.num);
+		CHECK(string(text, len) == row.name);
+		CHECK(reader.getSigned(id, number) == UNSUPPORTED_OPERATION);
+		++rows;
+	}
+	CHECK(eRet == AT_END_OF_FILE);
+	CHECK(rows == expectedIds.size());
+
+	UnconvertFromZDWToMemory batchReader(file);
+	batchReader.setStatusOutputCallback(quietStatusOutput);
+	batchReader.setRowPredicates(predicates);
+	RowBatch batch;
+	rows = 0;
+	bool bInOrder = true;
+	while ((eRet = batchReader.getBatch(1000, batch)) == OK)
+	{
+		CHECK(batch.numRows > 0 && batch.numRows <= 1000);
+		CHECK(batch.columns.size() == 6);
+		for (size_t r = 0; r < batch.numRows; ++r, ++rows)
+			if (rows >= expectedIds.size() || batch.columns[0].values[r] != expectedIds[rows])
+				bInOrder = false;
+	}
+	CHECK(eRet == AT_END_OF_FILE);
+	CHECK(bInOrder);
+	CHECK(rows == expectedIds.size());
+}
+
+void checkIndex(const string& file, const Options& options, const size_t numRows, const bool bMultiBlock)
+{
+	UnconvertFromZDWToMemory reader(file);
+	reader.setStatusOutputCallback(quietStatusOutput);
+	const bool bLoaded = reader.loadBlockIndex();
+	CHECK(bLoaded == options.indexed());
+	if (!bLoaded)
+		return;
+
+	const vector<BlockIndexEntry>& index = reader.getBlockIndex();
+	CHECK(!bMultiBlock || index.size() > 1);
+	size_t firstRow = 0;
+	for (size_t b = 0; b < index.size(); ++b)
+	{
+		const BlockIndexEntry& entry = index[b];
+		CHECK(entry.zoneMaps.size() == 6);
+		CHECK(entry.bloomFilters.size() == options.bloomColumns.size());
+		if (options.keyframeInterval) {
+			CHECK(entry.keyframeInterval == options.keyframeInterval);
+			CHECK(entry.keyframes.size() == (entry.numRows - 1) / options.keyframeInterval);
+		} else {
+			CHECK(entry.keyframes.empty());
+		}
+
+		//Ids ascend through the file.
+		char buf[32];
+		sprintf(buf, "%lu", static_cast<unsigned long>(firstRow));
+		CHECK(reader.blockCanMatch(b, "id", EQUAL, buf));
+		CHECK(!reader.blockCanMatch(b, "id", LESS, buf));
+		sprintf(buf, "%lu", static_cast<unsigned long>(firstRow + entry.numRows));
+		CHECK(!reader.blockCanMatch(b, "id", GREATER_EQUAL, buf));
+		CHECK(reader.blockCanMatch(b, "num", LESS, "-149"));
+		CHECK(!reader.blockCanMatch(b, "num", GREATER, "220"));
+
+		const Row row(firstRow + 1, bMultiBlock);
+		CHECK(reader.blockMayContain(b, "t", vector<string>(1, row.t)));
+		CHECK(reader.blockMayContain(b, "name", vector<string>(1, row.name)));
+		CHECK(!reader.blockMayContain(b, "name", vector<string>(1, "omega"))); //outside the zone map
+		firstRow += entry.numRows;
+	}
+	CHECK(firstRow == numRows);
+}
+
+void testFile(const string& dir, const string& source, const string& sql, const size_t numRows,
+	const Options& options, const float extraMB = 0)
+{
+	const string file = convert(dir, source, options, extraMB);
+	if (file.empty()) {
+		fprintf(stderr, "%s: conversion failed\n", options.name);
+		return;
+	}
+	const bool bMultiBlock = extraMB != 0;
+
+	//Whole files, by each decoding path.
+	CHECK(unconvert(file, dir, 1, false) == sql);
+	CHECK(unconvert(file, dir, 4, false) == sql);
+	CHECK(unconvert(file, dir, 1, true) == sql);
+	CHECK(unconvert(file, dir, 4, true) == sql);
+	CHECK(readRows(file) == sql);
+
+	checkIndex(file, options, numRows, bMultiBlock);
+
+	//Skipping forward, past the first block of a file of several.
+	const size_t skipTo = numRows * 2 / 3 + 17;
+	size_t pos = 0;
+	for (size_t i = 0; i < skipTo; ++i)
+		pos = sql.find('\n', pos) + 1;
+	CHECK(readRows(file, skipTo) == sql.substr(pos));
+
+	//Row predicates, which indexed blocks are skipped by.
+	vector<RowPredicate> predicates;
+	char buf[32];
+	sprintf(buf, "%lu", static_cast<unsigned long>(numRows - 150));
+	predicates.push_back(RowPredicate("id", GREATER_EQUAL, buf));
+	RowPredicate names("name", EQUAL, "beta");
+	names.operands.push_back("gamma");
+	predicates.push_back(names);
+
+	string expected;
+	vector<size_t> expectedIds;
+	for (size_t i = numRows - 150; i < numRows; ++i)
+	{
+		const Row row(i, bMultiBlock);
+		if (!strcmp(row.name, "beta") || !strcmp(row.name, "gamma")) {
+			expected += row.line();
+			expectedIds.push_back(i);
+		}
+	}
+	CHECK(!expectedIds.empty());
+	CHECK(unconvert(file, dir, 1, false, predicates) == expected);
+	CHECK(unconvert(file, dir, 4, true, predicates) == expected);
+	CHECK(readRows(file, 0, predicates) == expected);
+	checkTypedRows(file, predicates, expectedIds);
+
+	vector<RowPredicate> none(1, RowPredicate("name", EQUAL, "omega"));
+	CHECK(unconvert(file, dir, 4, false, none).empty());
+	CHECK(readRows(file, 0, none).empty());
+}
+
+//An index that doesn't match the file is not loaded, and reading the file through to it fails.
+void testCorruptIndex(const string& dir, const string& file)
+{
+	const string contents = readFile(file);
+	CHECK(contents.size() > 100);
+	if (contents.size() <= 100)
+		return;
+
+	vector<string> corrupt;
+	string bad = contents;
+	bad[bad.size() - 1] = 'X'; //magic
+	corrupt.push_back(bad);
+	bad = contents;
+	++bad[bad.size() - 12]; //index length
+	corrupt.push_back(bad);
+	bad = contents;
+	++bad[bad.size() - 16]; //block count
+	corrupt.push_back(bad);
+	corrupt.push_back(contents.substr(0, contents.size() - 1));
+	corrupt.push_back(contents.substr(0, contents.size() - 40));
+
+	const string path = dir + "/corrupt.zdw";
+	for (size_t i = 0; i < corrupt.size(); ++i)
+	{
+		writeFile(path, corrupt[i]);
+		UnconvertFromZDWToMemory reader(path);
+		reader.setStatusOutputCallback(quietStatusOutput);
+		CHECK(!reader.loadBlockIndex());
+		CHECK(reader.getBlockIndex().empty());
+
+		//A file cut short fails with an exception.
+		ERR_CODE eRet;
+		try {
+			UnconvertFromZDWToFile<BufferedOutput> unconverter(path, false, true);
+			unconverter.setStatusOutputCallback(quietStatusOutput);
+			eRet = unconverter.unconvert("test_zdw_files", "out", ".sql", dir.c_str(), false);
+		} catch (const ZDWException& ex) {
+			eRet = ex.code;
+		}
+		CHECK(eRet != OK);
+	}
+	unlink(path.c_str());
+	unlink((dir + "/out.sql").c_str());
+	unlink((dir + "/out.desc.sql").c_str());
+}
+
+}
+
+
+int main()
+{
+	char dirTemplate[] = "/tmp/test_zdw_files.XXXXXX";
+	if (!mkdtemp(dirTemplate)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	const string dir = dirTemplate;
+
+	const size_t SMALL_ROWS = 3000;
+	const string small = writeSource(dir + "/small", SMALL_ROWS, false);
+
+	testFile(dir, "small", small, SMALL_ROWS, Options("v11", ConvertToZDW::GZIP));
+	testFile(dir, "small", small, SMALL_ROWS, Options("v11_plain", ConvertToZDW::NONE));
+
+	Options options("index", ConvertToZDW::GZIP);
+	options.bBlockIndex = true;
+	testFile(dir, "small", small, SMALL_ROWS, options);
+	options.name = "index_plain";
+	options.compressor = ConvertToZDW::NONE;
+	testFile(dir, "small", small, SMALL_ROWS, options);
+	testCorruptIndex(dir, dir + "/index_plain.zdw");
+	options.name = "index_single_pass";
+	options.bSinglePass = true;
+	testFile(dir, "small", small, SMALL_ROWS, options);
+
+	options = Options("bloom", ConvertToZDW::NONE);
+	options.bloomColumns.push_back("name");
+	options.bloomColumns.push_back("t");
+	testFile(dir, "small", small, SMALL_ROWS, options);
+
+	options = Options("columnar", ConvertToZDW::GZIP);
+	options.bColumnar = true;
+	testFile(dir, "small", small, SMALL_ROWS, options);
+
+	options = Options("keyframes", ConvertToZDW::NONE);
+	options.keyframeInterval = 100;
+	options.numThreads = 4;
+	testFile(dir, "small", small, SMALL_ROWS, options);
+
+	//Files of several blocks, which memory limits end.
+	const size_t LARGE_ROWS = 200000;
+	const string large = writeSource(dir + "/large", LARGE_ROWS, true);
+	const float EXTRA_MB = 16;
+
+	options = Options("large_index", ConvertToZDW::NONE);
+	options.bBlockIndex = true;
+	options.bloomColumns.push_back("t");
+	testFile(dir, "large", large, LARGE_ROWS, options, EXTRA_MB);
+
+	options = Options("large_keyframes", ConvertToZDW::GZIP);
+	options.keyframeInterval = 500;
+	testFile(dir, "large", large, LARGE_ROWS, options, EXTRA_MB);
+
+	options = Options("large_columnar", ConvertToZDW::NONE);
+	options.bColumnar = true;
+	options.numThreads = 4;
+	testFile(dir, "large", large, LARGE_ROWS, options, EXTRA_MB);
+
+	const string command = "rm -rf " + dir;
+	if (system(command.c_str()))
+		fprintf(stderr, "Could not remove %s\n", dir.c_str());
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All ZDW file tests passed\n");
+	return 0;
+}
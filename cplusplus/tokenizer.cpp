@@ -0,0 +1,284 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#include "tokenizer.h"
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+namespace {
+
+const size_t BLOCK_SIZE = 64; //bytes scanned at once -- one per mask bit
+const size_t PAGE_SIZE = 4096; //smallest page size -- loads within a page can't fault
+
+//Bit i of each mask is set when byte i of a scanned block is that character.
+struct DelimiterMasks
+{
+	uint64_t tab, newline, backslash, space;
+};
+
+//Returns: a mask of the first len bits
+inline uint64_t low_bits(const size_t len)
+{
+	return len >= BLOCK_SIZE ? ~static_cast<uint64_t>(0) : (static_cast<uint64_t>(1) << len) - 1;
+}
+
+//Returns: index of the highest set bit of a non-zero mask
+inline size_t highest_bit(const uint64_t mask)
+{
+	return 63 - __builtin_clzll(mask);
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#if defined(__AVX2__)
+class Block
+{
+public:
+	explicit Block(const char* text)
+		: lo(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(text)))
+		, hi(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + 32)))
+	{ }
+
+	uint64_t match(const char c) const
+	{
+		const __m256i target = _mm256_set1_epi8(c);
+		const uint64_t l = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, target)));
+		const uint64_t h = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, target)));
+		return l | (h << 32);
+	}
+
+private:
+	const __m256i lo, hi;
+};
+#else
+class Block
+{
+public:
+	explicit Block(const char* text)
+	{
+		for (int i = 0; i < 4; ++i)
+			v[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i * 16));
+	}
+
+	uint64_t match(const char c) const
+	{
+		const __m128i target = _mm_set1_epi8(c);
+		uint64_t mask = 0;
+		for (int i = 0; i < 4; ++i)
+			mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v[i], target)))) << (i * 16);
+		return mask;
+	}
+
+private:
+	__m128i v[4];
+};
+#endif
+
+//Finds the requested delimiters in the first BLOCK_SIZE bytes of text.
+//When len is shorter than a block, no bits are set past it.
+template <bool bTab, bool bNewline, bool bSpace>
+inline void scan_delimiters(const char* text, const size_t len, DelimiterMasks& masks)
+{
+	char padded[BLOCK_SIZE];
+	const char *block = text;
+	if (len < BLOCK_SIZE &&
+			(reinterpret_cast<uintptr_t>(text) & (PAGE_SIZE - 1)) > PAGE_SIZE - BLOCK_SIZE)
+	{
+		//A full load would cross into the next page, which might not be mapped.
+		memcpy(padded, text, len);
+		block = padded;
+	}
+
+	const Block v(block);
+	const uint64_t valid = low_bits(len);
+	masks.backslash = v.match('\\') & valid;
+	if (bTab)
+		masks.tab = v.match('\t') & valid;
+	if (bNewline)
+		masks.newline = v.match('\n') & valid;
+	if (bSpace)
+		masks.space = v.match(' ') & valid;
+}
+
+#else
+
+template <bool bTab, bool bNewline, bool bSpace>
+inline void scan_delimiters(const char* text, const size_t len, DelimiterMasks& masks)
+{
+	masks.tab = masks.newline = masks.backslash = masks.space = 0;
+	const size_t n = len < BLOCK_SIZE ? len : BLOCK_SIZE;
+	for (size_t i = 0; i < n; ++i)
+	{
+		const uint64_t bit = static_cast<uint64_t>(1) << i;
+		switch (text[i])
+		{
+			case '\t': masks.tab |= bit; break;
+			case '\n': masks.newline |= bit; break;
+			case '\\': masks.backslash |= bit; break;
+			case ' ': masks.space |= bit; break;
+		}
+	}
+}
+
+#endif
+
+//Resolves runs of backslashes in a block: a character is escaped when it follows an odd-length run.
+//
+//Returns: mask of the escaped characters in the block
+inline uint64_t find_escaped_chars(
+	uint64_t backslash,    //(in) backslashes in the block
+	uint64_t& prevEscaped) //(in/out) 1 if the block's first character is escaped
+{
+	static const uint64_t EVEN_BITS = 0x5555555555555555ULL;
+
+	if (!backslash && !prevEscaped)
+		return 0;
+
+	backslash &= ~prevEscaped; //an escaped backslash doesn't escape the next char
+	const uint64_t followsEscape = (backslash << 1) | prevEscaped;
+
+	//Adding the start of each run that begins on an odd bit carries through the run,
+	//so the bit past each run tells whether its length is odd or even.
+	const uint64_t oddSequenceStarts = backslash & ~EVEN_BITS & ~followsEscape;
+	const uint64_t sequencesStartingOnEvenBits = oddSequenceStarts + backslash;
+	prevEscaped = sequencesStartingOnEvenBits < backslash ? 1 : 0; //a run ending the block carried out
+	const uint64_t invertMask = sequencesStartingOnEvenBits << 1;
+
+	return (EVEN_BITS ^ invertMask) & followsEscape;
+}
+
+//Collects the fields of a row into rowColumns.
+//Fields are written over the vector's existing elements where possible -- rows typically have
+//the same number of fields, so the vector rarely needs to grow.
+class FieldWriter
+{
+public:
+	explicit FieldWriter(std::vector<adobe::zdw::TextSpan>& rowColumns)
+		: rowColumns(rowColumns)
+		, fields(rowColumns.empty() ? NULL : &rowColumns[0])
+		, capacity(rowColumns.size())
+		, numFields(0)
+	{ }
+	~FieldWriter() { rowColumns.resize(numFields); }
+
+	void add(const char* str, const size_t len)
+	{
+		if (numFields == capacity) {
+			rowColumns.resize(capacity ? capacity * 2 : 16);
+			fields = &rowColumns[0];
+			capacity = rowColumns.size();
+		}
+		fields[numFields].str = str;
+		fields[numFields].len = len;
+		++numFields;
+	}
+
+private:
+	std::vector<adobe::zdw::TextSpan>& rowColumns;
+	adobe::zdw::TextSpan *fields;
+	size_t capacity, numFields;
+};
+
+template <bool bTrimTrailingSpaces>
+void split_row_into_columns(const char* row, const size_t len, std::vector<adobe::zdw::TextSpan>& rowColumns)
+{
+	FieldWriter out(rowColumns);
+
+	size_t colStart = 0;
+	size_t contentEnd = 0; //one past the last non-space char seen so far
+	uint64_t prevEscaped = 0;
+	DelimiterMasks masks;
+	for (size_t base = 0; base < len; base += BLOCK_SIZE)
+	{
+		const size_t blockLen = len - base;
+		scan_delimiters<true, false, bTrimTrailingSpaces>(row + base, blockLen, masks);
+		uint64_t tabs = masks.tab & ~find_escaped_chars(masks.backslash, prevEscaped);
+		const uint64_t nonSpace = bTrimTrailingSpaces ? ~masks.space & low_bits(blockLen) : 0;
+
+		while (tabs)
+		{
+			const size_t bit = __builtin_ctzll(tabs);
+			const size_t tab = base + bit;
+			if (bTrimTrailingSpaces) {
+				const uint64_t before = nonSpace & low_bits(bit);
+				const size_t end = before ? base + highest_bit(before) + 1 : contentEnd;
+				out.add(row + colStart, end > colStart ? end - colStart : 0);
+			} else {
+				out.add(row + colStart, tab - colStart);
+			}
+			colStart = tab + 1; //move on to the next field
+			tabs &= tabs - 1;
+		}
+
+		if (nonSpace)
+			contentEnd = base + highest_bit(nonSpace) + 1;
+	}
+
+	//Last field.
+	if (bTrimTrailingSpaces)
+		out.add(row + colStart, contentEnd > colStart ? contentEnd - colStart : 0);
+	else
+		out.add(row + colStart, len - colStart);
+}
+
+}
+
+
+namespace adobe {
+namespace zdw {
+
+//Returns: whether the char at pos is escaped by an odd number of backslashes (counted back to rowStart)
+bool IsEscaped(const char* pos, const char* rowStart)
+{
+	const char* slash = pos - 1;
+	while (slash >= rowStart && *slash == '\\')
+		--slash;
+	return ((pos - slash) % 2) == 0;
+}
+
+//Returns: position of the first newline in [pos, end) that is not escaped by a backslash, or NULL if none
+const char* FindRowEnd(
+	const char* pos, const char* end,
+	const char* rowStart) //(in) escape chars are not counted before this point
+{
+	uint64_t prevEscaped = pos > rowStart && IsEscaped(pos, rowStart) ? 1 : 0;
+	DelimiterMasks masks;
+	for ( ; pos < end; pos += BLOCK_SIZE)
+	{
+		scan_delimiters<false, true, false>(pos, end - pos, masks);
+		const uint64_t newlines = masks.newline & ~find_escaped_chars(masks.backslash, prevEscaped);
+		if (newlines)
+			return pos + __builtin_ctzll(newlines);
+	}
+	return NULL;
+}
+
+//Splits a row of length len into its tab-delimited column values in a single pass,
+//skipping tabs escaped by backslashes.  The row is not modified.
+void SplitRowIntoColumns(const char* row, const size_t len,
+	std::vector<TextSpan>& rowColumns, const bool bTrimTrailingSpaces)
+{
+	if (bTrimTrailingSpaces)
+		split_row_into_columns<true>(row, len, rowColumns);
+	else
+		split_row_into_columns<false>(row, len, rowColumns);
+}
+
+} // namespace zdw
+} // namespace adobe
@@ -0,0 +1,38 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include "zdw/includes.h"
+#include "getnextrow.h"
+
+#include <vector>
+
+
+namespace adobe {
+namespace zdw {
+
+//Splitting of input text into rows and columns.
+//Text is scanned 64 bytes at a time (SSE2/AVX2 when available), producing a bitmask of the
+//delimiters found.  Runs of backslashes are resolved on the masks, so escaped delimiters are
+//skipped without walking back over the text.
+
+bool IsEscaped(const char* pos, const char* rowStart);
+const char* FindRowEnd(const char* pos, const char* end, const char* rowStart);
+void SplitRowIntoColumns(const char* row, const size_t len,
+	std::vector<TextSpan>& rowColumns, const bool bTrimTrailingSpaces);
+
+} // namespace zdw
+} // namespace adobe
+
+#endif
@@ -17,12 +17,15 @@
 #include "zdw/UnconvertFromZDW.h"
 
 #include <algorithm>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 using namespace adobe::zdw;
 using std::string;
+using std::vector;
 
 
 //*****************************
@@ -75,6 +78,17 @@ void usage(char* executable)
 	       "\n"
 	       "\t--non-empty-column-header   output a header line listing non-empty columns in the next file block\n"
 	       "\n"
+	       "\t--threads=N  decode blocks on N threads, outputting their text in order (default=1)\n"
+	       "\t\t Up to 2N blocks are held in memory at once.\n"
+	       "\n"
+	       "\t--pipeline  read (and uncompress) input ahead and write output on separate threads while decoding rows\n"
+	       "\n"
+	       "\t--where '<predicates>'  output only the rows satisfying all of the predicates, e.g. \"page='home' AND hits>5\"\n"
+	       "\t\t Each is <column>(=|==|<|<=|>|>=)<value> or <column> IN (<value>,...), joined by AND.\n"
+	       "\t\t Not-equal (<> or !=) is not supported.\n"
+	       "\t\t Numbers (including decimals) compare numerically, and text in strcmp order.  Quote values holding spaces or commas,\n"
+	       "\t\t or starting with =, <, > or !.\n"
+	       "\n"
 	       "\t--help     show this help\n"
 	       "\t--version  show the version number\n"
 	       "\n");
@@ -119,6 +133,99 @@ int emptyFilename(char* exeName)
 	return BAD_PARAMETER;
 }
 
+//************************************
+static void skipSpaces(const char*& pos)
+{
+	while (isspace(static_cast<unsigned char>(*pos)))
+		++pos;
+}
+
+//Reads a value, which ends at a space or one of the delimiters unless it's quoted (with ' or ").
+//Returns: false for an unterminated quote
+static bool readValue(const char*& pos, const char* delimiters, string& value)
+{
+	skipSpaces(pos);
+	if (*pos == '\'' || *pos == '"') {
+		const char *end = strchr(pos + 1, *pos);
+		if (!end)
+			return false;
+		value.assign(pos + 1, end - pos - 1);
+		pos = end + 1;
+		return true;
+	}
+	const char *begin = pos;
+	while (*pos && !isspace(static_cast<unsigned char>(*pos)) && !strchr(delimiters, *pos))
+		++pos;
+	value.assign(begin, pos - begin);
+	return true;
+}
+
+//Parses --where predicates, e.g. "page='home' AND hits>5 AND code IN (a,b)".
+//Returns: whether the text could be parsed
+static bool parseWhere(const char* text, vector<RowPredicate>& predicates)
+{
+	const char *pos = text;
+	for (;;) {
+		RowPredicate predicate;
+		skipSpaces(pos);
+		const char *begin = pos;
+		while (*pos && !isspace(static_cast<unsigned char>(*pos)) && !strchr("=<>!(", *pos))
+			++pos;
+		if (pos == begin)
+			return false;
+		predicate.column.assign(begin, pos - begin);
+		skipSpaces(pos);
+
+		string value;
+		if (!strncasecmp(pos, "IN", 2) && (isspace(static_cast<unsigned char>(pos[2])) || pos[2] == '(')) {
+			pos += 2;
+			skipSpaces(pos);
+			if (*pos++ != '(')
+				return false;
+			for (;;) {
+				if (!readValue(pos, ",)", value))
+					return false;
+				predicate.operands.push_back(value);
+				skipSpaces(pos);
+				if (*pos != ',')
+					break;
+				++pos;
+			}
+			if (*pos++ != ')')
+				return false;
+		} else {
+			switch (*pos++)
+			{
+				case '=': predicate.op = EQUAL; break; //"==" is also accepted
+				case '<':
+					predicate.op = *pos == '=' ? LESS_EQUAL : LESS;
+					break;
+				case '>':
+					predicate.op = *pos == '=' ? GREATER_EQUAL : GREATER;
+					break;
+				default: return false;
+			}
+			if (*pos == '=')
+				++pos;
+			//Unsupported operators (e.g. "<>", "!=", "<=>") are rejected rather than read as part of the value.
+			skipSpaces(pos);
+			if (*pos && strchr("=<>!", *pos))
+				return false;
+			if (!readValue(pos, "", value))
+				return false;
+			predicate.operands.push_back(value);
+		}
+		predicates.push_back(predicate);
+
+		skipSpaces(pos);
+		if (!*pos)
+			return true;
+		if (strncasecmp(pos, "AND", 3) || !isspace(static_cast<unsigned char>(pos[3])))
+			return false;
+		pos += 3;
+	}
+}
+
 //********************************************
 ERR_CODE unconvertFile(
 	string const& filename,
@@ -135,7 +242,10 @@ ERR_CODE unconvertFile(
 	COLUMN_INCLUSION_RULE columnInclusionRule,
 	bool bShowBasicStatisticsOnly,
 	bool bNonEmptyColumnHeader,
-	const internal::MetadataOptions& metadataOptions)
+	const internal::MetadataOptions& metadataOptions,
+	const vector<RowPredicate>& rowPredicates,
+	int numThreads,
+	bool bPipelined)
 {
 	assert(exeName);
 
@@ -146,6 +256,9 @@ ERR_CODE unconvertFile(
 		if (bShowBasicStatisticsOnly)
 			unconvertFromZDW.showBasicStatisticsOnly();
 		unconvertFromZDW.outputNonEmptyColumnHeader(bNonEmptyColumnHeader);
+		unconvertFromZDW.setRowPredicates(rowPredicates);
+		unconvertFromZDW.setNumThreads(numThreads);
+		unconvertFromZDW.setPipelined(bPipelined);
 		eRet = unconvertFromZDW.unconvert(exeName, outputBasename, outputFileExtension.c_str(), specifiedDir, bToStdout);
 	} else {
 		UnconvertFromZDWToFile<BufferedOrderedOutput> unconvertFromZDW(filename, bShowStatus, bQuiet, bTestOnly, bOutputDescFileOnly);
@@ -155,6 +268,9 @@ ERR_CODE unconvertFile(
 			eRet = BAD_REQUESTED_COLUMN;
 		} else {
 			unconvertFromZDW.outputNonEmptyColumnHeader(bNonEmptyColumnHeader);
+			unconvertFromZDW.setRowPredicates(rowPredicates);
+			unconvertFromZDW.setNumThreads(numThreads);
+			unconvertFromZDW.setPipelined(bPipelined);
 			eRet = unconvertFromZDW.unconvert(exeName, outputBasename, outputFileExtension.c_str(), specifiedDir, bToStdout);
 		}
 	}
@@ -188,8 +304,11 @@ int main(int argc, char* argv[])
 	COLUMN_INCLUSION_RULE inclusionRule = FAIL_ON_INVALID_COLUMN;
 	bool bShowBasicStatisticsOnly = false;
 	bool bOutputBlockHeaderNonEmptyColumns = false;
+	int numThreads = 1;
+	bool bPipelined = false;
 	string defaultExtension = ".sql";
 	string namesOfColumnsToOutput;
+	vector<RowPredicate> rowPredicates;
 
 	internal::MetadataOptions metadataOptions;
 
@@ -309,6 +428,29 @@ int main(int argc, char* argv[])
 							bOutputBlockHeaderNonEmptyColumns = true;
 							break;
 						}
+						if (!strncmp(flag, "threads=", 8)) {
+							numThreads = atoi(flag + 8);
+							if (numThreads < 1)
+								return badParam(argv[0], arg);
+							break;
+						}
+						if (!strcmp(flag, "pipeline")) {
+							bPipelined = true;
+							break;
+						}
+						if (!strcmp(flag, "where") || !strncmp(flag, "where=", 6)) {
+							const char *predicates = flag + 5;
+							if (!*predicates) {
+								if (argc <= i + 1)
+									return missingParam(argv[0], arg);
+								predicates = argv[++i];
+							} else {
+								++predicates; //skip '='
+							}
+							if (!parseWhere(predicates, rowPredicates))
+								return badParam(argv[0], predicates);
+							break;
+						}
 						if (!strcmp(flag, "metadata")) {
 							metadataOptions.bOutputOnlyMetadata = true;
 							break;
@@ -375,6 +517,10 @@ int main(int argc, char* argv[])
 				case 'd':
 					++i;
 				break;
+				case '-':
+					if (!strcmp(arg, "--where"))
+						++i;
+				break;
 			}
 		} else {
 			if (arg[0] == '\0') {
@@ -399,7 +545,10 @@ int main(int argc, char* argv[])
 					inclusionRule,
 					bShowBasicStatisticsOnly,
 					bOutputBlockHeaderNonEmptyColumns,
-					metadataOptions
+					metadataOptions,
+					rowPredicates,
+					numThreads,
+					bPipelined
 				);
 				if (eRet != OK)
 					return eRet;
@@ -424,7 +573,10 @@ int main(int argc, char* argv[])
 			inclusionRule,
 			bShowBasicStatisticsOnly,
 			bOutputBlockHeaderNonEmptyColumns,
-			metadataOptions
+			metadataOptions,
+			rowPredicates,
+			numThreads,
+			bPipelined
 		);
 		if (eRet != OK)
 			return eRet;
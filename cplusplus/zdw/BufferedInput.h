@@ -13,37 +13,59 @@
 #ifndef BUFFEREDINPUT_H
 #define BUFFEREDINPUT_H
 
+#include "includes.h"
+
+#include <stdio.h>
 #include <string>
 
 
 namespace adobe {
 namespace zdw {
 
+//Buffered reading of a ZDW file's data.
+//
+//Compressed input (gzip, bzip2, xz, zstd) is recognized by its leading magic bytes and is
+//uncompressed in-process when the codec was compiled in (see ZDW_HAVE_* in CMakeLists.txt),
+//or else piped through the codec's command-line tool.
+//Uncompressed files are memory-mapped, so their data can be used in place (see readInPlace).
 class BufferedInput
 {
+private:
+	//not implemented
+	BufferedInput(BufferedInput const &);
+	BufferedInput &operator=(BufferedInput const &);
+
 public:
-	// open a pipe via a command and read input from the pipe
-	BufferedInput(const std::string& command, const size_t capacity = 16 * 1024);
+	static const size_t DEFAULT_CAPACITY;
+
+	//Returns: a reader of the named file's (uncompressed) data, or NULL if the file can't be read
+	static BufferedInput* open(const std::string& filename, const size_t capacity = DEFAULT_CAPACITY);
+
+	//Returns: a reader of the data in fp (e.g., stdin), which remains owned by the caller
+	static BufferedInput* open(FILE* fp, const size_t capacity = DEFAULT_CAPACITY);
 
-	// read from standard input
-	BufferedInput();
+	//Returns: a reader of length bytes held in memory, which remain owned by the caller
+	static BufferedInput* openMemory(const char* data, const size_t length);
 
-	~BufferedInput();
+	//Returns: a reader of source's data that reads ahead of the caller on a separate thread,
+	//  taking ownership of source, or source itself when read-ahead isn't useful or available
+	static BufferedInput* readAhead(BufferedInput* source);
 
-	void close();
+	virtual ~BufferedInput();
+
+	virtual void close() = 0;
+
+	//Restarts reading from the beginning of the input.
+	//Returns: false if the input can't be rewound (e.g., a pipe)
 	bool rewind();
 
 	//Returns: whether any more data can be returned
-	bool eof() const;
+	bool eof() const { return bEOF && index >= length; }
 
 	//Returns: whether file handle appears to be open
-	bool is_open() const { return (this->fp != NULL) || this->bFromStdin; }
+	virtual bool is_open() const = 0;
 
-	//Input source.
-	//Either must be set explicitly in order to avoid inadvertent reads from an unexpected source.
-	void readFromStdin(const bool bVal = true) { this->bFromStdin = bVal; }
-
-	void reset() { index = length = 0; }
+	void reset() { offset += length; index = length = 0; }
 
 	bool can_read_more_data() const;
 
@@ -52,12 +74,32 @@ public:
 	//Returns: number of bytes read
 	size_t read(void* data, size_t size);
 
+	//Returns: a pointer to the next size bytes of input, advancing past them,
+	//  or NULL when fewer bytes than that are buffered (use read instead).
+	//  The bytes remain valid until the next read, or for as long as the input is open when is_in_memory().
+	const char* readInPlace(const size_t size)
+	{
+		if (size > this->length - this->index)
+			return NULL;
+		const char *bytes = this->data + this->index;
+		this->index += size;
+		return bytes;
+	}
+
+	//Returns: number of (uncompressed) bytes read or skipped so far
+	ULONGLONG tell() const { return this->offset + this->index; }
+
+	//Returns: whether the entire input is held in memory
+	bool is_in_memory() const { return this->bInMemory; }
+
+	//Returns: the entire input when is_in_memory(), or else NULL
+	const char* memory() const { return this->bInMemory ? this->data : NULL; }
+	size_t memory_size() const { return this->bInMemory ? this->length : 0; }
+
 	//Skip ahead the indicated number of bytes without outputting any of the data.
 	//Returns: number of bytes skipped
 	size_t skip(size_t size);
 
-	bool open();
-
 	// Obtains a line of data (or as much of a line as can fit) into the supplied buffer.
 	//
 	// If there isn't enough data in the buffer for the entire line, as much of the line as possible will be stored
@@ -69,15 +111,29 @@ public:
 	// Returns a pointer to the filled buffer or nullptr if there is no more data to read into the buffer.
 	const char* getline(char* buf, const size_t size);
 
+protected:
+	explicit BufferedInput(const size_t capacity);
+	BufferedInput(const char* data, const size_t length); //input held entirely in memory
+
+	//Reads up to size bytes of (uncompressed) data straight into data.
+	//Returns: number of bytes read -- fewer than size only at the end of the input or on error
+	virtual size_t readSource(char* data, const size_t size) = 0;
+
+	//Returns: number of bytes skipped -- fewer than size only at the end of the input or on error
+	virtual size_t skipSource(size_t size);
+
+	//Returns: whether the input was repositioned at its beginning
+	virtual bool rewindSource() { return false; }
+
 private:
-	std::string command;
-	FILE* fp;
 	char *buffer;
-	size_t capacity;
+	const size_t capacity;
 
+	const char *data; //the buffer, or the whole input when it is held in memory
 	size_t index, length; //data that is sitting in the buffer
-	bool bEOF;
-	bool bFromStdin; //if set, read from stdin instead of 'fp'
+	ULONGLONG offset; //position of data[0] in the input
+	bool bEOF; //set when the source has no more data
+	const bool bInMemory;
 };
 
 } // namespace zdw
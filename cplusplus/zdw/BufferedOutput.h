@@ -20,6 +20,8 @@
 namespace adobe {
 namespace zdw {
 
+class OutputWriter;
+
 class BufferedOrderedOutput
 {
 private:
@@ -58,8 +60,12 @@ private:
 
 public:
 	BufferedOrderedOutput(FILE* fp);
+	explicit BufferedOrderedOutput(std::string* text); //output is appended to text
 	~BufferedOrderedOutput();
 
+	//Writes output to the file on a separate thread from now on.
+	bool startWriter();
+
 	bool write(const void* data, const size_t size);
 	bool writePtr(const void* data, const size_t size);
 
@@ -72,6 +78,10 @@ public:
 	//Completes the current row/line of text.
 	bool writeEndline(const void* data, const size_t size);
 
+	//Writes the previous line again, in place of the current one.
+	//Returns: whether it was written; if not, the line must be written column by column
+	bool repeatLine();
+
 	bool writeRawLine(const void* data, const size_t size);
 
 	//Call to reorder column outputs in each row/line of text.
@@ -83,7 +93,11 @@ public:
 	void setOutputColumnPtrs(const char**) { } //not needed in this class template version
 
 private:
+	bool writeOut(const void* data, const size_t size);
+
 	FILE* const fp;
+	std::string* const text;
+	OutputWriter* writer;
 
 	//for (re)ordering column outputs within a line of text
 	std::vector<int> outputIndex; //input --> output index remapping
@@ -103,8 +117,12 @@ private:
 
 public:
 	BufferedOutput(FILE* fp, const size_t capacity = 16 * 1024);
+	explicit BufferedOutput(std::string* text, const size_t capacity = 16 * 1024); //output is appended to text
 	~BufferedOutput();
 
+	//Writes output to the file on a separate thread from now on.
+	bool startWriter();
+
 	//Returns: whether operation succeeded
 	bool flush();
 
@@ -116,7 +134,11 @@ public:
 	bool writeSeparator(const void* data, const size_t size) { return write(data, size); }
 
 	//Completes the current row/line of text.
-	bool writeEndline(const void* data, const size_t size) { return write(data, size); }
+	bool writeEndline(const void* data, const size_t size);
+
+	//Writes the previous line again, in place of the current one, while it remains in the buffer.
+	//Returns: whether it was written; if not, the line must be written column by column
+	bool repeatLine();
 
 	bool writeRawLine(const void* data, const size_t size) { return write(data, size); }
 
@@ -124,11 +146,19 @@ public:
 	void setOutputColumnPtrs(const char**) { } //not needed in this class template version
 
 private:
+	bool writeOut(const void* data, const size_t size);
+
 	FILE* const fp;
+	std::string* const text;
+	OutputWriter* writer;
 	const size_t capacity;
 	char* const buffer;
 
 	size_t index;
+	size_t lineBegin; //index of the current line in buffer, or NO_LINE if the buffer was flushed since it began
+	size_t lastLineBegin, lastLineEnd; //the previous line, while it remains in buffer
+
+	static const size_t NO_LINE = size_t(-1);
 };
 
 
@@ -163,6 +193,7 @@ public:
 	void writeEmpty() { }
 	bool writeSeparator(const void* /*data*/, const size_t /*size*/);
 	bool writeEndline(const void* /*data*/, const size_t /*size*/);
+	bool repeatLine() { return false; } //each row's column values are written anew
 	bool writeRawLine(const void* data, const size_t size);
 
 	size_t getNumOutputColumns() { return this->numColumns; }
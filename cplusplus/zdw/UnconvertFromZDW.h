@@ -16,6 +16,7 @@
 #include "includes.h"
 #include "BufferedInput.h"
 #include "BufferedOutput.h"
+#include "block_index.h"
 #include "status_output.h"
 
 #include <map>
@@ -71,6 +72,44 @@ public:
 	ERR_CODE code;
 };
 
+//A column's values in a batch of rows (see UnconvertFromZDWToMemory::getBatch).
+struct ColumnBatch
+{
+	ColumnBatch() : column(0), type(0) { }
+
+	ULONG column; //index in the file
+	UCHAR type;
+	//Integer columns: the numbers (two's complement for signed types).
+	//Version 9+ dictionary columns (text, date times and decimals): the offset of each value's text
+	//in the block's dictionary (see getDictionaryText).  Offsets sort in the strcmp order of their text.
+	//CHAR columns: the character, with the escaped character in the second byte.
+	std::vector<ULONGLONG> values;
+	std::vector<UCHAR> validity; //a bit set for each row whose value isn't empty (or a zero number)
+};
+
+struct RowBatch
+{
+	RowBatch() : numRows(0) { }
+
+	size_t numRows;
+	std::vector<ColumnBatch> columns; //of the columns being output, in the file's order
+};
+
+//A condition on a column's values, which rows must satisfy to be output (see setRowPredicates).
+//Values compare as they are output: integers and decimals numerically, and text (including date times) in strcmp order.
+//CHAR columns only support EQUAL.
+struct RowPredicate
+{
+	RowPredicate() : op(EQUAL) { }
+	RowPredicate(const std::string& column, const PREDICATE_OP op, const std::string& operand)
+		: column(column), op(op), operands(1, operand)
+	{ }
+
+	std::string column;
+	PREDICATE_OP op;
+	std::vector<std::string> operands; //EQUAL is satisfied by any of them (i.e., IN); other ops take one
+};
+
 
 namespace internal {
 
@@ -93,6 +132,83 @@ struct VisitorPart
 	internal::indexBytes m_PrevID;
 };
 
+//Version 12+: a column's segment of a columnar block (see BLOCK_FLAG_COLUMNAR)
+struct ColumnSegment
+{
+	ULONG column;
+	const UCHAR *bits;    //sameness bits, one per row
+	const char *values;   //the next changed value
+	const char *valuesEnd;
+	ULONGLONG value;      //the value of the last row decoded
+};
+
+//Kinds of steps in a block's decode plan (see DecodeOp)
+enum DECODE_KIND
+{
+	DECODE_DEFAULT,    //an output column without values in the block
+	DECODE_TEXT,       //version 9+ dictionary text
+	DECODE_UNSIGNED,
+	DECODE_SIGNED,
+	DECODE_CHAR,       //version 5+ single (or escaped) character
+	DECODE_VISID_HIGH, //version 1-7
+	DECODE_VISID_LOW,  //version 1-7, output along with the preceding VISID_HIGH column
+	DECODE_OTHER,      //decimals, and the text and characters of earlier versions
+
+	DECODE_KIND_COUNT
+};
+
+//The text last output for a column, re-emitted while its value stays the same.
+struct FormattedValue
+{
+	bool bValid;
+	ULONGLONG value;
+	const char *text; //in the dictionary, or else in formatted
+	ULONG length;     //0 for an empty value
+	char formatted[24];
+};
+
+//A step of the plan for outputting each row of a block, compiled when the block header is read.
+//A row's changed values are read first (see readChangedValues); the plan then visits the columns
+//being output in order, along with VISID_HIGH columns, which set the value of VISID_LOW columns being output.
+struct DecodeOp
+{
+	ULONG column;
+	UCHAR kind;      //DECODE_KIND
+	bool bOutput;
+	bool bSeparator; //whether a tab precedes the column's output
+	ULONGLONG base;  //added to the column's non-empty values
+	FormattedValue *cache; //kept apart from the plan, which is read for every row
+};
+
+//Kinds of row filters (see RowFilter)
+enum FILTER_KIND
+{
+	FILTER_UNSIGNED,
+	FILTER_SIGNED,
+	FILTER_CHAR,       //version 5+ single (or escaped) character
+	FILTER_DICTIONARY, //version 9+ text, compared by its offset in the block's sorted dictionary
+	FILTER_TEXT,       //the text of earlier versions
+	FILTER_DECIMAL     //version 4+ decimal text, compared numerically
+};
+
+//A row predicate, resolved against the file's columns when the header is read,
+//and against each block's dictionary when its decode plan is compiled.
+struct RowFilter
+{
+	ULONG column;
+	UCHAR kind;       //FILTER_KIND
+	PREDICATE_OP op;
+	std::vector<ULONGLONG> numbers; //integer and CHAR operands (two's complement for signed types)
+	std::vector<std::string> texts; //text (and decimal) operands
+	bool bEmptyMatches;             //whether an empty text satisfies the predicate
+
+	//Per block.
+	std::vector<ULONGLONG> offsets; //the sorted dictionary offsets of the EQUAL operands present, or else of the first entry past the range's lower values
+	bool bCached;     //whether bResult holds the result for the column's stored value
+	ULONGLONG stored;
+	bool bResult;
+};
+
 struct MetadataOptions
 {
 	bool bOutputOnlyMetadata;
@@ -146,11 +262,36 @@ public:
 	bool setNamesOfColumnsToOutput(const std::vector<std::string> &csv_vector, COLUMN_INCLUSION_RULE inclusionRule);
 	void showBasicStatisticsOnly(bool bVal = true) { this->bShowBasicStatisticsOnly = bVal; }
 
+	//Version 12+: Loads the file's block index without reading the blocks.
+	//The index ends the file, so a compressed file is uncompressed through to its end to load it,
+	//which stdin can't be.  The index is also available after the last block has been read.
+	//Only an uncompressed file's index is loaded implicitly (i.e. by skipToRow and row predicates).
+	//Returns: whether the index was loaded
+	bool loadBlockIndex();
+	const std::vector<BlockIndexEntry>& getBlockIndex() const { return this->blockIndex; }
+	//Returns: false only when the indicated block's zone maps show that none of its rows
+	//  has a value in the named column satisfying (value op operand), so the block may be skipped
+	bool blockCanMatch(const size_t block, const std::string& columnName,
+		const PREDICATE_OP op, const std::string& operand) const;
+	//Returns: false only when the indicated block's zone maps or Bloom filter show that none of its rows
+	//  has any of the values in the named column
+	bool blockMayContain(const size_t block, const std::string& columnName,
+		const std::vector<std::string>& values) const;
+
+	//Outputs only the rows whose values satisfy every predicate, checking each row before formatting any of its text.
+	//The predicates are resolved when the header is read, which fails with BAD_REQUESTED_COLUMN for a column
+	//not in the file, or BAD_PARAMETER for an operand or op the column's type doesn't support.
+	void setRowPredicates(const std::vector<RowPredicate>& predicates) { this->rowPredicates = predicates; }
+
 	ERR_CODE GetSchema(std::ostream& stream);
 
 	void setMetadataOptions(const internal::MetadataOptions& options) { this->metadataOptions = options; }
 
 protected:
+	//Creates a reader of the blocks of header's file, sharing its header info.
+	//Its blocks are handed to it by header (see swapBlock).
+	explicit UnconvertFromZDW_Base(const UnconvertFromZDW_Base* header);
+
 	ERR_CODE outputDescToFile(const std::vector<std::string>& columnNames,
 		const std::string& outputDir, const char* filestub, const char* ext);
 	ERR_CODE outputDescToStdOut(const std::vector<std::string>& columnNames);
@@ -159,8 +300,15 @@ protected:
 	ERR_CODE outputMetadataToStdOut() const;
 
 	size_t readBytes(void* buf, const size_t len, const bool bHaltOnReadError = true);
+	ERR_CODE readChangedValues(ULONG* changesInColumn, const bool bValidate);
+	ERR_CODE readRowValues();
+	bool isFilterColumn(const size_t c) const;
+	bool blockMaySatisfyFilters() const;
+	bool entryCanMatch(const BlockIndexEntry& entry, const size_t c, const PREDICATE_OP op, const std::string& operand) const;
+	bool entryMayContain(const BlockIndexEntry& entry, const size_t c, const std::vector<std::string>& values) const;
+	ERR_CODE filterRow(bool& bSatisfied);
 	size_t skipBytes(const size_t len);
-	char* GetWord(ULONG index, char* row);
+	const char* GetWord(ULONG index, char* row, size_t& length);
 
 	static std::string GetBaseNameForInFile(const std::string &inFileName);
 	bool UseVirtualExportBaseNameColumn() const;
@@ -170,7 +318,18 @@ protected:
 	void EnableVirtualExportRowColumn();
 
 	void cleanupBlock();
+	void swapBlock(UnconvertFromZDW_Base& other);
 	ERR_CODE parseBlockHeader();
+	ERR_CODE readRowData(std::vector<char>& rowData, const char*& rows, ULONGLONG& length);
+	const char* readRowBytes(std::vector<char>& rowData, const size_t len);
+	ERR_CODE readColumnSegments(const bool bAllColumns);
+	ERR_CODE decodeColumnarRows();
+	ERR_CODE skipRowsInBlock(const ULONG target);
+	ERR_CODE scanColumnarBlock(ULONGLONG& equalityBitsSet, std::vector<ULONG>& equalityBitsInColumn);
+	bool isValidColumnValue(const size_t c, const ULONGLONG n) const;
+	ERR_CODE readBlockIndex();
+	bool readBlockIndexFromEnd(std::vector<BlockIndexEntry>& entries) const;
+	int findFileColumn(const std::string& name) const;
 	std::string getBlockHeaderString() const;
 
 	size_t llutoa(ULONGLONG value);
@@ -179,8 +338,10 @@ protected:
 	ULONG exportFileLineLength;
 	ULONG virtualLineLength;
 	std::map<std::string, std::string> metadata; //version 11+
-	std::vector<char *> dictionary; //version 9+
+	std::vector<const char *> dictionary; //version 9+
 	std::vector<ULONG> dictionary_memblock_size;
+	bool bDictionaryInPlace; //if set, the dictionary points into the input and isn't freed
+	std::vector<ULONGLONG> dictionaryEnds; //version 9+: a bit set at the offset of each entry's null terminator
 	internal::UniquesPart *uniques;  //version 1-8
 	internal::VisitorPart *visitors; //version 1-7
 
@@ -231,6 +392,33 @@ protected:
 	ULONGLONG dictionarySize, numVisitors;
 	ULONG rowsRead;
 	long numSetColumns;
+	ULONG blocksRead; //block headers parsed so far
+	ULONGLONG rowDataBegin; //input position of the current block's rows
+	std::vector<internal::DecodeOp> decodePlan; //steps to output each row of the current block
+	std::vector<internal::FormattedValue> formattedValues; //the text cached by each step of decodePlan
+	std::vector<ULONG> usedColumns;     //the column of each sameness flag
+	std::vector<long> columnFlags;      //the sameness flag of each column with values in the block, or -1
+	std::vector<UCHAR> flagByteWidths;  //for each byte of the sameness flags, the length of the changed values flagged by each of its 256 values
+	std::vector<UCHAR> trackedFlags;    //the sameness flags of the columns whose values are decoded, padded to a multiple of 8 bytes
+	std::vector<ULONG> flagByteOffsets; //where the values flagged by each byte of the current row's sameness flags begin
+	std::vector<char> rowValues;        //a row's changed values, when they can't be read in place
+	bool bRowCached; //whether the decode plan output the previous row, so its steps' caches hold that row's text
+
+	//Row predicates.
+	std::vector<RowPredicate> rowPredicates;
+	std::vector<internal::RowFilter> rowFilters;
+	bool bRowFiltered; //set when readNextRow's row didn't satisfy the row filters, so nothing was output
+
+	//Used when unpacking a columnar block (version 12+).
+	bool bColumnarBlock;
+	std::vector<internal::ColumnSegment> columnSegments; //of the columns being read
+	std::vector<ULONG> columnarOutputColumns; //columns being output, in column order
+	std::vector<char> columnarData;      //segments read from the input, when they can't be used in place
+	std::vector<ULONGLONG> columnarRows; //values decoded from each segment for the current batch of rows
+	ULONG columnarRowsBegin, columnarRowsEnd; //the batch of rows in columnarRows
+
+	std::vector<BlockIndexEntry> blockIndex; //version 12+
+	const BlockIndexEntry* blockEntry; //the current block's index entry, when the index is loaded
 
 	StatusOutputCallback statusOutput;
 
@@ -248,14 +436,23 @@ protected:
 	STATE eState;
 
 	size_t GetCurrentRowNumber() const { return currentRowNumber; }
+	void SetCurrentRowNumber(const size_t row) { currentRowNumber = row; }
+	void AdvanceCurrentRowNumber(const size_t rows) { currentRowNumber += rows; }
 	void IncrementCurrentRowNumber() { ++currentRowNumber; }
 
 private:
 	void readLineLength();
 	void readDictionary();
+	bool isDictionaryNeeded() const;
 	void readDictionaryChunk(const size_t size);
+	void indexDictionary();
 	void readVisitorDictionary();
 	void readColumnFieldStats();
+	ERR_CODE compileDecodePlan();
+	ERR_CODE resolveRowPredicates();
+	void compileRowFilters();
+	ULONGLONG findDictionaryEntry(const std::string& text, const bool bPastEqual);
+	ERR_CODE evaluateFilter(const internal::RowFilter& filter, const ULONGLONG stored, bool& bSatisfied);
 
 	ERR_CODE outputDesc(const std::vector<std::string>& columnNames, FILE* out);
 	std::vector<std::string> getDesc(const std::vector<std::string>& columnNames,
@@ -280,10 +477,25 @@ public:
 	{ }
 
 protected:
+	explicit UnconvertFromZDW(const UnconvertFromZDW_Base* header)
+		: UnconvertFromZDW_Base(header)
+	{ }
+
 	void outputDefault(T& buffer, const UCHAR type);
 	ERR_CODE parseNextBlock(T& buffer);
+	ERR_CODE parseBlockRows(T& buffer);
 	bool printBlockHeader(T& buffer);
 	ERR_CODE readNextRow(T& buffer);
+
+private:
+	ERR_CODE outputValue(T& buffer, const size_t c, const internal::storageBytes& val);
+	template <int KIND>
+	ERR_CODE decodeColumn(T& buffer, const internal::DecodeOp& op, ULONGLONG& visid_low);
+	ERR_CODE outputCachedRow(T& buffer);
+
+	//Kernels to run the steps of a decode plan, by kind.
+	typedef ERR_CODE (UnconvertFromZDW::*DecodeKernel)(T& buffer, const internal::DecodeOp& op, ULONGLONG& visid_low);
+	static const DecodeKernel decodeKernels[internal::DECODE_KIND_COUNT];
 };
 
 // Note: This class template is used with two BufferedOutput_T types:
@@ -301,12 +513,26 @@ public:
 			const bool bTestOnly = false, const bool bOutputDescFileOnly = false)
 		: UnconvertFromZDW<BufferedOutput_T>(inFileName, bShowStatus, bQuiet, bTestOnly, bOutputDescFileOnly)
 		, out(NULL)
+		, numThreads(1)
+		, bPipelined(false)
 	{ }
 
+	//When more than one, blocks are decoded in parallel on this many threads and their text is output in order.
+	//Up to twice as many blocks are held in memory at once.
+	void setNumThreads(const int threads) { numThreads = threads > 1 ? threads : 1; }
+
+	//When set, compressed input is read ahead and output text is written on separate threads while rows are decoded.
+	void setPipelined(const bool bVal) { bPipelined = bVal; }
+
 	ERR_CODE unconvert(const char* exeName, const char* outputBasename, const char* ext, const char* outputDir, bool bStdout);
 
 private:
+	void getOutputColumnOrder(std::vector<int>& outputOrder) const;
+	ERR_CODE parseBlocksInParallel(const std::vector<int>& outputOrder);
+
 	FILE *out;
+	int numThreads;
+	bool bPipelined;
 };
 
 class UnconvertFromZDWToMemory : public UnconvertFromZDW<BufferedOutputInMem>
@@ -331,6 +557,42 @@ public:
 
 	ERR_CODE getNumOutputColumns(size_t& num);
 
+	//Typed access to the values of the current row, without formatting them as text.
+	//nextRow advances to the next row in place of getRow, decoding only the values of the columns being output.
+	//Rows not satisfying the row predicates are skipped (see setRowPredicates).
+	//The accessors take the index of a column in the file (see getColumnIndex), which must be one of them.
+	//Returns: BAD_REQUESTED_COLUMN for a column not being output, or UNSUPPORTED_OPERATION for a column of another type
+	ERR_CODE nextRow();
+	int getColumnIndex(const std::string& name) const { return findFileColumn(name); }
+	//Whether the column's value was stored with the row, i.e., differs from that of the previous row in the file.
+	//Every non-empty value is stored with the first row of a block and with keyframe rows.
+	bool isChanged(const size_t column) const;
+	bool isEmpty(const size_t column) const; //an empty text or zero number
+	ERR_CODE getUnsigned(const size_t column, uint64_t& value) const;
+	ERR_CODE getSigned(const size_t column, int64_t& value) const;
+	//The text of a column whose values are in the dictionary (text, date times and version 4+ decimals),
+	//which remains valid through the block, or of a (version 5+) CHAR column, valid until the next call.
+	//Before version 9, all text is only valid until the next call.
+	ERR_CODE getText(const size_t column, const char*& text, size_t& length);
+	//The seconds since the epoch of a DATETIME column's value, taken as UTC (0 when empty).
+	//Returns: BAD_PARAMETER when the text isn't a valid date (e.g. MySQL's zero date)
+	ERR_CODE getDateTime(const size_t column, int64_t& seconds);
+
+	//Reads the values of up to maxRows of the next rows into batch, by column, without formatting them as text.
+	//A batch holds rows of only one block, so the dictionary offsets of its values remain valid until
+	//the next call.  The batch's buffers are reused by each call.
+	//Rows not satisfying the row predicates are left out (see setRowPredicates).
+	//Returns: AT_END_OF_FILE, with no rows, after the last row
+	ERR_CODE getBatch(const size_t maxRows, RowBatch& batch);
+	//Version 9+: the text at an offset in the current block's dictionary
+	ERR_CODE getDictionaryText(const ULONGLONG offset, const char*& text, size_t& length);
+
+	//Advances to the indicated row of the file (counting from 0), so the next getRow call returns it.
+	//Rows may only be skipped forward.  When the block index is loaded (see loadBlockIndex),
+	//whole blocks are skipped without decoding their rows, and decoding begins at the last keyframe
+	//before the row.  An uncompressed file's index is loaded here.
+	ERR_CODE skipToRow(const ULONGLONG row);
+
 	size_t getCurrentRowLength();
 
 	// Call getNumOutputColumns or getRow first to retrieve the actual value of line length
@@ -348,6 +610,11 @@ protected:
 	ERR_CODE handleZDWParseBlockHeader();
 
 private:
+	ERR_CODE beginRow();
+	ERR_CODE readBatch(const size_t maxRows, RowBatch& batch);
+	ERR_CODE finishReading();
+	ERR_CODE getStoredValue(const size_t column, ULONGLONG& value) const;
+
 	boost::scoped_ptr<BufferedOutputInMem> pBufferedOutput;
 	size_t num_output_columns;
 	bool bUseInternalBuffer;
@@ -0,0 +1,154 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#ifndef BLOCK_INDEX_H
+#define BLOCK_INDEX_H
+
+#include "includes.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+namespace adobe {
+namespace zdw {
+
+//Version 12 files end with an index of their blocks, following the final block:
+//1. An entry per block:
+//   entry length (4 bytes, not counting itself), block offset (8), row data length (8), row count (4), dictionary size (8),
+//   then a zone map for each column (see ColumnZoneMap):
+//     non-empty rows (4), and if any,
+//       numeric and CHAR columns: min (8), max (8)
+//       other columns: min text length (2), min text, max text length (2, high bit set if truncated), max text
+//       HyperLogLog registers (ZONE_MAP_SKETCH_SIZE)
+//   then, when columns have Bloom filters (see BloomFilter) or there are keyframes, the number of filters (4), and for each:
+//     column (4), filter blocks (4), the filter (BloomFilter::BLOCK_SIZE bytes per block)
+//   then, when there are keyframes, the keyframe interval (4), the number of keyframes (4),
+//     and each one's offset (8) from the start of the block's row data
+//   Entries may be longer, carrying data that later versions add.
+//2. The block count (4), the index length (8, from the first entry through the end of the file) and "ZDWI".
+//Offsets and lengths are in bytes of the uncompressed file.
+
+//Statistics of a column's values in one block, for deciding whether the block can be skipped.
+//Empty values (output as 0 in numeric columns) are not included -- they are the block's
+//row count minus nonEmptyRows.
+struct ColumnZoneMap
+{
+	ColumnZoneMap() : nonEmptyRows(0), min(0), max(0), bMaxTextTruncated(false) { }
+
+	ULONG nonEmptyRows;
+	ULONGLONG min, max;           //numeric and CHAR columns: stored values (two's complement for signed types)
+	std::string minText, maxText; //other columns: least and greatest values, in strcmp order
+	bool bMaxTextTruncated;       //maxText holds only a prefix of the greatest value
+	std::vector<UCHAR> sketch;    //HyperLogLog registers of the non-empty values
+
+	//Returns: estimated number of distinct non-empty values
+	double estimateDistinct() const;
+};
+
+//A split-block Bloom filter of a set of text values.
+//Each value sets one bit in each 32-bit word of a single 32-byte block, so a probe touches only one cache line
+//(and is a few vector instructions with AVX2).
+class BloomFilter
+{
+public:
+	static const size_t BLOCK_SIZE = 32;
+
+	BloomFilter() : numBlocks(0) { }
+
+	//Sizes an empty filter for the indicated number of distinct values.
+	void init(const size_t numValues);
+
+	void insert(const char* str, const size_t len) { insert(hash(str, len)); }
+	bool mayContain(const std::string& value) const { return mayContain(hash(value.data(), value.size())); }
+
+	bool empty() const { return !numBlocks; }
+	ULONG getNumBlocks() const { return numBlocks; }
+	const ULONG* data() const { return &words[0]; }
+	void assign(const ULONG numBlocks, const char* data);
+
+private:
+	static const size_t WORDS_PER_BLOCK = BLOCK_SIZE / sizeof(ULONG);
+
+	static ULONGLONG hash(const char* str, const size_t len);
+	void insert(const ULONGLONG h);
+	bool mayContain(const ULONGLONG h) const;
+	size_t blockStart(const ULONGLONG h) const
+	{
+		//The hash's upper half picks the block.
+		return ((h >> 32) * numBlocks >> 32) * WORDS_PER_BLOCK;
+	}
+
+	ULONG numBlocks;
+	std::vector<ULONG> words;
+};
+
+struct BlockIndexEntry
+{
+	BlockIndexEntry() : offset(0), rowDataLength(0), numRows(0), dictionarySize(0), keyframeInterval(0) { }
+
+	ULONGLONG offset;         //of the block's header
+	ULONGLONG rowDataLength;  //encoded rows, which end the block
+	ULONG numRows;
+	ULONGLONG dictionarySize;
+	std::vector<ColumnZoneMap> zoneMaps; //one per column, if present
+	std::map<ULONG, BloomFilter> bloomFilters; //by column
+
+	//Rows keyframeInterval, 2 * keyframeInterval, ... of a block are keyframes, which include every
+	//column's value (as if none matched the previous row's), so decoding can start at any of them.
+	ULONG keyframeInterval;
+	std::vector<ULONGLONG> keyframes; //offset of each keyframe row from the start of the row data
+};
+
+enum PREDICATE_OP { EQUAL, LESS, LESS_EQUAL, GREATER, GREATER_EQUAL };
+
+//Version 12+: flags in the byte of the block header that marks the last block.
+//A columnar block's rows are stored by column instead of one after another:
+//the length (8 bytes) of each non-empty column's segment, then the segments, in column order.
+//A segment holds the column's sameness bits (one per row, set when the value differs from the
+//previous row's), then the changed values.  A reader can thus skip over the columns it doesn't need.
+const UCHAR BLOCK_FLAG_LAST = 0x1;
+const UCHAR BLOCK_FLAG_COLUMNAR = 0x2;
+
+const USHORT BLOCK_INDEX_VERSION = 12; //first file version with a block index
+const ULONG BLOCK_INDEX_ENTRY_SIZE = 28; //not counting zone maps
+const size_t BLOCK_INDEX_TAIL_SIZE = 16;
+const char BLOCK_INDEX_MAGIC[4] = { 'Z', 'D', 'W', 'I' };
+
+const int ZONE_MAP_SKETCH_BITS = 8;
+const size_t ZONE_MAP_SKETCH_SIZE = 1 << ZONE_MAP_SKETCH_BITS;
+const size_t ZONE_MAP_MAX_TEXT_LENGTH = 256; //longer min/max values are truncated
+
+//Returns: whether the column type's zone maps hold numeric (rather than text) bounds
+bool IsNumericZoneMapType(const UCHAR columnType);
+
+//Serialization of index entries.
+void AppendBlockIndexEntry(const BlockIndexEntry& entry, const UCHAR* columnType, std::string& out);
+//Returns: whether an entry of length len could be parsed
+bool ParseBlockIndexEntry(const char* data, const size_t len,
+	const UCHAR* columnType, const size_t numColumns, BlockIndexEntry& entry);
+//Returns: whether the last BLOCK_INDEX_TAIL_SIZE bytes of a file end a block index, giving its block count and length
+bool ParseBlockIndexTail(const char* tail, ULONG& numBlocks, ULONGLONG& indexSize);
+//Returns: whether the index, of indexSize bytes ending a file of fileSize bytes, could be parsed,
+//  listing blocks that are in order and lie before it
+bool ParseBlockIndex(const char* index, const ULONGLONG indexSize, const ULONGLONG fileSize,
+	const UCHAR* columnType, const size_t numColumns, std::vector<BlockIndexEntry>& entries);
+
+//Returns: false only when no value of the column in a block of numRows rows can satisfy (value op operand)
+bool ZoneMapCanMatch(const ColumnZoneMap& zoneMap, const UCHAR columnType, const ULONG numRows,
+	const PREDICATE_OP op, const std::string& operand);
+
+} // namespace zdw
+} // namespace adobe
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#include "zonemap.h"
+#include "zdw_column_type_constants.h"
+
+#include <algorithm>
+
+using namespace adobe::zdw::internal;
+
+
+namespace {
+
+const size_t BLOOM_COMPACT_MIN_SIZE = 4096; //values gathered for a Bloom filter before repeats are first dropped
+
+//Finalizer of MurmurHash3, spreading every input bit over the hash.
+inline uint64_t mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+//Sorts signed values as unsigned ones.
+inline adobe::zdw::ULONGLONG sortKey(const adobe::zdw::ULONGLONG val, const bool bSigned)
+{
+	return bSigned ? val ^ 0x8000000000000000ULL : val;
+}
+
+}
+
+
+namespace adobe {
+namespace zdw {
+
+void ZoneMapBuilder::init(const std::vector<char unsigned>& columnType, const std::vector<bool>& bloomColumns)
+{
+	this->columns.resize(columnType.size());
+	for (size_t c = 0; c < columnType.size(); ++c)
+	{
+		Column& column = this->columns[c];
+		const UCHAR type = columnType[c];
+		column.bText = !IsNumericZoneMapType(type);
+		column.bSigned = type == TINY_SIGNED || type == SHORT_SIGNED || type == LONG_SIGNED || type == LONGLONG_SIGNED;
+		column.bBloom = column.bText && c < bloomColumns.size() && bloomColumns[c];
+		column.sketch.resize(ZONE_MAP_SKETCH_SIZE);
+		reset(column);
+	}
+}
+
+void ZoneMapBuilder::reset(Column& column)
+{
+	column.nonEmptyRows = 0;
+	column.last = 0;
+	column.min = column.max = 0;
+	column.minEntry = column.maxEntry = NULL;
+	std::fill(column.sketch.begin(), column.sketch.end(), 0);
+	column.entries.clear();
+	column.compactSize = BLOOM_COMPACT_MIN_SIZE;
+}
+
+//Drops repeated values from the entries gathered for a column's Bloom filter.
+void ZoneMapBuilder::compactEntries(Column& column)
+{
+	std::vector<const DictionaryEntry*>& entries = column.entries;
+	std::sort(entries.begin(), entries.end());
+	entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+	column.compactSize = std::max(2 * entries.size(), BLOOM_COMPACT_MIN_SIZE);
+}
+
+void ZoneMapBuilder::addNewValue(Column& column, const ULONGLONG val, const DictionaryEntry* entry)
+{
+	column.last = val;
+
+	//Text values are ordered by their dictionary offsets, as the dictionary is written in strcmp order.
+	const ULONGLONG key = sortKey(val, column.bSigned);
+	if (column.nonEmptyRows == 1 || key < sortKey(column.min, column.bSigned)) {
+		column.min = val;
+		column.minEntry = entry;
+	}
+	if (column.nonEmptyRows == 1 || key > sortKey(column.max, column.bSigned)) {
+		column.max = val;
+		column.maxEntry = entry;
+	}
+
+	//HyperLogLog: the leading hash bits choose a register, which keeps the longest run of leading zeros seen in the rest.
+	//Text is hashed by content, so sketches of different blocks can be merged.
+	const uint64_t h = mix(entry ? entry->hash : val);
+	const size_t r = h >> (64 - ZONE_MAP_SKETCH_BITS);
+	const uint64_t rest = (h << ZONE_MAP_SKETCH_BITS) | (1ULL << (ZONE_MAP_SKETCH_BITS - 1));
+	const UCHAR rank = static_cast<UCHAR>(__builtin_clzll(rest) + 1);
+	if (rank > column.sketch[r])
+		column.sketch[r] = rank;
+}
+
+void ZoneMapBuilder::getZoneMaps(std::vector<ColumnZoneMap>& zoneMaps, std::map<ULONG, BloomFilter>& bloomFilters)
+{
+	zoneMaps.resize(this->columns.size());
+	bloomFilters.clear();
+	for (size_t c = 0; c < this->columns.size(); ++c)
+	{
+		Column& column = this->columns[c];
+		ColumnZoneMap& zoneMap = zoneMaps[c];
+		zoneMap = ColumnZoneMap();
+		zoneMap.nonEmptyRows = column.nonEmptyRows;
+		if (column.nonEmptyRows) {
+			if (column.bText) {
+				const size_t minLen = column.minEntry->len - 1; //exclude null terminator
+				const size_t maxLen = column.maxEntry->len - 1;
+				zoneMap.minText.assign(column.minEntry->str(), std::min(minLen, ZONE_MAP_MAX_TEXT_LENGTH));
+				zoneMap.maxText.assign(column.maxEntry->str(), std::min(maxLen, ZONE_MAP_MAX_TEXT_LENGTH));
+				zoneMap.bMaxTextTruncated = maxLen > ZONE_MAP_MAX_TEXT_LENGTH;
+			} else {
+				zoneMap.min = column.min;
+				zoneMap.max = column.max;
+			}
+			zoneMap.sketch = column.sketch;
+		}
+
+		if (column.bBloom) {
+			//Each distinct value is added once, so the filter is sized by their count.
+			compactEntries(column);
+			const std::vector<const DictionaryEntry*>& entries = column.entries;
+
+			BloomFilter& filter = bloomFilters[c];
+			filter.init(entries.size());
+			for (size_t i = 0; i < entries.size(); ++i)
+				filter.insert(entries[i]->str(), entries[i]->len - 1);
+		}
+		reset(column);
+	}
+}
+
+} // namespace zdw
+} // namespace adobe
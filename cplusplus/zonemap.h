@@ -0,0 +1,90 @@
+/**
+ * Copyright 2019 Adobe. All rights reserved.
+ * This file is licensed to you under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License. You may obtain a copy
+ * of the License at http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software distributed under
+ * the License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR REPRESENTATIONS
+ * OF ANY KIND, either express or implied. See the License for the specific language
+ * governing permissions and limitations under the License.
+ */
+
+#ifndef ZONEMAP_H
+#define ZONEMAP_H
+
+#include "zdw/block_index.h"
+#include "dictionary.h"
+
+#include <map>
+#include <vector>
+
+
+namespace adobe {
+namespace zdw {
+
+//********************************************************
+//Gathers the zone map statistics of each column over the rows of a block, as they are written,
+//and the values of the columns that get Bloom filters.
+class ZoneMapBuilder
+{
+public:
+	void init(const std::vector<char unsigned>& columnType,
+		const std::vector<bool>& bloomColumns); //text columns to build Bloom filters of
+
+	//Adds a row's value of a numeric or CHAR column (0 is empty).
+	void add(const size_t c, const ULONGLONG val)
+	{
+		if (!val)
+			return;
+		Column& column = columns[c];
+		++column.nonEmptyRows;
+		if (val != column.last) //a repeated value changes nothing else
+			addNewValue(column, val, NULL);
+	}
+
+	//Adds a row's value of a text column (NULL is empty).
+	//Entries must remain valid, with their offsets assigned, until getZoneMaps is called.
+	void add(const size_t c, const internal::DictionaryEntry* entry)
+	{
+		if (!entry)
+			return;
+		Column& column = columns[c];
+		++column.nonEmptyRows;
+		if (entry->offset != column.last) {
+			addNewValue(column, entry->offset, entry);
+			if (column.bBloom) {
+				column.entries.push_back(entry);
+				if (column.entries.size() >= column.compactSize)
+					compactEntries(column);
+			}
+		}
+	}
+
+	//Returns the statistics gathered, and starts over for another block.
+	void getZoneMaps(std::vector<ColumnZoneMap>& zoneMaps, std::map<ULONG, BloomFilter>& bloomFilters);
+
+private:
+	struct Column
+	{
+		bool bText, bSigned, bBloom;
+		ULONG nonEmptyRows;
+		ULONGLONG last;     //value (or dictionary offset) of the last row, as repeats are common
+		ULONGLONG min, max; //in sort order: text by dictionary offset, as the dictionary is sorted
+		const internal::DictionaryEntry *minEntry, *maxEntry;
+		std::vector<UCHAR> sketch;
+		std::vector<const internal::DictionaryEntry*> entries; //values for the Bloom filter, with repeats since the last compaction
+		size_t compactSize; //entries are de-duplicated on reaching this many, keeping them within twice the distinct values
+	};
+
+	void addNewValue(Column& column, const ULONGLONG val, const internal::DictionaryEntry* entry);
+	static void compactEntries(Column& column);
+	static void reset(Column& column);
+
+	std::vector<Column> columns;
+};
+
+} // namespace zdw
+} // namespace adobe
+
+#endif